@@ -52,6 +52,7 @@
 #include "pathfinder.h"
 #include "pocostuff.h"
 #include "random.h"
+#include "replication.h"
 #include "scriptstuff.h"
 #include "serialize.h"
 #include "sound.h"
@@ -387,6 +388,7 @@ int ConfigureEngine(asIScriptEngine* engine) {
 	RegisterMiscFunctions(engine);
 	engine->SetDefaultAccessMask(NVGT_SUBSYSTEM_NET);
 	RegisterScriptNetwork(engine);
+	RegisterScriptReplication(engine);
 	engine->SetDefaultAccessMask(NVGT_SUBSYSTEM_SPEECH);
 	RegisterScreenReaderSpeech(engine);
 	engine->SetDefaultAccessMask(NVGT_SUBSYSTEM_FS);
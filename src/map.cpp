@@ -18,7 +18,20 @@
 #include <algorithm>
 #include <obfuscate.h>
 #include <limits>
+#include <memory>
+#include <Poco/Environment.h>
+#include <Poco/Event.h>
+#include <Poco/Runnable.h>
+#include <Poco/ThreadPool.h>
+#include <scriptarray.h>
 #include "scriptstuff.h"
+#include "serialize.h"
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#define NVGT_MAP_SSE
+	#include <immintrin.h>
+#elif defined(__ARM_NEON)
+	#include <arm_neon.h>
+#endif
 
 static asIScriptContext* fcallback_ctx = NULL;
 
@@ -30,10 +43,21 @@ inline Vector3 VECTOR3(float x, float y, float z) {
 	return v;
 }
 
-Vector3 rotate(Vector3 p, Vector3 o, double theta, bool maintain_z = true) {
+// Gets the cosine and sine rotate uses for theta, which are snapped to exactly 0 at right angles.
+static void rotation_cs(double theta, float& c, float& s) {
+	if (theta == 0) {
+		c = 1;
+		s = 0;
+		return;
+	}
 	int angle = (180.0 / M_PI) * theta;
+	c = angle != 90 && angle != 270 ? cos(theta) : 0;
+	s = angle != 180 ? sin(theta) : 0;
+}
+Vector3 rotate(Vector3 p, Vector3 o, double theta, bool maintain_z = true) {
 	Vector3 r;
-	Vector3 cs = VECTOR3(angle != 90 && angle != 270 ? cos(theta) : 0, angle != 180 ? sin(theta) : 0, 0);
+	Vector3 cs;
+	rotation_cs(theta, cs.x, cs.y);
 	r.x = (cs.x * (p.x - o.x)) - (cs.y * (p.y - o.y)) + o.x;
 	r.y = (cs.y * (p.x - o.x)) + (cs.x * (p.y - o.y)) + o.y;
 	if (maintain_z)
@@ -52,23 +76,24 @@ Vector3 get_center(double minx, double maxx, double miny, double maxy, double mi
 }
 
 // following function in a round about way from https://stackoverflow.com/questions/10962379/how-to-check-intersection-between-2-rotated-rectangles
-bool polygons_intersect(const std::vector<Vector3>& a, const std::vector<Vector3>& b) {
+static bool polygons_intersect(const Vector3* a, int a_size, const Vector3* b, int b_size) {
 	for (int polyi = 0; polyi < 2; ++polyi) {
-		const std::vector<Vector3>& polygon = polyi == 0 ? a : b;
-		for (int i1 = 0; i1 < polygon.size(); ++i1) {
-			const int i2 = (i1 + 1) % polygon.size();
+		const Vector3* polygon = polyi == 0 ? a : b;
+		int size = polyi == 0 ? a_size : b_size;
+		for (int i1 = 0; i1 < size; ++i1) {
+			const int i2 = (i1 + 1) % size;
 			const double normalx = polygon[i2].y - polygon[i1].y;
 			const double normaly = polygon[i2].x - polygon[i1].x;
 			double minA = (std::numeric_limits<double>::max());
 			double maxA = (std::numeric_limits<double>::min());
-			for (int ai = 0; ai < a.size(); ++ai) {
+			for (int ai = 0; ai < a_size; ++ai) {
 				const double projected = normalx * a[ai].x + normaly * a[ai].y;
 				if (projected < minA) minA = projected;
 				if (projected > maxA) maxA = projected;
 			}
 			double minB = std::numeric_limits<double>::max();
 			double maxB = std::numeric_limits<double>::min();
-			for (int bi = 0; bi < b.size(); ++bi) {
+			for (int bi = 0; bi < b_size; ++bi) {
 				const double projected = normalx * b[bi].x + normaly * b[bi].y;
 				if (projected < minB) minB = projected;
 				if (projected > maxB) maxB = projected;
@@ -79,14 +104,25 @@ bool polygons_intersect(const std::vector<Vector3>& a, const std::vector<Vector3
 	}
 	return true;
 }
+bool polygons_intersect(const std::vector<Vector3>& a, const std::vector<Vector3>& b) {
+	return polygons_intersect(a.data(), a.size(), b.data(), b.size());
+}
+// Builds the 4 point polygon boxes_intersect tests for a box, given the cosine and sine of its rotation from rotation_cs.
+static void box_polygon(float minx, float maxx, float miny, float maxy, float c, float s, Vector3* polygon) {
+	Vector3 center = get_center(minx, maxx, miny, maxy, 0, 0);
+	const float px[4] = {-center.x, -center.x, center.x, center.x};
+	const float py[4] = {-center.y, center.y, center.y, -center.y};
+	for (int i = 0; i < 4; i++)
+		polygon[i] = VECTOR3(minx + (c * px[i] - s * py[i]), miny + (s * px[i] + c * py[i]), 0);
+}
 bool boxes_intersect(float minx1, float maxx1, float miny1, float maxy1, float r1, float minx2, float maxx2, float miny2, float maxy2, float r2) {
-	Vector3 c1 = get_center(minx1, maxx1 + 1, miny1, maxy1 + 1, 0, 0);
-	Vector3 c2 = get_center(minx2, maxx2, miny2, maxy2, 0, 0);
-	Vector3 min1 = VECTOR3(minx1, miny1, 0);
-	Vector3 min2 = VECTOR3(minx2, miny2, 0);
-	std::vector<Vector3> p1 = {min1 + rotate(VECTOR3(-c1.x, -c1.y, 0), VECTOR3(0, 0, 0), r1), min1 + rotate(VECTOR3(-c1.x, c1.y, 0), VECTOR3(0, 0, 0), r1), min1 + rotate(VECTOR3(c1.x, c1.y, 0), VECTOR3(0, 0, 0), r1), min1 + rotate(VECTOR3(c1.x, -c1.y, 0), VECTOR3(0, 0, 0), r1)};
-	std::vector<Vector3> p2 = {min2 + rotate(VECTOR3(-c2.x, -c2.y, 0), VECTOR3(0, 0, 0), r2), min2 + rotate(VECTOR3(-c2.x, c2.y, 0), VECTOR3(0, 0, 0), r2), min2 + rotate(VECTOR3(c2.x, c2.y, 0), VECTOR3(0, 0, 0), r2), min2 + rotate(VECTOR3(c2.x, -c2.y, 0), VECTOR3(0, 0, 0), r2)};
-	return polygons_intersect(p1, p2);
+	float c, s;
+	Vector3 p1[4], p2[4];
+	rotation_cs(r1, c, s);
+	box_polygon(minx1, maxx1 + 1, miny1, maxy1 + 1, c, s, p1);
+	rotation_cs(r2, c, s);
+	box_polygon(minx2, maxx2, miny2, maxy2, c, s, p2);
+	return polygons_intersect(p1, 4, p2, 4);
 }
 
 static asITypeInfo* g_MapAreaArrayType = NULL;
@@ -103,8 +139,9 @@ static bool map_area_sort(map_area* a1, map_area* a2) {
 	return a1 == NULL || a2 == NULL || a1->priority < a2->priority;
 }
 
-map_area::map_area(coordinate_map* p, float minx, float maxx, float miny, float maxy, float minz, float maxz, float rotation, CScriptAny* primary_data, const std::string& data1, const std::string& data2, const std::string& data3, int priority, asINT64 flags) : parent(p), minx(minx), maxx(maxx), miny(miny), maxy(maxy), minz(minz), maxz(maxz), rotation(rotation), framesize(0), primary_data(primary_data), data1(data1), data2(data2), data3(data3), priority(priority), flags(flags), framed(false), tmp_adding_to_result(false), ref_count(1) {
+map_area::map_area(coordinate_map* p, float minx, float maxx, float miny, float maxy, float minz, float maxz, float rotation, CScriptAny* primary_data, const std::string& data1, const std::string& data2, const std::string& data3, int priority, asINT64 flags) : parent(p), minx(minx), maxx(maxx), miny(miny), maxy(maxy), minz(minz), maxz(maxz), rotation(rotation), framesize(0), primary_data(primary_data), data1(data1), data2(data2), data3(data3), priority(priority), flags(flags), framed(false), tmp_adding_to_result(false), tree_leaf(-1), ref_count(1) {
 	center = get_center(minx, maxx, miny, maxy, minz, maxz);
+	update_rotation();
 	reframe();
 }
 void map_area::add_ref() {
@@ -136,16 +173,31 @@ bool map_area::is_unfiltered(asIScriptFunction* filter_callback) {
 	if (!new_context) ctx->PopState();
 	return ret;
 }
+// The box a tree stores for an area, which must contain every point and range that could find it.
+static void get_tree_bounds(const map_area* a, map_bounds& bounds) {
+	float reach;
+	a->get_bounds(bounds, reach);
+	bounds.minx -= reach;
+	bounds.maxx += reach;
+	bounds.miny -= reach;
+	bounds.maxy += reach;
+}
 void map_area::unframe() {
+	if (parent && framed && tree_leaf >= 0) {
+		parent->tree->remove(tree_leaf);
+		tree_leaf = -1;
+		framed = false;
+		if (ref_count > 1)
+			release();
+		return;
+	}
 	if (!parent || !framesize || !framed) return;
 	for (map_frame* f : frames) {
-		auto it = std::find(f->areas.begin(), f->areas.end(), this);
-		while (it != f->areas.end()) {
-			f->areas.erase(it);
+		for (unsigned int i = f->areas.size(); i-- > 0;) {
+			if (f->areas[i] != this) continue;
+			f->remove_area(i);
 			if (ref_count > 1)
-			release();
-			else
-				it = std::find(f->areas.begin(), f->areas.end(), this);
+				release();
 		}
 	}
 	framed = false;
@@ -153,18 +205,22 @@ void map_area::unframe() {
 }
 void map_area::reframe() {
 	if (!parent || framed) return;
+	if (parent->tree) {
+		map_bounds bounds;
+		get_tree_bounds(this, bounds);
+		add_ref();
+		tree_leaf = parent->tree->insert(this, bounds);
+		framed = true;
+		return;
+	}
 	if (!framesize) framesize = get_frame_size(maxx - minx, maxy - miny, maxz - minz);
 	Vector3 MIN = VECTOR3(minx, miny, minz);
 	Vector3 MAX = VECTOR3(maxx, maxy, maxz);
 	if (rotation > 0) {
-		Vector3 d = MAX - MIN;
-		std::vector<Vector3> points = {rotate(MIN, center, rotation), rotate(VECTOR3(MIN.x + d.x, MIN.y, 0), center, rotation), rotate(VECTOR3(MIN.x, MIN.y + d.y, 0), center, rotation), rotate(VECTOR3(MIN.x + d.x, MIN.y + d.y, 0), center, rotation)};
-		for (int i = 0; i < points.size(); i++) {
-			if (points[i].x < MIN.x) MIN.x = points[i].x - 1;
-			else if (points[i].x > MAX.x) MAX.x = points[i].x + 1;
-			if (points[i].y < MIN.y) MIN.y = points[i].y - 1;
-			else if (points[i].y > MAX.y) MAX.y = points[i].y + 1;
-		}
+		MIN.x = rotated_bounds.minx;
+		MAX.x = rotated_bounds.maxx;
+		MIN.y = rotated_bounds.miny;
+		MAX.y = rotated_bounds.maxy;
 	}
 	for (int x = MIN.x; x <= MAX.x + frame_sizes[framesize]; x += frame_sizes[framesize]) {
 		for (int y = MIN.y; y <= MAX.y + frame_sizes[framesize]; y += frame_sizes[framesize]) {
@@ -172,7 +228,7 @@ void map_area::reframe() {
 				map_frame* f = parent->get_frame(x, y, z, framesize);
 				if (!f) continue;
 				add_ref();
-				f->areas.push_back(this);
+				f->add_area(this);
 				frames.push_back(f);
 			}
 		}
@@ -181,7 +237,7 @@ void map_area::reframe() {
 }
 void map_area::set(float minx, float maxx, float miny, float maxy, float minz, float maxz, float rotation) {
 	bool was_framed = framed;
-	unframe();
+	if (tree_leaf < 0) unframe();
 	this->minx = minx;
 	this->maxx = maxx;
 	this->miny = miny;
@@ -190,7 +246,12 @@ void map_area::set(float minx, float maxx, float miny, float maxy, float minz, f
 	this->maxz = maxz;
 	this->rotation = rotation;
 	center = get_center(minx, maxx, miny, maxy, minz, maxz);
-	if (was_framed) reframe();
+	update_rotation();
+	if (tree_leaf >= 0) {
+		map_bounds bounds;
+		get_tree_bounds(this, bounds);
+		parent->tree->move(tree_leaf, bounds);
+	} else if (was_framed) reframe();
 }
 void map_area::set_area(float minx, float maxx, float miny, float maxy, float minz, float maxz) {
 	set(minx, maxx, miny, maxy, minz, maxz, rotation);
@@ -198,6 +259,29 @@ void map_area::set_area(float minx, float maxx, float miny, float maxy, float mi
 void map_area::set_rotation(float rotation) {
 	set(minx, maxx, miny, maxy, minz, maxz, rotation);
 }
+void map_area::update_rotation() {
+	rotation_cs(rotation, rotation_cos, rotation_sin);
+	box_polygon(minx, maxx, miny, maxy, rotation_cos, rotation_sin, polygon);
+	// is_in_area rotates points into the area, so its world space bounds are the area's corners rotated the other way.
+	const float xs[2] = {minx, maxx + 1}, ys[2] = {miny, maxy + 1};
+	rotated_bounds.minx = rotated_bounds.miny = std::numeric_limits<float>::infinity();
+	rotated_bounds.maxx = rotated_bounds.maxy = -std::numeric_limits<float>::infinity();
+	for (int i = 0; i < 4; i++) {
+		float dx = xs[i & 1] - center.x, dy = ys[i >> 1] - center.y;
+		float x = center.x + rotation_cos * dx + rotation_sin * dy, y = center.y - rotation_sin * dx + rotation_cos * dy;
+		rotated_bounds.minx = std::min(rotated_bounds.minx, x - 1);
+		rotated_bounds.maxx = std::max(rotated_bounds.maxx, x + 1);
+		rotated_bounds.miny = std::min(rotated_bounds.miny, y - 1);
+		rotated_bounds.maxy = std::max(rotated_bounds.maxy, y + 1);
+	}
+	rotated_bounds.minz = minz;
+	rotated_bounds.maxz = maxz + 1;
+}
+void map_area::set_flags(asINT64 flags) {
+	this->flags = flags;
+	for (map_frame* f : frames)
+		f->update_flags(this);
+}
 bool map_area::is_in_area(float x, float y, float z, float d, asIScriptFunction* filter_callback, asINT64 required_flags, asINT64 excluded_flags) {
 	bool flag_filter = ((flags & required_flags) == required_flags) && ((flags & excluded_flags) == 0);
 	if (!flag_filter) return false;
@@ -210,9 +294,9 @@ bool map_area::is_in_area(float x, float y, float z, float d, asIScriptFunction*
 	}
 	Vector3 border = VECTOR3(1, 1, 1);
 	if (rotation > 0) {
-		Vector3 r = rotate(VECTOR3(x, y, z), center, rotation);
-		x = r.x;
-		y = r.y;
+		float dx = x - center.x, dy = y - center.y;
+		x = (rotation_cos * dx) - (rotation_sin * dy) + center.x;
+		y = (rotation_sin * dx) + (rotation_cos * dy) + center.y;
 		//border=rotate(border, VECTOR3(0, 0, 0), rotation);
 	}
 	if (x < minx - d + (border.x < 0 ? border.x : 0) || x >= maxx + d + (border.x > 0 ? border.x : 0)) return false;
@@ -230,24 +314,164 @@ bool map_area::is_in_area_range(float minx, float maxx, float miny, float maxy,
 			R = rotate(R, get_center(minx, maxx, miny, maxy, minz, maxz), r);
 		return R.x >= minx - d && R.x < maxx + d + 1.0 && R.y >= miny - d && R.y < maxy + d + 1.0 && R.z >= minz - d && R.z < maxz + d + 1.0 && is_unfiltered(filter_callback);
 	}
-	return minz >= this->minz - d && maxz < this->maxz + d + 1.0 && boxes_intersect(minx - d, maxx + d, miny - d, maxy + d, r, this->minx, this->maxx, this->miny, this->maxy, this->rotation) && is_unfiltered(filter_callback);
+	if (minz < this->minz - d || maxz >= this->maxz + d + 1.0) return false;
+	// Equivalent to boxes_intersect(minx - d, maxx + d, miny - d, maxy + d, r, this->minx, this->maxx, this->miny, this->maxy, this->rotation) using this area's cached polygon.
+	float c, s;
+	rotation_cs(r, c, s);
+	Vector3 query[4];
+	box_polygon(minx - d, maxx + d + 1, miny - d, maxy + d + 1, c, s, query);
+	return polygons_intersect(query, 4, polygon, 4) && is_unfiltered(filter_callback);
 }
 
+// Gets bounds with exclusive maximums containing every point is_in_area can accept with a distance of at most 1, and how much further a point may be in x and y with a greater distance.
+void map_area::get_bounds(map_bounds& bounds, float& reach) const {
+	bounds.minx = minx;
+	bounds.maxx = maxx + 1;
+	bounds.miny = miny;
+	bounds.maxy = maxy + 1;
+	bounds.minz = minz;
+	bounds.maxz = maxz + 1;
+	if (rotation > 0) bounds = rotated_bounds;
+	int longest = maxx - minx;
+	if (maxy - miny > longest) longest = maxy - miny;
+	if (longest < 1) longest = 1;
+	reach = std::max({0.0f, bounds.minx - (center.x - longest), center.x + longest - bounds.maxx, bounds.miny - (center.y - longest), center.y + longest - bounds.maxy});
+}
+void map_frame::pack_area(unsigned int i) {
+	map_area* a = areas[i];
+	map_bounds bounds;
+	float reach;
+	a->get_bounds(bounds, reach);
+	lanes.minx[i] = bounds.minx;
+	lanes.maxx[i] = bounds.maxx;
+	lanes.miny[i] = bounds.miny;
+	lanes.maxy[i] = bounds.maxy;
+	lanes.minz[i] = bounds.minz;
+	lanes.maxz[i] = bounds.maxz;
+	lanes.spread[i] = a->get_spread();
+	lanes.reach[i] = reach;
+	lanes.priority[i] = a->priority;
+	lanes.flags[i] = a->flags;
+}
+// Sizes the lanes to the areas rounded up to MAP_AREA_LANES, filling new slots with bounds no point can be in.
+void map_frame::pad() {
+	size_t padded = (areas.size() + MAP_AREA_LANES - 1) / MAP_AREA_LANES * MAP_AREA_LANES;
+	float inf = std::numeric_limits<float>::infinity();
+	lanes.minx.resize(padded, inf);
+	lanes.maxx.resize(padded, -inf);
+	lanes.miny.resize(padded, inf);
+	lanes.maxy.resize(padded, -inf);
+	lanes.minz.resize(padded, inf);
+	lanes.maxz.resize(padded, -inf);
+	lanes.spread.resize(padded, 1);
+	lanes.reach.resize(padded, 0);
+	lanes.priority.resize(padded, std::numeric_limits<int>::min());
+	lanes.flags.resize(padded, 0);
+}
+void map_frame::add_area(map_area* a) {
+	areas.push_back(a);
+	pad();
+	pack_area(areas.size() - 1);
+}
+// Rebuilds every packed lane, for after areas were appended directly.
+void map_frame::repack() {
+	pad();
+	for (unsigned int i = 0; i < areas.size(); i++)
+		pack_area(i);
+}
+void map_frame::remove_area(unsigned int i) {
+	if (i >= areas.size()) return;
+	areas.erase(areas.begin() + i);
+	lanes.minx.erase(lanes.minx.begin() + i);
+	lanes.maxx.erase(lanes.maxx.begin() + i);
+	lanes.miny.erase(lanes.miny.begin() + i);
+	lanes.maxy.erase(lanes.maxy.begin() + i);
+	lanes.minz.erase(lanes.minz.begin() + i);
+	lanes.maxz.erase(lanes.maxz.begin() + i);
+	lanes.spread.erase(lanes.spread.begin() + i);
+	lanes.reach.erase(lanes.reach.begin() + i);
+	lanes.priority.erase(lanes.priority.begin() + i);
+	lanes.flags.erase(lanes.flags.begin() + i);
+	pad();
+}
+void map_frame::update_flags(map_area* a) {
+	for (unsigned int i = 0; i < areas.size(); i++) {
+		if (areas[i] == a) lanes.flags[i] = a->flags;
+	}
+}
+// Returns a bit for each of the MAP_AREA_LANES areas starting at first whose packed bounds contain the given point, after widening them by d times each area's spread plus its reach if d is greater than 1. This is only a conservative prefilter, map_area::is_in_area makes the final decision.
+static unsigned int point_candidates(const map_area_lanes& l, unsigned int first, float x, float y, float z, float d) {
+	float wide = d > 1 ? 1 : 0;
+	#if defined(__AVX__)
+	__m256 vd = _mm256_set1_ps(d);
+	__m256 t = _mm256_add_ps(_mm256_mul_ps(vd, _mm256_loadu_ps(&l.spread[first])), _mm256_mul_ps(_mm256_loadu_ps(&l.reach[first]), _mm256_set1_ps(wide)));
+	__m256 vx = _mm256_set1_ps(x), vy = _mm256_set1_ps(y), vz = _mm256_set1_ps(z);
+	__m256 m = _mm256_and_ps(_mm256_cmp_ps(vx, _mm256_sub_ps(_mm256_loadu_ps(&l.minx[first]), t), _CMP_GE_OQ), _mm256_cmp_ps(vx, _mm256_add_ps(_mm256_loadu_ps(&l.maxx[first]), t), _CMP_LE_OQ));
+	m = _mm256_and_ps(m, _mm256_and_ps(_mm256_cmp_ps(vy, _mm256_sub_ps(_mm256_loadu_ps(&l.miny[first]), t), _CMP_GE_OQ), _mm256_cmp_ps(vy, _mm256_add_ps(_mm256_loadu_ps(&l.maxy[first]), t), _CMP_LE_OQ)));
+	m = _mm256_and_ps(m, _mm256_and_ps(_mm256_cmp_ps(vz, _mm256_sub_ps(_mm256_loadu_ps(&l.minz[first]), vd), _CMP_GE_OQ), _mm256_cmp_ps(vz, _mm256_add_ps(_mm256_loadu_ps(&l.maxz[first]), vd), _CMP_LE_OQ)));
+	return _mm256_movemask_ps(m);
+	#elif defined(NVGT_MAP_SSE)
+	__m128 vd = _mm_set1_ps(d), vw = _mm_set1_ps(wide);
+	__m128 vx = _mm_set1_ps(x), vy = _mm_set1_ps(y), vz = _mm_set1_ps(z);
+	unsigned int mask = 0;
+	for (unsigned int i = first; i < first + MAP_AREA_LANES; i += 4) {
+		__m128 t = _mm_add_ps(_mm_mul_ps(vd, _mm_loadu_ps(&l.spread[i])), _mm_mul_ps(_mm_loadu_ps(&l.reach[i]), vw));
+		__m128 m = _mm_and_ps(_mm_cmpge_ps(vx, _mm_sub_ps(_mm_loadu_ps(&l.minx[i]), t)), _mm_cmple_ps(vx, _mm_add_ps(_mm_loadu_ps(&l.maxx[i]), t)));
+		m = _mm_and_ps(m, _mm_and_ps(_mm_cmpge_ps(vy, _mm_sub_ps(_mm_loadu_ps(&l.miny[i]), t)), _mm_cmple_ps(vy, _mm_add_ps(_mm_loadu_ps(&l.maxy[i]), t))));
+		m = _mm_and_ps(m, _mm_and_ps(_mm_cmpge_ps(vz, _mm_sub_ps(_mm_loadu_ps(&l.minz[i]), vd)), _mm_cmple_ps(vz, _mm_add_ps(_mm_loadu_ps(&l.maxz[i]), vd))));
+		mask |= _mm_movemask_ps(m) << (i - first);
+	}
+	return mask;
+	#elif defined(__ARM_NEON)
+	float32x4_t vd = vdupq_n_f32(d);
+	float32x4_t vx = vdupq_n_f32(x), vy = vdupq_n_f32(y), vz = vdupq_n_f32(z);
+	const uint32_t bits[4] = {1, 2, 4, 8};
+	uint32x4_t vbits = vld1q_u32(bits);
+	unsigned int mask = 0;
+	for (unsigned int i = first; i < first + MAP_AREA_LANES; i += 4) {
+		float32x4_t t = vmlaq_n_f32(vmulq_f32(vd, vld1q_f32(&l.spread[i])), vld1q_f32(&l.reach[i]), wide);
+		uint32x4_t m = vandq_u32(vcgeq_f32(vx, vsubq_f32(vld1q_f32(&l.minx[i]), t)), vcleq_f32(vx, vaddq_f32(vld1q_f32(&l.maxx[i]), t)));
+		m = vandq_u32(m, vandq_u32(vcgeq_f32(vy, vsubq_f32(vld1q_f32(&l.miny[i]), t)), vcleq_f32(vy, vaddq_f32(vld1q_f32(&l.maxy[i]), t))));
+		m = vandq_u32(m, vandq_u32(vcgeq_f32(vz, vsubq_f32(vld1q_f32(&l.minz[i]), vd)), vcleq_f32(vz, vaddq_f32(vld1q_f32(&l.maxz[i]), vd))));
+		uint32x2_t half = vpadd_u32(vget_low_u32(vandq_u32(m, vbits)), vget_high_u32(vandq_u32(m, vbits)));
+		mask |= (vget_lane_u32(half, 0) + vget_lane_u32(half, 1)) << (i - first);
+	}
+	return mask;
+	#else
+	unsigned int mask = 0;
+	for (unsigned int i = 0; i < MAP_AREA_LANES; i++) {
+		unsigned int a = first + i;
+		float t = d * l.spread[a] + l.reach[a] * wide;
+		if (x >= l.minx[a] - t && x <= l.maxx[a] + t && y >= l.miny[a] - t && y <= l.maxy[a] + t && z >= l.minz[a] - d && z <= l.maxz[a] + d)
+			mask |= 1 << i;
+	}
+	return mask;
+	#endif
+}
 int map_frame::add_areas_for_point(std::vector<map_area*>& local_areas, float x, float y, float z, float d, int p, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
-	for (int i = 0; i < areas.size(); i++) {
-		if (areas[i]->priority >= p && areas[i]->is_in_area(x, y, z, d, filter_callback, flags, excluded_flags)) {
-			p = areas[i]->priority;
-			local_areas.push_back(areas[i]);
+	unsigned int count = areas.size();
+	for (unsigned int first = 0; first < count; first += MAP_AREA_LANES) {
+		unsigned int hits = point_candidates(lanes, first, x, y, z, d);
+		for (unsigned int i = first; hits; i++, hits >>= 1) {
+			if (!(hits & 1) || lanes.priority[i] < p || (lanes.flags[i] & flags) != flags || (lanes.flags[i] & excluded_flags) != 0) continue;
+			if (areas[i]->is_in_area(x, y, z, d, filter_callback, flags, excluded_flags)) {
+				p = areas[i]->priority;
+				local_areas.push_back(areas[i]);
+			}
 		}
 	}
 	return p;
 }
-int map_frame::add_areas_for_range(std::vector<map_area*>& local_areas, float minx, float maxx, float miny, float maxy, float minz, float maxz, float d, int p, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
+// If seen is given it is used to skip areas already in the result instead of the tmp_adding_to_result flag, which lets several threads query the same map at once.
+int map_frame::add_areas_for_range(std::vector<map_area*>& local_areas, float minx, float maxx, float miny, float maxy, float minz, float maxz, float d, int p, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags, ankerl::unordered_dense::set<map_area*>* seen) {
 	for (int i = 0; i < areas.size(); i++) {
-		if (!areas[i]->tmp_adding_to_result && areas[i]->priority >= p && areas[i]->is_in_area_range(minx, maxx, miny, maxy, minz, maxz, d, 0, filter_callback, flags, excluded_flags)) {
+		if (lanes.priority[i] < p || (lanes.flags[i] & flags) != flags || (lanes.flags[i] & excluded_flags) != 0) continue;
+		if (seen ? seen->find(areas[i]) != seen->end() : areas[i]->tmp_adding_to_result) continue;
+		if (areas[i]->priority >= p && areas[i]->is_in_area_range(minx, maxx, miny, maxy, minz, maxz, d, 0, filter_callback, flags, excluded_flags)) {
 			//p=areas[i]->priority; // Object can be reframed at the end of frame with lower priority than something that is higher in the frame, such item will not be included in list if p keeps getting reset.
 			local_areas.push_back(areas[i]);
-			areas[i]->tmp_adding_to_result = true;
+			if (seen) seen->insert(areas[i]);
+			else areas[i]->tmp_adding_to_result = true;
 		}
 	}
 	return p;
@@ -256,6 +480,232 @@ void map_frame::reset() {
 	for (auto i : areas)
 		i->release();
 	areas.clear();
+	pad();
+}
+
+static void merge_bounds(map_bounds& out, const map_bounds& a, const map_bounds& b) {
+	out.minx = std::min(a.minx, b.minx);
+	out.maxx = std::max(a.maxx, b.maxx);
+	out.miny = std::min(a.miny, b.miny);
+	out.maxy = std::max(a.maxy, b.maxy);
+	out.minz = std::min(a.minz, b.minz);
+	out.maxz = std::max(a.maxz, b.maxz);
+}
+// Surface area, the cost that tree insertion minimizes.
+static float bounds_cost(const map_bounds& b) {
+	float dx = b.maxx - b.minx, dy = b.maxy - b.miny, dz = b.maxz - b.minz;
+	return 2 * (dx * dy + dy * dz + dz * dx);
+}
+int map_tree::allocate_node() {
+	int node;
+	if (free_list < 0) {
+		node = nodes.size();
+		nodes.emplace_back();
+	} else {
+		node = free_list;
+		free_list = nodes[node].parent;
+	}
+	map_tree_node& n = nodes[node];
+	n.parent = n.left = n.right = -1;
+	n.height = 0;
+	n.area = NULL;
+	return node;
+}
+void map_tree::free_node(int node) {
+	nodes[node].parent = free_list;
+	nodes[node].height = -1;
+	nodes[node].area = NULL;
+	free_list = node;
+}
+int map_tree::insert(map_area* area, const map_bounds& bounds) {
+	int leaf = allocate_node();
+	map_tree_node& n = nodes[leaf];
+	n.area = area;
+	n.box.minx = bounds.minx - MAP_TREE_MARGIN;
+	n.box.maxx = bounds.maxx + MAP_TREE_MARGIN;
+	n.box.miny = bounds.miny - MAP_TREE_MARGIN;
+	n.box.maxy = bounds.maxy + MAP_TREE_MARGIN;
+	n.box.minz = bounds.minz - MAP_TREE_MARGIN;
+	n.box.maxz = bounds.maxz + MAP_TREE_MARGIN;
+	insert_leaf(leaf);
+	return leaf;
+}
+void map_tree::remove(int leaf) {
+	if (leaf < 0 || leaf >= nodes.size() || nodes[leaf].height != 0) return;
+	remove_leaf(leaf);
+	free_node(leaf);
+}
+// Only touches the tree if the new bounds have left the leaf's margin, returns whether they did.
+bool map_tree::move(int leaf, const map_bounds& bounds) {
+	if (leaf < 0 || leaf >= nodes.size() || nodes[leaf].height != 0) return false;
+	const map_bounds& box = nodes[leaf].box;
+	if (box.minx <= bounds.minx && box.maxx >= bounds.maxx && box.miny <= bounds.miny && box.maxy >= bounds.maxy && box.minz <= bounds.minz && box.maxz >= bounds.maxz) return false;
+	map_area* area = nodes[leaf].area;
+	remove_leaf(leaf);
+	map_tree_node& n = nodes[leaf];
+	n.area = area;
+	n.box.minx = bounds.minx - MAP_TREE_MARGIN;
+	n.box.maxx = bounds.maxx + MAP_TREE_MARGIN;
+	n.box.miny = bounds.miny - MAP_TREE_MARGIN;
+	n.box.maxy = bounds.maxy + MAP_TREE_MARGIN;
+	n.box.minz = bounds.minz - MAP_TREE_MARGIN;
+	n.box.maxz = bounds.maxz + MAP_TREE_MARGIN;
+	insert_leaf(leaf);
+	return true;
+}
+// Releases the tree's reference to each of its areas, leaving them unframed.
+void map_tree::clear() {
+	for (map_tree_node& n : nodes) {
+		if (n.height != 0 || !n.area) continue;
+		n.area->tree_leaf = -1;
+		n.area->framed = false;
+		n.area->release();
+	}
+	nodes.clear();
+	root = free_list = -1;
+}
+void map_tree::insert_leaf(int leaf) {
+	if (root < 0) {
+		root = leaf;
+		nodes[root].parent = -1;
+		return;
+	}
+	map_bounds box = nodes[leaf].box;
+	// Walk down to the cheapest sibling for the new leaf.
+	int index = root;
+	while (nodes[index].left >= 0) {
+		const map_tree_node& n = nodes[index];
+		map_bounds combined;
+		merge_bounds(combined, n.box, box);
+		float combined_cost = bounds_cost(combined);
+		float cost = 2 * combined_cost;
+		float inheritance_cost = 2 * (combined_cost - bounds_cost(n.box));
+		float child_costs[2];
+		int children[2] = {n.left, n.right};
+		for (int c = 0; c < 2; c++) {
+			const map_tree_node& child = nodes[children[c]];
+			merge_bounds(combined, child.box, box);
+			child_costs[c] = bounds_cost(combined) + inheritance_cost;
+			if (child.left >= 0) child_costs[c] -= bounds_cost(child.box);
+		}
+		if (cost < child_costs[0] && cost < child_costs[1]) break;
+		index = child_costs[0] < child_costs[1] ? children[0] : children[1];
+	}
+	int sibling = index;
+	int old_parent = nodes[sibling].parent;
+	int new_parent = allocate_node();
+	map_tree_node& p = nodes[new_parent];
+	p.parent = old_parent;
+	merge_bounds(p.box, nodes[sibling].box, box);
+	p.height = nodes[sibling].height + 1;
+	p.left = sibling;
+	p.right = leaf;
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+	if (old_parent >= 0) {
+		if (nodes[old_parent].left == sibling) nodes[old_parent].left = new_parent;
+		else nodes[old_parent].right = new_parent;
+	} else root = new_parent;
+	for (index = nodes[leaf].parent; index >= 0; index = nodes[index].parent) {
+		index = balance(index);
+		map_tree_node& n = nodes[index];
+		n.height = 1 + std::max(nodes[n.left].height, nodes[n.right].height);
+		merge_bounds(n.box, nodes[n.left].box, nodes[n.right].box);
+	}
+}
+void map_tree::remove_leaf(int leaf) {
+	if (leaf == root) {
+		root = -1;
+		return;
+	}
+	int parent = nodes[leaf].parent;
+	int grandparent = nodes[parent].parent;
+	int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+	free_node(parent);
+	if (grandparent < 0) {
+		root = sibling;
+		nodes[sibling].parent = -1;
+		return;
+	}
+	if (nodes[grandparent].left == parent) nodes[grandparent].left = sibling;
+	else nodes[grandparent].right = sibling;
+	nodes[sibling].parent = grandparent;
+	for (int index = grandparent; index >= 0; index = nodes[index].parent) {
+		index = balance(index);
+		map_tree_node& n = nodes[index];
+		n.height = 1 + std::max(nodes[n.left].height, nodes[n.right].height);
+		merge_bounds(n.box, nodes[n.left].box, nodes[n.right].box);
+	}
+}
+// Rotates the taller child of node up if its children's heights differ by more than 1, returning the node now in its place.
+int map_tree::balance(int a) {
+	map_tree_node& A = nodes[a];
+	if (A.left < 0 || A.height < 2) return a;
+	int b = A.left, c = A.right;
+	map_tree_node& B = nodes[b];
+	map_tree_node& C = nodes[c];
+	int difference = C.height - B.height;
+	if (difference > 1) {
+		int f = C.left, g = C.right;
+		map_tree_node& F = nodes[f];
+		map_tree_node& G = nodes[g];
+		C.left = a;
+		C.parent = A.parent;
+		A.parent = c;
+		if (C.parent >= 0) {
+			if (nodes[C.parent].left == a) nodes[C.parent].left = c;
+			else nodes[C.parent].right = c;
+		} else root = c;
+		if (F.height > G.height) {
+			C.right = f;
+			A.right = g;
+			G.parent = a;
+			merge_bounds(A.box, B.box, G.box);
+			merge_bounds(C.box, A.box, F.box);
+			A.height = 1 + std::max(B.height, G.height);
+			C.height = 1 + std::max(A.height, F.height);
+		} else {
+			C.right = g;
+			A.right = f;
+			F.parent = a;
+			merge_bounds(A.box, B.box, F.box);
+			merge_bounds(C.box, A.box, G.box);
+			A.height = 1 + std::max(B.height, F.height);
+			C.height = 1 + std::max(A.height, G.height);
+		}
+		return c;
+	}
+	if (difference < -1) {
+		int d = B.left, e = B.right;
+		map_tree_node& D = nodes[d];
+		map_tree_node& E = nodes[e];
+		B.left = a;
+		B.parent = A.parent;
+		A.parent = b;
+		if (B.parent >= 0) {
+			if (nodes[B.parent].left == a) nodes[B.parent].left = b;
+			else nodes[B.parent].right = b;
+		} else root = b;
+		if (D.height > E.height) {
+			B.right = d;
+			A.left = e;
+			E.parent = a;
+			merge_bounds(A.box, C.box, E.box);
+			merge_bounds(B.box, A.box, D.box);
+			A.height = 1 + std::max(C.height, E.height);
+			B.height = 1 + std::max(A.height, D.height);
+		} else {
+			B.right = e;
+			A.left = d;
+			D.parent = a;
+			merge_bounds(A.box, C.box, D.box);
+			merge_bounds(B.box, A.box, E.box);
+			A.height = 1 + std::max(C.height, D.height);
+			B.height = 1 + std::max(A.height, E.height);
+		}
+		return b;
+	}
+	return a;
 }
 
 void coordinate_map::add_ref() {
@@ -296,11 +746,24 @@ map_frame* coordinate_map::get_frame(int x, int y, int z, int size, bool create)
 map_area* coordinate_map::add_area(float minx, float maxx, float miny, float maxy, float minz, float maxz, float rotation, CScriptAny* primary_data, const std::string& data1, const std::string& data2, const std::string& data3, int priority, asINT64 flags) {
 	return new map_area(this, minx, maxx, miny, maxy, minz, maxz, rotation, primary_data, data1, data2, data3, priority, flags);
 }
-void coordinate_map::get_areas(float minx, float maxx, float miny, float maxy, float minz, float maxz, float d, std::vector<map_area*>& local_areas, bool priority_check, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
+// Like get_areas but does not release the filter callback. Point queries may pass the frames containing the point by size in point_frames if they are already known, and see map_frame::add_areas_for_range for seen.
+void coordinate_map::find_areas(float minx, float maxx, float miny, float maxy, float minz, float maxz, float d, std::vector<map_area*>& local_areas, bool priority_check, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags, map_frame* const* point_frames, ankerl::unordered_dense::set<map_area*>* seen) {
 	int p = -1;
-	if (minx == maxx && miny == maxy && minz == maxz && d < 1) {
+	if (tree) {
+		// The tree hands back each candidate once, so there is neither a per frame priority reset nor any need to track areas already added.
+		bool point = minx == maxx && miny == maxy && minz == maxz && d < 1;
+		// Rotated areas apply d along their own axes, which can reach further along the world's.
+		float spread = d * float(M_SQRT2);
+		map_bounds bounds = {minx - spread, maxx + spread + 1, miny - spread, maxy + spread + 1, minz - d, maxz + d + 1};
+		tree->query(bounds, [&](map_area* a) {
+			if (a->priority < p) return;
+			if (point ? !a->is_in_area(minx, miny, minz, d, filter_callback, flags, excluded_flags) : !a->is_in_area_range(minx, maxx, miny, maxy, minz, maxz, d, 0, filter_callback, flags, excluded_flags)) return;
+			if (point && priority_check) p = a->priority;
+			local_areas.push_back(a);
+		});
+	} else if (minx == maxx && miny == maxy && minz == maxz && d < 1) {
 		for (int i = total_frame_sizes - 1; i >= 0; i--) {
-			map_frame* f = get_frame(minx, miny, minz, i, false);
+			map_frame* f = point_frames ? point_frames[i] : get_frame(minx, miny, minz, i, false);
 			if (!f) continue;
 			p = f->add_areas_for_point(local_areas, minx, miny, minz, d, p, filter_callback, flags, excluded_flags);
 			if (!priority_check) p = -1;
@@ -312,15 +775,18 @@ void coordinate_map::get_areas(float minx, float maxx, float miny, float maxy, f
 					for (int z = minz - d; z <= maxz + d + frame_sizes[i]; z += frame_sizes[i]) {
 						map_frame* f = get_frame(x, y, z, i, false);
 						if (!f) continue;
-						p = f->add_areas_for_range(local_areas, minx, maxx, miny, maxy, minz, maxz, d, p, filter_callback, flags, excluded_flags);
+						p = f->add_areas_for_range(local_areas, minx, maxx, miny, maxy, minz, maxz, d, p, filter_callback, flags, excluded_flags, seen);
 						if (!priority_check) p = -1;
 					}
 				}
 			}
 		}
 	}
-	for (auto i : local_areas)
-		i->tmp_adding_to_result = false;
+	if (seen) seen->clear();
+	else {
+		for (auto i : local_areas)
+			i->tmp_adding_to_result = false;
+	}
 	if (priority_check && local_areas.size() > 1) {
 		map_area* final = NULL;
 		for (auto i : local_areas) {
@@ -329,6 +795,9 @@ void coordinate_map::get_areas(float minx, float maxx, float miny, float maxy, f
 		if (final) std::swap(final, local_areas[local_areas.size() - 1]);
 	} else if (local_areas.size() > 1)
 		sort(local_areas.begin(), local_areas.end(), map_area_sort);
+}
+void coordinate_map::get_areas(float minx, float maxx, float miny, float maxy, float minz, float maxz, float d, std::vector<map_area*>& local_areas, bool priority_check, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
+	find_areas(minx, maxx, miny, maxy, minz, maxz, d, local_areas, priority_check, filter_callback, flags, excluded_flags);
 	if (filter_callback) filter_callback->Release();
 }
 CScriptArray* coordinate_map::get_areas_script(float x, float y, float z, float d, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
@@ -353,22 +822,172 @@ CScriptArray* coordinate_map::get_areas_in_range_script(float minx, float maxx,
 		array->InsertLast(&local_areas[i]);
 	return array;
 }
-map_area* coordinate_map::get_area(float x, float y, float z, int max_priority, float d, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
-	std::vector<map_area*> local_areas;
-	get_areas(x, x, y, y, z, z, d, local_areas, max_priority < 0, filter_callback, flags, excluded_flags);
+// Picks the result of get_area out of the areas found at a point, without adding a reference to it.
+static map_area* select_area(const std::vector<map_area*>& local_areas, int max_priority) {
 	if (local_areas.size() < 1)return NULL;
-	if (max_priority < 0) {
-		local_areas[local_areas.size() - 1]->add_ref();
+	if (max_priority < 0)
 		return local_areas[local_areas.size() - 1];
-	}
 	for (int i = local_areas.size() - 1; i >= 0; i--) {
 		if (local_areas[i]->priority >= max_priority) continue;
-		local_areas[i]->add_ref();
 		return local_areas[i];
 	}
 	return NULL;
 }
+map_area* coordinate_map::get_area(float x, float y, float z, int max_priority, float d, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
+	std::vector<map_area*> local_areas;
+	get_areas(x, x, y, y, z, z, d, local_areas, max_priority < 0, filter_callback, flags, excluded_flags);
+	map_area* a = select_area(local_areas, max_priority);
+	if (a) a->add_ref();
+	return a;
+}
+
+// Runs the given queries in order, appending their results to results and recording where each query's results begin. Point queries in the same smallest frame reuse the frame lookups of the query before them.
+void coordinate_map::run_queries(map_query* queries, unsigned int count, std::vector<map_area*>& results, float d, bool single, int max_priority, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
+	std::vector<map_area*> local_areas;
+	local_areas.reserve(20);
+	ankerl::unordered_dense::set<map_area*> seen;
+	map_frame* point_frames[total_frame_sizes];
+	map_query* framed_query = NULL;
+	for (unsigned int i = 0; i < count; i++) {
+		map_query& q = queries[i];
+		bool point = q.minx == q.maxx && q.miny == q.maxy && q.minz == q.maxz && d < 1;
+		if (point && !tree && (!framed_query || framed_query->cx != q.cx || framed_query->cy != q.cy || framed_query->cz != q.cz)) {
+			for (int s = 0; s < total_frame_sizes; s++)
+				point_frames[s] = get_frame(q.minx, q.miny, q.minz, s, false);
+			framed_query = &q;
+		}
+		local_areas.clear();
+		find_areas(q.minx, q.maxx, q.miny, q.maxy, q.minz, q.maxz, d, local_areas, single && max_priority < 0, filter_callback, flags, excluded_flags, point ? point_frames : NULL, &seen);
+		q.start = results.size();
+		if (single) results.push_back(select_area(local_areas, max_priority));
+		else results.insert(results.end(), local_areas.begin(), local_areas.end());
+		q.count = results.size() - q.start;
+	}
+}
+// Runs one chunk of a batched query on a pool thread. Filter callbacks must execute on the script thread, so batches that use one are never split.
+class map_query_worker : public Poco::Runnable {
+public:
+	coordinate_map* map;
+	map_query* queries;
+	unsigned int count;
+	float d;
+	bool single;
+	int max_priority;
+	asIScriptFunction* filter_callback;
+	asINT64 flags;
+	asINT64 excluded_flags;
+	std::vector<map_area*> results;
+	Poco::Event done;
+	void run() {
+		map->run_queries(queries, count, results, d, single, max_priority, filter_callback, flags, excluded_flags);
+		done.set();
+	}
+};
+// Batches smaller than this always run on the calling thread.
+#define MAP_BATCH_THREADING_THRESHOLD 512
+// Looks up every point (3 floats each) or box (6 floats each, minx, maxx, miny, maxy, minz, maxz) in coordinates. The results array is resized and overwritten rather than recreated so that callers can reuse it every tick. For single queries it receives one area or null per query, otherwise it receives every query's areas one after another and offsets receives count + 1 entries, the areas of query i being results[offsets[i]] up to but not including results[offsets[i + 1]]. Returns the number of areas found.
+unsigned int coordinate_map::query_batch(CScriptArray* coordinates, bool range, CScriptArray* results, CScriptArray* offsets, bool single, int max_priority, float d, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
+	unsigned int stride = range ? 6 : 3;
+	unsigned int count = coordinates && results && (single || offsets) ? coordinates->GetSize() / stride : 0;
+	if (count < 1) {
+		if (results) results->Resize(0);
+		if (offsets) {
+			offsets->Resize(1);
+			*(unsigned int*)offsets->At(0) = 0;
+		}
+		if (filter_callback) filter_callback->Release();
+		return 0;
+	}
+	std::vector<map_query> queries(count);
+	const float* c = (const float*)coordinates->GetBuffer();
+	int cell = frame_sizes[total_frame_sizes - 1] - 1;
+	for (unsigned int i = 0; i < count; i++, c += stride) {
+		map_query& q = queries[i];
+		if (range) {
+			q.minx = c[0];
+			q.maxx = c[1];
+			q.miny = c[2];
+			q.maxy = c[3];
+			q.minz = c[4];
+			q.maxz = c[5];
+		} else {
+			q.minx = q.maxx = c[0];
+			q.miny = q.maxy = c[1];
+			q.minz = q.maxz = c[2];
+		}
+		int x = q.minx, y = q.miny, z = q.minz;
+		q.cx = x - (x & cell);
+		q.cy = y - (y & cell);
+		q.cz = z - (z & cell);
+		q.index = i;
+	}
+	std::sort(queries.begin(), queries.end(), [](const map_query& a, const map_query& b) {
+		return a.cx != b.cx ? a.cx < b.cx : a.cy != b.cy ? a.cy < b.cy : a.cz < b.cz;
+	});
+	unsigned int chunks = 1;
+	if (!filter_callback && count >= MAP_BATCH_THREADING_THRESHOLD)
+		chunks = std::max(1u, std::min((unsigned int)Poco::Environment::processorCount(), count / (MAP_BATCH_THREADING_THRESHOLD / 2)));
+	unsigned int per_chunk = (count + chunks - 1) / chunks;
+	std::unique_ptr<map_query_worker[]> workers(new map_query_worker[chunks]);
+	for (unsigned int w = 0; w < chunks; w++) {
+		map_query_worker& worker = workers[w];
+		worker.map = this;
+		worker.queries = queries.data() + std::min(count, w * per_chunk);
+		worker.count = std::min(count, (w + 1) * per_chunk) - std::min(count, w * per_chunk);
+		worker.d = d;
+		worker.single = single;
+		worker.max_priority = max_priority;
+		worker.filter_callback = filter_callback;
+		worker.flags = flags;
+		worker.excluded_flags = excluded_flags;
+		if (w == 0) continue;
+		try {
+			Poco::ThreadPool::defaultPool().start(worker);
+		} catch (Poco::NoThreadAvailableException&) {
+			worker.run();
+		}
+	}
+	workers[0].run();
+	for (unsigned int w = 1; w < chunks; w++)
+		workers[w].done.wait();
+	std::vector<const map_query*> by_index(count);
+	for (const map_query& q : queries)
+		by_index[q.index] = &q;
+	unsigned int total = 0;
+	for (unsigned int w = 0; w < chunks; w++)
+		total += workers[w].results.size();
+	results->Resize(total);
+	unsigned int* offset = NULL;
+	if (!single) {
+		offsets->Resize(count + 1);
+		offset = (unsigned int*)offsets->GetBuffer();
+	}
+	unsigned int found = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		const map_query* q = by_index[i];
+		std::vector<map_area*>& chunk_results = workers[(q - queries.data()) / per_chunk].results;
+		if (offset) offset[i] = found;
+		for (unsigned int r = 0; r < q->count; r++) {
+			map_area* a = chunk_results[q->start + r];
+			results->SetValue(single ? i : found, &a);
+			if (!single || a) found++;
+		}
+	}
+	if (offset) offset[count] = found;
+	if (filter_callback) filter_callback->Release();
+	return found;
+}
+unsigned int coordinate_map::get_areas_batch(CScriptArray* points, CScriptArray* results, CScriptArray* offsets, float d, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
+	return query_batch(points, false, results, offsets, false, -1, d, filter_callback, flags, excluded_flags);
+}
+unsigned int coordinate_map::get_areas_in_range_batch(CScriptArray* boxes, CScriptArray* results, CScriptArray* offsets, float d, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
+	return query_batch(boxes, true, results, offsets, false, -1, d, filter_callback, flags, excluded_flags);
+}
+unsigned int coordinate_map::get_area_batch(CScriptArray* points, CScriptArray* results, int max_priority, float d, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags) {
+	return query_batch(points, false, results, NULL, true, max_priority, d, filter_callback, flags, excluded_flags);
+}
 void coordinate_map::reset() {
+	if (tree) tree->clear();
 	for (int i = 0; i < total_frame_sizes; i++) {
 		for (auto f : frames[i]) {
 			f.second->reset();
@@ -378,15 +997,224 @@ void coordinate_map::reset() {
 	}
 }
 
+// Serialized coordinate maps are a header followed by every framed area and, for grid maps, the frames each area was registered in so that loading needs no reframing. Values are stored in native byte order like serialized dictionaries.
+#define MAP_SERIALIZE_MAGIC "\x0e\x16\x07\x0d"
+#define MAP_SERIALIZE_VERSION 1
+#define MAP_SERIALIZED_AREA_MIN_SIZE 57
+template<class T> static void map_write(std::string& out, const T& value) {
+	out.append((const char*)&value, sizeof(T));
+}
+static void map_write_string(std::string& out, const std::string& value) {
+	map_write(out, (unsigned int)value.size());
+	out += value;
+}
+typedef struct {
+	const std::string* data;
+	size_t cursor;
+} map_reader;
+template<class T> static bool map_read(map_reader& r, T& value) {
+	if (r.data->size() - r.cursor < sizeof(T)) return false;
+	memcpy(&value, r.data->data() + r.cursor, sizeof(T));
+	r.cursor += sizeof(T);
+	return true;
+}
+static bool map_read_string(map_reader& r, std::string& value) {
+	unsigned int size;
+	if (!map_read(r, size) || r.data->size() - r.cursor < size) return false;
+	value.assign(r.data->data() + r.cursor, size);
+	r.cursor += size;
+	return true;
+}
+// Whether reframe could have put an area in the frame at x, y, z of the given size, so that a layout can't place areas in frames they don't overlap.
+static bool map_frame_may_hold(const map_area* a, int x, int y, int z, int size) {
+	int fs = frame_sizes[size];
+	if (a->framesize != size || (x & (fs - 1)) || (y & (fs - 1)) || (z & (fs - 1))) return false;
+	float minx = a->rotation > 0 ? a->rotated_bounds.minx : a->minx, maxx = a->rotation > 0 ? a->rotated_bounds.maxx : a->maxx;
+	float miny = a->rotation > 0 ? a->rotated_bounds.miny : a->miny, maxy = a->rotation > 0 ? a->rotated_bounds.maxy : a->maxy;
+	return x > int(minx) - fs && x <= maxx + fs && y > int(miny) - fs && y <= maxy + fs && z > int(a->minz) - fs && z <= a->maxz + fs;
+}
+// Returns a blob that deserialize can rebuild this map's framed areas from. primary_data is kept if it holds an integer, a float or a string.
+std::string coordinate_map::serialize() {
+	if (!g_StringTypeid)
+		g_StringTypeid = g_ScriptEngine->GetStringFactoryReturnTypeId();
+	std::vector<map_area*> areas;
+	ankerl::unordered_dense::map<map_area*, unsigned int> indices;
+	if (tree) {
+		float inf = std::numeric_limits<float>::infinity();
+		tree->query({-inf, inf, -inf, inf, -inf, inf}, [&](map_area* a) {
+			indices[a] = areas.size();
+			areas.push_back(a);
+		});
+	} else {
+		for (int i = 0; i < total_frame_sizes; i++) {
+			for (auto& f : frames[i]) {
+				for (map_area* a : f.second->areas) {
+					if (indices.emplace(a, areas.size()).second) areas.push_back(a);
+				}
+			}
+		}
+	}
+	std::string out;
+	out.reserve(16 + areas.size() * (MAP_SERIALIZED_AREA_MIN_SIZE + 8));
+	out.append(MAP_SERIALIZE_MAGIC, 4);
+	map_write(out, (unsigned int)MAP_SERIALIZE_VERSION);
+	map_write(out, (unsigned int)areas.size());
+	for (map_area* a : areas) {
+		const float bounds[7] = {a->minx, a->maxx, a->miny, a->maxy, a->minz, a->maxz, a->rotation};
+		out.append((const char*)bounds, sizeof(bounds));
+		map_write(out, a->priority);
+		map_write(out, (asINT64)a->flags);
+		map_write(out, a->framesize);
+		map_write_string(out, a->data1);
+		map_write_string(out, a->data2);
+		map_write_string(out, a->data3);
+		int type_id = a->primary_data ? a->primary_data->GetTypeId() : 0;
+		asINT64 int_value;
+		double double_value;
+		std::string string_value;
+		if (type_id == asTYPEID_DOUBLE && a->primary_data->Retrieve(double_value)) {
+			map_write(out, (unsigned char)2);
+			map_write(out, double_value);
+		} else if (type_id != 0 && type_id != g_StringTypeid && a->primary_data->Retrieve(int_value)) {
+			map_write(out, (unsigned char)1);
+			map_write(out, int_value);
+		} else if (type_id == g_StringTypeid && a->primary_data->Retrieve(&string_value, g_StringTypeid)) {
+			map_write(out, (unsigned char)3);
+			map_write_string(out, string_value);
+		} else map_write(out, (unsigned char)0);
+	}
+	map_write(out, (unsigned char)(tree ? 0 : 1));
+	if (!tree) {
+		for (int i = 0; i < total_frame_sizes; i++) {
+			map_write(out, (unsigned int)frames[i].size());
+			for (auto& f : frames[i]) {
+				map_write(out, f.first.x);
+				map_write(out, f.first.y);
+				map_write(out, f.first.z);
+				map_write(out, (unsigned int)f.second->areas.size());
+				for (map_area* a : f.second->areas)
+					map_write(out, indices[a]);
+			}
+		}
+	}
+	return out;
+}
+// Replaces the contents of this map with those of a blob from serialize, returning false and leaving the map untouched if the blob is invalid. A grid layout is reused when both maps are grids, otherwise each area is reframed.
+bool coordinate_map::deserialize(const std::string& data) {
+	if (!g_StringTypeid)
+		g_StringTypeid = g_ScriptEngine->GetStringFactoryReturnTypeId();
+	map_reader r = {&data, 0};
+	unsigned int version = 0, count = 0;
+	if (data.size() < 12 || memcmp(data.data(), MAP_SERIALIZE_MAGIC, 4) != 0) return false;
+	r.cursor = 4;
+	if (!map_read(r, version) || version != MAP_SERIALIZE_VERSION || !map_read(r, count) || count > (data.size() - r.cursor) / MAP_SERIALIZED_AREA_MIN_SIZE) return false;
+	std::vector<map_area*> areas;
+	areas.reserve(count);
+	bool ok = true;
+	for (unsigned int i = 0; i < count && ok; i++) {
+		float bounds[7];
+		int priority, framesize;
+		asINT64 flags;
+		std::string data1, data2, data3;
+		unsigned char type = 0;
+		ok = map_read(r, bounds) && map_read(r, priority) && map_read(r, flags) && map_read(r, framesize) && framesize >= 0 && framesize < total_frame_sizes && map_read_string(r, data1) && map_read_string(r, data2) && map_read_string(r, data3) && map_read(r, type) && type < 4;
+		if (!ok) break;
+		CScriptAny* primary_data = NULL;
+		if (type == 1) {
+			asINT64 value;
+			if (!(ok = map_read(r, value))) break;
+			primary_data = new CScriptAny(g_ScriptEngine);
+			primary_data->Store(value);
+		} else if (type == 2) {
+			double value;
+			if (!(ok = map_read(r, value))) break;
+			primary_data = new CScriptAny(g_ScriptEngine);
+			primary_data->Store(value);
+		} else if (type == 3) {
+			std::string value;
+			if (!(ok = map_read_string(r, value))) break;
+			primary_data = new CScriptAny(&value, g_StringTypeid, g_ScriptEngine);
+		}
+		// A NULL parent stops the constructor from framing the area, that happens in bulk below.
+		map_area* a = new map_area(NULL, bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5], bounds[6], primary_data, data1, data2, data3, priority, flags);
+		a->parent = this;
+		a->framesize = framesize;
+		areas.push_back(a);
+	}
+	unsigned char has_layout = 0;
+	typedef struct {
+		int size, x, y, z;
+		unsigned int first, count;
+	} frame_record;
+	std::vector<frame_record> layout;
+	std::vector<unsigned int> layout_areas;
+	std::vector<unsigned int> last_frame(areas.size(), 0xffffffff); // Index of the last frame record each area was listed in, to catch duplicates.
+	ankerl::unordered_dense::set<hashpoint, hashpoint_hash, hashpoint_equals> seen_frames;
+	if (ok) ok = map_read(r, has_layout);
+	for (int i = 0; ok && has_layout && i < total_frame_sizes; i++) {
+		unsigned int frame_count;
+		if (!(ok = map_read(r, frame_count) && frame_count <= (data.size() - r.cursor) / 16)) break;
+		seen_frames.clear();
+		for (unsigned int f = 0; f < frame_count && ok; f++) {
+			frame_record fr;
+			fr.size = i;
+			fr.first = layout_areas.size();
+			ok = map_read(r, fr.x) && map_read(r, fr.y) && map_read(r, fr.z) && map_read(r, fr.count) && fr.count <= (data.size() - r.cursor) / 4 && seen_frames.insert(hashpoint(fr.x, fr.y, fr.z)).second;
+			unsigned int record = layout.size();
+			for (unsigned int j = 0; ok && j < fr.count; j++) {
+				unsigned int idx;
+				ok = map_read(r, idx) && idx < areas.size() && last_frame[idx] != record && map_frame_may_hold(areas[idx], fr.x, fr.y, fr.z, i);
+				if (!ok) break;
+				last_frame[idx] = record;
+				layout_areas.push_back(idx);
+			}
+			layout.push_back(fr);
+		}
+	}
+	if (!ok) {
+		for (map_area* a : areas)
+			a->release();
+		return false;
+	}
+	reset();
+	if (has_layout && !tree) {
+		for (const frame_record& fr : layout) {
+			map_frame* f = get_frame(fr.x, fr.y, fr.z, fr.size);
+			f->areas.reserve(f->areas.size() + fr.count);
+			for (unsigned int j = 0; j < fr.count; j++) {
+				map_area* a = areas[layout_areas[fr.first + j]];
+				a->add_ref();
+				f->areas.push_back(a);
+				a->frames.push_back(f);
+				a->framed = true;
+			}
+			f->repack();
+		}
+	} else {
+		for (map_area* a : areas)
+			a->reframe();
+	}
+	// The map's frames now hold their own references.
+	for (map_area* a : areas)
+		a->release();
+	return true;
+}
+
 coordinate_map* new_coordinate_map() {
 	return new coordinate_map();
 }
+coordinate_map* new_coordinate_map_indexed(coordinate_map_index index) {
+	return new coordinate_map(index);
+}
 
 void RegisterScriptMap(asIScriptEngine* engine) {
 	engine->SetDefaultAccessMask(NVGT_SUBSYSTEM_GENERAL);
 	engine->RegisterGlobalFunction(_O("vector rotate(vector, vector, double, bool = true)"), asFUNCTION(rotate), asCALL_CDECL);
 	engine->RegisterGlobalFunction(_O("bool boxes_intersect(float, float, float, float, float, float, float, float, float, float)"), asFUNCTION(boxes_intersect), asCALL_CDECL);
 	engine->SetDefaultAccessMask(NVGT_SUBSYSTEM_MAP);
+	engine->RegisterEnum(_O("coordinate_map_index"));
+	engine->RegisterEnumValue(_O("coordinate_map_index"), _O("COORDINATE_MAP_INDEX_GRID"), COORDINATE_MAP_INDEX_GRID);
+	engine->RegisterEnumValue(_O("coordinate_map_index"), _O("COORDINATE_MAP_INDEX_TREE"), COORDINATE_MAP_INDEX_TREE);
 	engine->RegisterObjectType(_O("coordinate_map"), 0, asOBJ_REF);
 	engine->RegisterObjectType(_O("coordinate_map_area"), 0, asOBJ_REF);
 	engine->RegisterFuncdef(_O("bool coordinate_map_filter_callback(coordinate_map_area@)"));
@@ -406,7 +1234,8 @@ void RegisterScriptMap(asIScriptEngine* engine) {
 	engine->RegisterObjectProperty(_O("coordinate_map_area"), _O("const string data3"), asOFFSET(map_area, data3));
 	engine->RegisterObjectProperty(_O("coordinate_map_area"), _O("const int priority"), asOFFSET(map_area, priority));
 	engine->RegisterObjectProperty(_O("coordinate_map_area"), _O("const bool framed"), asOFFSET(map_area, framed));
-	engine->RegisterObjectProperty(_O("coordinate_map_area"), _O("int64 flags"), asOFFSET(map_area, flags));
+	engine->RegisterObjectMethod(_O("coordinate_map_area"), _O("int64 get_flags() const property"), asMETHOD(map_area, get_flags), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("coordinate_map_area"), _O("void set_flags(int64) property"), asMETHOD(map_area, set_flags), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("coordinate_map_area"), _O("void unframe()"), asMETHOD(map_area, unframe), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("coordinate_map_area"), _O("void reframe()"), asMETHOD(map_area, reframe), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("coordinate_map_area"), _O("void set(float, float, float, float, float, float, float)"), asMETHOD(map_area, set), asCALL_THISCALL);
@@ -414,11 +1243,18 @@ void RegisterScriptMap(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod(_O("coordinate_map_area"), _O("void set_rotation(float)"), asMETHOD(map_area, set_rotation), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("coordinate_map_area"), _O("bool is_in_area(float, float, float, float = 0.0, coordinate_map_filter_callback@ = null, int64=0, int64=0) const"), asMETHOD(map_area, is_in_area), asCALL_THISCALL);
 	engine->RegisterObjectBehaviour(_O("coordinate_map"), asBEHAVE_FACTORY, _O("coordinate_map @m()"), asFUNCTION(new_coordinate_map), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("coordinate_map"), asBEHAVE_FACTORY, _O("coordinate_map @m(coordinate_map_index)"), asFUNCTION(new_coordinate_map_indexed), asCALL_CDECL);
 	engine->RegisterObjectBehaviour(_O("coordinate_map"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(coordinate_map, add_ref), asCALL_THISCALL);
 	engine->RegisterObjectBehaviour(_O("coordinate_map"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(coordinate_map, release), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("coordinate_map"), _O("coordinate_map_area@ add_area(float, float, float, float, float, float, float, any@, const string&in, const string&in, const string&in, int, int64=0)"), asMETHOD(coordinate_map, add_area), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("coordinate_map"), _O("coordinate_map_area@[]@ get_areas(float, float, float, float = 0.0, coordinate_map_filter_callback@ = null, int64=0, int64=0) const"), asMETHOD(coordinate_map, get_areas_script), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("coordinate_map"), _O("coordinate_map_area@[]@ get_areas(float, float, float, float, float, float, float = 0.0, coordinate_map_filter_callback@ = null, int64=0, int64=0) const"), asMETHOD(coordinate_map, get_areas_in_range_script), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("coordinate_map"), _O("coordinate_map_area@ get_area(float, float, float, int = -1, float = 0.0, coordinate_map_filter_callback@ = null, int64=0, int64=0) const"), asMETHOD(coordinate_map, get_area), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("coordinate_map"), _O("uint get_areas_batch(const float[]&in, coordinate_map_area@[]&, uint[]&, float = 0.0, coordinate_map_filter_callback@ = null, int64=0, int64=0) const"), asMETHOD(coordinate_map, get_areas_batch), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("coordinate_map"), _O("uint get_areas_in_range_batch(const float[]&in, coordinate_map_area@[]&, uint[]&, float = 0.0, coordinate_map_filter_callback@ = null, int64=0, int64=0) const"), asMETHOD(coordinate_map, get_areas_in_range_batch), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("coordinate_map"), _O("uint get_area_batch(const float[]&in, coordinate_map_area@[]&, int = -1, float = 0.0, coordinate_map_filter_callback@ = null, int64=0, int64=0) const"), asMETHOD(coordinate_map, get_area_batch), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("coordinate_map"), _O("coordinate_map_index get_index() const property"), asMETHOD(coordinate_map, get_index), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("coordinate_map"), _O("string serialize() const"), asMETHOD(coordinate_map, serialize), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("coordinate_map"), _O("bool deserialize(const string&in)"), asMETHOD(coordinate_map, deserialize), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("coordinate_map"), _O("void reset()"), asMETHOD(coordinate_map, reset), asCALL_THISCALL);
 }
@@ -19,9 +19,18 @@
 #include "bullet3.h"
 #include "pathfinder.h"
 #define total_frame_sizes 3
+// Number of areas a frame tests against a point at once, the packed fields of each frame are padded to a multiple of this.
+#define MAP_AREA_LANES 8
 
 class coordinate_map;
 
+// The spatial index a coordinate_map files its areas in. The grid registers each area in every fixed size frame its bounds cover, while the tree keeps one leaf per area in a dynamic bounding volume hierarchy that is cheap to update when areas move every tick.
+typedef enum { COORDINATE_MAP_INDEX_GRID, COORDINATE_MAP_INDEX_TREE } coordinate_map_index;
+
+typedef struct {
+	float minx, maxx, miny, maxy, minz, maxz;
+} map_bounds;
+
 class map_frame;
 class map_area {
 	int ref_count;
@@ -46,6 +55,12 @@ public:
 	bool framed;
 	bool tmp_adding_to_result;
 	std::vector<map_frame*> frames;
+	int tree_leaf; // This area's leaf in its map's tree, -1 if not in one.
+	// Rotation data cached by update_rotation whenever the area changes, so that queries need neither trigonometry nor allocations.
+	float rotation_cos;
+	float rotation_sin;
+	Vector3 polygon[4]; // The area as boxes_intersect sees it, for the separating axis test in is_in_area_range.
+	map_bounds rotated_bounds; // Every point is_in_area can accept with a distance of 0 once rotated.
 	map_area(coordinate_map* p, float minx, float max, float miny, float maxy, float minz, float maxz, float rotation, CScriptAny* primary_data, const std::string& data1, const std::string& data2, const std::string& data3, int priority, asINT64 flags);
 	void add_ref();
 	void release();
@@ -54,31 +69,126 @@ public:
 	void set(float minx, float maxx, float miny, float maxy, float minz, float maxz, float rotation);
 	void set_area(float minx, float maxx, float miny, float maxy, float minz, float maxz);
 	void set_rotation(float rotation);
+	asINT64 get_flags() const { return flags; }
+	void set_flags(asINT64 flags);
+	void update_rotation();
+	void get_bounds(map_bounds& bounds, float& reach) const;
+	// How much a query distance can widen the area along the world axes, as is_in_area applies it along the rotated ones.
+	float get_spread() const {
+		return rotation > 0 ? fabs(rotation_cos) + fabs(rotation_sin) : 1;
+	}
 	bool is_in_area(float x, float y, float z, float d = 0.0, asIScriptFunction* filter_callback = NULL, asINT64 required_flags = 0, asINT64 excluded_flags = 0);
 	bool is_in_area_range(float minx, float maxx, float miny, float maxy, float minz, float maxz, float d = 0.0, float r = 0.0, asIScriptFunction* filter_callback = NULL, asINT64 required_flags = 0, asINT64 excluded_flags = 0);
 };
+// Structure of arrays copy of the fields of a frame's areas that queries test, kept index for index with map_frame::areas so that most candidates can be rejected without dereferencing them.
+typedef struct {
+	std::vector<float> minx, maxx, miny, maxy, minz, maxz; // Exclusive maximums, and for rotated areas the bounds of every point the rotated area could contain.
+	std::vector<float> spread; // See map_area::get_spread.
+	std::vector<float> reach; // How much further a point may be from the x and y bounds and still be found when a query's distance is greater than 1, see map_area::is_in_area.
+	std::vector<int> priority;
+	std::vector<asINT64> flags;
+} map_area_lanes;
 class map_frame {
+	void pack_area(unsigned int i);
+	void pad();
 public:
 	std::vector<map_area*> areas;
+	map_area_lanes lanes;
 	int size;
+	void add_area(map_area* a);
+	void repack();
+	void remove_area(unsigned int i);
+	void update_flags(map_area* a);
 	int add_areas_for_point(std::vector<map_area*>& local_areas, float x, float y, float z, float d = 0.0, int p = -1, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0);
-	int add_areas_for_range(std::vector<map_area*>& local_areas, float minx, float maxx, float miny, float maxy, float minz, float maxz, float d = 0.0, int p = -1, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0);
+	int add_areas_for_range(std::vector<map_area*>& local_areas, float minx, float maxx, float miny, float maxy, float minz, float maxz, float d = 0.0, int p = -1, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0, ankerl::unordered_dense::set<map_area*>* seen = NULL);
 	void reset();
 };
+typedef struct {
+	map_bounds box; // For leaves this is the area's bounds grown by MAP_TREE_MARGIN, so that small moves leave the tree alone.
+	int parent; // Links the next free node for free nodes.
+	int left;
+	int right; // Both children are -1 for leaves.
+	int height; // 0 for leaves, -1 for free nodes.
+	map_area* area;
+} map_tree_node;
+// A dynamic bounding volume tree in the style of the one in Box2D, kept balanced with AVL rotations so that inserting, removing and moving an area are all O(log n).
+#define MAP_TREE_MARGIN 2.0f
+#define MAP_TREE_STACK 256
+class map_tree {
+	std::vector<map_tree_node> nodes;
+	int root;
+	int free_list;
+	int allocate_node();
+	void free_node(int node);
+	void insert_leaf(int leaf);
+	void remove_leaf(int leaf);
+	int balance(int node);
+	static bool overlaps(const map_bounds& a, const map_bounds& b) {
+		return a.minx <= b.maxx && b.minx <= a.maxx && a.miny <= b.maxy && b.miny <= a.maxy && a.minz <= b.maxz && b.minz <= a.maxz;
+	}
+public:
+	map_tree() : root(-1), free_list(-1) {}
+	int insert(map_area* area, const map_bounds& bounds);
+	void remove(int leaf);
+	bool move(int leaf, const map_bounds& bounds);
+	void clear();
+	int get_height() const {
+		return root < 0 ? 0 : nodes[root].height;
+	}
+	// Calls callback with the area of every leaf whose box overlaps bounds. The tree may not be modified until this returns.
+	template<class F> void query(const map_bounds& bounds, F callback) const {
+		if (root < 0) return;
+		int stack[MAP_TREE_STACK];
+		int top = 0;
+		stack[top++] = root;
+		while (top > 0) {
+			const map_tree_node& n = nodes[stack[--top]];
+			if (!overlaps(n.box, bounds)) continue;
+			if (n.left < 0) callback(n.area);
+			else if (top + 2 <= MAP_TREE_STACK) {
+				stack[top++] = n.left;
+				stack[top++] = n.right;
+			}
+		}
+	}
+};
+// One query of a batched coordinate_map lookup, point queries have equal minimum and maximum coordinates.
+typedef struct {
+	float minx, maxx, miny, maxy, minz, maxz;
+	int cx, cy, cz; // The smallest frame containing the query's minimum corner, queries are sorted by this so that neighbouring point queries can share frame lookups.
+	unsigned int index; // Position of the query in the caller's input.
+	unsigned int start; // First result of this query within the results of the chunk that ran it.
+	unsigned int count;
+} map_query;
 class coordinate_map {
 	ankerl::unordered_dense::map<hashpoint, map_frame*, hashpoint_hash, hashpoint_equals> frames[total_frame_sizes];
 	int ref_count;
 public:
-	coordinate_map() : ref_count(1) {}
+	map_tree* tree; // NULL unless the map uses COORDINATE_MAP_INDEX_TREE.
+	coordinate_map(coordinate_map_index index = COORDINATE_MAP_INDEX_GRID) : ref_count(1), tree(index == COORDINATE_MAP_INDEX_TREE ? new map_tree() : NULL) {}
+	~coordinate_map() {
+		delete tree;
+	}
+	coordinate_map_index get_index() const {
+		return tree ? COORDINATE_MAP_INDEX_TREE : COORDINATE_MAP_INDEX_GRID;
+	}
 	void add_ref();
 	void release();
 	Vector3 get_frame_coordinates(int x, int y, int z, int size);
 	map_frame* get_frame(int x, int y, int z, int size, bool create = true);
 	map_area* add_area(float minx, float maxx, float miny, float maxy, float minz, float maxz, float rotation, CScriptAny* primary_data, const std::string& data1, const std::string& data2, const std::string& data3, int priority, asINT64 flags = 0);
+	void find_areas(float minx, float maxx, float miny, float maxy, float minz, float maxz, float d, std::vector<map_area*>& local_areas, bool priority_check = true, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0, map_frame* const* point_frames = NULL, ankerl::unordered_dense::set<map_area*>* seen = NULL);
 	void get_areas(float minx, float maxx, float miny, float maxy, float minz, float maxz, float d, std::vector<map_area*>& local_areas, bool priority_check = true, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0);
+	void run_queries(map_query* queries, unsigned int count, std::vector<map_area*>& results, float d, bool single, int max_priority, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags);
+	unsigned int query_batch(CScriptArray* coordinates, bool range, CScriptArray* results, CScriptArray* offsets, bool single, int max_priority, float d, asIScriptFunction* filter_callback, asINT64 flags, asINT64 excluded_flags);
+	unsigned int get_areas_batch(CScriptArray* points, CScriptArray* results, CScriptArray* offsets, float d = 0.0, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0);
+	unsigned int get_areas_in_range_batch(CScriptArray* boxes, CScriptArray* results, CScriptArray* offsets, float d = 0.0, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0);
+	unsigned int get_area_batch(CScriptArray* points, CScriptArray* results, int max_priority = -1, float d = 0.0, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0);
 	CScriptArray* get_areas_script(float x, float y, float z, float d = 0.0, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0);
 	CScriptArray* get_areas_in_range_script(float minx, float maxx, float miny, float maxy, float minz, float maxz, float d = 0.0, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0);
 	map_area* get_area(float x, float y, float z, int max_priority = -1, float d = 0.0, asIScriptFunction* filter_callback = NULL, asINT64 flags = 0, asINT64 excluded_flags = 0);
+	std::string serialize();
+	bool deserialize(const std::string& data);
 	void reset();
 };
 
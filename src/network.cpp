@@ -16,12 +16,19 @@
 bool g_enet_initialized = false;
 network_event g_enet_none_event; // The none event is static and never changes, why reallocate it every time network::request() doesn't come up with an event?
 ENetPeer* network::get_peer(asQWORD peer_id) {
+	Poco::ScopedReadRWLock lock(peers_lock);
 	std::unordered_map<asQWORD, ENetPeer*>::iterator i = peers.find(peer_id);
 	if (i == peers.end())
 		return NULL;
 	return i->second;
 }
 
+// Peers that are still connecting on the service thread are known but have no ENetPeer yet.
+bool network::has_peer(asQWORD peer_id) {
+	Poco::ScopedReadRWLock lock(peers_lock);
+	return peers.find(peer_id) != peers.end();
+}
+
 network::network() {
 	if (!g_enet_initialized) {
 		enet_initialize();
@@ -32,6 +39,10 @@ network::network() {
 	channel_count = 0;
 	is_client = false;
 	RefCount = 1;
+	threaded = false;
+	poll_interval = 1;
+	incoming = NULL;
+	batch = NULL;
 	reset_totals();
 }
 void network::addRef() {
@@ -40,17 +51,35 @@ void network::addRef() {
 void network::release() {
 	if (asAtomicDec(RefCount) < 1) {
 		destroy();
+		delete incoming;
+		if (batch) batch->Release();
+		for (network_event* e : event_pool)
+			e->release();
 		delete this;
 	}
 }
 
 void network::destroy(bool flush) {
+	stop_thread();
+	network_event_slot slot;
+	while (incoming && incoming->pop(slot)) {
+		if (slot.packet) enet_packet_destroy(slot.packet);
+	}
+	for (network_event_slot& s : backlog) {
+		if (s.packet) enet_packet_destroy(s.packet);
+	}
+	backlog.clear();
 	if (host) {
 		if (flush) enet_host_flush(host);
 		enet_host_destroy(host);
 		host = NULL;
 	}
 	peers.clear();
+	{
+		Poco::FastMutex::ScopedLock lock(groups_mutex);
+		for (std::pair<const std::string, std::unordered_set<asQWORD>>& g : groups)
+			g.second.clear();
+	}
 	next_peer = 1;
 	channel_count = 0;
 	is_client = false;
@@ -93,53 +122,227 @@ asQWORD network::connect(const std::string& hostname, unsigned short port) {
 	ENetAddress addr;
 	if (enet_address_set_host(&addr, hostname.c_str()) < 0) return false;
 	addr.port = port;
+	asQWORD id = next_peer++;
+	if (threaded) {
+		// The id is reserved now so that sends to it queue up behind the connection, a failed connection then reports a disconnect for it.
+		{
+			Poco::ScopedWriteRWLock lock(peers_lock);
+			peers[id] = NULL;
+		}
+		network_command c = {NETWORK_COMMAND_CONNECT, id, NULL, 0, addr};
+		commands.push(c);
+		return id;
+	}
 	ENetPeer* svr = enet_host_connect(host, &addr, channel_count, 0);
 	if (!svr) return 0;
-	peers[next_peer] = svr;
-	svr->data = reinterpret_cast<void*>(next_peer);
-	next_peer += 1;
-	return next_peer - 1;
+	peers[id] = svr;
+	svr->data = reinterpret_cast<void*>(id);
+	return id;
 }
 
-network_event* network::request(uint32_t timeout) {
-	if (!host) {
-		g_enet_none_event.addRef();
-			return &g_enet_none_event;
-		}
-	ENetEvent event;
-	int r = enet_host_service(host, &event, timeout);
-	if (r < 1) {
-		g_enet_none_event.addRef();
-			return &g_enet_none_event;
-		}
-	update_totals(); // total_sent, total_received...
-	network_event* e = new network_event();
-	e->type = event.type;
-	e->channel = event.channelID;
+// Keeps the peer map in step with an event from enet_host_service and fills in what request needs to report it, taking ownership of any received packet. Returns false for events that shouldn't be reported.
+bool network::convert_event(ENetEvent& event, network_event_slot& slot) {
+	slot.type = event.type;
+	slot.channel = event.channelID;
+	slot.peer_id = 0;
+	slot.packet = NULL;
 	if (event.type == ENET_EVENT_TYPE_CONNECT) {
 		enet_peer_timeout(event.peer, 128, 10000, 35000);
 		if (!is_client) {
-			event.peer->data = reinterpret_cast<void*>(next_peer);
-			peers[next_peer] = event.peer;
-			e->peer_id = next_peer;
-			next_peer++;
+			asQWORD id = next_peer++;
+			event.peer->data = reinterpret_cast<void*>(id);
+			Poco::ScopedWriteRWLock lock(peers_lock);
+			peers[id] = event.peer;
+			slot.peer_id = id;
 		} else
-			e->peer_id = (asQWORD)event.peer->data;
+			slot.peer_id = (asQWORD)event.peer->data;
 	} else if (event.type == ENET_EVENT_TYPE_DISCONNECT) {
 		asQWORD peer_id = (asQWORD)event.peer->data;
 		event.peer->data = NULL;
-		if (peer_id > 0)
+		if (peer_id > 0) {
+			Poco::ScopedWriteRWLock lock(peers_lock);
 			peers.erase(peer_id);
-		e->peer_id = peer_id;
+		}
+		slot.peer_id = peer_id;
 	} else if (event.type == ENET_EVENT_TYPE_RECEIVE) {
-		e->peer_id = (asQWORD)event.peer->data;
-		e->message.append((char*)event.packet->data, event.packet->dataLength);
-		enet_packet_destroy(event.packet);
+		slot.peer_id = (asQWORD)event.peer->data;
+		slot.packet = event.packet;
+	} else
+		return false;
+	return true;
+}
+void network::fill_event(network_event_slot& slot, network_event* e) {
+	e->type = slot.type;
+	e->channel = slot.channel;
+	e->peer_id = slot.peer_id;
+	if (slot.packet) {
+		e->message.assign((char*)slot.packet->data, slot.packet->dataLength);
+		enet_packet_destroy(slot.packet);
+	} else
+		e->message.clear();
+}
+network_event* network::make_event(network_event_slot& slot) {
+	network_event* e;
+	if (event_pool.empty()) e = new network_event();
+	else {
+		e = event_pool.back();
+		event_pool.pop_back();
 	}
+	fill_event(slot, e);
 	return e;
 }
+// Fetches the next event for request or request_batch. Only the first fetch of a call may wait or read from the socket, later ones just drain events that enet has already queued.
+bool network::next_slot(network_event_slot& slot, uint32_t timeout, bool first) {
+	// Events left over from a service thread that has since stopped are still delivered first.
+	if (incoming && incoming->pop(slot)) return true;
+	if (threaded) {
+		if (!first) return false;
+		// incoming_ready stays set after a drain that never waited on it, so a wakeup only counts once it yields an event.
+		enet_uint32 start = enet_time_get();
+		for (uint32_t elapsed = 0; elapsed < timeout; elapsed = enet_time_get() - start) {
+			if (incoming_ready.tryWait(timeout - elapsed) && incoming->pop(slot)) return true;
+		}
+		return false;
+	}
+	if (!backlog.empty()) {
+		slot = backlog.front();
+		backlog.pop_front();
+		return true;
+	}
+	if (!host) return false;
+	ENetEvent event;
+	while ((first ? enet_host_service(host, &event, timeout) : enet_host_check_events(host, &event)) > 0) {
+		if (convert_event(event, slot)) return true;
+		first = false;
+	}
+	return false;
+}
+network_event* network::request(uint32_t timeout) {
+	network_event_slot slot;
+	if (!next_slot(slot, timeout, true)) {
+		g_enet_none_event.addRef();
+		return &g_enet_none_event;
+	}
+	if (!threaded) update_totals(); // total_sent, total_received...
+	return make_event(slot);
+}
+// Receives up to max events (0 for no limit) in one call, waiting up to timeout milliseconds only if none are ready. events is resized to the number received. Events in it that the script holds no other handle to are refilled in place or kept for later calls rather than freed, so a server draining thousands of events a second reuses the same objects and message buffers.
+unsigned int network::request_batch(CScriptArray* events, unsigned int max, uint32_t timeout) {
+	if (!events) return 0;
+	unsigned int count = 0;
+	network_event_slot slot;
+	while ((max == 0 || count < max) && next_slot(slot, timeout, count == 0)) {
+		if (count >= events->GetSize()) {
+			events->Reserve(count < 16 ? 16 : count * 2);
+			events->Resize(count + 1);
+		}
+		network_event** e = (network_event**)events->At(count);
+		if (*e && ((*e)->RefCount > 1 || *e == &g_enet_none_event)) {
+			(*e)->release();
+			*e = NULL;
+		}
+		if (*e) fill_event(slot, *e);
+		else *e = make_event(slot);
+		count++;
+	}
+	for (asUINT i = count; i < events->GetSize(); i++) {
+		network_event** e = (network_event**)events->At(i);
+		if (!*e || (*e)->RefCount > 1 || *e == &g_enet_none_event) continue;
+		event_pool.push_back(*e);
+		*e = NULL;
+	}
+	events->Resize(count);
+	if (!threaded) update_totals();
+	return count;
+}
+// The same, filling an array owned by the network that is reused by the next call.
+CScriptArray* network::request_batch(unsigned int max, uint32_t timeout) {
+	if (!batch) {
+		asIScriptContext* ctx = asGetActiveContext();
+		batch = CScriptArray::Create(ctx->GetEngine()->GetTypeInfoByDecl("network_event@[]"));
+	}
+	request_batch(batch, max, timeout);
+	batch->AddRef();
+	return batch;
+}
+
+// Moves all servicing of the host onto a background thread, so that acknowledgements, resends and pings keep flowing however long the script takes between calls to request. Incoming events wait in a queue for request, while sends and disconnections are queued for the thread, which waits at most poll_interval milliseconds for network traffic before handling them. While it runs, sends report that they were queued rather than that enet accepted them.
+bool network::start_thread(unsigned int poll_interval) {
+	if (!host || threaded) return false;
+	this->poll_interval = poll_interval > 0 ? poll_interval : 1;
+	if (!incoming) incoming = new spsc_ring<network_event_slot, NETWORK_EVENT_RING_SIZE>();
+	threaded = true;
+	service_thread.start(*this);
+	return true;
+}
+// Stops the background thread once it has passed on everything queued for it, returning the host to being serviced by request.
+void network::stop_thread() {
+	if (!threaded) return;
+	threaded = false;
+	service_thread.join();
+	network_command c;
+	while (commands.pop(c))
+		apply(c);
+}
+void network::run() {
+	while (threaded) {
+		bool received = false;
+		{
+			Poco::FastMutex::ScopedLock lock(host_mutex);
+			network_command c;
+			while (commands.pop(c))
+				apply(c);
+			ENetEvent event;
+			network_event_slot slot;
+			while (enet_host_service(host, &event, 0) > 0) {
+				if (!convert_event(event, slot)) continue;
+				backlog.push_back(slot);
+			}
+			while (!backlog.empty() && incoming->push(backlog.front())) {
+				backlog.pop_front();
+				received = true;
+			}
+		}
+		if (received) incoming_ready.set();
+		enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE | ENET_SOCKET_WAIT_INTERRUPT;
+		enet_socket_wait(host->socket, &condition, poll_interval);
+	}
+}
+// Carries out a queued command on the service thread, or on the script thread once the service thread has stopped.
+void network::apply(network_command& c) {
+	if (c.type == NETWORK_COMMAND_SEND) {
+		ENetPeer* peer = c.peer ? get_peer(c.peer) : NULL;
+		if (!c.peer) enet_host_broadcast(host, c.channel, c.packet);
+		else if (!peer || enet_peer_send(peer, c.channel, c.packet) != 0) enet_packet_destroy(c.packet);
+	} else if (c.type == NETWORK_COMMAND_SEND_PEER) {
+		if (enet_peer_send(reinterpret_cast<ENetPeer*>(c.peer), c.channel, c.packet) != 0) enet_packet_destroy(c.packet);
+	} else if (c.type == NETWORK_COMMAND_SEND_GROUP) {
+		send_shared(c.packet, c.recipients->data(), c.recipients->size(), c.channel);
+		delete c.recipients;
+	} else if (c.type == NETWORK_COMMAND_CONNECT) {
+		ENetPeer* peer = enet_host_connect(host, &c.address, channel_count, 0);
+		Poco::ScopedWriteRWLock lock(peers_lock);
+		if (peer) {
+			peers[c.peer] = peer;
+			peer->data = reinterpret_cast<void*>(c.peer);
+			return;
+		}
+		peers.erase(c.peer);
+		network_event_slot slot = {ENET_EVENT_TYPE_DISCONNECT, c.peer, 0, NULL};
+		backlog.push_back(slot);
+	} else {
+		ENetPeer* peer = get_peer(c.peer);
+		if (!peer) return;
+		if (c.type == NETWORK_COMMAND_DISCONNECT_SOFTLY) enet_peer_disconnect_later(peer, 0);
+		else if (c.type == NETWORK_COMMAND_DISCONNECT) enet_peer_disconnect(peer, 0);
+		else enet_peer_disconnect_now(peer, 0);
+		Poco::ScopedWriteRWLock lock(peers_lock);
+		peers.erase(c.peer);
+	}
+}
 
 std::string network::get_peer_address(asQWORD peer_id) {
+	Poco::FastMutex::ScopedLock lock(host_mutex);
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return "";
 	std::string tmp(32, '\0');
@@ -148,6 +351,7 @@ std::string network::get_peer_address(asQWORD peer_id) {
 	return tmp;
 }
 unsigned int network::get_peer_average_round_trip_time(asQWORD peer_id) {
+	Poco::FastMutex::ScopedLock lock(host_mutex);
 	if (!host) return -1;
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return -1;
@@ -156,15 +360,36 @@ unsigned int network::get_peer_average_round_trip_time(asQWORD peer_id) {
 
 bool network::send(asQWORD peer_id, const std::string& message, unsigned char channel, bool reliable) {
 	if (!host || channel > channel_count) return false;
-	ENetPeer* peer = get_peer(peer_id);
-	if (peer_id && !peer) return false;
+	if (peer_id && !has_peer(peer_id)) return false;
 	ENetPacket* packet = enet_packet_create(message.c_str(), message.size(), (reliable ? ENET_PACKET_FLAG_RELIABLE : 0));
 	if (!packet) return false;
-	bool r = true;
-	if (peer_id) r = enet_peer_send(peer, channel, packet) == 0;
-	else enet_host_broadcast(host, channel, packet);
-	if (!r) enet_packet_destroy(packet);
-	return r;
+	return deliver(peer_id, packet, channel);
+}
+// Sends the writer's buffer without copying it, leaving the writer empty whether or not the send succeeds.
+bool network::send(asQWORD peer_id, packet_writer* writer, unsigned char channel, bool reliable) {
+	if (!host || channel > channel_count || (peer_id && !has_peer(peer_id))) {
+		writer->reset();
+		return false;
+	}
+	ENetPacket* packet = writer->detach(reliable);
+	if (!packet) return false;
+	return deliver(peer_id, packet, channel);
+}
+// Sends a packet to one peer or broadcasts it if peer_id is 0, taking ownership of it.
+bool network::deliver(asQWORD peer_id, ENetPacket* packet, unsigned char channel) {
+	if (threaded) {
+		network_command c = {NETWORK_COMMAND_SEND, peer_id, packet, channel};
+		commands.push(c);
+		return true;
+	}
+	if (!peer_id) {
+		enet_host_broadcast(host, channel, packet);
+		return true;
+	}
+	ENetPeer* peer = get_peer(peer_id);
+	if (peer && enet_peer_send(peer, channel, packet) == 0) return true;
+	enet_packet_destroy(packet);
+	return false;
 }
 bool network::send_peer(asQWORD peer, const std::string& message, unsigned char channel, bool reliable) {
 	if (!host || channel > channel_count) return false;
@@ -172,13 +397,137 @@ bool network::send_peer(asQWORD peer, const std::string& message, unsigned char
 	if (!peer_obj) return false;
 	ENetPacket* packet = enet_packet_create(message.c_str(), message.size(), (reliable ? ENET_PACKET_FLAG_RELIABLE : 0));
 	if (!packet) return false;
+	if (threaded) {
+		network_command c = {NETWORK_COMMAND_SEND_PEER, peer, packet, channel};
+		commands.push(c);
+		return true;
+	}
 	bool r = enet_peer_send(peer_obj, channel, packet) == 0;
 	if (!r) enet_packet_destroy(packet);
 	return r;
 }
 
+// Queues one packet for several peers. Enet counts each peer's reference to it, so it is allocated and copied once however many peers it goes to, and it is freed here only if no peer took it.
+unsigned int network::send_shared(ENetPacket* packet, const asQWORD* recipients, size_t count, unsigned char channel) {
+	unsigned int sent = 0;
+	for (size_t i = 0; i < count; i++) {
+		ENetPeer* peer = get_peer(recipients[i]);
+		if (peer && enet_peer_send(peer, channel, packet) == 0) sent++;
+	}
+	if (packet->referenceCount == 0) enet_packet_destroy(packet);
+	return sent;
+}
+// Takes ownership of packet, and of the contents of recipients when threaded. Returns the number of peers the packet was queued for. Without a service thread that is enet's own count; with one it is the number of connected recipients handed to the thread, as peers that leave before the thread gets to the send can't be taken back out of a count already returned.
+unsigned int network::send_multiple(std::vector<asQWORD>& recipients, ENetPacket* packet, unsigned char channel) {
+	if (!packet) return 0;
+	if (!host || channel > channel_count || recipients.empty()) {
+		enet_packet_destroy(packet);
+		return 0;
+	}
+	if (threaded) {
+		unsigned int count = recipients.size();
+		network_command c = {NETWORK_COMMAND_SEND_GROUP, 0, packet, channel};
+		c.recipients = new std::vector<asQWORD>(std::move(recipients));
+		commands.push(c);
+		return count;
+	}
+	return send_shared(packet, recipients.data(), recipients.size(), channel);
+}
+void network::listed_peers(CScriptArray* peer_ids, std::vector<asQWORD>& recipients) {
+	recipients.reserve(peer_ids->GetSize());
+	for (asUINT i = 0; i < peer_ids->GetSize(); i++) {
+		asQWORD id = *(asQWORD*)peer_ids->At(i);
+		if (has_peer(id)) recipients.push_back(id);
+	}
+}
+// Sends one message to every listed peer that is connected, returning how many it was queued for (see send_multiple).
+unsigned int network::send_peers(CScriptArray* peer_ids, const std::string& message, unsigned char channel, bool reliable) {
+	std::vector<asQWORD> recipients;
+	listed_peers(peer_ids, recipients);
+	if (recipients.empty()) return 0;
+	return send_multiple(recipients, enet_packet_create(message.c_str(), message.size(), (reliable ? ENET_PACKET_FLAG_RELIABLE : 0)), channel);
+}
+unsigned int network::send_peers(CScriptArray* peer_ids, packet_writer* writer, unsigned char channel, bool reliable) {
+	std::vector<asQWORD> recipients;
+	listed_peers(peer_ids, recipients);
+	return send_multiple(recipients, writer->detach(reliable), channel);
+}
+
+bool network::create_group(const std::string& name) {
+	Poco::FastMutex::ScopedLock lock(groups_mutex);
+	return groups.emplace(name, std::unordered_set<asQWORD>()).second;
+}
+bool network::destroy_group(const std::string& name) {
+	Poco::FastMutex::ScopedLock lock(groups_mutex);
+	return groups.erase(name) > 0;
+}
+bool network::add_to_group(const std::string& name, asQWORD peer_id) {
+	if (!has_peer(peer_id)) return false;
+	Poco::FastMutex::ScopedLock lock(groups_mutex);
+	std::unordered_map<std::string, std::unordered_set<asQWORD>>::iterator g = groups.find(name);
+	if (g == groups.end()) return false;
+	return g->second.insert(peer_id).second;
+}
+bool network::remove_from_group(const std::string& name, asQWORD peer_id) {
+	Poco::FastMutex::ScopedLock lock(groups_mutex);
+	std::unordered_map<std::string, std::unordered_set<asQWORD>>::iterator g = groups.find(name);
+	if (g == groups.end()) return false;
+	return g->second.erase(peer_id) > 0;
+}
+bool network::is_in_group(const std::string& name, asQWORD peer_id) {
+	Poco::FastMutex::ScopedLock lock(groups_mutex);
+	std::unordered_map<std::string, std::unordered_set<asQWORD>>::iterator g = groups.find(name);
+	return g != groups.end() && g->second.count(peer_id) > 0 && has_peer(peer_id);
+}
+CScriptArray* network::list_group(const std::string& name) {
+	asIScriptContext* ctx = asGetActiveContext();
+	asIScriptEngine* engine = ctx->GetEngine();
+	asITypeInfo* arrayType = engine->GetTypeInfoByDecl("uint64[]");
+	CScriptArray* array = CScriptArray::Create(arrayType);
+	Poco::FastMutex::ScopedLock lock(groups_mutex);
+	std::unordered_map<std::string, std::unordered_set<asQWORD>>::iterator g = groups.find(name);
+	if (g == groups.end()) return array;
+	array->Reserve(g->second.size());
+	for (asQWORD peer : g->second) {
+		if (has_peer(peer)) array->InsertLast(&peer);
+	}
+	return array;
+}
+// Collects the ids of a group's connected members, dropping those that have gone away.
+void network::group_members(const std::string& name, std::vector<asQWORD>& recipients) {
+	Poco::FastMutex::ScopedLock lock(groups_mutex);
+	std::unordered_map<std::string, std::unordered_set<asQWORD>>::iterator g = groups.find(name);
+	if (g == groups.end()) return;
+	recipients.reserve(g->second.size());
+	for (std::unordered_set<asQWORD>::iterator it = g->second.begin(); it != g->second.end();) {
+		if (!has_peer(*it)) {
+			it = g->second.erase(it);
+			continue;
+		}
+		recipients.push_back(*it++);
+	}
+}
+// Sends one message to every member of a group in a single packet, returning how many peers it was queued for (see send_multiple).
+unsigned int network::send_group(const std::string& name, const std::string& message, unsigned char channel, bool reliable) {
+	std::vector<asQWORD> recipients;
+	group_members(name, recipients);
+	if (recipients.empty()) return 0;
+	return send_multiple(recipients, enet_packet_create(message.c_str(), message.size(), (reliable ? ENET_PACKET_FLAG_RELIABLE : 0)), channel);
+}
+unsigned int network::send_group(const std::string& name, packet_writer* writer, unsigned char channel, bool reliable) {
+	std::vector<asQWORD> recipients;
+	group_members(name, recipients);
+	return send_multiple(recipients, writer->detach(reliable), channel);
+}
+
 bool network::disconnect_peer_softly(asQWORD peer_id) {
 	if (!host) return false;
+	if (threaded) {
+		if (!has_peer(peer_id)) return false;
+		network_command c = {NETWORK_COMMAND_DISCONNECT_SOFTLY, peer_id};
+		commands.push(c);
+		return true;
+	}
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return false;
 	enet_peer_disconnect_later(peer, 0);
@@ -187,6 +536,12 @@ bool network::disconnect_peer_softly(asQWORD peer_id) {
 }
 bool network::disconnect_peer(asQWORD peer_id) {
 	if (!host) return false;
+	if (threaded) {
+		if (!has_peer(peer_id)) return false;
+		network_command c = {NETWORK_COMMAND_DISCONNECT, peer_id};
+		commands.push(c);
+		return true;
+	}
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return false;
 	enet_peer_disconnect(peer, 0);
@@ -195,6 +550,12 @@ bool network::disconnect_peer(asQWORD peer_id) {
 }
 bool network::disconnect_peer_forcefully(asQWORD peer_id) {
 	if (!host) return false;
+	if (threaded) {
+		if (!has_peer(peer_id)) return false;
+		network_command c = {NETWORK_COMMAND_DISCONNECT_FORCEFULLY, peer_id};
+		commands.push(c);
+		return true;
+	}
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return false;
 	enet_peer_disconnect_now(peer, 0);
@@ -208,6 +569,7 @@ CScriptArray* network::list_peers() {
 	asITypeInfo* arrayType = engine->GetTypeInfoByDecl("uint64[]");
 	CScriptArray* array = CScriptArray::Create(arrayType);
 	if (!host) return array;
+	Poco::ScopedReadRWLock lock(peers_lock);
 	array->Reserve(peers.size());
 	for (std::unordered_map<asQWORD, ENetPeer*>::iterator it = peers.begin(); it != peers.end(); it++) {
 		asQWORD peer = it->first;
@@ -217,11 +579,13 @@ CScriptArray* network::list_peers() {
 }
 
 bool network::set_bandwidth_limits(unsigned int incoming, unsigned int outgoing) {
+	Poco::FastMutex::ScopedLock lock(host_mutex);
 	if (!host) return false;
 	enet_host_bandwidth_limit(host, incoming, outgoing);
 	return true;
 }
 void network::set_packet_compression(bool flag) {
+	Poco::FastMutex::ScopedLock lock(host_mutex);
 	if (!host) return;
 	if (flag) enet_host_compress_with_range_coder(host);
 	else enet_host_compress(host, nullptr);
@@ -250,6 +614,227 @@ network_event& network_event::operator=(const network_event& e) {
 	return *this;
 }
 
+// Pooled buffers are powers of 2 in size from 64 bytes to 1mb, and each is preceded by its capacity so that it can be returned to the right pool from enet's free callback.
+#define PACKET_BUFFER_MIN_SHIFT 6
+#define PACKET_BUFFER_MAX_SHIFT 20
+#define PACKET_BUFFER_POOL_BYTES (16 * 1024 * 1024) // Total capacity of the free buffers kept across every size.
+#define PACKET_BUFFER_HEADER 16
+std::vector<unsigned char*> g_packet_buffers[PACKET_BUFFER_MAX_SHIFT - PACKET_BUFFER_MIN_SHIFT + 1];
+size_t g_packet_buffers_bytes = 0;
+Poco::FastMutex g_packet_buffers_mutex;
+unsigned char* packet_buffer_alloc(size_t size, size_t& capacity) {
+	unsigned int shift = PACKET_BUFFER_MIN_SHIFT;
+	while (shift < PACKET_BUFFER_MAX_SHIFT && (size_t(1) << shift) < size) shift++;
+	capacity = size > (size_t(1) << shift) ? size : size_t(1) << shift;
+	if (capacity == size_t(1) << shift) {
+		Poco::FastMutex::ScopedLock lock(g_packet_buffers_mutex);
+		std::vector<unsigned char*>& pool = g_packet_buffers[shift - PACKET_BUFFER_MIN_SHIFT];
+		if (!pool.empty()) {
+			unsigned char* buffer = pool.back();
+			pool.pop_back();
+			g_packet_buffers_bytes -= capacity;
+			return buffer;
+		}
+	}
+	unsigned char* block = (unsigned char*)malloc(PACKET_BUFFER_HEADER + capacity);
+	if (!block) return NULL;
+	*(size_t*)block = capacity;
+	return block + PACKET_BUFFER_HEADER;
+}
+void packet_buffer_free(unsigned char* buffer) {
+	if (!buffer) return;
+	unsigned char* block = buffer - PACKET_BUFFER_HEADER;
+	size_t capacity = *(size_t*)block;
+	for (unsigned int shift = PACKET_BUFFER_MIN_SHIFT; shift <= PACKET_BUFFER_MAX_SHIFT; shift++) {
+		if (capacity != size_t(1) << shift) continue;
+		Poco::FastMutex::ScopedLock lock(g_packet_buffers_mutex);
+		std::vector<unsigned char*>& pool = g_packet_buffers[shift - PACKET_BUFFER_MIN_SHIFT];
+		if (g_packet_buffers_bytes + capacity > PACKET_BUFFER_POOL_BYTES) break;
+		pool.push_back(buffer);
+		g_packet_buffers_bytes += capacity;
+		return;
+	}
+	free(block);
+}
+void packet_buffer_release(ENetPacket* packet) {
+	packet_buffer_free(packet->data);
+}
+
+packet_writer::packet_writer() {
+	data = NULL;
+	size = capacity = 0;
+	bit_pos = 0;
+	RefCount = 1;
+}
+packet_writer::~packet_writer() {
+	packet_buffer_free(data);
+}
+void packet_writer::addRef() {
+	asAtomicInc(RefCount);
+}
+void packet_writer::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+void packet_writer::grow(size_t needed) {
+	size_t new_capacity;
+	unsigned char* buffer = packet_buffer_alloc(needed > capacity * 2 ? needed : capacity * 2, new_capacity);
+	if (!buffer) throw std::bad_alloc();
+	if (size) memcpy(buffer, data, size);
+	packet_buffer_free(data);
+	data = buffer;
+	capacity = new_capacity;
+}
+void packet_writer::write_bits(asQWORD value, unsigned int count) {
+	if (count > 64) count = 64;
+	while (count > 0) {
+		if (bit_pos == 0) {
+			if (size >= capacity) grow(size + 1);
+			data[size++] = 0;
+		}
+		unsigned int n = 8 - bit_pos < count ? 8 - bit_pos : count;
+		data[size - 1] |= (value & ((1 << n) - 1)) << bit_pos;
+		value >>= n;
+		count -= n;
+		bit_pos = (bit_pos + n) & 7;
+	}
+}
+// LEB128, 7 bits to a byte with the high bit set on all but the last.
+void packet_writer::write_varint(asQWORD value) {
+	unsigned char bytes[10];
+	unsigned int count = 0;
+	do {
+		bytes[count] = value & 0x7f;
+		value >>= 7;
+		if (value) bytes[count] |= 0x80;
+		count++;
+	} while (value);
+	memcpy(append(count), bytes, count);
+}
+// Stores value as one of 2^bits evenly spaced steps between min and max, clamping it to that range.
+void packet_writer::write_quantized(float value, float min, float max, unsigned int bits) {
+	if (bits < 1) bits = 1;
+	else if (bits > 32) bits = 32;
+	asQWORD steps = (asQWORD(1) << bits) - 1;
+	double t = max > min ? (double(value) - min) / (double(max) - min) : 0;
+	if (!(t > 0)) t = 0;
+	else if (t > 1) t = 1;
+	write_bits(asQWORD(t * steps + 0.5), bits);
+}
+// Strings are prefixed with their length as a varint.
+void packet_writer::write_string(const std::string& value) {
+	write_varint(value.size());
+	write_bytes(value);
+}
+void packet_writer::write_bytes(const std::string& value) {
+	if (value.empty()) return;
+	memcpy(append(value.size()), value.data(), value.size());
+}
+// Wraps the buffer in an enet packet that frees it back to the pool, leaving the writer empty.
+ENetPacket* packet_writer::detach(bool reliable) {
+	if (!data) grow(1);
+	ENetPacket* packet = enet_packet_create(data, size, ENET_PACKET_FLAG_NO_ALLOCATE | (reliable ? ENET_PACKET_FLAG_RELIABLE : 0));
+	if (!packet) {
+		reset();
+		return NULL;
+	}
+	packet->freeCallback = packet_buffer_release;
+	data = NULL;
+	size = capacity = 0;
+	bit_pos = 0;
+	return packet;
+}
+
+packet_reader::packet_reader() {
+	event = NULL;
+	source = &owned;
+	pos = 0;
+	bit_pos = 0;
+	error = false;
+	RefCount = 1;
+}
+packet_reader::~packet_reader() {
+	if (event) event->release();
+}
+void packet_reader::addRef() {
+	asAtomicInc(RefCount);
+}
+void packet_reader::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+// Takes over the caller's reference to e.
+void packet_reader::set_event(network_event* e) {
+	if (event) event->release();
+	event = e;
+	owned.clear();
+	source = e ? &e->message : &owned;
+	pos = 0;
+	bit_pos = 0;
+	error = false;
+}
+void packet_reader::set_string(const std::string& data) {
+	if (event) event->release();
+	event = NULL;
+	owned = data;
+	source = &owned;
+	pos = 0;
+	bit_pos = 0;
+	error = false;
+}
+asQWORD packet_reader::read_bits(unsigned int count) {
+	if (count > 64) count = 64;
+	const unsigned char* bytes = (const unsigned char*)source->data();
+	asQWORD value = 0;
+	unsigned int shift = 0;
+	while (count > 0) {
+		if (pos >= source->size()) {
+			error = true;
+			return 0;
+		}
+		unsigned int n = 8 - bit_pos < count ? 8 - bit_pos : count;
+		value |= asQWORD((bytes[pos] >> bit_pos) & ((1 << n) - 1)) << shift;
+		shift += n;
+		count -= n;
+		bit_pos += n;
+		if (bit_pos == 8) {
+			pos++;
+			bit_pos = 0;
+		}
+	}
+	return value;
+}
+asQWORD packet_reader::read_varint() {
+	asQWORD value = 0;
+	for (unsigned int shift = 0; shift < 70; shift += 7) {
+		const unsigned char* in = consume(1);
+		if (!in) return 0;
+		value |= asQWORD(*in & 0x7f) << shift;
+		if (!(*in & 0x80)) return value;
+	}
+	error = true;
+	return 0;
+}
+float packet_reader::read_quantized(float min, float max, unsigned int bits) {
+	if (bits < 1) bits = 1;
+	else if (bits > 32) bits = 32;
+	asQWORD steps = (asQWORD(1) << bits) - 1;
+	return float(min + (double(max) - min) * read_bits(bits) / steps);
+}
+std::string packet_reader::read_string() {
+	asQWORD size = read_varint();
+	if (error || size > available()) {
+		pos = source->size();
+		error = true;
+		return "";
+	}
+	return read_bytes(size);
+}
+std::string packet_reader::read_bytes(unsigned int size) {
+	const unsigned char* in = consume(size);
+	return in ? std::string((const char*)in, size) : "";
+}
+
 
 int EVENT_NONE = ENET_EVENT_TYPE_NONE, EVENT_CONNECT = ENET_EVENT_TYPE_CONNECT, EVENT_DISCONNECT = ENET_EVENT_TYPE_DISCONNECT, EVENT_RECEIVE = ENET_EVENT_TYPE_RECEIVE;
 
@@ -259,6 +844,22 @@ network* ScriptNetwork_Factory() {
 network_event* ScriptNetwork_event_Factory() {
 	return new network_event();
 }
+packet_writer* ScriptPacket_writer_Factory() {
+	return new packet_writer();
+}
+packet_reader* ScriptPacket_reader_Factory() {
+	return new packet_reader();
+}
+packet_reader* ScriptPacket_reader_event_Factory(network_event* e) {
+	packet_reader* r = new packet_reader();
+	r->set_event(e);
+	return r;
+}
+packet_reader* ScriptPacket_reader_string_Factory(const std::string& data) {
+	packet_reader* r = new packet_reader();
+	r->set_string(data);
+	return r;
+}
 void RegisterScriptNetwork(asIScriptEngine* engine) {
 	engine->RegisterGlobalProperty(_O("const int event_none"), &EVENT_NONE);
 	engine->RegisterGlobalProperty(_O("const int event_connect"), &EVENT_CONNECT);
@@ -273,6 +874,62 @@ void RegisterScriptNetwork(asIScriptEngine* engine) {
 	engine->RegisterObjectProperty(_O("network_event"), _O("const uint64 peer_id"), asOFFSET(network_event, peer_id));
 	engine->RegisterObjectProperty(_O("network_event"), _O("const uint channel"), asOFFSET(network_event, channel));
 	engine->RegisterObjectProperty(_O("network_event"), _O("const string message"), asOFFSET(network_event, message));
+	engine->RegisterObjectType(_O("packet_writer"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("packet_writer"), asBEHAVE_FACTORY, _O("packet_writer @w()"), asFUNCTION(ScriptPacket_writer_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("packet_writer"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(packet_writer, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("packet_writer"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(packet_writer, release), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_int8(int8)"), asMETHODPR(packet_writer, write<int8_t>, (int8_t), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_uint8(uint8)"), asMETHODPR(packet_writer, write<uint8_t>, (uint8_t), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_int16(int16)"), asMETHODPR(packet_writer, write<int16_t>, (int16_t), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_uint16(uint16)"), asMETHODPR(packet_writer, write<uint16_t>, (uint16_t), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_int(int)"), asMETHODPR(packet_writer, write<int32_t>, (int32_t), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_uint(uint)"), asMETHODPR(packet_writer, write<uint32_t>, (uint32_t), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_int64(int64)"), asMETHODPR(packet_writer, write<int64_t>, (int64_t), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_uint64(uint64)"), asMETHODPR(packet_writer, write<uint64_t>, (uint64_t), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_float(float)"), asMETHODPR(packet_writer, write<float>, (float), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_double(double)"), asMETHODPR(packet_writer, write<double>, (double), void), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_bool(bool)"), asMETHOD(packet_writer, write_bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_bits(uint64, uint)"), asMETHOD(packet_writer, write_bits), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_varint(uint64)"), asMETHOD(packet_writer, write_varint), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_svarint(int64)"), asMETHOD(packet_writer, write_svarint), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_quantized(float, float, float, uint)"), asMETHOD(packet_writer, write_quantized), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_string(const string& in)"), asMETHOD(packet_writer, write_string), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void write_bytes(const string& in)"), asMETHOD(packet_writer, write_bytes), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void reserve(uint)"), asMETHOD(packet_writer, reserve), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("void reset()"), asMETHOD(packet_writer, reset), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("uint get_size() const property"), asMETHOD(packet_writer, get_size), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_writer"), _O("string get_data() const property"), asMETHOD(packet_writer, get_data), asCALL_THISCALL);
+	engine->RegisterObjectType(_O("packet_reader"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("packet_reader"), asBEHAVE_FACTORY, _O("packet_reader @r()"), asFUNCTION(ScriptPacket_reader_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("packet_reader"), asBEHAVE_FACTORY, _O("packet_reader @r(network_event@)"), asFUNCTION(ScriptPacket_reader_event_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("packet_reader"), asBEHAVE_FACTORY, _O("packet_reader @r(const string& in)"), asFUNCTION(ScriptPacket_reader_string_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("packet_reader"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(packet_reader, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("packet_reader"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(packet_reader, release), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("void set(network_event@)"), asMETHOD(packet_reader, set_event), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("void set(const string& in)"), asMETHOD(packet_reader, set_string), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("int8 read_int8()"), asMETHODPR(packet_reader, read<int8_t>, (), int8_t), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("uint8 read_uint8()"), asMETHODPR(packet_reader, read<uint8_t>, (), uint8_t), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("int16 read_int16()"), asMETHODPR(packet_reader, read<int16_t>, (), int16_t), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("uint16 read_uint16()"), asMETHODPR(packet_reader, read<uint16_t>, (), uint16_t), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("int read_int()"), asMETHODPR(packet_reader, read<int32_t>, (), int32_t), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("uint read_uint()"), asMETHODPR(packet_reader, read<uint32_t>, (), uint32_t), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("int64 read_int64()"), asMETHODPR(packet_reader, read<int64_t>, (), int64_t), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("uint64 read_uint64()"), asMETHODPR(packet_reader, read<uint64_t>, (), uint64_t), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("float read_float()"), asMETHODPR(packet_reader, read<float>, (), float), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("double read_double()"), asMETHODPR(packet_reader, read<double>, (), double), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("bool read_bool()"), asMETHOD(packet_reader, read_bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("uint64 read_bits(uint)"), asMETHOD(packet_reader, read_bits), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("uint64 read_varint()"), asMETHOD(packet_reader, read_varint), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("int64 read_svarint()"), asMETHOD(packet_reader, read_svarint), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("float read_quantized(float, float, uint)"), asMETHOD(packet_reader, read_quantized), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("string read_string()"), asMETHOD(packet_reader, read_string), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("string read_bytes(uint)"), asMETHOD(packet_reader, read_bytes), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("bool skip(uint)"), asMETHOD(packet_reader, skip), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("uint get_position() const property"), asMETHOD(packet_reader, get_position), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("void set_position(uint) property"), asMETHOD(packet_reader, set_position), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("uint get_size() const property"), asMETHOD(packet_reader, get_size), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("uint get_remaining() const property"), asMETHOD(packet_reader, get_remaining), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("packet_reader"), _O("bool get_error() const property"), asMETHOD(packet_reader, get_error), asCALL_THISCALL);
 	engine->RegisterObjectType(_O("network"), 0, asOBJ_REF);
 	engine->RegisterObjectBehaviour(_O("network"), asBEHAVE_FACTORY, _O("network @n()"), asFUNCTION(ScriptNetwork_Factory), asCALL_CDECL);
 	engine->RegisterObjectBehaviour(_O("network"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network, addRef), asCALL_THISCALL);
@@ -283,14 +940,30 @@ void RegisterScriptNetwork(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod(_O("network"), _O("bool setup_local_server(uint16, uint8, uint16)"), asMETHOD(network, setup_local_server), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("uint64 connect(const string& in, uint16)"), asMETHOD(network, connect), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("network_event@ request(uint = 0)"), asMETHOD(network, request), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint request_batch(network_event@[]&, uint = 0, uint = 0)"), asMETHODPR(network, request_batch, (CScriptArray*, unsigned int, uint32_t), unsigned int), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("network_event@[]@ request_batch(uint = 0, uint = 0)"), asMETHODPR(network, request_batch, (unsigned int, uint32_t), CScriptArray*), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool start_thread(uint = 1)"), asMETHOD(network, start_thread), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("void stop_thread()"), asMETHOD(network, stop_thread), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool get_threaded() const property"), asMETHOD(network, is_threaded), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("string get_peer_address(uint64) const"), asMETHOD(network, get_peer_address), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("uint get_peer_average_round_trip_time(uint64) const"), asMETHOD(network, get_peer_average_round_trip_time), asCALL_THISCALL);
-	engine->RegisterObjectMethod(_O("network"), _O("bool send(uint64, const string& in, uint8, bool = true)"), asMETHOD(network, send), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool send(uint64, const string& in, uint8, bool = true)"), asMETHODPR(network, send, (asQWORD, const std::string&, unsigned char, bool), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool send(uint64, packet_writer&, uint8, bool = true)"), asMETHODPR(network, send, (asQWORD, packet_writer*, unsigned char, bool), bool), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_reliable(uint64, const string& in, uint8)"), asMETHOD(network, send_reliable), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_unreliable(uint64, const string& in, uint8)"), asMETHOD(network, send_unreliable), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_peer(uint64, const string& in, uint8, bool = true)"), asMETHOD(network, send_peer), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_reliable_peer(uint64, const string& in, uint8)"), asMETHOD(network, send_reliable_peer), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_unreliable_peer(uint64, const string& in, uint8)"), asMETHOD(network, send_unreliable_peer), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint send_peers(const uint64[]& in, const string& in, uint8, bool = true)"), asMETHODPR(network, send_peers, (CScriptArray*, const std::string&, unsigned char, bool), unsigned int), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint send_peers(const uint64[]& in, packet_writer&, uint8, bool = true)"), asMETHODPR(network, send_peers, (CScriptArray*, packet_writer*, unsigned char, bool), unsigned int), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool create_peer_group(const string& in)"), asMETHOD(network, create_group), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool destroy_peer_group(const string& in)"), asMETHOD(network, destroy_group), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool add_to_peer_group(const string& in, uint64)"), asMETHOD(network, add_to_group), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool remove_from_peer_group(const string& in, uint64)"), asMETHOD(network, remove_from_group), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool is_in_peer_group(const string& in, uint64) const"), asMETHOD(network, is_in_group), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint64[]@ get_peer_group(const string& in) const"), asMETHOD(network, list_group), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint send_peer_group(const string& in, const string& in, uint8, bool = true)"), asMETHODPR(network, send_group, (const std::string&, const std::string&, unsigned char, bool), unsigned int), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint send_peer_group(const string& in, packet_writer&, uint8, bool = true)"), asMETHODPR(network, send_group, (const std::string&, packet_writer*, unsigned char, bool), unsigned int), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool disconnect_peer_softly(uint64)"), asMETHOD(network, disconnect_peer_softly), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool disconnect_peer(uint64)"), asMETHOD(network, disconnect_peer), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool disconnect_peer_forcefully(uint64)"), asMETHOD(network, disconnect_peer_forcefully), asCALL_THISCALL);
@@ -19,21 +19,147 @@
 #else
 	#include <cstring>
 #endif
+#include <atomic>
+#include <deque>
 #include <map>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <vector>
 #include <angelscript.h>
 #include <scriptarray.h>
+#include <Poco/Event.h>
+#include <Poco/Mutex.h>
+#include <Poco/Runnable.h>
+#include <Poco/RWLock.h>
+#include <Poco/Thread.h>
+
+// A fixed capacity queue for exactly one producing and one consuming thread. The capacity must be a power of 2.
+template <class T, unsigned int capacity> class spsc_ring {
+	T items[capacity];
+	std::atomic<unsigned int> head; // Next item to pop, only advanced by the consumer.
+	std::atomic<unsigned int> tail; // Next slot to fill, only advanced by the producer.
+public:
+	spsc_ring() : head(0), tail(0) {}
+	bool push(const T& item) {
+		unsigned int t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == capacity) return false;
+		items[t % capacity] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	bool pop(T& item) {
+		unsigned int h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		item = items[h % capacity];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
+// An unbounded queue that any number of threads may push to without locking while one thread pops, after Dmitry Vyukov's intrusive MPSC node queue. A pop can miss an item whose push is still in progress, which is then returned by a later pop.
+template <class T> class mpsc_queue {
+	struct node {
+		std::atomic<node*> next;
+		T value;
+	};
+	std::atomic<node*> head; // Most recently pushed node, exchanged by producers.
+	node* tail; // Oldest node, only touched by the consumer.
+	node stub;
+	void push_node(node* n) {
+		n->next.store(NULL, std::memory_order_relaxed);
+		node* previous = head.exchange(n, std::memory_order_acq_rel);
+		previous->next.store(n, std::memory_order_release);
+	}
+public:
+	mpsc_queue() : head(&stub), tail(&stub) {
+		stub.next.store(NULL, std::memory_order_relaxed);
+	}
+	~mpsc_queue() {
+		T value;
+		while (pop(value));
+	}
+	void push(const T& value) {
+		node* n = new node;
+		n->value = value;
+		push_node(n);
+	}
+	bool pop(T& value) {
+		node* t = tail;
+		node* next = t->next.load(std::memory_order_acquire);
+		if (t == &stub) {
+			if (!next) return false;
+			tail = t = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if (!next) {
+			if (t != head.load(std::memory_order_acquire)) return false;
+			push_node(&stub);
+			next = t->next.load(std::memory_order_acquire);
+			if (!next) return false;
+		}
+		tail = next;
+		value = t->value;
+		delete t;
+		return true;
+	}
+};
+
+// Work handed from script threads to a network's service thread, see network::start_thread.
+typedef enum { NETWORK_COMMAND_SEND, NETWORK_COMMAND_SEND_PEER, NETWORK_COMMAND_SEND_GROUP, NETWORK_COMMAND_CONNECT, NETWORK_COMMAND_DISCONNECT_SOFTLY, NETWORK_COMMAND_DISCONNECT, NETWORK_COMMAND_DISCONNECT_FORCEFULLY } network_command_type;
+typedef struct {
+	network_command_type type;
+	asQWORD peer; // A peer id, 0 to broadcast, or an ENetPeer pointer for NETWORK_COMMAND_SEND_PEER.
+	ENetPacket* packet;
+	unsigned char channel;
+	ENetAddress address;
+	std::vector<asQWORD>* recipients; // Peer ids for NETWORK_COMMAND_SEND_GROUP, freed once the command is applied.
+} network_command;
+// An event as the service thread hands it to request, received packets are copied into a network_event's message on the script thread.
+typedef struct {
+	int type;
+	asQWORD peer_id;
+	unsigned int channel;
+	ENetPacket* packet;
+} network_event_slot;
+#define NETWORK_EVENT_RING_SIZE 4096
 
 extern bool g_enet_initialized;
 class network_event;
-class network {
+class packet_writer;
+class network : public Poco::Runnable {
 	int RefCount;
 	ENetHost* host;
 	std::unordered_map<asQWORD, ENetPeer*> peers;
-	asQWORD next_peer;
+	std::atomic<asQWORD> next_peer;
 	unsigned char channel_count;
+	// Threaded mode. The service thread owns the host while it runs, taking host_mutex around everything it does with it so that script threads can still make quick queries. Sends, connections and disconnections are queued so that their order is kept without script threads waiting on the service thread.
+	Poco::Thread service_thread;
+	std::atomic<bool> threaded;
+	unsigned int poll_interval;
+	Poco::FastMutex host_mutex;
+	Poco::RWLock peers_lock; // Guards peers while the service thread runs.
+	mpsc_queue<network_command> commands;
+	spsc_ring<network_event_slot, NETWORK_EVENT_RING_SIZE>* incoming; // Created by the first start_thread, so that networks never serviced on a thread don't carry it.
+	std::deque<network_event_slot> backlog; // Events that didn't fit in incoming, owned by the service thread while it runs.
+	Poco::Event incoming_ready;
+	void run() override;
+	void apply(network_command& c);
+	bool convert_event(ENetEvent& event, network_event_slot& slot);
+	bool next_slot(network_event_slot& slot, uint32_t timeout, bool first);
+	void fill_event(network_event_slot& slot, network_event* e);
+	network_event* make_event(network_event_slot& slot);
+	std::vector<network_event*> event_pool; // Events that request_batch took back from scripts, reused with whatever message capacity they had.
+	CScriptArray* batch; // Handed out by request_batch(max, timeout), created on first use.
+	std::unordered_map<std::string, std::unordered_set<asQWORD>> groups; // Named sets of peer ids for send_group, ids of peers that have gone away are dropped when the group is next sent to.
+	Poco::FastMutex groups_mutex;
+	unsigned int send_shared(ENetPacket* packet, const asQWORD* recipients, size_t count, unsigned char channel);
+	bool deliver(asQWORD peer_id, ENetPacket* packet, unsigned char channel);
+	unsigned int send_multiple(std::vector<asQWORD>& recipients, ENetPacket* packet, unsigned char channel);
+	void listed_peers(CScriptArray* peer_ids, std::vector<asQWORD>& recipients);
+	void group_members(const std::string& name, std::vector<asQWORD>& recipients);
 	ENetPeer* get_peer(asQWORD peer_id);
+	bool has_peer(asQWORD peer_id);
 	// Enet's total_sent/received counters are 32 bit integers that can overflow, work around that
 	asQWORD total_sent_data, total_sent_packets, total_received_data, total_received_packets;
 	void update_totals() {
@@ -55,11 +181,19 @@ public:
 	bool setup_client(unsigned char max_channels, unsigned short max_peers);
 	bool setup_server(unsigned short port, unsigned char max_channels, unsigned short max_peers);
 	bool setup_local_server(unsigned short port, unsigned char max_channels, unsigned short max_peers);
+	bool start_thread(unsigned int poll_interval = 1);
+	void stop_thread();
+	bool is_threaded() {
+		return threaded;
+	}
 	asQWORD connect(const std::string& hostname, unsigned short port);
 	network_event* request(uint32_t timeout = 0);
+	unsigned int request_batch(CScriptArray* events, unsigned int max = 0, uint32_t timeout = 0);
+	CScriptArray* request_batch(unsigned int max = 0, uint32_t timeout = 0);
 	std::string get_peer_address(asQWORD peer_id);
 	unsigned int get_peer_average_round_trip_time(asQWORD peer_id);
 	bool send(asQWORD peer_id, const std::string& message, unsigned char channel, bool reliable = true);
+	bool send(asQWORD peer_id, packet_writer* writer, unsigned char channel, bool reliable = true);
 	bool send_reliable(asQWORD peer_id, const std::string& message, unsigned char channel) {
 		return send(peer_id, message, channel);
 	}
@@ -73,6 +207,16 @@ public:
 	bool send_unreliable_peer(asQWORD peer, const std::string& message, unsigned char channel) {
 		return send(peer, message, channel, false);
 	}
+	unsigned int send_peers(CScriptArray* peer_ids, const std::string& message, unsigned char channel, bool reliable = true);
+	unsigned int send_peers(CScriptArray* peer_ids, packet_writer* writer, unsigned char channel, bool reliable = true);
+	bool create_group(const std::string& name);
+	bool destroy_group(const std::string& name);
+	bool add_to_group(const std::string& name, asQWORD peer_id);
+	bool remove_from_group(const std::string& name, asQWORD peer_id);
+	bool is_in_group(const std::string& name, asQWORD peer_id);
+	CScriptArray* list_group(const std::string& name);
+	unsigned int send_group(const std::string& name, const std::string& message, unsigned char channel, bool reliable = true);
+	unsigned int send_group(const std::string& name, packet_writer* writer, unsigned char channel, bool reliable = true);
 	bool disconnect_peer_softly(asQWORD peer_id);
 	bool disconnect_peer(asQWORD peer_id);
 	bool disconnect_peer_forcefully(asQWORD peer_id);
@@ -80,31 +224,39 @@ public:
 	bool set_bandwidth_limits(unsigned int incoming, unsigned int outgoing);
 	void set_packet_compression(bool flag);
 	bool get_packet_compression() {
+		Poco::FastMutex::ScopedLock lock(host_mutex);
 		return host && host->compressor.context;
 	}
 	size_t get_connected_peers() {
+		Poco::FastMutex::ScopedLock lock(host_mutex);
 		return host ? host->connectedPeers : -1;
 	}
 	size_t get_bytes_received() {
+		Poco::FastMutex::ScopedLock lock(host_mutex);
 		update_totals();
 		return host ? total_received_data : -1;
 	}
 	size_t get_bytes_sent() {
+		Poco::FastMutex::ScopedLock lock(host_mutex);
 		update_totals();
 		return host ? total_sent_data : -1;
 	}
 	size_t get_packets_received() {
+		Poco::FastMutex::ScopedLock lock(host_mutex);
 		update_totals();
 		return host ? total_received_packets : -1;
 	}
 	size_t get_packets_sent() {
+		Poco::FastMutex::ScopedLock lock(host_mutex);
 		update_totals();
 		return host ? total_sent_packets : -1;
 	}
 	size_t get_duplicate_peers() {
+		Poco::FastMutex::ScopedLock lock(host_mutex);
 		return host ? host->duplicatePeers : -1;
 	}
 	void set_duplicate_peers(size_t peers) {
+		Poco::FastMutex::ScopedLock lock(host_mutex);
 		if (host) host->duplicatePeers = peers;
 	}
 	bool active() {
@@ -125,4 +277,173 @@ public:
 	void release();
 };
 
+// Buffers for packet_writer, pooled by size and shared by all networks. They are handed to enet as packet data, and go back to the pool when enet frees the packet.
+unsigned char* packet_buffer_alloc(size_t size, size_t& capacity);
+void packet_buffer_free(unsigned char* buffer);
+template <class T> asQWORD packet_to_bits(T value) {
+	if constexpr(std::is_same<T, float>::value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	} else if constexpr(std::is_same<T, double>::value) {
+		asQWORD bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	} else
+		return asQWORD(typename std::make_unsigned<T>::type(value));
+}
+template <class T> T packet_from_bits(asQWORD bits) {
+	if constexpr(std::is_same<T, float>::value) {
+		uint32_t b = uint32_t(bits);
+		float value;
+		memcpy(&value, &b, sizeof(value));
+		return value;
+	} else if constexpr(std::is_same<T, double>::value) {
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	} else
+		return T(typename std::make_unsigned<T>::type(bits));
+}
+// Builds a packet field by field in a pooled buffer which network::send then gives to enet as is, leaving the writer empty. Numbers are little endian. Bit fields, including bools, are packed from the lowest bit of a byte up, and the next whole-byte field starts on a fresh byte.
+class packet_writer {
+	unsigned char* data;
+	size_t size;
+	size_t capacity;
+	unsigned int bit_pos; // Bits used in the last byte by bit fields, 0 if the next bit field starts a new byte.
+	void grow(size_t needed);
+public:
+	int RefCount;
+	packet_writer();
+	~packet_writer();
+	void addRef();
+	void release();
+	unsigned char* append(size_t bytes) {
+		bit_pos = 0;
+		if (size + bytes > capacity) grow(size + bytes);
+		unsigned char* out = data + size;
+		size += bytes;
+		return out;
+	}
+	template <class T> void write(T value) {
+		asQWORD bits = packet_to_bits(value);
+		unsigned char* out = append(sizeof(T));
+		for (size_t i = 0; i < sizeof(T); i++)
+			out[i] = (bits >> (i * 8)) & 0xff;
+	}
+	void write_bits(asQWORD value, unsigned int count);
+	void write_bool(bool value) {
+		write_bits(value ? 1 : 0, 1);
+	}
+	void write_varint(asQWORD value);
+	void write_svarint(asINT64 value) {
+		write_varint((asQWORD(value) << 1) ^ asQWORD(value >> 63));
+	}
+	void write_quantized(float value, float min, float max, unsigned int bits);
+	void write_string(const std::string& value);
+	void write_bytes(const std::string& value);
+	void reserve(unsigned int bytes) {
+		if (bytes > capacity) grow(bytes);
+	}
+	void reset() {
+		size = 0;
+		bit_pos = 0;
+	}
+	// Drops everything written after the first new_size bytes, the next field then starts a fresh byte.
+	void truncate(size_t new_size) {
+		if (new_size >= size) return;
+		size = new_size;
+		bit_pos = 0;
+	}
+	unsigned int get_size() {
+		return size;
+	}
+	std::string get_data() {
+		return std::string((char*)data, size);
+	}
+	ENetPacket* detach(bool reliable);
+};
+// Reads fields written by a packet_writer straight out of a network_event's message, which it holds a reference to, or out of its own copy of a string. Reads past the end return 0 or an empty string and set error.
+class packet_reader {
+	network_event* event;
+	std::string owned;
+	const std::string* source; // The event's message or owned.
+	size_t pos;
+	unsigned int bit_pos; // Bits of the byte at pos already read as bit fields.
+	bool error;
+public:
+	int RefCount;
+	packet_reader();
+	~packet_reader();
+	void addRef();
+	void release();
+	void set_event(network_event* e);
+	void set_string(const std::string& data);
+	// Bytes left to read. The position is pulled back within the message first, as an event's message can be assigned a shorter one while being read.
+	size_t available() {
+		if (pos > source->size()) {
+			pos = source->size();
+			bit_pos = 0;
+		}
+		return source->size() - pos;
+	}
+	const unsigned char* consume(size_t bytes) {
+		if (bit_pos) {
+			pos++;
+			bit_pos = 0;
+		}
+		if (available() < bytes) {
+			pos = source->size();
+			error = true;
+			return NULL;
+		}
+		const unsigned char* in = (const unsigned char*)source->data() + pos;
+		pos += bytes;
+		return in;
+	}
+	template <class T> T read() {
+		const unsigned char* in = consume(sizeof(T));
+		asQWORD bits = 0;
+		if (in) {
+			for (size_t i = 0; i < sizeof(T); i++)
+				bits |= asQWORD(in[i]) << (i * 8);
+		}
+		return packet_from_bits<T>(bits);
+	}
+	asQWORD read_bits(unsigned int count);
+	bool read_bool() {
+		return read_bits(1) != 0;
+	}
+	asQWORD read_varint();
+	asINT64 read_svarint() {
+		asQWORD value = read_varint();
+		return asINT64(value >> 1) ^ -asINT64(value & 1);
+	}
+	float read_quantized(float min, float max, unsigned int bits);
+	std::string read_string();
+	std::string read_bytes(unsigned int size);
+	bool skip(unsigned int bytes) {
+		return consume(bytes) != NULL;
+	}
+	unsigned int get_position() {
+		available();
+		return pos + (bit_pos ? 1 : 0);
+	}
+	void set_position(unsigned int position) {
+		pos = position < source->size() ? position : source->size();
+		bit_pos = 0;
+		error = false;
+	}
+	unsigned int get_size() {
+		return source->size();
+	}
+	unsigned int get_remaining() {
+		size_t left = available();
+		return bit_pos && left ? left - 1 : left;
+	}
+	bool get_error() {
+		return error;
+	}
+};
+
 void RegisterScriptNetwork(asIScriptEngine* engine);
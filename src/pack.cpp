@@ -10,14 +10,23 @@
  * 3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <algorithm>
 #include <errno.h>
 #include <obfuscate.h>
+#include <set>
+#include <Poco/Condition.h>
+#include <Poco/Environment.h>
 #include <Poco/FileStream.h>
 #include <Poco/Format.h>
+#include <Poco/Glob.h>
+#include <Poco/Runnable.h>
+#include <Poco/SHA2Engine.h>
 #include <Poco/StreamCopier.h>
-#include <Poco/Thread.h>
+#include <Poco/ThreadPool.h>
 #include <Poco/Util/Application.h>
+#include <Poco/zlib.h>
 #ifndef _WIN32
+	#include <sys/mman.h>
 	#include <sys/stat.h>
 	#include <unistd.h>
 #else
@@ -39,9 +48,78 @@ static std::string g_pack_ident = "NVPK";
 
 bool find_embedded_pack(string& filename, unsigned int& file_offset);
 
+// Maps an entire opened file into memory as read-only for PACK_OPEN_MODE_MAPPED, returning NULL on failure. The file itself can be closed as soon as this returns.
+static unsigned char* map_file(FILE* f, size_t size) {
+	if (!f || !size) return NULL;
+	#ifdef _WIN32
+	HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(fileno(f)), NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) return NULL;
+	void* ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping); // The view holds it's own reference to the mapping.
+	return (unsigned char*)ptr;
+	#else
+	void* ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(f), 0);
+	if (ptr == MAP_FAILED) return NULL;
+	return (unsigned char*)ptr;
+	#endif
+}
+static void unmap_file(unsigned char* ptr, size_t size) {
+	#ifdef _WIN32
+	UnmapViewOfFile(ptr);
+	#else
+	munmap(ptr, size);
+	#endif
+}
+// 64 bit safe replacements for fseek(f, offset, SEEK_SET) and for cutting off the end of an open file.
+static inline int pack_seek(FILE* f, uint64_t offset) {
+	#ifdef _WIN32
+	return _fseeki64(f, offset, SEEK_SET);
+	#else
+	return fseeko(f, offset, SEEK_SET);
+	#endif
+}
+static inline bool pack_truncate(FILE* f, uint64_t size) {
+	#ifdef _WIN32
+	return _chsize_s(_fileno(f), size) == 0;
+	#else
+	return ftruncate(fileno(f), size) == 0;
+	#endif
+}
+// Reads from an absolute position in a file so that any number of threads can read through the same handle at once. On posix pread leaves the file pointer alone, but ReadFile with an OVERLAPPED structure on a synchronous handle moves it to the end of the read, so on Windows nothing may rely on the file pointer of a handle that is also read from this way.
+static size_t pack_pread(FILE* f, void* buffer, size_t size, uint64_t offset) {
+	#ifdef _WIN32
+	OVERLAPPED o;
+	memset(&o, 0, sizeof(OVERLAPPED));
+	o.Offset = (DWORD)offset;
+	o.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD bytesread = 0;
+	if (!ReadFile((HANDLE)_get_osfhandle(_fileno(f)), buffer, size, &bytesread, &o))
+		return 0;
+	return bytesread;
+	#else
+	size_t total = 0;
+	while (total < size) {
+		ssize_t r = pread(fileno(f), (char*)buffer + total, size - total, offset + total);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		total += r;
+	}
+	return total;
+	#endif
+}
+// Copies bytes out of a memory resident pack (memload or mapped) into a caller provided buffer, undoing pack_char_encrypt on the way so that no intermediate buffer is needed.
+static inline void pack_decrypt_copy(unsigned char* dest, const unsigned char* src, unsigned int size, unsigned int offset, unsigned int namelen) {
+	for (unsigned int i = 0; i < size; i++)
+		dest[i] = pack_char_decrypt(src[i], offset + i, namelen);
+}
+
 pack::pack() {
 	fptr = NULL;
 	mptr = NULL;
+	map_base = NULL;
+	map_size = 0;
 	pack_items.clear();
 	pack_filenames.clear();
 	pack_streams.clear();
@@ -49,8 +127,13 @@ pack::pack() {
 	set_pack_identifier(g_pack_ident);
 	next_stream_idx = 0;
 	open_mode = PACK_OPEN_MODE_NONE;
-	delay_close = false;
 	file_offset = 0;
+	generation = 0;
+	version = 0;
+	create_version = 1;
+	data_end = 0;
+	directory_offset = directory_size = 0;
+	compression_level = 0;
 	RefCount = 1;
 }
 void pack::AddRef() {
@@ -73,34 +156,85 @@ bool pack::set_pack_identifier(const std::string& ident) {
 }
 // Loads or creates the given pack file based on mode.
 bool pack::open(const string& filename_in, pack_open_mode mode, bool memload) {
+	Poco::ScopedWriteRWLock lock(state_lock);
 	if (fptr || mptr) {
-			if (!close()) return false; // A pack file is already opened and was unable to close, maybe some sounds are actively playing from it.
-		}
+		if (!close_pack()) return false; // A pack file is already opened and was unable to close.
+	}
 	if (mode <= PACK_OPEN_MODE_NONE || mode >= PACK_OPEN_MODES_TOTAL)
 		return false; // Invalid mode.
 	string filename = filename_in;
-	if (mode == PACK_OPEN_MODE_READ) find_embedded_pack(filename, file_offset);
+	if (mode == PACK_OPEN_MODE_READ || mode == PACK_OPEN_MODE_MAPPED) find_embedded_pack(filename, file_offset);
 	if (mode == PACK_OPEN_MODE_APPEND && !FileExists(filename))
 		mode = PACK_OPEN_MODE_CREATE;
 	if (mode == PACK_OPEN_MODE_CREATE) {
 		fptr = fopen(filename.c_str(), "wb");
 		if (fptr == NULL)
 			return false;
-		pack_header h;
-		memset(&h, 0, sizeof(pack_header));
-		memcpy(&h, &pack_ident[0], 8);
-		h.filecount = 0;
-		fwrite(&h, sizeof(pack_header), 1, fptr);
+		if (create_version >= 2) {
+			pack_header_v2 h;
+			memset(&h, 0, sizeof(pack_header_v2));
+			memcpy(h.ident, &pack_ident[0], 8);
+			h.marker = PACK_V2_MARKER;
+			h.version = 2;
+			fwrite(&h, sizeof(pack_header_v2), 1, fptr);
+			data_end = sizeof(pack_header_v2);
+		} else {
+			pack_header h;
+			memset(&h, 0, sizeof(pack_header));
+			memcpy(&h, &pack_ident[0], 8);
+			h.filecount = 0;
+			fwrite(&h, sizeof(pack_header), 1, fptr);
+		}
+		version = create_version;
 		current_filename = filename;
 		open_mode = mode;
 		return true;
+	} else if (mode == PACK_OPEN_MODE_MAPPED) {
+		// The directory is parsed straight out of the mapping and no FILE handle is kept, so that all subsequent reads are plain memory accesses.
+		FILE* f = fopen(filename.c_str(), "rb");
+		if (!f)
+			return false;
+		#ifdef _WIN32
+		map_size = _filelengthi64(fileno(f));
+		#else
+		struct stat st;
+		if (fstat(fileno(f), &st) == 0)
+			map_size = st.st_size;
+		#endif
+		map_base = map_file(f, map_size);
+		fclose(f);
+		if (!map_base) {
+			map_size = 0;
+			file_offset = 0;
+			return false;
+		}
+		uint64_t total_size = map_size - file_offset;
+		if (file_offset > 0) { // Embedded pack, read the size.
+			if (file_offset + sizeof(unsigned int) > map_size) {
+				close_pack();
+				return false;
+			}
+			unsigned int embedded_size;
+			memcpy(&embedded_size, map_base + file_offset, sizeof(unsigned int));
+			total_size = embedded_size;
+			file_offset += sizeof(unsigned int);
+		}
+		if (file_offset + total_size > map_size) {
+			close_pack();
+			return false;
+		}
+		mptr = map_base + file_offset;
+		if (!load_directory(mptr, total_size)) {
+			close_pack();
+			return false;
+		}
 	} else if (mode == PACK_OPEN_MODE_APPEND || mode == PACK_OPEN_MODE_READ) {
 		fptr = fopen(filename.c_str(), mode == PACK_OPEN_MODE_APPEND ? "rb+" : "rb");
 		if (!fptr)
 			return false;
-		unsigned int total_size = 0;
+		uint64_t total_size = 0;
 		#ifdef _WIN32
-		total_size = filelength(fileno(fptr));
+		total_size = _filelengthi64(fileno(fptr));
 		#else
 		struct stat st;
 		if (fstat(fileno(fptr), &st) == 0)
@@ -108,38 +242,64 @@ bool pack::open(const string& filename_in, pack_open_mode mode, bool memload) {
 		#endif
 		fseek(fptr, file_offset, SEEK_SET);
 		if (file_offset > 0) { // Embedded pack, read the size.
-			fread(&total_size, sizeof(unsigned int), 1, fptr);
+			unsigned int embedded_size = 0;
+			fread(&embedded_size, sizeof(unsigned int), 1, fptr);
+			total_size = embedded_size;
 			file_offset += sizeof(unsigned int);
 		}
 		pack_header h;
-		if (!fread(&h, sizeof(pack_header), 1, fptr)) {
-			fclose(fptr);
-			return false;
-		}
-		if (memcmp(h.ident, &pack_ident[0], 8) != 0) {
+		if (!fread(&h, sizeof(pack_header), 1, fptr) || memcmp(h.ident, &pack_ident[0], 8) != 0) {
 			fclose(fptr);
+			fptr = NULL;
+			file_offset = 0;
 			return false;
 		}
-		for (unsigned int c = 0; c < h.filecount; c++) {
-			pack_item i;
-			memset(&i, 0, sizeof(pack_item));
-			if (fread(&i, sizeof(unsigned int), 3, fptr) < 3) {
-				pack_items.clear();
-				pack_filenames.clear();
-				fclose(fptr);
-				return false;
+		if (h.filecount == PACK_V2_MARKER) {
+			pack_header_v2 h2;
+			memcpy(&h2, &h, sizeof(pack_header));
+			string dir;
+			bool valid = fread((unsigned char*)&h2 + sizeof(pack_header), sizeof(pack_header_v2) - sizeof(pack_header), 1, fptr) == 1 && h2.directory_offset >= sizeof(pack_header_v2) && h2.directory_offset <= total_size && h2.directory_size <= total_size - h2.directory_offset;
+			if (valid) {
+				dir.resize(h2.directory_size);
+				valid = pack_seek(fptr, file_offset + h2.directory_offset) == 0 && fread(&dir[0], 1, dir.size(), fptr) == dir.size();
 			}
-			string fn(i.namelen, '\0');
-			if ((i.filesize * i.namelen * 2) != i.magic || i.namelen > total_size || i.filesize > total_size || fread(&fn[0], 1, i.namelen, fptr) < i.namelen) {
-				pack_items.clear();
-				pack_filenames.clear();
+			if (!valid || !parse_directory_v2((const unsigned char*)dir.data(), dir.size(), h2.filecount, h2.directory_offset)) {
 				fclose(fptr);
+				fptr = NULL;
+				file_offset = 0;
 				return false;
 			}
-			i.offset = ftell(fptr) - file_offset;
-			pack_items[fn] = i;
-			pack_filenames.push_back(fn);
-			fseek(fptr, i.filesize, SEEK_CUR);
+			data_end = h2.directory_offset;
+			if (mode == PACK_OPEN_MODE_APPEND) {
+				// New items go after the old directory rather than over it, so that the pack stays readable as it was until close points the header at a new directory.
+				directory_offset = h2.directory_offset;
+				directory_size = h2.directory_size;
+				data_end = directory_offset + directory_size;
+				pack_seek(fptr, data_end);
+			}
+		} else {
+			for (unsigned int c = 0; c < h.filecount; c++) {
+				pack_item_v1 ih;
+				bool valid = fread(&ih, sizeof(pack_item_v1), 1, fptr) == 1 && (ih.filesize * ih.namelen * 2) == ih.magic && ih.namelen <= total_size && ih.filesize <= total_size;
+				string fn(valid ? ih.namelen : 0, '\0');
+				if (!valid || fread(&fn[0], 1, ih.namelen, fptr) < ih.namelen) {
+					pack_items.clear();
+					pack_filenames.clear();
+					fclose(fptr);
+					fptr = NULL;
+					file_offset = 0;
+					return false;
+				}
+				pack_item i;
+				memset(&i, 0, sizeof(pack_item));
+				i.filesize = i.stored_size = ih.filesize;
+				i.namelen = ih.namelen;
+				i.offset = ftell(fptr) - file_offset;
+				pack_items[fn] = i;
+				pack_filenames.push_back(fn);
+				fseek(fptr, ih.filesize, SEEK_CUR);
+			}
+			version = 1;
 		}
 		// Perform any extra read/append initialization
 		if (mode == PACK_OPEN_MODE_READ && memload) {
@@ -160,36 +320,227 @@ bool pack::open(const string& filename_in, pack_open_mode mode, bool memload) {
 	open_mode = mode;
 	return true;
 }
+// Walks the item headers of a pack that is already resident in memory, used for mapped packs to avoid a seek per item.
+bool pack::load_directory(const unsigned char* data, uint64_t total_size) {
+	pack_header h;
+	if (total_size < sizeof(pack_header))
+		return false;
+	memcpy(&h, data, sizeof(pack_header));
+	if (memcmp(h.ident, &pack_ident[0], 8) != 0)
+		return false;
+	if (h.filecount == PACK_V2_MARKER) {
+		pack_header_v2 h2;
+		if (total_size < sizeof(pack_header_v2))
+			return false;
+		memcpy(&h2, data, sizeof(pack_header_v2));
+		if (h2.directory_offset < sizeof(pack_header_v2) || h2.directory_offset > total_size || h2.directory_size > total_size - h2.directory_offset)
+			return false;
+		return parse_directory_v2(data + h2.directory_offset, h2.directory_size, h2.filecount, h2.directory_offset);
+	}
+	uint64_t pos = sizeof(pack_header);
+	for (unsigned int c = 0; c < h.filecount; c++) {
+		pack_item_v1 ih;
+		if (total_size - pos < sizeof(pack_item_v1)) {
+			pack_items.clear();
+			pack_filenames.clear();
+			return false;
+		}
+		memcpy(&ih, data + pos, sizeof(pack_item_v1));
+		pos += sizeof(pack_item_v1);
+		if ((ih.filesize * ih.namelen * 2) != ih.magic || ih.namelen > total_size - pos || ih.filesize > total_size - pos - ih.namelen) {
+			pack_items.clear();
+			pack_filenames.clear();
+			return false;
+		}
+		string fn((const char*)data + pos, ih.namelen);
+		pos += ih.namelen;
+		pack_item i;
+		memset(&i, 0, sizeof(pack_item));
+		i.filesize = i.stored_size = ih.filesize;
+		i.namelen = ih.namelen;
+		i.offset = pos;
+		pack_items[fn] = i;
+		pack_filenames.push_back(fn);
+		pos += ih.filesize;
+	}
+	version = 1;
+	return true;
+}
+// Loads a v2 central directory that has been read into memory, data_limit being the offset past which no item data may extend (the start of the directory).
+bool pack::parse_directory_v2(const unsigned char* dir, uint64_t dir_size, unsigned int filecount, uint64_t data_limit) {
+	pack_items.reserve(filecount);
+	pack_filenames.reserve(filecount);
+	uint64_t pos = 0;
+	for (unsigned int c = 0; c < filecount; c++) {
+		pack_directory_entry e;
+		if (dir_size - pos < sizeof(pack_directory_entry)) {
+			pack_items.clear();
+			pack_filenames.clear();
+			return false;
+		}
+		memcpy(&e, dir + pos, sizeof(pack_directory_entry));
+		pos += sizeof(pack_directory_entry);
+		if (e.namelen > dir_size - pos || e.offset > data_limit || e.filesize > data_limit - e.offset || e.flags & 0xffff & ~(PACK_ITEM_COMPRESSED | PACK_ITEM_ALIAS)) {
+			pack_items.clear();
+			pack_filenames.clear();
+			return false;
+		}
+		string fn((const char*)dir + pos, e.namelen);
+		pos += e.namelen;
+		if (pack_items.find(fn) != pack_items.end()) {
+			pack_items.clear();
+			pack_filenames.clear();
+			return false;
+		}
+		pack_item i;
+		i.offset = e.offset;
+		i.stored_size = e.filesize;
+		i.filesize = e.flags & PACK_ITEM_COMPRESSED ? e.original_size : e.filesize;
+		i.namelen = e.flags & PACK_ITEM_ALIAS ? e.flags >> 16 : e.namelen;
+		i.checksum = e.checksum;
+		i.flags = e.flags & PACK_ITEM_COMPRESSED;
+		pack_items[fn] = i;
+		pack_filenames.push_back(fn);
+	}
+	version = 2;
+	return true;
+}
+// Writes the central directory of a v2 pack at data_end sorted by filename, then points the header at it. The header is only written once the directory is flushed to disk, so a pack interrupted before then still opens with its previous directory.
+bool pack::write_directory_v2() {
+	vector<const string*> names;
+	names.reserve(pack_filenames.size());
+	for (const string& n : pack_filenames) names.push_back(&n);
+	sort(names.begin(), names.end(), [](const string * a, const string * b) { return *a < *b; });
+	string dir;
+	for (const string* n : names) {
+		const pack_item& i = pack_items[*n];
+		pack_directory_entry e;
+		memset(&e, 0, sizeof(pack_directory_entry));
+		e.offset = i.offset;
+		e.filesize = i.stored_size;
+		e.namelen = n->size();
+		e.checksum = i.checksum;
+		e.flags = i.flags;
+		if (i.namelen != e.namelen) e.flags |= PACK_ITEM_ALIAS | (i.namelen << 16);
+		if (i.flags & PACK_ITEM_COMPRESSED) e.original_size = i.filesize;
+		dir.append((const char*)&e, sizeof(pack_directory_entry));
+		dir.append(*n);
+	}
+	if (directory_size && data_end == directory_offset + directory_size && dir.size() == directory_size) {
+		// Nothing was added since the pack was opened, don't leave a copy of an unchanged directory behind.
+		string old(directory_size, '\0');
+		if (pack_seek(fptr, file_offset + directory_offset) == 0 && fread(&old[0], 1, old.size(), fptr) == old.size() && old == dir)
+			return true;
+	}
+	if (pack_seek(fptr, data_end) != 0 || fwrite(dir.data(), 1, dir.size(), fptr) != dir.size() || fflush(fptr) != 0)
+		return false;
+	pack_header_v2 h;
+	memset(&h, 0, sizeof(pack_header_v2));
+	memcpy(h.ident, &pack_ident[0], 8);
+	h.marker = PACK_V2_MARKER;
+	h.version = 2;
+	h.filecount = names.size();
+	h.directory_offset = data_end;
+	h.directory_size = dir.size();
+	fseek(fptr, 0, SEEK_SET);
+	if (fwrite(&h, sizeof(pack_header_v2), 1, fptr) != 1)
+		return false;
+	fflush(fptr);
+	pack_truncate(fptr, data_end + dir.size()); // Drops whatever an earlier interrupted append left past the old directory.
+	return true;
+}
 
 bool pack::close() {
-	while (delay_close) Poco::Thread::sleep(5);
-	delay_close = false;
+	Poco::ScopedWriteRWLock lock(state_lock);
+	return close_pack();
+}
+// Does the work of close with state_lock already held for writing. Streams still open are not freed as their owners will close them, but they are detached from the pack so that their reads fail from now on.
+bool pack::close_pack() {
 	bool ret = false;
 	if (fptr && (open_mode == PACK_OPEN_MODE_APPEND || open_mode == PACK_OPEN_MODE_CREATE)) {
-		pack_header h;
-		memset(&h, 0, sizeof(pack_header));
-		memcpy(h.ident, &pack_ident[0], 8);
-		h.filecount = pack_items.size();
-		fseek(fptr, 0, SEEK_SET);
-		ret = fwrite(&h, sizeof(pack_header), 1, fptr) == 1;
+		if (version >= 2)
+			ret = write_directory_v2();
+		else {
+			pack_header h;
+			memset(&h, 0, sizeof(pack_header));
+			memcpy(h.ident, &pack_ident[0], 8);
+			h.filecount = pack_items.size();
+			fseek(fptr, 0, SEEK_SET);
+			ret = fwrite(&h, sizeof(pack_header), 1, fptr) == 1;
+		}
 	} else
 		ret = true;
 	if (fptr)
 		fclose(fptr);
 	pack_items.clear();
 	pack_filenames.clear();
-	pack_streams.clear();
+	{
+		Poco::FastMutex::ScopedLock streams_lock(streams_mutex);
+		pack_streams.clear();
+	}
+	generation += 1;
 	current_filename = "";
 	file_offset = 0;
 	//next_stream_idx=0;
 	open_mode = PACK_OPEN_MODE_NONE;
+	version = 0;
+	data_end = 0;
+	directory_offset = directory_size = 0;
 	fptr = NULL;
-	if (mptr)
+	if (map_base)
+		unmap_file(map_base, map_size);
+	else if (mptr)
 		free(mptr);
+	map_base = NULL;
+	map_size = 0;
 	mptr = NULL;
 	return ret;
 }
 
+// Encrypts and writes a chunk of an item's data at the current file position, or appends it to out if given, updating the item's stored size and checksum as it goes.
+bool pack::write_item_data(pack_item& i, const unsigned char* data, unsigned int size, std::string* out) {
+	unsigned char tmp[4096];
+	for (unsigned int p = 0; p < size; p += sizeof(tmp)) {
+		unsigned int bufsize = size - p < sizeof(tmp) ? size - p : sizeof(tmp);
+		for (unsigned int j = 0; j < bufsize; j++)
+			tmp[j] = pack_char_encrypt(data[p + j], i.stored_size + j, i.namelen);
+		i.checksum = crc32(i.checksum, tmp, bufsize);
+		if (out)
+			out->append((const char*)tmp, bufsize);
+		else if (fwrite(tmp, 1, bufsize, fptr) != bufsize)
+			return false;
+		i.stored_size += bufsize;
+	}
+	return true;
+}
+// Writes an item as a series of independently deflated frames of PACK_FRAME_SIZE bytes, followed by the offset of every frame, the end of the last frame, the frame size and the frame count. Readers can then seek by inflating only the frame they need. Data is taken from memory, or read from src if data is NULL, and goes to out instead of the pack file if given. Returns false if writing fails or if the data doesn't shrink, in which case the caller should rewind and store the item raw.
+bool pack::write_compressed(pack_item& i, FILE* src, const unsigned char* data, unsigned int size, std::string* out) {
+	unsigned int frame_count = (size + PACK_FRAME_SIZE - 1) / PACK_FRAME_SIZE;
+	vector<unsigned int> index;
+	index.reserve(frame_count + 3);
+	vector<unsigned char> frame(data ? 0 : PACK_FRAME_SIZE), deflated(compressBound(PACK_FRAME_SIZE));
+	for (unsigned int f = 0; f < frame_count; f++) {
+		unsigned int len = size - f * PACK_FRAME_SIZE < PACK_FRAME_SIZE ? size - f * PACK_FRAME_SIZE : PACK_FRAME_SIZE;
+		const unsigned char* in = data ? data + uint64_t(f) * PACK_FRAME_SIZE : frame.data();
+		if (!data && fread(frame.data(), 1, len, src) != len)
+			return false;
+		uLongf outlen = deflated.size();
+		if (compress2(deflated.data(), &outlen, in, len, compression_level) != Z_OK)
+			return false;
+		index.push_back(i.stored_size);
+		if (!write_item_data(i, deflated.data(), outlen, out) || i.stored_size >= size)
+			return false;
+	}
+	index.push_back(i.stored_size);
+	index.push_back(PACK_FRAME_SIZE);
+	index.push_back(frame_count);
+	if (!write_item_data(i, (const unsigned char*)index.data(), index.size() * sizeof(unsigned int), out) || i.stored_size >= size)
+		return false;
+	i.filesize = size;
+	i.flags |= PACK_ITEM_COMPRESSED;
+	return true;
+}
+
 // Adds a file from disk to the pack. Returns false if disk filename doesn't exist or can't be read, pack_filename is already an item in the pack and allow_replace is false, or this object is not opened in append/create mode.
 bool pack::add_file(const string& disk_filename, const string& pack_filename, bool allow_replace) {
 	if (!fptr || file_offset > 0)
@@ -211,42 +562,64 @@ bool pack::add_file(const string& disk_filename, const string& pack_filename, bo
 	#endif
 	if (!dptr)
 		return false;
-	unsigned int cur_pos = ftell(fptr);
+	uint64_t cur_pos = version >= 2 ? data_end : ftell(fptr);
 	pack_item i;
 	memset(&i, 0, sizeof(pack_item));
 	i.namelen = pack_filename.size();
-	i.offset = cur_pos + i.namelen + (sizeof(unsigned int) * 3);
-	if (fwrite(&i, sizeof(unsigned int), 3, fptr) < 3) {
-		fseek(fptr, cur_pos, SEEK_SET);
-		fclose(dptr);
-		return false;
-	}
-	if (fwrite(pack_filename.c_str(), sizeof(char), i.namelen, fptr) < i.namelen) {
-		fseek(fptr, cur_pos, SEEK_SET);
-		fclose(dptr);
-		return false;
+	bool compressed = false;
+	if (version >= 2) {
+		i.offset = cur_pos;
+		pack_seek(fptr, cur_pos);
+		if (compression_level > 0) {
+			fseek(dptr, 0, SEEK_END);
+			long disk_size = ftell(dptr);
+			fseek(dptr, 0, SEEK_SET);
+			if (disk_size > 0 && disk_size <= 0xffffffffLL)
+				compressed = write_compressed(i, dptr, NULL, disk_size);
+			if (!compressed) { // Store it raw instead.
+				memset(&i, 0, sizeof(pack_item));
+				i.namelen = pack_filename.size();
+				i.offset = cur_pos;
+				pack_seek(fptr, cur_pos);
+				fseek(dptr, 0, SEEK_SET);
+			}
+		}
+	} else {
+		pack_item_v1 ih = {0, i.namelen, 0};
+		i.offset = cur_pos + i.namelen + sizeof(pack_item_v1);
+		if (fwrite(&ih, sizeof(pack_item_v1), 1, fptr) < 1 || fwrite(pack_filename.c_str(), sizeof(char), i.namelen, fptr) < i.namelen) {
+			fseek(fptr, cur_pos, SEEK_SET);
+			fclose(dptr);
+			return false;
+		}
 	}
 	unsigned char read_buffer[4096];
-	while (true) {
+	while (!compressed) {
 		unsigned int dataread = fread(read_buffer, 1, 4096, dptr);
 		if (dataread < 1)
 			break;
-		for (unsigned int j = 0; j < dataread; j++)
-			read_buffer[j] = pack_char_encrypt(read_buffer[j], i.filesize + j, i.namelen);
-		fwrite(read_buffer, 1, dataread, fptr);
-		i.filesize += dataread;
+		if (!write_item_data(i, read_buffer, dataread)) {
+			pack_seek(fptr, cur_pos);
+			fclose(dptr);
+			return false;
+		}
 		if (dataread < 4096)
 			break;
 	}
 	fclose(dptr);
-	fseek(fptr, cur_pos, SEEK_SET);
-	i.magic = i.filesize * i.namelen * 2;
-	if (fwrite(&i, sizeof(unsigned int), 3, fptr) < 3) {
+	if (!compressed)
+		i.filesize = i.stored_size;
+	if (version >= 2)
+		data_end += i.stored_size;
+	else {
 		fseek(fptr, cur_pos, SEEK_SET);
-		fclose(dptr);
-		return false;
+		pack_item_v1 ih = {(unsigned int)i.filesize, i.namelen, (unsigned int)i.filesize * i.namelen * 2};
+		if (fwrite(&ih, sizeof(pack_item_v1), 1, fptr) < 1) {
+			fseek(fptr, cur_pos, SEEK_SET);
+			return false;
+		}
+		fseek(fptr, 0, SEEK_END);
 	}
-	fseek(fptr, 0, SEEK_END);
 	pack_items[pack_filename] = i;
 	pack_filenames.push_back(pack_filename);
 	return true;
@@ -261,33 +634,38 @@ bool pack::add_memory(const string& pack_filename, unsigned char* data, unsigned
 		else
 			return false;
 	}
-	unsigned int cur_pos = ftell(fptr);
+	uint64_t cur_pos = version >= 2 ? data_end : ftell(fptr);
 	pack_item i;
 	memset(&i, 0, sizeof(pack_item));
-	i.filesize = size;
 	i.namelen = pack_filename.size();
-	i.magic = i.filesize * i.namelen * 2;
-	i.offset = cur_pos + i.namelen + (sizeof(unsigned int) * 3);
-	if (fwrite(&i, sizeof(unsigned int), 3, fptr) < 3) {
-		fseek(fptr, cur_pos, SEEK_SET);
-		return false;
+	if (version >= 2) {
+		i.offset = cur_pos;
+		pack_seek(fptr, cur_pos);
+	} else {
+		pack_item_v1 ih = {size, i.namelen, size * i.namelen * 2};
+		i.offset = cur_pos + i.namelen + sizeof(pack_item_v1);
+		if (fwrite(&ih, sizeof(pack_item_v1), 1, fptr) < 1 || fwrite(pack_filename.c_str(), sizeof(char), i.namelen, fptr) < i.namelen) {
+			fseek(fptr, cur_pos, SEEK_SET);
+			return false;
+		}
 	}
-	if (fwrite(pack_filename.c_str(), sizeof(char), i.namelen, fptr) < i.namelen) {
-		fseek(fptr, cur_pos, SEEK_SET);
-		return false;
+	if (version >= 2 && compression_level > 0 && size > 0 && !write_compressed(i, NULL, data, size)) { // Store it raw instead.
+		memset(&i, 0, sizeof(pack_item));
+		i.namelen = pack_filename.size();
+		i.offset = cur_pos;
+		pack_seek(fptr, cur_pos);
 	}
-	char tmp[1024];
-	int bufsize = 1024; // Keep at multiple of 16 for encryption.
-	for (uint64_t p = 0; p < size; p += bufsize) {
-		if (p + bufsize >= size) bufsize = size - p;
-		for (unsigned int j = 0; j < bufsize; j++)
-			tmp[j] = pack_char_encrypt(data[(p * bufsize) + j], (p * bufsize) + j, i.namelen);
-		if (fwrite(tmp, 1, bufsize, fptr) != bufsize) {
-			fseek(fptr, cur_pos, SEEK_SET);
+	if (!(i.flags & PACK_ITEM_COMPRESSED)) {
+		if (!write_item_data(i, data, size)) {
+			pack_seek(fptr, cur_pos);
 			return false;
 		}
+		i.filesize = i.stored_size;
 	}
-	fseek(fptr, 0, SEEK_END);
+	if (version >= 2)
+		data_end += i.stored_size;
+	else
+		fseek(fptr, 0, SEEK_END);
 	pack_items[pack_filename] = i;
 	pack_filenames.push_back(pack_filename);
 	return true;
@@ -297,7 +675,217 @@ bool pack::add_memory(const string& pack_filename, const string& data, bool allo
 	return add_memory(pack_filename, (unsigned char*)data.c_str(), data.size(), allow_replace);
 }
 
-// Deletes a file from the pack if it exists, and returns true on success. This operation is usually highly intensive, and if you must do it over and over again, it's best to just recompile your pack. If this function returns false, and you are sure your arguments are correct, you can consider that your pack file is now probably corrupt. This should only happen if the pack contains invalid headers or incomplete file data in the first place.
+// Bulk adding of files for pack::add_files. Worker threads from a private pool read, hash, compress and encrypt files into memory, while the calling thread writes the finished items to the pack in input order so that the pack is still written in one sequential pass. Files with identical contents are only stored once, later copies becoming aliases that share the first copy's data. Workers stop taking new files while PACK_BUILDER_BUFFER_LIMIT bytes of prepared data wait to be written, which bounds memory use by size rather than by file count.
+#define PACK_BUILDER_BUFFER_LIMIT (64 * 1024 * 1024)
+class pack_builder : public Poco::Runnable {
+public:
+	typedef struct {
+		const string* disk_filename;
+		const string* pack_filename;
+		pack_item item;
+		string data; // Stored bytes, already compressed and encrypted.
+		size_t alias_of; // Index of the entry that stores this entry's data, which is usually the entry itself.
+		size_t buffered; // Size of data as counted in pack_builder::buffered.
+		bool ready;
+		bool ok;
+	} entry;
+	pack* p;
+	vector<entry> entries;
+	unordered_map<string, size_t> digests; // SHA-256 of file contents:index of the entry storing them
+	Poco::FastMutex mutex;
+	Poco::Condition cond;
+	size_t next;
+	size_t written;
+	size_t buffered; // Bytes of prepared data not yet written.
+	pack_builder(pack* p, const vector<string>& disk_names, const vector<string>& pack_names) : p(p), entries(disk_names.size()), next(0), written(0), buffered(0) {
+		for (size_t i = 0; i < entries.size(); i++) {
+			entries[i].disk_filename = &disk_names[i];
+			entries[i].pack_filename = &pack_names[i];
+			entries[i].alias_of = i;
+			entries[i].buffered = 0;
+			entries[i].ready = false;
+			entries[i].ok = false;
+		}
+	}
+	void run() override {
+		while (true) {
+			size_t idx;
+			{
+				Poco::FastMutex::ScopedLock lock(mutex);
+				// The entry the writer waits for is always taken, so a full buffer can't stall it.
+				while (next < entries.size() && next > written && buffered >= PACK_BUILDER_BUFFER_LIMIT)
+					cond.wait(mutex);
+				if (next >= entries.size())
+					return;
+				idx = next++;
+			}
+			try {
+				prepare(idx);
+			} catch (...) {
+				entries[idx].ok = false;
+			}
+			Poco::FastMutex::ScopedLock lock(mutex);
+			entries[idx].ready = true;
+			entries[idx].buffered = entries[idx].data.size();
+			buffered += entries[idx].buffered;
+			cond.broadcast();
+		}
+	}
+	// Reads and encodes one file. Unless dedupe is false, a file whose contents were already seen becomes an alias instead.
+	void prepare(size_t idx, bool dedupe = true) {
+		entry& e = entries[idx];
+		FILE* f = fopen(e.disk_filename->c_str(), "rb");
+		if (!f)
+			return;
+		fseek(f, 0, SEEK_END);
+		long size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		string contents(size > 0 && size <= 0xffffffffLL ? size : 0, '\0');
+		bool read_ok = size >= 0 && size <= 0xffffffffLL && fread(&contents[0], 1, contents.size(), f) == contents.size();
+		fclose(f);
+		if (!read_ok)
+			return;
+		if (dedupe) {
+			Poco::SHA2Engine hash(Poco::SHA2Engine::SHA_256);
+			hash.update(contents);
+			const Poco::DigestEngine::Digest& digest = hash.digest();
+			string key((const char*)digest.data(), digest.size());
+			Poco::FastMutex::ScopedLock lock(mutex);
+			auto it = digests.find(key);
+			if (it != digests.end() && entries[it->second].pack_filename->size() < 0x10000) {
+				e.alias_of = it->second;
+				e.ok = true;
+				return;
+			} else if (it == digests.end())
+				digests[key] = idx;
+		}
+		memset(&e.item, 0, sizeof(pack_item));
+		e.item.namelen = e.pack_filename->size();
+		const unsigned char* data = (const unsigned char*)contents.data();
+		if (p->compression_level < 1 || contents.empty() || !p->write_compressed(e.item, NULL, data, contents.size(), &e.data)) {
+			memset(&e.item, 0, sizeof(pack_item));
+			e.item.namelen = e.pack_filename->size();
+			e.data.clear();
+			p->write_item_data(e.item, data, contents.size(), &e.data);
+			e.item.filesize = e.item.stored_size;
+		}
+		e.ok = true;
+	}
+};
+// Adds many files at once, returning the number that were added. On v2 packs the files are prepared on threads worker threads (0 for one per processor) and deduplicated, v1 packs simply add them one at a time.
+unsigned int pack::add_files(const vector<string>& disk_names, const vector<string>& pack_names, bool allow_replace, unsigned int threads) {
+	if ((open_mode != PACK_OPEN_MODE_APPEND && open_mode != PACK_OPEN_MODE_CREATE) || !fptr || file_offset > 0 || disk_names.size() != pack_names.size())
+		return 0;
+	unsigned int added = 0;
+	if (version < 2) {
+		for (size_t i = 0; i < disk_names.size(); i++)
+			added += add_file(disk_names[i], pack_names[i], allow_replace);
+		return added;
+	}
+	if (threads == 0)
+		threads = Poco::Environment::processorCount();
+	pack_builder b(this, disk_names, pack_names);
+	Poco::ThreadPool pool(threads, threads);
+	for (unsigned int t = 0; t < threads; t++)
+		pool.start(b);
+	// Writes a prepared entry's data at the end of the pack under its own name, failing if the name is taken and can't be replaced or if writing fails.
+	auto store = [&](pack_builder::entry& e) {
+		const string& name = *e.pack_filename;
+		if (file_exists(name) && (!allow_replace || !delete_file(name)))
+			e.ok = false;
+		else if (pack_seek(fptr, data_end) != 0 || fwrite(e.data.data(), 1, e.data.size(), fptr) != e.data.size())
+			e.ok = false;
+		else {
+			e.item.offset = data_end;
+			data_end += e.item.stored_size;
+			pack_items[name] = e.item;
+			pack_filenames.push_back(name);
+			added++;
+		}
+		string().swap(e.data);
+	};
+	for (size_t idx = 0; idx < b.entries.size(); idx++) {
+		pack_builder::entry& e = b.entries[idx];
+		{
+			Poco::FastMutex::ScopedLock lock(b.mutex);
+			while (!e.ready)
+				b.cond.wait(b.mutex);
+		}
+		if (e.ok && e.alias_of == idx)
+			store(e);
+		Poco::FastMutex::ScopedLock lock(b.mutex);
+		b.buffered -= e.buffered;
+		b.written = idx + 1;
+		b.cond.broadcast();
+	}
+	pool.joinAll();
+	// Aliases go last, as the entry holding their data may come after them in the list. When that entry couldn't be stored, the first alias that can be stores its own copy and the rest share it.
+	unordered_map<size_t, size_t> replacements;
+	for (size_t idx = 0; idx < b.entries.size(); idx++) {
+		pack_builder::entry& e = b.entries[idx];
+		if (!e.ok || e.alias_of == idx)
+			continue;
+		auto r = replacements.find(e.alias_of);
+		size_t owner = r != replacements.end() ? r->second : e.alias_of;
+		if (!b.entries[owner].ok || b.entries[owner].pack_filename->size() >= 0x10000) {
+			size_t original = e.alias_of;
+			e.alias_of = idx;
+			e.ok = false;
+			b.prepare(idx, false);
+			if (e.ok)
+				store(e);
+			if (e.ok)
+				replacements[original] = idx;
+			continue;
+		}
+		const string& name = *e.pack_filename;
+		if (file_exists(name) && (!allow_replace || !delete_file(name)))
+			continue;
+		pack_items[name] = b.entries[owner].item;
+		pack_filenames.push_back(name);
+		added++;
+	}
+	return added;
+}
+unsigned int pack::add_files(CScriptArray* disk_names, CScriptArray* pack_names, bool allow_replace, unsigned int threads) {
+	if (!disk_names || !pack_names || disk_names->GetSize() != pack_names->GetSize())
+		return 0;
+	vector<string> disk(disk_names->GetSize()), names(pack_names->GetSize());
+	for (unsigned int i = 0; i < disk.size(); i++) {
+		disk[i] = *(string*)disk_names->At(i);
+		names[i] = *(string*)pack_names->At(i);
+	}
+	return add_files(disk, names, allow_replace, threads);
+}
+// Adds every file matching a glob pattern, naming each one by it's path relative to base_path with forward slashes.
+unsigned int pack::add_glob(const string& pattern, const string& base_path, bool allow_replace, unsigned int threads) {
+	set<string> found;
+	try {
+		Poco::Glob::glob(pattern, found);
+	} catch (Poco::Exception&) {
+		return 0;
+	}
+	vector<string> disk, names;
+	disk.reserve(found.size());
+	names.reserve(found.size());
+	for (const string& path : found) {
+		if (!FileExists(path))
+			continue;
+		string name = path;
+		replace(name.begin(), name.end(), '\\', '/');
+		string base = base_path;
+		replace(base.begin(), base.end(), '\\', '/');
+		if (!base.empty() && base.back() != '/')
+			base += '/';
+		if (!base.empty() && name.compare(0, base.size(), base) == 0)
+			name.erase(0, base.size());
+		disk.push_back(path);
+		names.push_back(name);
+	}
+	return add_files(disk, names, allow_replace, threads);
+}
+
+// Deletes a file from the pack if it exists, and returns true on success. For v2 packs this only drops the item from the central directory, leaving it's data behind as a tombstone that is reclaimed when the pack is next rebuilt. For v1 packs this operation is usually highly intensive, and if you must do it over and over again, it's best to just recompile your pack. If this function returns false, and you are sure your arguments are correct, you can consider that your pack file is now probably corrupt. This should only happen if the pack contains invalid headers or incomplete file data in the first place.
 bool pack::delete_file(const string& pack_filename) {
 	if (open_mode != PACK_OPEN_MODE_APPEND && open_mode != PACK_OPEN_MODE_CREATE || !fptr || file_offset > 0)
 		return false;
@@ -308,13 +896,18 @@ bool pack::delete_file(const string& pack_filename) {
 	}
 	if (idx >= pack_filenames.size())
 		return false;
-	unsigned int oldblock = pack_items[pack_filename].namelen + pack_items[pack_filename].filesize + (sizeof(unsigned int) * 3);
+	if (version >= 2) {
+		pack_items.erase(pack_filename);
+		pack_filenames.erase(pack_filenames.begin() + idx);
+		return true;
+	}
+	unsigned int oldblock = pack_items[pack_filename].namelen + pack_items[pack_filename].filesize + sizeof(pack_item_v1);
 	unsigned int oldnlen = pack_items[pack_filename].namelen;
 	unsigned int oldoff = pack_items[pack_filename].offset;
 	pack_items.erase(pack_filename);
 	pack_filenames.erase(pack_filenames.begin() + idx);
 	unsigned char tmp[4096];
-	unsigned int new_eof = oldoff - oldnlen - (sizeof(unsigned int) * 3);
+	unsigned int new_eof = oldoff - oldnlen - sizeof(pack_item_v1);
 	for (unsigned int i = idx; i < pack_filenames.size(); i++) {
 		pack_item item = pack_items[pack_filenames[i]];
 		unsigned int total_bytesread = 0;
@@ -333,42 +926,54 @@ bool pack::delete_file(const string& pack_filename) {
 		new_eof = ftell(fptr);
 		pack_items[pack_filenames[i]].offset -= oldblock;
 		item.offset -= oldblock;
-		fseek(fptr, item.offset - item.namelen - (sizeof(unsigned int) * 3), SEEK_SET);
-		fwrite(&item, sizeof(unsigned int), 3, fptr);
+		pack_item_v1 ih = {(unsigned int)item.filesize, item.namelen, (unsigned int)item.filesize * item.namelen * 2};
+		fseek(fptr, item.offset - item.namelen - sizeof(pack_item_v1), SEEK_SET);
+		fwrite(&ih, sizeof(pack_item_v1), 1, fptr);
 		fwrite(pack_filenames[i].c_str(), 1, item.namelen, fptr);
-		char tmp_idx[3];
-		//new_eof+=total_bytesread+item.namelen+(sizeof(unsigned int)*3);
 	}
-	// This sucks...
-	//new_eof-=oldblock-oldsize;
-	#ifdef _WIN32
-	HANDLE hFile = CreateFileA(current_filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (!hFile)
-		return true; // At this point the operation has completed, but we couldn't set the new eof. Hopefully a new file being added to the pack gets a chance to overwrite the new existing deleted data...
-	SetFilePointer(hFile, new_eof, NULL, FILE_BEGIN);
-	SetEndOfFile(hFile);
-	CloseHandle(hFile);
-	fclose(fptr);
-	#ifndef _UNICODE
-	fptr = fopen(current_filename.c_str(), "rb+");
-	#else
-	fptr = _wfopen(current_filename.c_str(), L"rb+");
-	#endif
-	if (!fptr) {
-		close(); // We couldn't reopen the file after delete, and so we must entirely close the pack in this unfortunate case.
-		return false;
-	}
-	#else
-	ftruncate(fileno(fptr), new_eof);
-	#endif
+	fflush(fptr);
+	pack_truncate(fptr, new_eof);
 	fseek(fptr, 0, SEEK_END);
 	return true;
 }
 
 bool pack::file_exists(const string& pack_filename) {
+	Poco::ScopedReadRWLock lock(state_lock);
 	return pack_items.find(pack_filename) != pack_items.end();
 }
 
+// Recomputes the checksum of an item's stored data and compares it with the one recorded in the central directory. v1 packs have no checksums, so in that case this only confirms that the item exists.
+bool pack::verify_file(const string& pack_filename) {
+	Poco::ScopedReadRWLock lock(state_lock);
+	auto it = pack_items.find(pack_filename);
+	if (it == pack_items.end()) return false;
+	const pack_item& item = it->second;
+	if (version < 2) return true;
+	unsigned int crc = 0;
+	if (mptr) {
+		for (uint64_t p = 0; p < item.stored_size; p += 0x40000000)
+			crc = crc32(crc, mptr + item.offset + p, item.stored_size - p < 0x40000000 ? item.stored_size - p : 0x40000000);
+		return crc == item.checksum;
+	}
+	if (!fptr) return false;
+	bool writing = open_mode != PACK_OPEN_MODE_READ;
+	long write_pos = 0;
+	if (writing) { // The positional reads below bypass stdio buffering, and on Windows they move the file pointer that writes continue from.
+		fflush(fptr);
+		write_pos = ftell(fptr);
+	}
+	unsigned char tmp[4096];
+	bool ok = true;
+	for (uint64_t p = 0; ok && p < item.stored_size; p += sizeof(tmp)) {
+		unsigned int bufsize = item.stored_size - p < sizeof(tmp) ? item.stored_size - p : sizeof(tmp);
+		ok = pack_pread(fptr, tmp, bufsize, file_offset + item.offset + p) == bufsize;
+		crc = crc32(crc, tmp, bufsize);
+	}
+	if (writing)
+		fseek(fptr, write_pos, SEEK_SET);
+	return ok && crc == item.checksum;
+}
+
 unsigned int pack::get_file_name(int idx, char* buffer, unsigned int size) {
 	if (idx < 0 || idx >= pack_filenames.size())
 		return 0;
@@ -380,11 +985,13 @@ unsigned int pack::get_file_name(int idx, char* buffer, unsigned int size) {
 	return size;
 }
 string pack::get_file_name(int idx) {
+	Poco::ScopedReadRWLock lock(state_lock);
 	if (idx < 0 || idx >= pack_filenames.size())
 		return "";
 	return pack_filenames[idx];
 }
 CScriptArray* pack::list_files() {
+	Poco::ScopedReadRWLock lock(state_lock);
 	unsigned int count = pack_filenames.size();
 	asIScriptContext* ctx = asGetActiveContext();
 	asIScriptEngine* engine = ctx->GetEngine();
@@ -397,45 +1004,108 @@ CScriptArray* pack::list_files() {
 }
 
 unsigned int pack::get_file_size(const string& pack_filename) {
-	if (pack_items.find(pack_filename) != pack_items.end())
-		return pack_items[pack_filename].filesize;
-	else
-		return 0;
+	Poco::ScopedReadRWLock lock(state_lock);
+	auto it = pack_items.find(pack_filename);
+	return it != pack_items.end() ? it->second.filesize : 0;
 }
 
 unsigned int pack::get_file_offset(const string& pack_filename) {
-	if (pack_items.find(pack_filename) != pack_items.end())
-		return file_offset + pack_items[pack_filename].offset;
-	else
-		return 0;
+	Poco::ScopedReadRWLock lock(state_lock);
+	auto it = pack_items.find(pack_filename);
+	return it != pack_items.end() ? file_offset + it->second.offset : 0;
 }
 
 unsigned int pack::read_file(const string& pack_filename, unsigned int offset, unsigned char* buffer, unsigned int size, FILE* reader) {
-	if (pack_items.find(pack_filename) == pack_items.end()) return 0;
-	unsigned int item_size = pack_items[pack_filename].filesize;
-	if (offset >= item_size)
+	Poco::ScopedReadRWLock lock(state_lock);
+	auto it = pack_items.find(pack_filename);
+	if (it == pack_items.end()) return 0;
+	return read_item(it->second, offset, buffer, size, reader, NULL);
+}
+// Reads part of an item's logical (uncompressed) data. Compressed items inflate only the frames covering the requested range, cache may be provided to keep the frame index and last inflated frame between calls.
+unsigned int pack::read_item(const pack_item& item, unsigned int offset, unsigned char* buffer, unsigned int size, FILE* reader, pack_frame_cache* cache) {
+	if (offset >= item.filesize)
 		return 0;
 	unsigned int bytes_to_read = size;
-	if (offset + size > item_size)
-		bytes_to_read = item_size - offset;
+	if (offset + size > item.filesize)
+		bytes_to_read = item.filesize - offset;
 	if (!buffer)
 		return bytes_to_read;
-	if (open_mode == PACK_OPEN_MODE_READ && mptr) {
-		memcpy(buffer, mptr + pack_items[pack_filename].offset + offset, bytes_to_read);
-		for (unsigned int i = 0; i < bytes_to_read; i++)
-			buffer[i] = pack_char_decrypt(buffer[i], offset + i, pack_items[pack_filename].namelen);
-		return bytes_to_read;
+	if (!mptr) {
+		if (!reader)
+			reader = fptr;
+		if (open_mode != PACK_OPEN_MODE_READ || !reader)
+			return 0;
+	}
+	if (item.flags & PACK_ITEM_COMPRESSED) {
+		pack_frame_cache tmp;
+		if (!cache) {
+			tmp.current = 0xffffffff;
+			cache = &tmp;
+		}
+		return read_compressed(item, offset, buffer, bytes_to_read, reader, *cache);
+	}
+	return read_stored(item, offset, buffer, bytes_to_read, reader);
+}
+// Reads and decrypts bytes exactly as they are stored in the pack, offset being relative to the start of the item's stored data.
+unsigned int pack::read_stored(const pack_item& item, uint64_t offset, unsigned char* buffer, unsigned int size, FILE* reader) {
+	if (mptr) {
+		pack_decrypt_copy(buffer, mptr + item.offset + offset, size, offset, item.namelen);
+		return size;
 	}
 	if (!reader)
-		reader = fptr;
-	if (open_mode != PACK_OPEN_MODE_READ || !reader || pack_items.find(pack_filename) == pack_items.end())
 		return 0;
-	fseek(reader, file_offset + pack_items[pack_filename].offset + offset, SEEK_SET);
-	unsigned int dataread = fread(buffer, 1, bytes_to_read, reader);
+	unsigned int dataread = pack_pread(reader, buffer, size, file_offset + item.offset + offset);
 	for (unsigned int i = 0; i < dataread; i++)
-		buffer[i] = pack_char_decrypt(buffer[i], offset + i, pack_items[pack_filename].namelen);
+		buffer[i] = pack_char_decrypt(buffer[i], offset + i, item.namelen);
 	return dataread;
 }
+// Loads the frame index from the end of a compressed item into cache if it isn't there already.
+bool pack::load_frame_index(const pack_item& item, pack_frame_cache& cache, FILE* reader) {
+	if (!cache.index.empty())
+		return true;
+	unsigned int trailer[2]; // frame size, frame count
+	if (item.stored_size < sizeof(trailer) || read_stored(item, item.stored_size - sizeof(trailer), (unsigned char*)trailer, sizeof(trailer), reader) != sizeof(trailer))
+		return false;
+	uint64_t index_size = (uint64_t(trailer[1]) + 1) * sizeof(unsigned int);
+	if (trailer[0] == 0 || index_size > item.stored_size - sizeof(trailer) || uint64_t(trailer[0]) * trailer[1] < item.filesize)
+		return false;
+	cache.index.resize(trailer[1] + 1);
+	if (read_stored(item, item.stored_size - sizeof(trailer) - index_size, (unsigned char*)cache.index.data(), index_size, reader) != index_size) {
+		cache.index.clear();
+		return false;
+	}
+	cache.frame_size = trailer[0];
+	cache.current = 0xffffffff;
+	return true;
+}
+unsigned int pack::read_compressed(const pack_item& item, unsigned int offset, unsigned char* buffer, unsigned int size, FILE* reader, pack_frame_cache& cache) {
+	if (!load_frame_index(item, cache, reader))
+		return 0;
+	unsigned int total = 0;
+	vector<unsigned char> stored;
+	while (total < size) {
+		unsigned int f = (offset + total) / cache.frame_size;
+		if (f != cache.current) {
+			cache.current = 0xffffffff;
+			if (f + 1 >= cache.index.size() || cache.index[f] >= cache.index[f + 1] || cache.index[f + 1] > item.stored_size)
+				return total;
+			stored.resize(cache.index[f + 1] - cache.index[f]);
+			if (read_stored(item, cache.index[f], stored.data(), stored.size(), reader) != stored.size())
+				return total;
+			uint64_t frame_start = uint64_t(f) * cache.frame_size;
+			cache.frame.resize(item.filesize - frame_start < cache.frame_size ? item.filesize - frame_start : cache.frame_size);
+			uLongf frame_len = cache.frame.size();
+			if (uncompress((Bytef*)&cache.frame[0], &frame_len, stored.data(), stored.size()) != Z_OK || frame_len != cache.frame.size())
+				return total;
+			cache.current = f;
+		}
+		unsigned int frame_pos = offset + total - f * cache.frame_size;
+		unsigned int n = cache.frame.size() - frame_pos < size - total ? cache.frame.size() - frame_pos : size - total;
+		memcpy(buffer + total, &cache.frame[frame_pos], n);
+		total += n;
+	}
+	return total;
+}
 std::string pack::read_file_string(const string& pack_filename, unsigned int offset, unsigned int size) {
 	std::string result(size, '\0');
 	int actual_size = read_file(pack_filename, offset, (unsigned char*)&result.front(), size);
@@ -454,49 +1124,95 @@ bool pack::raw_seek(int offset) {
 		return fseek(fptr, offset, SEEK_SET);
 }
 
-// Closes an opened stream, basically freeing it's structure of data.
+// Closes an opened stream, basically freeing it's structure of data. If another thread is reading from the stream at the time, it is freed as soon as that read completes.
 bool pack::stream_close(pack_stream* stream, bool while_reading) {
-	if (stream->reading) {
-		stream->close = true;
-		pack_streams.find(stream->stridx) != pack_streams.end()&&pack_streams.erase(stream->stridx);
-		return true;
+	bool ret;
+	{
+		Poco::FastMutex::ScopedLock lock(streams_mutex);
+		ret = pack_streams.erase(stream->stridx) > 0 && !while_reading;
+		if (stream->reading) {
+			stream->close = true;
+			return true;
+		}
 	}
-	bool ret = !while_reading & pack_streams.find(stream->stridx) != pack_streams.end() && pack_streams.erase(stream->stridx);
+	stream_free(stream);
+	return ret;
+}
+bool pack::stream_close_script(unsigned int idx) {
+	pack_stream* stream;
+	{
+		Poco::FastMutex::ScopedLock lock(streams_mutex);
+		auto it = pack_streams.find(idx);
+		if (it == pack_streams.end())
+			return false;
+		stream = it->second;
+		pack_streams.erase(it);
+		if (stream->reading) {
+			stream->close = true;
+			return true;
+		}
+	}
+	stream_free(stream);
+	return true;
+}
+// Must be called without holding any of the pack's locks, as releasing the stream's reference may close the pack.
+void pack::stream_free(pack_stream* stream) {
 	stream->stridx = 0;
 	if (stream->reader)
 		fclose(stream->reader);
 	delete stream;
 	Release();
-	return ret;
 }
-bool pack::stream_close_script(unsigned int idx) {
-	if (pack_streams.find(idx) == pack_streams.end())
-		return false;
-	return stream_close(pack_streams[idx]);
+// Looks up a script stream and marks it in use in the same critical section, so that a concurrent close can't free it before stream_unpin.
+pack_stream* pack::stream_pin(unsigned int idx) {
+	Poco::FastMutex::ScopedLock lock(streams_mutex);
+	auto it = pack_streams.find(idx);
+	if (it == pack_streams.end())
+		return NULL;
+	it->second->reading += 1;
+	return it->second;
+}
+// The stream must not be touched after this, as it's freed here if it was closed while in use.
+void pack::stream_unpin(pack_stream* stream) {
+	bool close;
+	{
+		Poco::FastMutex::ScopedLock lock(streams_mutex);
+		stream->reading -= 1;
+		close = !stream->reading && stream->close;
+	}
+	if (close)
+		stream_free(stream);
 }
 
-// Creates a pack_stream structure for the given filename at the given offset. Pack streams are simple structures meant to expidite the process of sequentially reading from a file in the pack. Returns 0xffffffff on failure.
+// Creates a pack_stream structure for the given filename at the given offset. Pack streams are simple structures meant to expidite the process of sequentially reading from a file in the pack. Returns NULL on failure.
 pack_stream* pack::stream_open(const string& pack_filename, unsigned int offset) {
 	if (pack_filename == "")
 		return NULL;
-	if (pack_items.find(pack_filename) == pack_items.end())
-		return NULL;
-	unsigned int size = pack_items[pack_filename].filesize;
-	pack_stream* s = new pack_stream();
-	s->filename = pack_filename;
-	s->offset = offset;
-	s->filesize = size;
-	s->reading = false;
-	s->close = false;
-	if (!mptr) {
-		s->reader = fopen(current_filename.c_str(), "rb");
-		if (!s->reader)
+	pack_stream* s;
+	{
+		Poco::ScopedReadRWLock lock(state_lock);
+		auto it = pack_items.find(pack_filename);
+		if (it == pack_items.end() || (!mptr && (!fptr || open_mode != PACK_OPEN_MODE_READ)))
 			return NULL;
-	} else
+		s = new pack_stream();
+		s->filename = pack_filename;
+		s->offset = offset;
+		s->filesize = it->second.filesize;
+		s->namelen = it->second.namelen;
+		s->compressed = it->second.flags & PACK_ITEM_COMPRESSED;
+		s->data = mptr && !s->compressed ? mptr + it->second.offset : NULL;
+		s->frames.current = 0xffffffff;
 		s->reader = NULL;
-	pack_streams[next_stream_idx] = s;
-	s->stridx = next_stream_idx;
-	next_stream_idx += 1;
+		s->reading = 0;
+		s->close = false;
+		s->generation = generation;
+	}
+	{
+		Poco::FastMutex::ScopedLock lock(streams_mutex);
+		pack_streams[next_stream_idx] = s;
+		s->stridx = next_stream_idx;
+		next_stream_idx += 1;
+	}
 	AddRef();
 	return s;
 }
@@ -506,30 +1222,49 @@ unsigned int pack::stream_open_script(const string& pack_filename, unsigned int
 	else return 0xffffffff;
 }
 
-// Reads bytes from a stream and increments it's offset by the number of bytes read. Returns the number of bytes read on success, 0xffffffff (-1) on failure either do to end of file or invalid stream.
+// Reads bytes from a stream and increments it's offset by the number of bytes read. Returns the number of bytes read, which is 0 at the end of the file or if the pack has since been closed.
 unsigned int pack::stream_read(pack_stream* stream, unsigned char* buffer, unsigned int size) {
-	stream->reading = true;
-	unsigned int bytesread = read_file(stream->filename.c_str(), stream->offset, buffer, size, stream->reader);
-	stream->reading = false;
-	bool close = stream->close;
-	if (stream->close)
-		stream_close(stream);
-	if (bytesread == 0xffffffff)
-		return 0xffffffff;
-	if (!close)
-		stream->offset += bytesread;
+	{
+		Poco::FastMutex::ScopedLock lock(streams_mutex);
+		stream->reading += 1;
+	}
+	unsigned int bytesread = stream_read_pinned(stream, buffer, size);
+	stream_unpin(stream);
+	return bytesread;
+}
+unsigned int pack::stream_read_pinned(pack_stream* stream, unsigned char* buffer, unsigned int size) {
+	unsigned int bytesread = 0;
+	{
+		Poco::ScopedReadRWLock lock(state_lock);
+		if (stream->generation != generation)
+			bytesread = 0;
+		else if (stream->data) { // Memory resident pack, copy straight out of it without looking the file up again.
+			bytesread = stream->offset < stream->filesize ? stream->filesize - stream->offset : 0;
+			if (size < bytesread)
+				bytesread = size;
+			if (buffer)
+				pack_decrypt_copy(buffer, stream->data + stream->offset, bytesread, stream->offset, stream->namelen);
+		} else {
+			auto it = pack_items.find(stream->filename);
+			if (it != pack_items.end()) // Compressed streams keep the frame index and last inflated frame, so sequential reads inflate each frame once.
+				bytesread = read_item(it->second, stream->offset, buffer, size, stream->reader, stream->compressed ? &stream->frames : NULL);
+		}
+	}
+	stream->offset += bytesread;
 	return bytesread;
 }
 unsigned int pack::stream_read_script(unsigned int idx, unsigned char* buffer, unsigned int size) {
-	if (pack_streams.find(idx) == pack_streams.end())
+	pack_stream* stream = stream_pin(idx);
+	if (!stream)
 		return 0xffffffff;
-	return stream_read(pack_streams[idx], buffer, size);
+	unsigned int bytesread = stream_read_pinned(stream, buffer, size);
+	stream_unpin(stream);
+	return bytesread;
 }
 std::string pack::stream_read_string(unsigned int idx, unsigned int size) {
 	std::string result(size, '\0');
-	int actual_size = stream_read_script(idx, (unsigned char*)&result.front(), size);
-	if (actual_size > -1)
-		result.resize(size);
+	unsigned int actual_size = stream_read_script(idx, (unsigned char*)&result.front(), size);
+	result.resize(actual_size == 0xffffffff ? 0 : actual_size);
 	return result;
 }
 
@@ -543,14 +1278,15 @@ bool pack::stream_seek(pack_stream* stream, unsigned int offset, int origin) {
 		stream->offset = stream->filesize + offset;
 	else
 		return false;
-	if (!mptr && stream->reader)
-		fseek(stream->reader, file_offset + stream->offset, SEEK_SET);
 	return true;
 }
 bool pack::stream_seek_script(unsigned int idx, unsigned int offset, int origin) {
-	if (pack_streams.find(idx) == pack_streams.end())
+	pack_stream* stream = stream_pin(idx);
+	if (!stream)
 		return false;
-	return stream_seek(pack_streams[idx], offset, origin);
+	bool ret = stream_seek(stream, offset, origin);
+	stream_unpin(stream);
+	return ret;
 }
 
 bool pack_set_global_identifier(const std::string& identifier) {
@@ -613,12 +1349,13 @@ bool find_embedded_pack(string& filename, unsigned int& file_offset) {
 	return false;
 }
 
-int packmode1 = PACK_OPEN_MODE_NONE, packmode2 = PACK_OPEN_MODE_APPEND, packmode3 = PACK_OPEN_MODE_CREATE, packmode4 = PACK_OPEN_MODE_READ;
+int packmode1 = PACK_OPEN_MODE_NONE, packmode2 = PACK_OPEN_MODE_APPEND, packmode3 = PACK_OPEN_MODE_CREATE, packmode4 = PACK_OPEN_MODE_READ, packmode5 = PACK_OPEN_MODE_MAPPED;
 void RegisterScriptPack(asIScriptEngine* engine) {
 	engine->RegisterGlobalProperty(_O("const int PACK_OPEN_MODE_NONE"), &packmode1);
 	engine->RegisterGlobalProperty(_O("const int PACK_OPEN_MODE_APPEND"), &packmode2);
 	engine->RegisterGlobalProperty(_O("const int PACK_OPEN_MODE_CREATE"), &packmode3);
 	engine->RegisterGlobalProperty(_O("const int PACK_OPEN_MODE_READ"), &packmode4);
+	engine->RegisterGlobalProperty(_O("const int PACK_OPEN_MODE_MAPPED"), &packmode5);
 	engine->RegisterGlobalProperty(_O("const string pack_global_identifier"), &g_pack_ident);
 	engine->RegisterGlobalFunction(_O("bool pack_set_global_identifier(const string&in)"), asFUNCTION(pack_set_global_identifier), asCALL_CDECL);
 	engine->RegisterObjectType(_O("pack"), 0, asOBJ_REF);
@@ -630,20 +1367,29 @@ void RegisterScriptPack(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod(_O("pack"), _O("bool close()"), asMETHOD(pack, close), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("bool add_file(const string &in, const string& in, bool = false)"), asMETHOD(pack, add_file), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("bool add_memory(const string &in, const string& in, bool = false)"), asMETHODPR(pack, add_memory, (const string&, const string&, bool), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("uint add_files(const string[]&in, const string[]&in, bool = false, uint = 0)"), asMETHODPR(pack, add_files, (CScriptArray*, CScriptArray*, bool, unsigned int), unsigned int), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("uint add_glob(const string &in, const string &in = \"\", bool = false, uint = 0)"), asMETHOD(pack, add_glob), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("bool delete_file(const string &in)"), asMETHOD(pack, delete_file), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("bool file_exists(const string &in) const"), asMETHOD(pack, file_exists), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("string get_file_name(int) const"), asMETHODPR(pack, get_file_name, (int), string), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("string[]@ list_files() const"), asMETHODPR(pack, list_files, (), CScriptArray*), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("uint get_file_size(const string &in) const"), asMETHOD(pack, get_file_size), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("uint get_file_offset(const string &in) const"), asMETHOD(pack, get_file_offset), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("bool verify_file(const string &in) const"), asMETHOD(pack, verify_file), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("bool is_file_compressed(const string &in) const"), asMETHOD(pack, is_file_compressed), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("string read_file(const string &in, uint, uint) const"), asMETHOD(pack, read_file_string), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("bool raw_seek(int)"), asMETHOD(pack, raw_seek), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("bool stream_close(uint)"), asMETHOD(pack, stream_close_script), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("uint stream_open(const string &in, uint) const"), asMETHOD(pack, stream_open_script), asCALL_THISCALL);
-	engine->RegisterObjectMethod(_O("pack"), _O("string stream_read(uint, uint) const"), asMETHOD(pack, stream_read), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("string stream_read(uint, uint) const"), asMETHOD(pack, stream_read_string), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("uint stream_pos(uint) const"), asMETHOD(pack, stream_pos_script), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("uint stream_seek(uint, uint, int) const"), asMETHOD(pack, stream_seek_script), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("uint stream_size(uint) const"), asMETHOD(pack, stream_size_script), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("bool get_active() const property"), asMETHOD(pack, is_active), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("bool get_mapped() const property"), asMETHOD(pack, is_mapped), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("pack"), _O("uint get_size() const property"), asMETHOD(pack, size), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("uint get_version() const property"), asMETHOD(pack, get_version), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("void set_version(uint) property"), asMETHOD(pack, set_version), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("int get_compression_level() const property"), asMETHOD(pack, get_compression_level), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("pack"), _O("void set_compression_level(int) property"), asMETHOD(pack, set_compression_level), asCALL_THISCALL);
 }
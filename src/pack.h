@@ -14,41 +14,98 @@
 
 #include <angelscript.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <cstring>
 #include <unordered_map>
 #include <string>
 #include <vector>
 #include <Poco/BinaryReader.h>
 #include <Poco/BinaryWriter.h>
+#include <Poco/Mutex.h>
+#include <Poco/RWLock.h>
 #include <scriptarray.h>
 #include "nvgt.h"
 
+typedef struct {
+	uint64_t filesize; // Size of this file in unsigned chars.
+	uint64_t stored_size; // Number of bytes this item occupies in the pack, only differs from filesize when the item is compressed.
+	uint64_t offset; // Not saved in v1 packs, contains the true offset in the loaded binary file to this item's data relative to the start of the pack.
+	unsigned int namelen; // Length of this filename in unsigned chars, also used as a key by pack_char_encrypt. For an alias this is the name length of the item whose data it shares.
+	unsigned int checksum; // crc32 of the item's data as stored in the pack, only available in v2 packs.
+	unsigned int flags; // PACK_ITEM_* flags from the v2 central directory.
+} pack_item;
+
+// The item is stored as independently deflated frames followed by a frame index, see pack::write_compressed.
+#define PACK_ITEM_COMPRESSED 1
+// The item shares data written under a name of a different length, which pack_char_encrypt was keyed with and which is stored in the upper 16 bits of the directory entry's flags.
+#define PACK_ITEM_ALIAS 2
+// Amount of uncompressed data in each frame of a compressed item, which bounds the work done by a seek to inflating one frame.
+#define PACK_FRAME_SIZE 65536
+
+// The item header that precedes each file's data in a v1 pack.
 typedef struct {
 	unsigned int filesize; // Size of this file in unsigned chars.
 	unsigned int namelen; // Length of this filename in unsigned chars.
 	unsigned int magic; // whatever value results from the expression filesize*namelen*2, it doesn't matter if our unsigned int overflows because this is for verification and we don't care about the actual value.
-	unsigned int offset; // Not actually saved in the final output stream, contains the true offset in the loaded binary file to this item's data.
-} pack_item;
+} pack_item_v1;
 
 typedef struct {
 	char ident[8];
 	unsigned int filecount;
 } pack_header;
 
+// v2 packs store every item's metadata in a central directory written after all item data, sorted by filename, so that opening a pack costs a single read no matter how many files it contains. The marker sits where v1 packs store their filecount so that older readers cleanly reject these packs.
+#define PACK_V2_MARKER 0xffffffff
+typedef struct {
+	char ident[8];
+	unsigned int marker; // Always PACK_V2_MARKER.
+	unsigned int version;
+	unsigned int filecount;
+	unsigned int reserved;
+	uint64_t directory_offset; // Relative to the start of the pack.
+	uint64_t directory_size;
+} pack_header_v2;
+
+// One central directory entry, immediately followed by namelen bytes of filename.
+typedef struct {
+	uint64_t offset;
+	uint64_t filesize; // Bytes stored in the pack.
+	unsigned int namelen;
+	unsigned int checksum;
+	unsigned int flags;
+	unsigned int original_size; // Uncompressed size for items flagged PACK_ITEM_COMPRESSED, 0 otherwise.
+} pack_directory_entry;
+
+// Per-reader state for compressed items, holding the frame index and the most recently inflated frame so that sequential reads inflate each frame only once.
+typedef struct {
+	std::vector<unsigned int> index; // Offset of each frame within the stored data plus the end of the last frame, empty until first loaded.
+	std::string frame;
+	unsigned int frame_size;
+	unsigned int current; // Index of the frame currently held in frame, 0xffffffff if none.
+} pack_frame_cache;
+
 typedef struct {
 	std::string filename; // Filename associated with the stream, passed to pack::read_file.
 	unsigned int offset; // Current offset in the stream.
 	unsigned int filesize; // For convenience, only fetch it once and save it here.
-	FILE* reader;
-	bool reading;
+	FILE* reader; // Optional private handle, streams otherwise read through the pack's own handle with positional reads.
+	unsigned int reading; // Calls currently using the stream, a close made meanwhile is deferred until the last of them finishes.
 	bool close;
 	unsigned int stridx;
+	unsigned int generation; // The pack::generation this stream was opened in, reads fail once the pack has been closed or reopened.
+	const unsigned char* data; // Points directly at this file's bytes when the pack is memory resident (memload or PACK_OPEN_MODE_MAPPED), NULL otherwise.
+	unsigned int namelen; // Cached from the pack_item so that reads from memory resident packs need no lookups.
+	bool compressed;
+	pack_frame_cache frames;
 } pack_stream;
 
-typedef enum { PACK_OPEN_MODE_NONE, PACK_OPEN_MODE_APPEND, PACK_OPEN_MODE_CREATE, PACK_OPEN_MODE_READ, PACK_OPEN_MODES_TOTAL } pack_open_mode;
+typedef enum { PACK_OPEN_MODE_NONE, PACK_OPEN_MODE_APPEND, PACK_OPEN_MODE_CREATE, PACK_OPEN_MODE_READ, PACK_OPEN_MODE_MAPPED, PACK_OPEN_MODES_TOTAL } pack_open_mode;
+// Any number of threads may read from a pack opened for reading at once, file data is fetched with positional reads that never touch a shared file pointer. Opening and closing take state_lock exclusively and so wait for in-flight reads, while modifying a pack opened for append or create must still happen from one thread.
 class pack {
 	FILE* fptr;
 	unsigned char* mptr;
+	unsigned char* map_base; // Start of the read-only file mapping when opened with PACK_OPEN_MODE_MAPPED, mptr then points file_offset bytes into it.
+	size_t map_size;
 	std::unordered_map<std::string, pack_item> pack_items;
 	std::vector<std::string> pack_filenames;
 	std::unordered_map<unsigned int, pack_stream*>pack_streams;
@@ -56,10 +113,32 @@ class pack {
 	pack_open_mode open_mode;
 	std::string pack_ident;
 	unsigned int file_offset; // Offset into opened file where pack is contained, used for embedding packs into executables.
+	unsigned int version; // On-disk format of the currently open pack.
+	unsigned int create_version; // Format written by PACK_OPEN_MODE_CREATE, 1 unless a script opts into 2.
+	uint64_t data_end; // v2 only, where the next added item is written and where the central directory goes on close.
+	uint64_t directory_offset, directory_size; // v2 append only, the central directory the header pointed at when the pack was opened.
+	int compression_level; // zlib level used for items added to v2 packs, 0 stores them uncompressed.
 	int RefCount;
+	Poco::RWLock state_lock; // Held for reading around every read of the pack's items or data, and for writing by open and close.
+	Poco::FastMutex streams_mutex; // Guards pack_streams, next_stream_idx and the reading count and close flag of each stream.
+	unsigned int generation; // Incremented each time the pack is closed so that streams outliving it can tell.
+	bool close_pack();
+	void stream_free(pack_stream* stream);
+	pack_stream* stream_pin(unsigned int idx);
+	void stream_unpin(pack_stream* stream);
+	unsigned int stream_read_pinned(pack_stream* stream, unsigned char* buffer, unsigned int size);
+	bool load_directory(const unsigned char* data, uint64_t total_size);
+	bool parse_directory_v2(const unsigned char* dir, uint64_t dir_size, unsigned int filecount, uint64_t data_limit);
+	bool write_directory_v2();
+	bool write_item_data(pack_item& i, const unsigned char* data, unsigned int size, std::string* out = NULL);
+	bool write_compressed(pack_item& i, FILE* src, const unsigned char* data, unsigned int size, std::string* out = NULL);
+	friend class pack_builder;
+	unsigned int read_stored(const pack_item& item, uint64_t offset, unsigned char* buffer, unsigned int size, FILE* reader);
+	bool load_frame_index(const pack_item& item, pack_frame_cache& cache, FILE* reader);
+	unsigned int read_compressed(const pack_item& item, unsigned int offset, unsigned char* buffer, unsigned int size, FILE* reader, pack_frame_cache& cache);
+	unsigned int read_item(const pack_item& item, unsigned int offset, unsigned char* buffer, unsigned int size, FILE* reader, pack_frame_cache* cache);
 public:
 	unsigned int next_stream_idx;
-	bool delay_close;
 	pack();
 	void AddRef();
 	void Release();
@@ -69,8 +148,12 @@ public:
 	bool add_file(const std::string& disk_filename, const std::string& pack_filename, bool allow_replace = false);
 	bool add_memory(const std::string& pack_filename, unsigned char* data, unsigned int size, bool allow_replace = false);
 	bool add_memory(const std::string& pack_filename, const std::string& data, bool allow_replace = false);
+	unsigned int add_files(const std::vector<std::string>& disk_names, const std::vector<std::string>& pack_names, bool allow_replace = false, unsigned int threads = 0);
+	unsigned int add_files(CScriptArray* disk_names, CScriptArray* pack_names, bool allow_replace = false, unsigned int threads = 0);
+	unsigned int add_glob(const std::string& pattern, const std::string& base_path = "", bool allow_replace = false, unsigned int threads = 0);
 	bool delete_file(const std::string& pack_filename);
 	bool file_exists(const std::string& pack_filename);
+	bool verify_file(const std::string& pack_filename);
 	unsigned int get_file_name(int idx, char* buffer, unsigned int size);
 	std::string get_file_name(int idx);
 	void list_files(std::vector<std::string>& files);
@@ -93,13 +176,17 @@ public:
 	bool stream_close_script(unsigned int idx);
 	unsigned int stream_open_script(const std::string& pack_filename, unsigned int offset = 0);
 	unsigned int stream_pos_script(unsigned int idx) {
-		return pack_streams.find(idx) != pack_streams.end() ? pack_streams[idx]->offset : 0xffffffff;
+		Poco::FastMutex::ScopedLock lock(streams_mutex);
+		auto it = pack_streams.find(idx);
+		return it != pack_streams.end() ? it->second->offset : 0xffffffff;
 	}
 	unsigned int stream_read_script(unsigned int idx, unsigned char* buffer, unsigned int size);
 	std::string stream_read_string(unsigned int idx, unsigned int size);
 	bool stream_seek_script(unsigned int idx, unsigned int offset, int origen = SEEK_SET);
 	unsigned int stream_size_script(unsigned int idx) {
-		return pack_streams.find(idx) != pack_streams.end() ? pack_streams[idx]->filesize : 0;
+		Poco::FastMutex::ScopedLock lock(streams_mutex);
+		auto it = pack_streams.find(idx);
+		return it != pack_streams.end() ? it->second->filesize : 0;
 	}
 	unsigned int size() {
 		return pack_items.size();
@@ -107,6 +194,26 @@ public:
 	bool is_active() {
 		return fptr || mptr;
 	};
+	bool is_mapped() {
+		return map_base != NULL;
+	}
+	unsigned int get_version() {
+		return is_active() ? version : create_version;
+	}
+	void set_version(unsigned int v) {
+		if (v >= 1 && v <= 2) create_version = v;
+	}
+	int get_compression_level() {
+		return compression_level;
+	}
+	void set_compression_level(int level) {
+		compression_level = level < 0 ? 0 : level > 9 ? 9 : level;
+	}
+	bool is_file_compressed(const std::string& pack_filename) {
+		Poco::ScopedReadRWLock lock(state_lock);
+		auto it = pack_items.find(pack_filename);
+		return it != pack_items.end() && (it->second.flags & PACK_ITEM_COMPRESSED);
+	}
 };
 
 void embed_pack(const std::string& disc_filename, const std::string& embed_filename);
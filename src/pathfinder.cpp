@@ -11,6 +11,10 @@
 */
 
 #include "pathfinder.h"
+#include <cfloat>
+#include <climits>
+#include <queue>
+#include <Poco/Environment.h>
 
 static asITypeInfo* VectorArrayType = NULL;
 #define NODE_BIT_SIZE 19
@@ -36,6 +40,516 @@ inline void decode_state(void* st, int* x, int* y, int* z) {
 	*z = (s >> NODE_BIT_SIZE * 2 & mc) - 10000;
 }
 
+// Hierarchical pathfinding (HPA*) over a pathfinder's cost field. The field is split into square clusters of cluster_size tiles on each z layer. Entrances are placed wherever passable tiles face each other across a cluster border, one per connected stretch of border, and each cluster caches the cost between every pair of its entrances. A search then only runs A* over entrances, with the start and goal joined to the entrances of their clusters, before refining each step of the result inside a single cluster. Changing costs marks the touched clusters dirty, and they and their neighbours are rebuilt before the next search.
+typedef struct {
+	int to;
+	float cost;
+} hpa_edge;
+typedef struct {
+	int x, y, z;
+	int cluster;
+	int refs; // Number of entrances using this node, 0 for free nodes.
+	std::vector<hpa_edge> intra; // To the other entrances of the same cluster.
+	std::vector<hpa_edge> inter; // Across a cluster border.
+} hpa_node;
+typedef struct {
+	std::vector<int> nodes;
+	std::vector<std::pair<int, int>> faces[5]; // Entrances shared with the next cluster along x, y and z, then diagonally along x and y and along x and -y, as nodes on this side and the other.
+	bool dirty;
+} hpa_cluster;
+// Border stretches at least this long get an entrance at each end rather than one in the middle.
+#define HPA_LONG_ENTRANCE 6
+static const int hpa_dx[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+static const int hpa_dy[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+static const float hpa_cost[8] = {1.0f, 1.41f, 1.0f, 1.41f, 1.0f, 1.41f, 1.0f, 1.41f};
+class path_hierarchy {
+	pathfinder* pf;
+	int size;
+	int clusters_x, clusters_y, clusters_z;
+	std::vector<hpa_cluster> clusters;
+	std::vector<hpa_node> nodes;
+	std::vector<int> free_nodes;
+	std::unordered_map<hashpoint, int, hashpoint_hash, hashpoint_equals> node_at;
+	std::vector<int> dirty;
+	// Scratch space for searches within one cluster, indexed by tile within the cluster.
+	std::vector<float> dist;
+	std::vector<int> came_from;
+	// Scratch space for searches over entrances, indexed by node with one extra slot for the goal.
+	std::vector<float> g;
+	std::vector<int> parent;
+	std::vector<unsigned int> visited;
+	unsigned int search_id;
+	// The box around the start that pathfinder::search_range confines the current search to, inclusive. ranged is only set during find, so that the cached costs between entrances are always computed over whole clusters.
+	bool ranged;
+	int range_x0, range_y0, range_z0, range_x1, range_y1, range_z1;
+	bool in_range(int x, int y, int z) {
+		return !ranged || (x >= range_x0 && x <= range_x1 && y >= range_y0 && y <= range_y1 && z >= range_z0 && z <= range_z1);
+	}
+	bool cluster_in_range(int c) {
+		int x0, y0, x1, y1, z;
+		cluster_bounds(c, x0, y0, x1, y1, z);
+		return in_range(x0, y0, z) && in_range(x1 - 1, y1 - 1, z);
+	}
+public:
+	int desperation;
+	path_hierarchy(pathfinder* owner) : pf(owner), search_id(0), ranged(false) {
+		size = pf->cluster_size;
+		desperation = pf->desperation_factor;
+		clusters_x = (pf->field_width + size - 1) / size;
+		clusters_y = (pf->field_height + size - 1) / size;
+		clusters_z = pf->field_depth;
+		clusters.resize(size_t(clusters_x) * clusters_y * clusters_z);
+		dirty.reserve(clusters.size());
+		for (int i = 0; i < clusters.size(); i++) {
+			clusters[i].dirty = true;
+			dirty.push_back(i);
+		}
+		dist.resize(size * size);
+		came_from.resize(size * size);
+	}
+	int get_entrance_count() {
+		return nodes.size() - free_nodes.size();
+	}
+	int cluster_of(int x, int y, int z) {
+		unsigned int fx = x - pf->field_x, fy = y - pf->field_y, fz = z - pf->field_z;
+		if (fx >= pf->field_width || fy >= pf->field_height || fz >= pf->field_depth) return -1;
+		return (fz * clusters_y + fy / size) * clusters_x + fx / size;
+	}
+	void cluster_bounds(int c, int& x0, int& y0, int& x1, int& y1, int& z) {
+		int cx = c % clusters_x, cy = c / clusters_x % clusters_y;
+		z = pf->field_z + c / (clusters_x * clusters_y);
+		x0 = pf->field_x + cx * size;
+		y0 = pf->field_y + cy * size;
+		x1 = std::min(x0 + size, pf->field_x + int(pf->field_width));
+		y1 = std::min(y0 + size, pf->field_y + int(pf->field_height));
+	}
+	// The cost of stepping onto a tile, matching pathfinder::AdjacentCost.
+	float move_cost(int x, int y, int z, float multiplier) {
+		if (pf->get_field_cost(x, y, z) < 0) return FLT_MAX;
+		float c = pf->get_difficulty(x, y, z);
+		if (c != FLT_MAX) c++;
+		return c > 10 ? FLT_MAX : c * multiplier;
+	}
+	bool passable(int x, int y, int z) {
+		return move_cost(x, y, z, 1) != FLT_MAX;
+	}
+	void mark_dirty(int minx, int miny, int minz, int maxx, int maxy, int maxz) {
+		minx = std::max(minx, pf->field_x) - pf->field_x;
+		miny = std::max(miny, pf->field_y) - pf->field_y;
+		minz = std::max(minz, pf->field_z) - pf->field_z;
+		maxx = std::min(maxx, pf->field_x + int(pf->field_width) - 1) - pf->field_x;
+		maxy = std::min(maxy, pf->field_y + int(pf->field_height) - 1) - pf->field_y;
+		maxz = std::min(maxz, pf->field_z + int(pf->field_depth) - 1) - pf->field_z;
+		if (minx > maxx || miny > maxy) return;
+		for (int z = minz; z <= maxz; z++) {
+			for (int cy = miny / size; cy <= maxy / size; cy++) {
+				for (int cx = minx / size; cx <= maxx / size; cx++) {
+					int c = (z * clusters_y + cy) * clusters_x + cx;
+					if (clusters[c].dirty) continue;
+					clusters[c].dirty = true;
+					dirty.push_back(c);
+				}
+			}
+		}
+	}
+	int get_node(int x, int y, int z, int cluster) {
+		auto it = node_at.find(hashpoint(x, y, z));
+		int n;
+		if (it != node_at.end()) n = it->second;
+		else {
+			if (free_nodes.empty()) {
+				n = nodes.size();
+				nodes.emplace_back();
+			} else {
+				n = free_nodes.back();
+				free_nodes.pop_back();
+			}
+			hpa_node& node = nodes[n];
+			node.x = x;
+			node.y = y;
+			node.z = z;
+			node.cluster = cluster;
+			node.refs = 0;
+			node_at[hashpoint(x, y, z)] = n;
+			clusters[cluster].nodes.push_back(n);
+		}
+		nodes[n].refs++;
+		return n;
+	}
+	void release_node(int n) {
+		hpa_node& node = nodes[n];
+		if (--node.refs > 0) return;
+		node_at.erase(hashpoint(node.x, node.y, node.z));
+		std::vector<int>& cn = clusters[node.cluster].nodes;
+		cn.erase(std::find(cn.begin(), cn.end(), n));
+		node.intra.clear();
+		node.inter.clear();
+		free_nodes.push_back(n);
+	}
+	static void remove_edge(std::vector<hpa_edge>& edges, int to) {
+		for (int i = 0; i < edges.size(); i++) {
+			if (edges[i].to != to) continue;
+			edges.erase(edges.begin() + i);
+			return;
+		}
+	}
+	void add_entrance(int a, int ax, int ay, int az, int b, int bx, int by, int bz, int face) {
+		float multiplier = ax != bx && ay != by ? 1.41f : 1.0f;
+		int na = get_node(ax, ay, az, a), nb = get_node(bx, by, bz, b);
+		nodes[na].inter.push_back({nb, move_cost(bx, by, bz, multiplier)});
+		nodes[nb].inter.push_back({na, move_cost(ax, ay, az, multiplier)});
+		clusters[a].faces[face].push_back(std::make_pair(na, nb));
+	}
+	// Replaces the entrances between cluster a and the next cluster in the direction of face, see hpa_cluster::faces.
+	void build_face(int a, int face) {
+		for (auto& e : clusters[a].faces[face]) {
+			remove_edge(nodes[e.first].inter, e.second);
+			remove_edge(nodes[e.second].inter, e.first);
+			release_node(e.first);
+			release_node(e.second);
+		}
+		clusters[a].faces[face].clear();
+		int x0, y0, x1, y1, z;
+		cluster_bounds(a, x0, y0, x1, y1, z);
+		if (face >= 3) {
+			// Clusters touching only at a corner need their own entrance when the diagonal step between them is the only way across.
+			int ay = face == 3 ? y1 - 1 : y0, by = face == 3 ? y1 : y0 - 1;
+			int b = cluster_of(x1, by, z);
+			if (b >= 0 && passable(x1 - 1, ay, z) && passable(x1, by, z) && !passable(x1, ay, z) && !passable(x1 - 1, by, z)) add_entrance(a, x1 - 1, ay, z, b, x1, by, z, face);
+			return;
+		}
+		if (face < 2) {
+			// Border tiles are paired straight across a single line. Each stretch of passable pairs gets an entrance at its middle, or one at either end when long enough that the detour to the middle would matter.
+			int b = cluster_of(face == 0 ? x1 : x0, face == 0 ? y0 : y1, z);
+			if (b < 0) return;
+			int length = face == 0 ? y1 - y0 : x1 - x0;
+			auto inside = [&](int i, int& x, int& y) {
+				x = face == 0 ? x1 - 1 : x0 + i;
+				y = face == 0 ? y0 + i : y1 - 1;
+			};
+			auto open = [&](int i) {
+				int x, y;
+				inside(i, x, y);
+				return i >= 0 && i < length && passable(x, y, z) && passable(x + (face == 0), y + (face == 1), z);
+			};
+			auto entrance = [&](int i, int j) {
+				int ax, ay, bx, by;
+				inside(i, ax, ay);
+				inside(j, bx, by);
+				add_entrance(a, ax, ay, z, b, bx + (face == 0), by + (face == 1), z, face);
+			};
+			int run = -1;
+			for (int i = 0; i <= length; i++) {
+				if (open(i)) {
+					if (run < 0) run = i;
+					continue;
+				}
+				if (run >= 0) {
+					if (i - run >= HPA_LONG_ENTRANCE) {
+						entrance(run, run);
+						entrance(i - 1, i - 1);
+					} else entrance((run + i - 1) / 2, (run + i - 1) / 2);
+					run = -1;
+				}
+				// A diagonal step across the border is only worth an entrance of its own when neither tile it joins has a straight crossing.
+				int x, y;
+				inside(i, x, y);
+				if (i == length || !passable(x, y, z)) continue;
+				for (int j = i - 1; j <= i + 1; j += 2) {
+					if (j < 0 || j >= length || open(j)) continue;
+					int bx, by;
+					inside(j, bx, by);
+					if (passable(bx + (face == 0), by + (face == 1), z)) entrance(i, j);
+				}
+			}
+			return;
+		}
+		// Layers meet across a whole square of tiles, so place an entrance in each 4-connected patch where both layers are passable, at the tile of the patch nearest its middle.
+		int b = cluster_of(x0, y0, z + 1);
+		if (b < 0) return;
+		int w = x1 - x0, h = y1 - y0;
+		std::vector<char> open(w * h), seen(w * h, 0);
+		for (int i = 0; i < w * h; i++)
+			open[i] = passable(x0 + i % w, y0 + i / w, z) && passable(x0 + i % w, y0 + i / w, z + 1);
+		std::vector<int> patch;
+		for (int i = 0; i < w * h; i++) {
+			if (!open[i] || seen[i]) continue;
+			patch.clear();
+			patch.push_back(i);
+			seen[i] = 1;
+			float mx = 0, my = 0;
+			for (int p = 0; p < patch.size(); p++) {
+				int t = patch[p], tx = t % w, ty = t / w;
+				mx += tx;
+				my += ty;
+				const int nx[4] = {tx + 1, tx - 1, tx, tx}, ny[4] = {ty, ty, ty + 1, ty - 1};
+				for (int k = 0; k < 4; k++) {
+					if (nx[k] < 0 || nx[k] >= w || ny[k] < 0 || ny[k] >= h) continue;
+					int n = ny[k] * w + nx[k];
+					if (!open[n] || seen[n]) continue;
+					seen[n] = 1;
+					patch.push_back(n);
+				}
+			}
+			mx /= patch.size();
+			my /= patch.size();
+			int best = patch[0];
+			float best_distance = FLT_MAX;
+			for (int t : patch) {
+				float d = (t % w - mx) * (t % w - mx) + (t / w - my) * (t / w - my);
+				if (d < best_distance) {
+					best_distance = d;
+					best = t;
+				}
+			}
+			add_entrance(a, x0 + best % w, y0 + best / w, z, b, x0 + best % w, y0 + best / w, z + 1, face);
+		}
+	}
+	// Dijkstra's algorithm over the tiles of one cluster from (sx, sy). In reverse, dist holds the cost of reaching the source from each tile instead. Stops once the tile (tx, ty) is settled if it is inside the cluster.
+	void search_cluster(int c, int sx, int sy, bool reverse, int tx = INT_MIN, int ty = INT_MIN) {
+		int x0, y0, x1, y1, z;
+		cluster_bounds(c, x0, y0, x1, y1, z);
+		int w = x1 - x0, h = y1 - y0;
+		std::fill(dist.begin(), dist.end(), FLT_MAX);
+		std::priority_queue<std::pair<float, int>, std::vector<std::pair<float, int>>, std::greater<std::pair<float, int>>> open;
+		int source = (sy - y0) * size + sx - x0;
+		dist[source] = 0;
+		came_from[source] = -1;
+		open.push(std::make_pair(0.0f, source));
+		int target = tx >= x0 && tx < x1 && ty >= y0 && ty < y1 ? (ty - y0) * size + tx - x0 : -1;
+		while (!open.empty()) {
+			std::pair<float, int> top = open.top();
+			open.pop();
+			int t = top.second;
+			if (top.first > dist[t]) continue;
+			if (t == target) break;
+			int x = x0 + t % size, y = y0 + t / size;
+			for (int i = 0; i < 8; i++) {
+				int nx = x + hpa_dx[i], ny = y + hpa_dy[i];
+				if (nx < x0 || nx >= x1 || ny < y0 || ny >= y1 || !in_range(nx, ny, z)) continue;
+				float step = reverse ? (passable(nx, ny, z) ? move_cost(x, y, z, hpa_cost[i]) : FLT_MAX) : move_cost(nx, ny, z, hpa_cost[i]);
+				if (step == FLT_MAX) continue;
+				int n = (ny - y0) * size + nx - x0;
+				if (dist[t] + step >= dist[n]) continue;
+				dist[n] = dist[t] + step;
+				came_from[n] = t;
+				open.push(std::make_pair(dist[n], n));
+			}
+		}
+	}
+	float cluster_dist(int c, int x, int y) {
+		int x0, y0, x1, y1, z;
+		cluster_bounds(c, x0, y0, x1, y1, z);
+		return dist[(y - y0) * size + x - x0];
+	}
+	void build_intra(int c) {
+		std::vector<int>& cn = clusters[c].nodes;
+		for (int n : cn) {
+			nodes[n].intra.clear();
+			search_cluster(c, nodes[n].x, nodes[n].y, false);
+			for (int m : cn) {
+				float d = m == n ? FLT_MAX : cluster_dist(c, nodes[m].x, nodes[m].y);
+				if (d != FLT_MAX) nodes[n].intra.push_back({m, d});
+			}
+		}
+	}
+	// Rebuilds every dirty cluster's entrances, then the cached paths of each cluster whose entrances may have changed.
+	void update() {
+		if (dirty.empty()) return;
+		std::vector<int> touched;
+		std::vector<char> is_touched(clusters.size(), 0);
+		const int steps[5] = {1, clusters_x, clusters_x * clusters_y, clusters_x + 1, 1 - clusters_x};
+		for (int c : dirty) {
+			int cx = c % clusters_x, cy = c / clusters_x % clusters_y, cz = c / (clusters_x * clusters_y);
+			const bool has_next[5] = {cx + 1 < clusters_x, cy + 1 < clusters_y, cz + 1 < clusters_z, cx + 1 < clusters_x && cy + 1 < clusters_y, cx + 1 < clusters_x && cy > 0};
+			const bool has_previous[5] = {cx > 0, cy > 0, cz > 0, cx > 0 && cy > 0, cx > 0 && cy + 1 < clusters_y};
+			for (int face = 0; face < 5; face++) {
+				if (has_next[face]) build_face(c, face);
+				if (has_previous[face] && !clusters[c - steps[face]].dirty) build_face(c - steps[face], face);
+				int around[2] = {has_next[face] ? c + steps[face] : -1, has_previous[face] ? c - steps[face] : -1};
+				for (int n : around) {
+					if (n < 0 || is_touched[n]) continue;
+					is_touched[n] = 1;
+					touched.push_back(n);
+				}
+			}
+			if (!is_touched[c]) {
+				is_touched[c] = 1;
+				touched.push_back(c);
+			}
+		}
+		for (int c : dirty)
+			clusters[c].dirty = false;
+		dirty.clear();
+		for (int c : touched)
+			build_intra(c);
+	}
+	// Appends the tiles after (x, y) on the cheapest path to (tx, ty) within cluster c.
+	bool refine(int c, int x, int y, int tx, int ty, std::vector<hashpoint>& path) {
+		int x0, y0, x1, y1, z;
+		cluster_bounds(c, x0, y0, x1, y1, z);
+		search_cluster(c, x, y, false, tx, ty);
+		int t = (ty - y0) * size + tx - x0;
+		if (dist[t] == FLT_MAX) return false;
+		size_t first = path.size();
+		for (; t != (y - y0) * size + x - x0; t = came_from[t])
+			path.push_back(hashpoint(x0 + t % size, y0 + t / size, z));
+		std::reverse(path.begin() + first, path.end());
+		return true;
+	}
+	bool find(int sx, int sy, int sz, int gx, int gy, int gz, std::vector<hashpoint>& path, float& total) {
+		update();
+		int range = pf->search_range;
+		ranged = range > 0;
+		range_x0 = sx - range;
+		range_y0 = sy - range;
+		range_z0 = sz - range;
+		range_x1 = sx + range;
+		range_y1 = sy + range;
+		range_z1 = sz + range;
+		bool found = search(sx, sy, sz, gx, gy, gz, path, total);
+		// The only way through the range may pass between entrances that lie outside of it, so a ranged search that finds nothing looks again tile by tile.
+		if (!found && ranged && sz == gz && cluster_of(sx, sy, sz) >= 0 && cluster_of(gx, gy, gz) >= 0 && in_range(gx, gy, gz)) {
+			path.clear();
+			found = search_range_tiles(sx, sy, sz, gx, gy, path, total);
+		}
+		ranged = false;
+		return found;
+	}
+	// A* over every tile of the search range that lies within the field.
+	bool search_range_tiles(int sx, int sy, int z, int gx, int gy, std::vector<hashpoint>& path, float& total) {
+		int x0 = std::max(range_x0, pf->field_x), y0 = std::max(range_y0, pf->field_y);
+		int x1 = std::min(range_x1 + 1, pf->field_x + int(pf->field_width)), y1 = std::min(range_y1 + 1, pf->field_y + int(pf->field_height));
+		int w = x1 - x0;
+		std::vector<float> d(size_t(w) * (y1 - y0), FLT_MAX);
+		std::vector<int> from(d.size());
+		auto estimate = [&](int x, int y) -> float {
+			int dx = abs(gx - x), dy = abs(gy - y);
+			return dx + dy - 0.59f * std::min(dx, dy);
+		};
+		typedef std::pair<float, int> entry;
+		std::priority_queue<entry, std::vector<entry>, std::greater<entry>> open;
+		int source = (sy - y0) * w + sx - x0, target = (gy - y0) * w + gx - x0;
+		d[source] = 0;
+		from[source] = -1;
+		open.push(entry(estimate(sx, sy), source));
+		while (!open.empty()) {
+			entry top = open.top();
+			open.pop();
+			int t = top.second, x = x0 + t % w, y = y0 + t / w;
+			if (top.first > d[t] + estimate(x, y)) continue;
+			if (t == target) break;
+			for (int i = 0; i < 8; i++) {
+				int nx = x + hpa_dx[i], ny = y + hpa_dy[i];
+				if (nx < x0 || nx >= x1 || ny < y0 || ny >= y1) continue;
+				float step = move_cost(nx, ny, z, hpa_cost[i]);
+				if (step == FLT_MAX) continue;
+				int n = (ny - y0) * w + nx - x0;
+				if (d[t] + step >= d[n]) continue;
+				d[n] = d[t] + step;
+				from[n] = t;
+				open.push(entry(d[n] + estimate(nx, ny), n));
+			}
+		}
+		if (d[target] == FLT_MAX) return false;
+		total = d[target];
+		for (int t = target; t >= 0; t = from[t])
+			path.push_back(hashpoint(x0 + t % w, y0 + t / w, z));
+		std::reverse(path.begin(), path.end());
+		return true;
+	}
+	bool search(int sx, int sy, int sz, int gx, int gy, int gz, std::vector<hashpoint>& path, float& total) {
+		int cs = cluster_of(sx, sy, sz), cg = cluster_of(gx, gy, gz);
+		if (cs < 0 || cg < 0 || !in_range(gx, gy, gz)) return false;
+		int goal = nodes.size();
+		if (g.size() < nodes.size() + 1) {
+			g.resize(nodes.size() + 1);
+			parent.resize(nodes.size() + 1);
+			visited.resize(nodes.size() + 1, 0);
+		}
+		if (++search_id == 0) {
+			std::fill(visited.begin(), visited.end(), 0);
+			search_id = 1;
+		}
+		typedef std::pair<float, int> entry;
+		std::priority_queue<entry, std::vector<entry>, std::greater<entry>> open;
+		auto estimate = [&](int x, int y, int z) -> float {
+			float dx = gx - x, dy = gy - y, dz = gz - z;
+			return pf->allow_diagonals ? sqrtf(dx * dx + dy * dy + dz * dz) : fabs(dx) + fabs(dy) + fabs(dz);
+		};
+		auto relax = [&](int n, float cost, int from) {
+			if (visited[n] == search_id && cost >= g[n]) return;
+			visited[n] = search_id;
+			g[n] = cost;
+			parent[n] = from;
+			open.push(entry(cost + (n == goal ? 0 : estimate(nodes[n].x, nodes[n].y, nodes[n].z)), n));
+		};
+		// The start joins the entrances of its cluster, and reaches the goal directly if they share one.
+		search_cluster(cs, sx, sy, false);
+		if (cs == cg && cluster_dist(cs, gx, gy) != FLT_MAX) relax(goal, cluster_dist(cs, gx, gy), -1);
+		for (int n : clusters[cs].nodes) {
+			float d = cluster_dist(cs, nodes[n].x, nodes[n].y);
+			if (d != FLT_MAX) relax(n, d, -1);
+		}
+		search_cluster(cg, gx, gy, true);
+		std::unordered_map<int, float> to_goal;
+		for (int n : clusters[cg].nodes) {
+			float d = cluster_dist(cg, nodes[n].x, nodes[n].y);
+			if (d != FLT_MAX) to_goal[n] = d;
+		}
+		std::vector<char> closed(goal + 1, 0);
+		bool found = false;
+		while (!open.empty()) {
+			int n = open.top().second;
+			open.pop();
+			if (closed[n]) continue;
+			closed[n] = 1;
+			if (n == goal) {
+				found = true;
+				break;
+			}
+			int c = nodes[n].cluster;
+			if (cluster_in_range(c)) {
+				for (const hpa_edge& e : nodes[n].intra)
+					relax(e.to, g[n] + e.cost, n);
+			} else {
+				// The cached costs may route through tiles outside of the search range, so measure this cluster again within it.
+				search_cluster(c, nodes[n].x, nodes[n].y, false);
+				for (int m : clusters[c].nodes) {
+					float d = m == n ? FLT_MAX : cluster_dist(c, nodes[m].x, nodes[m].y);
+					if (d != FLT_MAX) relax(m, g[n] + d, n);
+				}
+			}
+			for (const hpa_edge& e : nodes[n].inter) {
+				if (in_range(nodes[e.to].x, nodes[e.to].y, nodes[e.to].z))
+					relax(e.to, g[n] + e.cost, n);
+			}
+			auto it = to_goal.find(n);
+			if (it != to_goal.end()) relax(goal, g[n] + it->second, n);
+		}
+		if (!found) return false;
+		total = g[goal];
+		std::vector<int> route;
+		for (int n = parent[goal]; n >= 0; n = parent[n])
+			route.push_back(n);
+		std::reverse(route.begin(), route.end());
+		path.push_back(hashpoint(sx, sy, sz));
+		int x = sx, y = sy, z = sz;
+		for (int i = 0; i <= route.size(); i++) {
+			int nx = i < route.size() ? nodes[route[i]].x : gx, ny = i < route.size() ? nodes[route[i]].y : gy, nz = i < route.size() ? nodes[route[i]].z : gz;
+			if (nx == x && ny == y && nz == z) continue;
+			int c = cluster_of(x, y, z);
+			if (c == cluster_of(nx, ny, nz)) {
+				if (!refine(c, x, y, nx, ny, path)) return false;
+			} else path.push_back(hashpoint(nx, ny, nz));
+			x = nx;
+			y = ny;
+			z = nz;
+		}
+		return true;
+	}
+};
+
 pathfinder::pathfinder(int size, bool cache) {
 	pf = new micropather::MicroPather(this, size, 10, cache);
 	callback = NULL;
@@ -49,6 +563,14 @@ pathfinder::pathfinder(int size, bool cache) {
 	solving = false;
 	total_cost = 0;
 	automatic_reset = false;
+	field_x = field_y = field_z = 0;
+	field_width = field_height = field_depth = 0;
+	hierarchy = NULL;
+	cluster_size = 32;
+	hierarchical = false;
+	jump_point_search = true;
+	jump_id = 0;
+	std::fill(cost_counts, cost_counts + 10, 0);
 }
 void pathfinder::AddRef() {
 	asAtomicInc(RefCount);
@@ -57,6 +579,7 @@ void pathfinder::Release() {
 	if (asAtomicDec(RefCount) < 1) {
 		if (callback) callback->Release();
 		reset();
+		drop_hierarchy();
 		delete pf;
 		delete this;
 	}
@@ -66,17 +589,145 @@ void pathfinder::set_callback_function(asIScriptFunction* func) {
 	if (func)
 		callback = func;
 }
+// Costs in the field have the same meaning as values returned from the callback, 0 to 9 from easiest to hardest and 10 or above for impassable. Tiles outside of the field fall back to the callback if one is set, otherwise they are impassable.
+bool pathfinder::set_cost_field(CScriptArray* costs, int x, int y, int z, unsigned int width, unsigned int height, unsigned int depth) {
+	if (!costs || width < 1 || height < 1 || depth < 1 || costs->GetSize() < size_t(width) * height * depth) return false;
+	cost_field.assign((const unsigned char*)costs->GetBuffer(), (const unsigned char*)costs->GetBuffer() + size_t(width) * height * depth);
+	field_x = x;
+	field_y = y;
+	field_z = z;
+	field_width = width;
+	field_height = height;
+	field_depth = depth;
+	count_costs();
+	drop_hierarchy();
+	reset();
+	return true;
+}
+bool pathfinder::set_cost_field(CScriptGrid* costs, int x, int y, int z) {
+	if (!costs || costs->GetWidth() < 1 || costs->GetHeight() < 1) return false;
+	field_x = x;
+	field_y = y;
+	field_z = z;
+	field_width = costs->GetWidth();
+	field_height = costs->GetHeight();
+	field_depth = 1;
+	cost_field.resize(size_t(field_width) * field_height);
+	for (unsigned int gy = 0; gy < field_height; gy++) {
+		for (unsigned int gx = 0; gx < field_width; gx++)
+			cost_field[size_t(gy) * field_width + gx] = *(const unsigned char*)costs->At(gx, gy);
+	}
+	count_costs();
+	drop_hierarchy();
+	reset();
+	return true;
+}
+// Overwrites the part of the field covered by a block of costs whose minimum corner is at the given world coordinates, so that only tiles that changed need to be resent. Costs falling outside of the field are ignored.
+bool pathfinder::update_cost_field(CScriptArray* costs, int x, int y, int z, unsigned int width, unsigned int height, unsigned int depth) {
+	if (!costs || cost_field.empty() || costs->GetSize() < size_t(width) * height * depth) return false;
+	const unsigned char* src = (const unsigned char*)costs->GetBuffer();
+	for (unsigned int uz = 0; uz < depth; uz++) {
+		for (unsigned int uy = 0; uy < height; uy++) {
+			for (unsigned int ux = 0; ux < width; ux++) {
+				unsigned int fx = x + ux - field_x, fy = y + uy - field_y, fz = z + uz - field_z;
+				if (fx < field_width && fy < field_height && fz < field_depth)
+					store_cost((size_t(fz) * field_height + fy) * field_width + fx, src[(size_t(uz) * height + uy) * width + ux]);
+			}
+		}
+	}
+	invalidate_hierarchy(x, y, z, x + int(width) - 1, y + int(height) - 1, z + int(depth) - 1);
+	reset();
+	return true;
+}
+bool pathfinder::update_cost_field(CScriptGrid* costs, int x, int y, int z) {
+	if (!costs || cost_field.empty()) return false;
+	unsigned int fz = z - field_z;
+	if (fz >= field_depth) return true;
+	for (unsigned int uy = 0; uy < costs->GetHeight(); uy++) {
+		for (unsigned int ux = 0; ux < costs->GetWidth(); ux++) {
+			unsigned int fx = x + ux - field_x, fy = y + uy - field_y;
+			if (fx < field_width && fy < field_height)
+				store_cost((size_t(fz) * field_height + fy) * field_width + fx, *(const unsigned char*)costs->At(ux, uy));
+		}
+	}
+	invalidate_hierarchy(x, y, z, x + int(costs->GetWidth()) - 1, y + int(costs->GetHeight()) - 1, z);
+	reset();
+	return true;
+}
+bool pathfinder::set_cost(int x, int y, int z, unsigned char cost) {
+	unsigned int fx = x - field_x, fy = y - field_y, fz = z - field_z;
+	if (fx >= field_width || fy >= field_height || fz >= field_depth) return false;
+	store_cost((size_t(fz) * field_height + fy) * field_width + fx, cost);
+	invalidate_hierarchy(x, y, z, x, y, z);
+	reset();
+	return true;
+}
+int pathfinder::get_cost(int x, int y, int z) {
+	return get_field_cost(x, y, z);
+}
+void pathfinder::clear_cost_field() {
+	std::vector<unsigned char>().swap(cost_field);
+	field_width = field_height = field_depth = 0;
+	count_costs();
+	drop_hierarchy();
+	reset();
+}
+void pathfinder::count_costs() {
+	std::fill(cost_counts, cost_counts + 10, 0);
+	for (unsigned char v : cost_field) {
+		if (v < 10) cost_counts[v]++;
+	}
+}
+void pathfinder::invalidate_hierarchy(int minx, int miny, int minz, int maxx, int maxy, int maxz) {
+	if (hierarchy) hierarchy->mark_dirty(minx, miny, minz, maxx, maxy, maxz);
+}
+void pathfinder::drop_hierarchy() {
+	delete hierarchy;
+	hierarchy = NULL;
+}
+// Smaller clusters make each change to the field cheaper to absorb, larger ones leave fewer entrances to search over long distances.
+void pathfinder::set_cluster_size(unsigned int size) {
+	if (size < 4) size = 4;
+	if (size > 256) size = 256;
+	if (size == cluster_size) return;
+	cluster_size = size;
+	drop_hierarchy();
+}
+unsigned int pathfinder::get_entrance_count() {
+	if (!hierarchical || cost_field.empty() || field_depth != 1) return 0;
+	path_hierarchy* h = get_hierarchy();
+	h->update();
+	return h->get_entrance_count();
+}
+// The hierarchy is built for one desperation_factor, so it starts over whenever that has changed since.
+path_hierarchy* pathfinder::get_hierarchy() {
+	if (hierarchy && hierarchy->desperation != desperation_factor) drop_hierarchy();
+	if (!hierarchy) hierarchy = new path_hierarchy(this);
+	return hierarchy;
+}
 float pathfinder::get_difficulty(void* state) {
-	if (!callback) return FLT_MAX;
+	if (!callback && cost_field.empty()) return FLT_MAX;
 	int x, y, z;
 	decode_state(state, &x, &y, &z);
 	return get_difficulty(x, y, z);
 }
-float pathfinder::get_difficulty(int x, int y, int z) {
+// Callback results are memoized per desperation factor until reset unless cached is false, in which case the callback is always asked and nothing is stored.
+float pathfinder::get_difficulty(int x, int y, int z, bool cached) {
+	if (!cost_field.empty()) {
+		int v = get_field_cost(x, y, z);
+		if (v >= 0) {
+			if (v < 10) v -= desperation_factor;
+			if (v < 0) v = 0;
+			return v < 10 ? v : FLT_MAX;
+		}
+		if (!callback) return FLT_MAX;
+	}
 	hashpoint pt(x, y, z);
-	hashpoint_float_map::iterator n = difficulty_cache[desperation_factor].find(pt);
-	if (n != difficulty_cache[desperation_factor].end())
-		return n->second;
+	if (cached) {
+		hashpoint_float_map::iterator n = difficulty_cache[desperation_factor].find(pt);
+		if (n != difficulty_cache[desperation_factor].end())
+			return n->second;
+	}
 	if (abort) return FLT_MAX;
 	asIScriptContext* ACtx = asGetActiveContext();
 	bool new_context = ACtx == NULL || ACtx->PushState() < 0;
@@ -100,7 +751,7 @@ float pathfinder::get_difficulty(int x, int y, int z) {
 	if (v < 10) v -= desperation_factor;
 	if (v < 0) v = 0;
 	float val = (v < 10 ? v : FLT_MAX);
-	difficulty_cache[desperation_factor][pt] = val;
+	if (cached) difficulty_cache[desperation_factor][pt] = val;
 	if (new_context) g_ScriptEngine->ReturnContext(ctx);
 	else ctx->PopState();
 	return val;
@@ -121,6 +772,139 @@ void pathfinder::reset() {
 		difficulty_cache[i].clear();
 	pf->Reset();
 }
+// Returns the cost every passable tile shares when jump point search can stand in for micropather, or 0 if it can't. That needs a single layer field with nothing beyond it, as a callback could make tiles outside of the field passable and paths through other layers aren't searched.
+float pathfinder::uniform_cost(int start_z, int end_z) {
+	if (!jump_point_search || callback || field_depth != 1 || start_z != field_z || end_z != field_z) return 0;
+	int cost = -1;
+	for (int v = 0; v < 10; v++) {
+		if (!cost_counts[v]) continue;
+		int c = v > desperation_factor ? v - desperation_factor : 0;
+		if (cost >= 0 && c != cost) return 0;
+		cost = c;
+	}
+	return cost + 1;
+}
+bool pathfinder::jump_open(int x, int y) {
+	unsigned int fx = x - field_x, fy = y - field_y;
+	if (fx >= field_width || fy >= field_height || cost_field[size_t(fy) * field_width + fx] > 9) return false;
+	return search_range < 1 || (abs(x - start_x) <= search_range && abs(y - start_y) <= search_range);
+}
+// Moves from (x, y) in a direction until reaching the goal or a tile with a forced neighbour, which becomes a jump point. Diagonal moves also stop where a straight jump from the tile would find one. Diagonal moves may cut corners as they may in AdjacentCost.
+bool pathfinder::jump(int& x, int& y, int dx, int dy, int goal_x, int goal_y) {
+	while (true) {
+		x += dx;
+		y += dy;
+		if (!jump_open(x, y)) return false;
+		if (x == goal_x && y == goal_y) return true;
+		if (dx && dy) {
+			if ((!jump_open(x - dx, y) && jump_open(x - dx, y + dy)) || (!jump_open(x, y - dy) && jump_open(x + dx, y - dy))) return true;
+			int jx = x, jy = y;
+			if (jump(jx, jy, dx, 0, goal_x, goal_y)) return true;
+			jx = x;
+			jy = y;
+			if (jump(jx, jy, 0, dy, goal_x, goal_y)) return true;
+		} else if (dx) {
+			if ((!jump_open(x, y + 1) && jump_open(x + dx, y + 1)) || (!jump_open(x, y - 1) && jump_open(x + dx, y - 1))) return true;
+		} else if ((!jump_open(x + 1, y) && jump_open(x + 1, y + dy)) || (!jump_open(x - 1, y) && jump_open(x - 1, y + dy)))
+			return true;
+	}
+}
+// A* over jump points, which on a field of equal costs finds paths exactly as cheap as micropather's while only putting a handful of tiles in the open list. Fills path with every tile from start to end.
+bool pathfinder::jump_point_find(int start_x, int start_y, int end_x, int end_y, float cost, std::vector<hashpoint>& path) {
+	size_t size = size_t(field_width) * field_height;
+	if (jump_stamp.size() != size) {
+		jump_g.resize(size);
+		jump_parent.resize(size);
+		jump_stamp.assign(size, 0);
+		jump_id = 0;
+	}
+	if (++jump_id == 0) {
+		std::fill(jump_stamp.begin(), jump_stamp.end(), 0);
+		jump_id = 1;
+	}
+	auto tile = [&](int x, int y) -> int {
+		return (y - field_y) * field_width + (x - field_x);
+	};
+	// Octile distance, exact for the moves a jump makes.
+	auto distance = [&](int x0, int y0, int x1, int y1) -> float {
+		int dx = abs(x1 - x0), dy = abs(y1 - y0);
+		return cost * (std::max(dx, dy) - std::min(dx, dy) + 1.41f * std::min(dx, dy));
+	};
+	typedef std::pair<float, int> entry;
+	std::priority_queue<entry, std::vector<entry>, std::greater<entry>> open;
+	int start = tile(start_x, start_y), goal = tile(end_x, end_y);
+	jump_g[start] = 0;
+	jump_parent[start] = -1;
+	jump_stamp[start] = jump_id;
+	open.push(entry(distance(start_x, start_y, end_x, end_y), start));
+	bool found = false;
+	while (!open.empty()) {
+		entry top = open.top();
+		open.pop();
+		int t = top.second;
+		int x = field_x + t % field_width, y = field_y + t / field_width;
+		if (top.first > jump_g[t] + distance(x, y, end_x, end_y)) continue;
+		if (t == goal) {
+			found = true;
+			break;
+		}
+		// Only the natural and forced neighbours of the direction this tile was reached from are worth jumping toward.
+		int directions[8][2], count = 0;
+		if (jump_parent[t] < 0) {
+			for (int i = 0; i < 8; i++) {
+				directions[count][0] = hpa_dx[i];
+				directions[count++][1] = hpa_dy[i];
+			}
+		} else {
+			int px = field_x + jump_parent[t] % field_width, py = field_y + jump_parent[t] / field_width;
+			int dx = (x > px) - (x < px), dy = (y > py) - (y < py);
+			auto add = [&](int ddx, int ddy) {
+				directions[count][0] = ddx;
+				directions[count++][1] = ddy;
+			};
+			if (dx && dy) {
+				add(dx, 0);
+				add(0, dy);
+				add(dx, dy);
+				if (!jump_open(x - dx, y)) add(-dx, dy);
+				if (!jump_open(x, y - dy)) add(dx, -dy);
+			} else if (dx) {
+				add(dx, 0);
+				if (!jump_open(x, y + 1)) add(dx, 1);
+				if (!jump_open(x, y - 1)) add(dx, -1);
+			} else {
+				add(0, dy);
+				if (!jump_open(x + 1, y)) add(1, dy);
+				if (!jump_open(x - 1, y)) add(-1, dy);
+			}
+		}
+		for (int i = 0; i < count; i++) {
+			int jx = x, jy = y;
+			if (!jump(jx, jy, directions[i][0], directions[i][1], end_x, end_y)) continue;
+			int n = tile(jx, jy);
+			float g = jump_g[t] + distance(x, y, jx, jy);
+			if (jump_stamp[n] == jump_id && g >= jump_g[n]) continue;
+			jump_stamp[n] = jump_id;
+			jump_g[n] = g;
+			jump_parent[n] = t;
+			open.push(entry(g + distance(jx, jy, end_x, end_y), n));
+		}
+	}
+	if (!found) return false;
+	total_cost = jump_g[goal];
+	// Jump points are joined by straight or diagonal lines, so fill in the tiles between them.
+	for (int t = goal; t >= 0; t = jump_parent[t]) {
+		int x = field_x + t % field_width, y = field_y + t / field_width;
+		path.push_back(hashpoint(x, y, field_z));
+		if (jump_parent[t] < 0) break;
+		int px = field_x + jump_parent[t] % field_width, py = field_y + jump_parent[t] / field_width;
+		int dx = (px > x) - (px < x), dy = (py > y) - (py < y);
+		for (x += dx, y += dy; x != px || y != py; x += dx, y += dy)
+			path.push_back(hashpoint(x, y, field_z));
+	}
+	std::reverse(path.begin(), path.end());
+	return true;
+}
 CScriptArray* pathfinder::find(int start_x, int start_y, int start_z, int end_x, int end_y, int end_z, CScriptAny* data) {
 	if (!VectorArrayType)
 		VectorArrayType = g_ScriptEngine->GetTypeInfoByDecl("array<vector>");
@@ -129,16 +913,37 @@ CScriptArray* pathfinder::find(int start_x, int start_y, int start_z, int end_x,
 	abort = false;
 	must_reset = false;
 	total_cost = 0;
-	if (!callback)
+	if (!callback && cost_field.empty())
 		return array;
 	if (search_range > 0 && allow_diagonals && sqrtf(powf(end_x - start_x, 2) + powf(end_y - start_y, 2) + powf(end_z - start_z, 2)) > search_range || search_range > 0 && !allow_diagonals && (fabs(end_x - start_x) + fabs(end_y - start_y) + fabs(end_z - start_z)) > search_range) return array;
 	if (automatic_reset) reset();
 	callback_data = data;
 	if (get_difficulty(start_x, start_y, start_z) > 9 || get_difficulty(end_x, end_y, end_z) > 9) return array;
-	void* start = encode_state(start_x, start_y, start_z, desperation_factor);
 	this->start_x = start_x;
 	this->start_y = start_y;
 	this->start_z = start_z;
+	// Jump point and hierarchical searches only read the cost field, and hierarchical searches stay within it. The hierarchy only links layers through straight vertical moves, so fields with more than one layer are left to micropather.
+	float uniform = uniform_cost(start_z, end_z);
+	if (uniform > 0 || (hierarchical && !cost_field.empty() && field_depth == 1)) {
+		std::vector<hashpoint> path;
+		bool found;
+		if (uniform > 0) found = jump_point_find(start_x, start_y, end_x, end_y, uniform, path);
+		else found = get_hierarchy()->find(start_x, start_y, start_z, end_x, end_y, end_z, path, total_cost);
+		callback_data = NULL;
+		if (data) data->Release();
+		if (!found) {
+			total_cost = 0;
+			return array;
+		}
+		array->Reserve(path.size());
+		for (const hashpoint& p : path) {
+			Vector3 v;
+			v.setValue(p.x, p.y, p.z);
+			array->InsertLast(&v);
+		}
+		return array;
+	}
+	void* start = encode_state(start_x, start_y, start_z, desperation_factor);
 	void* end = encode_state(end_x, end_y, end_z, desperation_factor);
 	micropather::MPVector<void*> path;
 	solving = true;
@@ -207,9 +1012,611 @@ void pathfinder::AdjacentCost(void* node, micropather::MPVector<micropather::Sta
 	}
 }
 
+// Per worker scratch space for path_service searches, sized to the field and reused across searches. Tiles are marked with the id of the search that last touched them so that nothing needs clearing between searches.
+class path_search {
+	path_service* s;
+	std::vector<float> dist;
+	std::vector<int> parent;
+	std::vector<unsigned int> stamp;
+	unsigned int search_id;
+public:
+	path_search(path_service* service) : s(service), search_id(0) {}
+	size_t index(int x, int y, int z) {
+		return (size_t(z - s->field_z) * s->field_height + (y - s->field_y)) * s->field_width + (x - s->field_x);
+	}
+	// The cost of stepping onto a tile under a profile, or FLT_MAX if the tile can't be entered.
+	float tile_cost(int x, int y, int z, const path_profile& p) {
+		unsigned int fx = x - s->field_x, fy = y - s->field_y, fz = z - s->field_z;
+		if (fx >= s->field_width || fy >= s->field_height || fz >= s->field_depth) return FLT_MAX;
+		int v = s->cost_field[(size_t(fz) * s->field_height + fy) * s->field_width + fx];
+		if (v > 9) return FLT_MAX;
+		v -= p.desperation_factor;
+		return (v < 0 ? 0 : v) + 1;
+	}
+	// Searches outward from the group's goal until every request's start has been reached, so the path of each request is found by following parents back toward the goal. A lone request uses its start as an A* target.
+	void solve(path_group& g, const path_profile& p) {
+		if (p.search_range > 0 && g.requests.size() > 1) {
+			// Each request may only search the region around its own start, so they can't share one search.
+			for (path_request* r : g.requests) {
+				path_group single = {g.goal, {r}};
+				solve(single, p);
+			}
+			return;
+		}
+		const path_key& goal = g.goal;
+		size_t size = size_t(s->field_width) * s->field_height * s->field_depth;
+		if (dist.size() < size) {
+			dist.resize(size);
+			parent.resize(size);
+			stamp.assign(size, 0);
+			search_id = 0;
+		}
+		if (++search_id == 0) {
+			std::fill(stamp.begin(), stamp.end(), 0);
+			search_id = 1;
+		}
+		for (path_request* r : g.requests) {
+			r->path.clear();
+			r->cost = FLT_MAX;
+		}
+		if (tile_cost(goal.goal_x, goal.goal_y, goal.goal_z, p) == FLT_MAX) return;
+		std::vector<path_request*> waiting;
+		for (path_request* r : g.requests) {
+			float dx = goal.goal_x - r->start_x, dy = goal.goal_y - r->start_y, dz = goal.goal_z - r->start_z;
+			bool in_range = p.search_range < 1 || (p.allow_diagonals ? sqrtf(dx * dx + dy * dy + dz * dz) : fabs(dx) + fabs(dy) + fabs(dz)) <= p.search_range; // The same test pathfinder::find makes.
+			if (in_range && tile_cost(r->start_x, r->start_y, r->start_z, p) != FLT_MAX) waiting.push_back(r);
+		}
+		if (waiting.empty()) return;
+		path_request* target = waiting.size() == 1 ? waiting[0] : NULL;
+		auto estimate = [&](int x, int y, int z) -> float {
+			if (!target) return 0.0f;
+			float dx = target->start_x - x, dy = target->start_y - y, dz = target->start_z - z;
+			return p.allow_diagonals ? sqrtf(dx * dx + dy * dy + dz * dz) : fabs(dx) + fabs(dy) + fabs(dz);
+		};
+		typedef std::pair<float, size_t> entry;
+		std::priority_queue<entry, std::vector<entry>, std::greater<entry>> open;
+		size_t source = index(goal.goal_x, goal.goal_y, goal.goal_z);
+		dist[source] = 0;
+		parent[source] = -1;
+		stamp[source] = search_id;
+		open.push(entry(estimate(goal.goal_x, goal.goal_y, goal.goal_z), source));
+		std::unordered_map<size_t, bool> starts; // Tile index:whether the search has settled it
+		for (path_request* r : waiting)
+			starts[index(r->start_x, r->start_y, r->start_z)] = false;
+		size_t unreached = starts.size();
+		const int dx[18] = {1, 1, 0, -1, -1, -1, 0, 1, 0, 0, 1, -1, 0, 0, 1, -1, 0, 0};
+		const int dy[18] = {0, 1, 1, 1, 0, -1, -1, -1, 0, 0, 0, 0, 1, -1, 0, 0, 1, -1};
+		const int dz[18] = {0, 0, 0, 0, 0, 0, 0, 0, 1, -1, 1, 1, 1, 1, -1, -1, -1, -1};
+		const float multiplier[18] = {1.0f, 1.41f, 1.0f, 1.41f, 1.0f, 1.41f, 1.0f, 1.41f, 1.0f, 1.0f, 1.41f, 1.41f, 1.41f, 1.41f, 1.41f, 1.41f, 1.41f, 1.41f};
+		while (!open.empty()) {
+			entry top = open.top();
+			open.pop();
+			size_t t = top.second;
+			int x = s->field_x + t % s->field_width, y = s->field_y + t / s->field_width % s->field_height, z = s->field_z + t / (size_t(s->field_width) * s->field_height);
+			if (top.first > dist[t] + estimate(x, y, z)) continue;
+			auto start = starts.find(t);
+			if (start != starts.end() && !start->second) {
+				start->second = true;
+				if (--unreached == 0) break;
+			}
+			float step = tile_cost(x, y, z, p);
+			for (int i = 0; i < 18; i++) {
+				int nx = x + dx[i], ny = y + dy[i], nz = z + dz[i];
+				if (p.search_range > 0 && (abs(nx - target->start_x) > p.search_range || abs(ny - target->start_y) > p.search_range || abs(nz - target->start_z) > p.search_range)) continue; // target is set whenever search_range is, see above.
+				if (tile_cost(nx, ny, nz, p) == FLT_MAX) continue;
+				size_t n = index(nx, ny, nz);
+				float d = dist[t] + step * multiplier[i];
+				if (stamp[n] == search_id && d >= dist[n]) continue;
+				stamp[n] = search_id;
+				dist[n] = d;
+				parent[n] = t;
+				open.push(entry(d + estimate(nx, ny, nz), n));
+			}
+		}
+		for (path_request* r : waiting) {
+			size_t t = index(r->start_x, r->start_y, r->start_z);
+			if (!starts[t]) continue;
+			r->cost = dist[t];
+			for (size_t n = t;; n = parent[n]) {
+				r->path.push_back(hashpoint(s->field_x + n % s->field_width, s->field_y + n / s->field_width % s->field_height, s->field_z + n / (size_t(s->field_width) * s->field_height)));
+				if (n == source) break;
+			}
+		}
+	}
+};
+path_service::path_service(unsigned int threads) : RefCount(1), next_id(1), pending(0), generation(0), stopping(false), field_x(0), field_y(0), field_z(0), field_width(0), field_height(0), field_depth(0), cache_capacity(4096), cache_hits(0) {
+	profiles.push_back({0, true, 0});
+	if (threads == 0) threads = std::max(1, int(Poco::Environment::processorCount()) - 1);
+	this->threads = threads;
+	pool = new Poco::ThreadPool(threads, threads);
+	for (unsigned int i = 0; i < threads; i++)
+		pool->start(*this);
+}
+path_service::~path_service() {
+	{
+		Poco::FastMutex::ScopedLock lock(mutex);
+		stopping = true;
+		wake.broadcast();
+	}
+	pool->joinAll();
+	delete pool;
+	for (auto& r : requests) {
+		if (r.second->callback) r.second->callback->Release();
+		delete r.second;
+	}
+}
+void path_service::AddRef() {
+	asAtomicInc(RefCount);
+}
+void path_service::Release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+void path_service::run() {
+	path_search search(this);
+	while (true) {
+		path_group g;
+		path_profile p;
+		{
+			Poco::FastMutex::ScopedLock lock(mutex);
+			while (!stopping && queue.empty())
+				wake.wait(mutex);
+			if (stopping) return;
+			g = std::move(queue.front());
+			queue.pop_front();
+			queued_goals.erase(g.goal);
+			p = profiles[g.goal.profile];
+		}
+		unsigned int search_generation;
+		{
+			Poco::ScopedReadRWLock lock(field_lock);
+			search_generation = generation;
+			if (!cost_field.empty()) search.solve(g, p);
+		}
+		Poco::FastMutex::ScopedLock lock(mutex);
+		for (path_request* r : g.requests)
+			finish(r, true, search_generation);
+	}
+}
+unsigned int path_service::get_cache_capacity() {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	return cache_capacity;
+}
+void path_service::set_cache_capacity(unsigned int capacity) {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	cache_capacity = capacity;
+	if (cache.size() > capacity) cache.clear();
+}
+// Publishes a solved request, called with mutex held.
+void path_service::finish(path_request* r, bool cacheable, unsigned int search_generation) {
+	pending--;
+	if (r->cancelled) {
+		delete r;
+		return;
+	}
+	r->done = true;
+	if (r->callback) completed.push_back(r->id);
+	if (!cacheable || search_generation != generation || cache_capacity < 1) return;
+	if (cache.size() >= cache_capacity) cache.clear();
+	path_key k = {r->start_x, r->start_y, r->start_z, r->goal_x, r->goal_y, r->goal_z, r->profile};
+	cache[k] = std::make_pair(r->path, r->cost);
+}
+// Called with field_lock held for writing, so no search can be running against the old field.
+void path_service::field_changed() {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	generation++;
+	cache.clear();
+}
+bool path_service::set_cost_field(CScriptArray* costs, int x, int y, int z, unsigned int width, unsigned int height, unsigned int depth) {
+	if (!costs || width < 1 || height < 1 || depth < 1 || costs->GetSize() < size_t(width) * height * depth) return false;
+	Poco::ScopedWriteRWLock lock(field_lock);
+	cost_field.assign((const unsigned char*)costs->GetBuffer(), (const unsigned char*)costs->GetBuffer() + size_t(width) * height * depth);
+	field_x = x;
+	field_y = y;
+	field_z = z;
+	field_width = width;
+	field_height = height;
+	field_depth = depth;
+	field_changed();
+	return true;
+}
+bool path_service::set_cost_field(CScriptGrid* costs, int x, int y, int z) {
+	if (!costs || costs->GetWidth() < 1 || costs->GetHeight() < 1) return false;
+	Poco::ScopedWriteRWLock lock(field_lock);
+	field_x = x;
+	field_y = y;
+	field_z = z;
+	field_width = costs->GetWidth();
+	field_height = costs->GetHeight();
+	field_depth = 1;
+	cost_field.resize(size_t(field_width) * field_height);
+	for (unsigned int gy = 0; gy < field_height; gy++) {
+		for (unsigned int gx = 0; gx < field_width; gx++)
+			cost_field[size_t(gy) * field_width + gx] = *(const unsigned char*)costs->At(gx, gy);
+	}
+	field_changed();
+	return true;
+}
+bool path_service::update_cost_field(CScriptArray* costs, int x, int y, int z, unsigned int width, unsigned int height, unsigned int depth) {
+	if (!costs || costs->GetSize() < size_t(width) * height * depth) return false;
+	Poco::ScopedWriteRWLock lock(field_lock);
+	if (cost_field.empty()) return false;
+	const unsigned char* src = (const unsigned char*)costs->GetBuffer();
+	for (unsigned int uz = 0; uz < depth; uz++) {
+		for (unsigned int uy = 0; uy < height; uy++) {
+			for (unsigned int ux = 0; ux < width; ux++) {
+				unsigned int fx = x + ux - field_x, fy = y + uy - field_y, fz = z + uz - field_z;
+				if (fx < field_width && fy < field_height && fz < field_depth)
+					cost_field[(size_t(fz) * field_height + fy) * field_width + fx] = src[(size_t(uz) * height + uy) * width + ux];
+			}
+		}
+	}
+	field_changed();
+	return true;
+}
+bool path_service::update_cost_field(CScriptGrid* costs, int x, int y, int z) {
+	if (!costs) return false;
+	Poco::ScopedWriteRWLock lock(field_lock);
+	if (cost_field.empty()) return false;
+	unsigned int fz = z - field_z;
+	if (fz >= field_depth) return true;
+	for (unsigned int uy = 0; uy < costs->GetHeight(); uy++) {
+		for (unsigned int ux = 0; ux < costs->GetWidth(); ux++) {
+			unsigned int fx = x + ux - field_x, fy = y + uy - field_y;
+			if (fx < field_width && fy < field_height)
+				cost_field[(size_t(fz) * field_height + fy) * field_width + fx] = *(const unsigned char*)costs->At(ux, uy);
+		}
+	}
+	field_changed();
+	return true;
+}
+bool path_service::set_cost(int x, int y, int z, unsigned char cost) {
+	Poco::ScopedWriteRWLock lock(field_lock);
+	unsigned int fx = x - field_x, fy = y - field_y, fz = z - field_z;
+	if (fx >= field_width || fy >= field_height || fz >= field_depth) return false;
+	cost_field[(size_t(fz) * field_height + fy) * field_width + fx] = cost;
+	field_changed();
+	return true;
+}
+int path_service::get_cost(int x, int y, int z) {
+	Poco::ScopedReadRWLock lock(field_lock);
+	unsigned int fx = x - field_x, fy = y - field_y, fz = z - field_z;
+	if (fx >= field_width || fy >= field_height || fz >= field_depth) return -1;
+	return cost_field[(size_t(fz) * field_height + fy) * field_width + fx];
+}
+// Profile 0 always exists with the defaults of a new pathfinder.
+unsigned int path_service::add_profile(int desperation_factor, bool allow_diagonals, int search_range) {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	profiles.push_back({desperation_factor < 0 ? 0 : desperation_factor > 10 ? 10 : desperation_factor, allow_diagonals, search_range});
+	return profiles.size() - 1;
+}
+// Returns an id for the request, or 0 if the profile doesn't exist. Requests answered from the cache are ready immediately, though their callbacks still wait for the next dispatch.
+unsigned int path_service::request(int start_x, int start_y, int start_z, int goal_x, int goal_y, int goal_z, unsigned int profile, asIScriptFunction* callback) {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	if (profile >= profiles.size()) {
+		if (callback) callback->Release();
+		return 0;
+	}
+	path_request* r = new path_request();
+	r->id = next_id++;
+	if (next_id == 0) next_id = 1;
+	r->start_x = start_x;
+	r->start_y = start_y;
+	r->start_z = start_z;
+	r->goal_x = goal_x;
+	r->goal_y = goal_y;
+	r->goal_z = goal_z;
+	r->profile = profile;
+	r->callback = callback;
+	r->cost = FLT_MAX;
+	r->done = false;
+	r->cancelled = false;
+	requests[r->id] = r;
+	pending++;
+	path_key k = {start_x, start_y, start_z, goal_x, goal_y, goal_z, profile};
+	auto cached = cache.find(k);
+	if (cached != cache.end()) {
+		r->path = cached->second.first;
+		r->cost = cached->second.second;
+		cache_hits++;
+		finish(r, false, generation);
+		return r->id;
+	}
+	path_key goal = {0, 0, 0, goal_x, goal_y, goal_z, profile};
+	auto queued = queued_goals.find(goal);
+	if (queued != queued_goals.end()) queued->second->requests.push_back(r);
+	else {
+		queue.push_back(path_group());
+		queue.back().goal = goal;
+		queue.back().requests.push_back(r);
+		queued_goals[goal] = std::prev(queue.end());
+		wake.signal();
+	}
+	return r->id;
+}
+// Forgets a request whether or not it has been solved, returning false for unknown ids.
+bool path_service::cancel(unsigned int id) {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	auto it = requests.find(id);
+	if (it == requests.end()) return false;
+	path_request* r = it->second;
+	requests.erase(it);
+	if (r->callback) r->callback->Release();
+	r->callback = NULL;
+	if (r->done) {
+		delete r;
+		return true;
+	}
+	path_key goal = {0, 0, 0, r->goal_x, r->goal_y, r->goal_z, r->profile};
+	auto queued = queued_goals.find(goal);
+	if (queued != queued_goals.end()) {
+		std::vector<path_request*>& group = queued->second->requests;
+		auto pos = std::find(group.begin(), group.end(), r);
+		if (pos != group.end()) {
+			group.erase(pos);
+			if (group.empty()) {
+				queue.erase(queued->second);
+				queued_goals.erase(queued);
+			}
+			pending--;
+			delete r;
+			return true;
+		}
+	}
+	r->cancelled = true; // A worker is solving it.
+	return true;
+}
+bool path_service::is_pending(unsigned int id) {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	auto it = requests.find(id);
+	return it != requests.end() && !it->second->done;
+}
+bool path_service::is_ready(unsigned int id) {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	auto it = requests.find(id);
+	return it != requests.end() && it->second->done;
+}
+// Takes the result of a finished request, which is then forgotten. The path is empty if the request failed or isn't ready, in which case cost is 0 and the request is kept.
+CScriptArray* path_service::get_path(unsigned int id, float* cost) {
+	if (!VectorArrayType)
+		VectorArrayType = g_ScriptEngine->GetTypeInfoByDecl("array<vector>");
+	CScriptArray* array = CScriptArray::Create(VectorArrayType);
+	if (cost) *cost = 0;
+	path_request* r;
+	{
+		Poco::FastMutex::ScopedLock lock(mutex);
+		auto it = requests.find(id);
+		if (it == requests.end() || !it->second->done) return array;
+		r = it->second;
+		requests.erase(it);
+	}
+	if (cost && !r->path.empty()) *cost = r->cost;
+	array->Reserve(r->path.size());
+	for (const hashpoint& p : r->path) {
+		Vector3 v;
+		v.setValue(p.x, p.y, p.z);
+		array->InsertLast(&v);
+	}
+	if (r->callback) r->callback->Release();
+	delete r;
+	return array;
+}
+// Calls the callbacks of up to max finished requests (0 for all of them) on the calling thread, returning how many were called. Each request is forgotten once its callback returns.
+unsigned int path_service::dispatch(unsigned int max) {
+	std::vector<unsigned int> ids;
+	{
+		Poco::FastMutex::ScopedLock lock(mutex);
+		size_t count = max > 0 && max < completed.size() ? max : completed.size();
+		ids.assign(completed.begin(), completed.begin() + count);
+		completed.erase(completed.begin(), completed.begin() + count);
+	}
+	unsigned int called = 0;
+	for (unsigned int id : ids) {
+		asIScriptFunction* callback;
+		{
+			Poco::FastMutex::ScopedLock lock(mutex);
+			auto it = requests.find(id);
+			if (it == requests.end() || !it->second->callback) continue; // Cancelled or already taken with get_path.
+			callback = it->second->callback;
+			it->second->callback = NULL;
+		}
+		float cost;
+		CScriptArray* path = get_path(id, &cost);
+		asIScriptContext* ACtx = asGetActiveContext();
+		bool new_context = ACtx == NULL || ACtx->PushState() < 0;
+		asIScriptContext* ctx = (new_context ? g_ScriptEngine->RequestContext() : ACtx);
+		if (ctx && ctx->Prepare(callback) >= 0) {
+			ctx->SetArgDWord(0, id);
+			ctx->SetArgObject(1, path);
+			ctx->SetArgFloat(2, cost);
+			ctx->Execute();
+			called++;
+		}
+		if (ctx) {
+			if (new_context) g_ScriptEngine->ReturnContext(ctx);
+			else ctx->PopState();
+		}
+		path->Release();
+		callback->Release();
+	}
+	return called;
+}
+void path_service::clear_cache() {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	cache.clear();
+}
+unsigned int path_service::get_pending_count() {
+	Poco::FastMutex::ScopedLock lock(mutex);
+	return pending;
+}
+
+// The moves of pathfinder::AdjacentCost.
+static const int flow_dx[18] = {1, 1, 0, -1, -1, -1, 0, 1, 0, 0, 1, -1, 0, 0, 1, -1, 0, 0};
+static const int flow_dy[18] = {0, 1, 1, 1, 0, -1, -1, -1, 0, 0, 0, 0, 1, -1, 0, 0, 1, -1};
+static const int flow_dz[18] = {0, 0, 0, 0, 0, 0, 0, 0, 1, -1, 1, 1, 1, 1, -1, -1, -1, -1};
+static const float flow_cost[18] = {1.0f, 1.41f, 1.0f, 1.41f, 1.0f, 1.41f, 1.0f, 1.41f, 1.0f, 1.0f, 1.41f, 1.41f, 1.41f, 1.41f, 1.41f, 1.41f, 1.41f, 1.41f};
+flow_field::flow_field() : RefCount(1), source(NULL), min_x(0), min_y(0), min_z(0), width(0), height(0), depth(0), sweep_id(0), goal_x(0), goal_y(0), goal_z(0), ready(false) {}
+flow_field::~flow_field() {
+	if (source) source->Release();
+}
+void flow_field::AddRef() {
+	asAtomicInc(RefCount);
+}
+void flow_field::Release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+// Costs are read past the pathfinder's difficulty cache, which would otherwise hand refresh the values from before the world changed and grow by an entry for every tile of the field.
+void flow_field::load_costs() {
+	for (unsigned int z = 0; z < depth; z++) {
+		for (unsigned int y = 0; y < height; y++) {
+			for (unsigned int x = 0; x < width; x++) {
+				float d = source->get_difficulty(min_x + int(x), min_y + int(y), min_z + int(z), false);
+				costs[(size_t(z) * height + y) * width + x] = d > 9 ? FLT_MAX : d + 1;
+			}
+		}
+	}
+}
+// Dijkstra's algorithm outward from the goal. When previous_goal is a tile, the integration field still holds distances to it, and any tile's old distance plus the cost of getting from the previous goal to the new one is a distance the tile can certainly achieve. Once the sweep has settled the previous goal it only continues through tiles it can bring below that bound, which for a goal that moved a short way leaves much of the region untouched.
+void flow_field::solve(size_t previous_goal) {
+	if (++sweep_id == 0) {
+		std::fill(stamp.begin(), stamp.end(), 0);
+		sweep_id = 1;
+	}
+	float offset = FLT_MAX; // Cost from the previous goal to the new one once known.
+	auto bound = [&](size_t t) -> float {
+		return offset == FLT_MAX || integration[t] == FLT_MAX ? FLT_MAX : integration[t] + offset;
+	};
+	typedef std::pair<float, size_t> entry;
+	std::priority_queue<entry, std::vector<entry>, std::greater<entry>> open;
+	size_t goal = index(goal_x, goal_y, goal_z);
+	if (costs[goal] != FLT_MAX) {
+		wave[goal] = 0;
+		wave_next[goal] = -1;
+		stamp[goal] = sweep_id;
+		open.push(entry(0.0f, goal));
+	}
+	while (!open.empty()) {
+		entry top = open.top();
+		open.pop();
+		size_t t = top.second;
+		if (top.first > wave[t]) continue;
+		if (t == previous_goal) offset = wave[t];
+		else if (wave[t] >= bound(t)) continue;
+		int x = t % width, y = t / width % height, z = t / (size_t(width) * height);
+		for (int i = 0; i < 18; i++) {
+			unsigned int nx = x + flow_dx[i], ny = y + flow_dy[i], nz = z + flow_dz[i];
+			if (nx >= width || ny >= height || nz >= depth) continue;
+			size_t n = (size_t(nz) * height + ny) * width + nx;
+			if (costs[n] == FLT_MAX) continue;
+			float d = wave[t] + costs[t] * flow_cost[i];
+			if ((stamp[n] == sweep_id && d >= wave[n]) || d >= bound(n)) continue;
+			stamp[n] = sweep_id;
+			wave[n] = d;
+			wave_next[n] = t;
+			open.push(entry(d, n));
+		}
+	}
+	// Tiles the sweep improved on take its result, the rest keep their old direction which still leads through the previous goal.
+	for (size_t t = 0; t < integration.size(); t++) {
+		float b = bound(t);
+		if (stamp[t] == sweep_id && wave[t] <= b) {
+			integration[t] = wave[t];
+			next[t] = wave_next[t];
+		} else if (b != FLT_MAX)
+			integration[t] = b;
+		else {
+			integration[t] = FLT_MAX;
+			next[t] = -1;
+		}
+	}
+}
+// Builds the field for a goal within the given bounds, inclusive, returning false if the bounds are empty or too large or the goal is outside them. The field holds onto the pathfinder so that it can be refreshed, and a goal that can't be entered simply leaves every tile unreachable.
+bool flow_field::build(pathfinder* source, int goal_x, int goal_y, int goal_z, int min_x, int min_y, int min_z, int max_x, int max_y, int max_z) {
+	if (this->source) this->source->Release();
+	this->source = source;
+	ready = false;
+	if (!source || max_x < min_x || max_y < min_y || max_z < min_z) return false;
+	uint64_t count = uint64_t(max_x - min_x + 1) * (max_y - min_y + 1) * (max_z - min_z + 1);
+	if (count > 0x1000000) return false;
+	this->min_x = min_x;
+	this->min_y = min_y;
+	this->min_z = min_z;
+	width = max_x - min_x + 1;
+	height = max_y - min_y + 1;
+	depth = max_z - min_z + 1;
+	if (index(goal_x, goal_y, goal_z) == SIZE_MAX) return false;
+	this->goal_x = goal_x;
+	this->goal_y = goal_y;
+	this->goal_z = goal_z;
+	costs.resize(count);
+	integration.assign(count, FLT_MAX);
+	next.assign(count, -1);
+	wave.resize(count);
+	wave_next.resize(count);
+	stamp.assign(count, 0);
+	sweep_id = 0;
+	load_costs();
+	solve(SIZE_MAX);
+	ready = true;
+	return true;
+}
+// Moves the goal without reading tile costs again, reusing as much of the current field as the move allows. Returns false if the new goal is outside of the field's bounds.
+bool flow_field::move_goal(int x, int y, int z) {
+	if (!ready || index(x, y, z) == SIZE_MAX) return false;
+	if (x == goal_x && y == goal_y && z == goal_z) return true;
+	size_t previous = index(goal_x, goal_y, goal_z);
+	goal_x = x;
+	goal_y = y;
+	goal_z = z;
+	solve(integration[previous] == 0 ? previous : SIZE_MAX);
+	return true;
+}
+// Reads every tile's cost from the pathfinder again and rebuilds the field, for when the world has changed.
+bool flow_field::refresh() {
+	if (!ready) return false;
+	load_costs();
+	std::fill(integration.begin(), integration.end(), FLT_MAX);
+	solve(SIZE_MAX);
+	return true;
+}
+// Returns the cost of reaching the goal from a tile, or -1 if the goal can't be reached from it.
+float flow_field::get_distance(int x, int y, int z) {
+	size_t t = ready ? index(x, y, z) : SIZE_MAX;
+	return t == SIZE_MAX || integration[t] == FLT_MAX ? -1 : integration[t];
+}
+// Returns the tile to step to from the given one, or the given tile itself at the goal or where the goal can't be reached.
+Vector3 flow_field::get_next(int x, int y, int z) {
+	size_t t = ready ? index(x, y, z) : SIZE_MAX;
+	Vector3 v;
+	if (t == SIZE_MAX || next[t] < 0) v.setValue(x, y, z);
+	else v.setValue(min_x + next[t] % int(width), min_y + next[t] / int(width) % int(height), min_z + next[t] / int(width * height));
+	return v;
+}
+// Returns the full path from a tile to the goal in the form pathfinder::find does, empty if the goal can't be reached.
+CScriptArray* flow_field::get_path(int x, int y, int z) {
+	if (!VectorArrayType)
+		VectorArrayType = g_ScriptEngine->GetTypeInfoByDecl("array<vector>");
+	CScriptArray* array = CScriptArray::Create(VectorArrayType);
+	size_t t = ready ? index(x, y, z) : SIZE_MAX;
+	if (t == SIZE_MAX || integration[t] == FLT_MAX) return array;
+	for (int n = t; n >= 0; n = next[n]) {
+		Vector3 v;
+		v.setValue(min_x + n % int(width), min_y + n / int(width) % int(height), min_z + n / int(width * height));
+		array->InsertLast(&v);
+	}
+	return array;
+}
+
 pathfinder* new_pathfinder(int size, bool cache) {
 	return new pathfinder(size, cache);
 }
+path_service* new_path_service(unsigned int threads) {
+	return new path_service(threads);
+}
+flow_field* new_flow_field() {
+	return new flow_field();
+}
 void RegisterScriptPathfinder(asIScriptEngine* engine) {
 	engine->RegisterObjectType("pathfinder", 0, asOBJ_REF);
 	engine->RegisterObjectBehaviour("pathfinder", asBEHAVE_FACTORY, "pathfinder @p(int = 1024, bool = true)", asFUNCTION(new_pathfinder), asCALL_CDECL);
@@ -221,9 +1628,60 @@ void RegisterScriptPathfinder(asIScriptEngine* engine) {
 	engine->RegisterObjectProperty("pathfinder", "bool allow_diagonals", asOFFSET(pathfinder, allow_diagonals));
 	engine->RegisterObjectProperty("pathfinder", "bool automatic_reset", asOFFSET(pathfinder, automatic_reset));
 	engine->RegisterObjectProperty("pathfinder", "int search_range", asOFFSET(pathfinder, search_range));
+	engine->RegisterObjectProperty("pathfinder", "bool hierarchical", asOFFSET(pathfinder, hierarchical));
+	engine->RegisterObjectProperty("pathfinder", "bool jump_point_search", asOFFSET(pathfinder, jump_point_search));
+	engine->RegisterObjectMethod("pathfinder", "uint get_cluster_size() property", asMETHOD(pathfinder, get_cluster_size), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "void set_cluster_size(uint) property", asMETHOD(pathfinder, set_cluster_size), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "uint get_entrance_count() property", asMETHOD(pathfinder, get_entrance_count), asCALL_THISCALL);
 	engine->RegisterFuncdef("int pathfinder_callback(int, int, int, any@ = null)");
 	engine->RegisterObjectMethod("pathfinder", "void set_callback_function(pathfinder_callback@)", asMETHOD(pathfinder, set_callback_function), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "bool set_cost_field(const uint8[]&in, int, int, int, uint, uint, uint = 1)", asMETHODPR(pathfinder, set_cost_field, (CScriptArray*, int, int, int, unsigned int, unsigned int, unsigned int), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "bool set_cost_field(const grid<uint8>&in, int, int, int = 0)", asMETHODPR(pathfinder, set_cost_field, (CScriptGrid*, int, int, int), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "bool update_cost_field(const uint8[]&in, int, int, int, uint, uint, uint = 1)", asMETHODPR(pathfinder, update_cost_field, (CScriptArray*, int, int, int, unsigned int, unsigned int, unsigned int), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "bool update_cost_field(const grid<uint8>&in, int, int, int = 0)", asMETHODPR(pathfinder, update_cost_field, (CScriptGrid*, int, int, int), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "bool set_cost(int, int, int, uint8)", asMETHOD(pathfinder, set_cost), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "int get_cost(int, int, int)", asMETHOD(pathfinder, get_cost), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "void clear_cost_field()", asMETHOD(pathfinder, clear_cost_field), asCALL_THISCALL);
+	engine->RegisterObjectMethod("pathfinder", "bool get_has_cost_field() property", asMETHOD(pathfinder, has_cost_field), asCALL_THISCALL);
 	engine->RegisterObjectMethod("pathfinder", "void cancel()", asMETHOD(pathfinder, cancel), asCALL_THISCALL);
 	engine->RegisterObjectMethod("pathfinder", "void reset()", asMETHOD(pathfinder, reset), asCALL_THISCALL);
 	engine->RegisterObjectMethod("pathfinder", "vector[]@ find(int, int, int, int, int, int, any@ = null)", asMETHOD(pathfinder, find), asCALL_THISCALL);
+	engine->RegisterObjectType("path_service", 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour("path_service", asBEHAVE_FACTORY, "path_service @s(uint = 0)", asFUNCTION(new_path_service), asCALL_CDECL);
+	engine->RegisterObjectBehaviour("path_service", asBEHAVE_ADDREF, "void f()", asMETHOD(path_service, AddRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour("path_service", asBEHAVE_RELEASE, "void f()", asMETHOD(path_service, Release), asCALL_THISCALL);
+	engine->RegisterFuncdef("void path_callback(uint, vector[]@, float)");
+	engine->RegisterObjectMethod("path_service", "uint get_cache_capacity() property", asMETHOD(path_service, get_cache_capacity), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "void set_cache_capacity(uint) property", asMETHOD(path_service, set_cache_capacity), asCALL_THISCALL);
+	engine->RegisterObjectProperty("path_service", "const uint cache_hits", asOFFSET(path_service, cache_hits));
+	engine->RegisterObjectMethod("path_service", "bool set_cost_field(const uint8[]&in, int, int, int, uint, uint, uint = 1)", asMETHODPR(path_service, set_cost_field, (CScriptArray*, int, int, int, unsigned int, unsigned int, unsigned int), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "bool set_cost_field(const grid<uint8>&in, int, int, int = 0)", asMETHODPR(path_service, set_cost_field, (CScriptGrid*, int, int, int), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "bool update_cost_field(const uint8[]&in, int, int, int, uint, uint, uint = 1)", asMETHODPR(path_service, update_cost_field, (CScriptArray*, int, int, int, unsigned int, unsigned int, unsigned int), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "bool update_cost_field(const grid<uint8>&in, int, int, int = 0)", asMETHODPR(path_service, update_cost_field, (CScriptGrid*, int, int, int), bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "bool set_cost(int, int, int, uint8)", asMETHOD(path_service, set_cost), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "int get_cost(int, int, int)", asMETHOD(path_service, get_cost), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "uint add_profile(int desperation_factor = 0, bool allow_diagonals = true, int search_range = 0)", asMETHOD(path_service, add_profile), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "uint request(int, int, int, int, int, int, uint profile = 0, path_callback@ callback = null)", asMETHOD(path_service, request), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "bool cancel(uint)", asMETHOD(path_service, cancel), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "bool is_pending(uint)", asMETHOD(path_service, is_pending), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "bool is_ready(uint)", asMETHOD(path_service, is_ready), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "vector[]@ get_path(uint, float&out cost = void)", asMETHOD(path_service, get_path), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "uint dispatch(uint max = 0)", asMETHOD(path_service, dispatch), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "void clear_cache()", asMETHOD(path_service, clear_cache), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "uint get_pending_count() property", asMETHOD(path_service, get_pending_count), asCALL_THISCALL);
+	engine->RegisterObjectMethod("path_service", "uint get_thread_count() property", asMETHOD(path_service, get_thread_count), asCALL_THISCALL);
+	engine->RegisterObjectType("flow_field", 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour("flow_field", asBEHAVE_FACTORY, "flow_field @f()", asFUNCTION(new_flow_field), asCALL_CDECL);
+	engine->RegisterObjectBehaviour("flow_field", asBEHAVE_ADDREF, "void f()", asMETHOD(flow_field, AddRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour("flow_field", asBEHAVE_RELEASE, "void f()", asMETHOD(flow_field, Release), asCALL_THISCALL);
+	engine->RegisterObjectProperty("flow_field", "const int goal_x", asOFFSET(flow_field, goal_x));
+	engine->RegisterObjectProperty("flow_field", "const int goal_y", asOFFSET(flow_field, goal_y));
+	engine->RegisterObjectProperty("flow_field", "const int goal_z", asOFFSET(flow_field, goal_z));
+	engine->RegisterObjectProperty("flow_field", "const bool ready", asOFFSET(flow_field, ready));
+	engine->RegisterObjectMethod("flow_field", "bool build(pathfinder@, int, int, int, int, int, int, int, int, int)", asMETHOD(flow_field, build), asCALL_THISCALL);
+	engine->RegisterObjectMethod("flow_field", "bool move_goal(int, int, int)", asMETHOD(flow_field, move_goal), asCALL_THISCALL);
+	engine->RegisterObjectMethod("flow_field", "bool refresh()", asMETHOD(flow_field, refresh), asCALL_THISCALL);
+	engine->RegisterObjectMethod("flow_field", "float get_distance(int, int, int)", asMETHOD(flow_field, get_distance), asCALL_THISCALL);
+	engine->RegisterObjectMethod("flow_field", "vector get_next(int, int, int)", asMETHOD(flow_field, get_next), asCALL_THISCALL);
+	engine->RegisterObjectMethod("flow_field", "vector[]@ get_path(int, int, int)", asMETHOD(flow_field, get_path), asCALL_THISCALL);
 }
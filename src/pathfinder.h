@@ -14,9 +14,16 @@
 
 #include <unordered_map>
 #include <string>
+#include <cstdint>
 #include <cstring>
 #include <algorithm>
 #include <vector>
+#include <list>
+#include <Poco/Condition.h>
+#include <Poco/Mutex.h>
+#include <Poco/RWLock.h>
+#include <Poco/Runnable.h>
+#include <Poco/ThreadPool.h>
 #ifdef _Win32
 	#include <windows.h>
 #endif
@@ -24,6 +31,7 @@
 #include <micropather.h>
 #include "scriptarray.h"
 #include "scriptany.h"
+#include "scriptgrid.h"
 #include "bullet3.h"
 #include "nvgt.h"
 
@@ -72,6 +80,7 @@ struct hashpoint_equals {
 };
 typedef std::unordered_map<hashpoint, void*, hashpoint_hash, hashpoint_equals> hashpoint_map;
 typedef std::unordered_map<hashpoint, float, hashpoint_hash, hashpoint_equals> hashpoint_float_map;
+class path_hierarchy;
 class pathfinder : public micropather::Graph {
 	hashpoint_float_map difficulty_cache[11];
 	micropather::MicroPather* pf;
@@ -80,11 +89,46 @@ class pathfinder : public micropather::Graph {
 	CScriptAny* callback_data;
 	bool abort;
 	bool must_reset;
+	// A dense block of tile costs read directly by the search instead of calling the callback, indexed x first then y then z relative to the field's origin.
+	std::vector<unsigned char> cost_field;
+	int field_x, field_y, field_z;
+	unsigned int field_width, field_height, field_depth;
+	path_hierarchy* hierarchy; // Built from the cost field by the first hierarchical search, see pathfinder.cpp.
+	unsigned int cluster_size;
+	friend class path_hierarchy;
+	void invalidate_hierarchy(int minx, int miny, int minz, int maxx, int maxy, int maxz);
+	void drop_hierarchy();
+	path_hierarchy* get_hierarchy();
+	// Returns the field's cost for a tile, or -1 if the tile is outside of the field.
+	int get_field_cost(int x, int y, int z) {
+		unsigned int fx = x - field_x, fy = y - field_y, fz = z - field_z;
+		if (fx >= field_width || fy >= field_height || fz >= field_depth) return -1;
+		return cost_field[(size_t(fz) * field_height + fy) * field_width + fx];
+	}
+	size_t cost_counts[10]; // Number of tiles in the field with each passable cost, so that find can cheaply tell when they all cost the same.
+	// Writes one tile of the field, keeping cost_counts up to date.
+	void store_cost(size_t i, unsigned char cost) {
+		if (cost_field[i] < 10) cost_counts[cost_field[i]]--;
+		if (cost < 10) cost_counts[cost]++;
+		cost_field[i] = cost;
+	}
+	void count_costs();
+	// Jump point search, used in place of micropather when every passable tile of a single layer field costs the same.
+	std::vector<float> jump_g;
+	std::vector<int> jump_parent;
+	std::vector<unsigned int> jump_stamp;
+	unsigned int jump_id;
+	float uniform_cost(int start_z, int end_z);
+	bool jump_open(int x, int y);
+	bool jump(int& x, int& y, int dx, int dy, int goal_x, int goal_y);
+	bool jump_point_find(int start_x, int start_y, int end_x, int end_y, float cost, std::vector<hashpoint>& path);
 public:
 	bool solving;
 	int desperation_factor;
 	bool allow_diagonals;
 	bool automatic_reset;
+	bool hierarchical;
+	bool jump_point_search;
 	int search_range;
 	float total_cost;
 	int start_x, start_y, start_z;
@@ -92,8 +136,23 @@ public:
 	void AddRef();
 	void Release();
 	void set_callback_function(asIScriptFunction* func);
+	bool set_cost_field(CScriptArray* costs, int x, int y, int z, unsigned int width, unsigned int height, unsigned int depth = 1);
+	bool set_cost_field(CScriptGrid* costs, int x, int y, int z = 0);
+	bool update_cost_field(CScriptArray* costs, int x, int y, int z, unsigned int width, unsigned int height, unsigned int depth = 1);
+	bool update_cost_field(CScriptGrid* costs, int x, int y, int z = 0);
+	bool set_cost(int x, int y, int z, unsigned char cost);
+	int get_cost(int x, int y, int z);
+	void clear_cost_field();
+	bool has_cost_field() {
+		return !cost_field.empty();
+	}
+	unsigned int get_cluster_size() {
+		return cluster_size;
+	}
+	void set_cluster_size(unsigned int size);
+	unsigned int get_entrance_count();
 	float get_difficulty(void* state);
-	float get_difficulty(int x, int y, int z);
+	float get_difficulty(int x, int y, int z, bool cached = true);
 	void cancel();
 	void reset();
 	CScriptArray* find(int start_x, int start_y, int start_z, int end_x, int end_y, int end_z, CScriptAny* data);
@@ -133,4 +192,133 @@ public:
 	}
 };
 
+// Settings shared by every request made on behalf of one kind of agent.
+typedef struct {
+	int desperation_factor;
+	bool allow_diagonals; // As pathfinder.allow_diagonals, which picks the distance estimate and range test rather than restricting movement.
+	int search_range; // As pathfinder.search_range, measured around each request's start.
+} path_profile;
+typedef struct {
+	unsigned int id;
+	int start_x, start_y, start_z;
+	int goal_x, goal_y, goal_z;
+	unsigned int profile;
+	asIScriptFunction* callback;
+	std::vector<hashpoint> path;
+	float cost;
+	bool done;
+	bool cancelled; // Set while a worker holds the request, which then deletes it rather than publishing the result.
+} path_request;
+struct path_key {
+	int start_x, start_y, start_z;
+	int goal_x, goal_y, goal_z;
+	unsigned int profile;
+	bool operator==(const path_key& other) const {
+		return memcmp(this, &other, sizeof(path_key)) == 0;
+	}
+};
+struct path_key_hash {
+	size_t operator()(const path_key& k) const {
+		size_t h = k.profile;
+		const int* v = &k.start_x;
+		for (int i = 0; i < 6; i++)
+			h = h * 1000003 ^ (unsigned int)v[i];
+		return h;
+	}
+};
+// Requests waiting for a worker, grouped so that every request sharing a goal and profile is answered by a single search outward from the goal.
+typedef struct {
+	path_key goal; // Only the goal and profile are used.
+	std::vector<path_request*> requests;
+} path_group;
+// Solves path requests on worker threads against a cost field of its own, so that many agents can repath without the script thread waiting on any search. Costs mean the same as those of pathfinder::set_cost_field, though tiles outside of the field are always impassable because script callbacks can't be called from the workers. Results are either collected with get_path or handed to a callback from dispatch, both on the script thread.
+class path_service : public Poco::Runnable {
+	int RefCount;
+	Poco::FastMutex mutex; // Guards everything below except the field.
+	Poco::Condition wake;
+	std::list<path_group> queue;
+	std::unordered_map<path_key, std::list<path_group>::iterator, path_key_hash> queued_goals;
+	std::unordered_map<unsigned int, path_request*> requests;
+	std::vector<unsigned int> completed; // Requests with callbacks that dispatch has yet to deliver.
+	std::unordered_map<path_key, std::pair<std::vector<hashpoint>, float>, path_key_hash> cache;
+	std::vector<path_profile> profiles;
+	unsigned int next_id;
+	unsigned int pending;
+	unsigned int generation; // Incremented by every change to the field so that searches started on an older field don't fill the cache.
+	bool stopping;
+	Poco::RWLock field_lock; // Held for reading by each search and for writing by changes to the field.
+	std::vector<unsigned char> cost_field;
+	int field_x, field_y, field_z;
+	unsigned int field_width, field_height, field_depth;
+	Poco::ThreadPool* pool;
+	unsigned int threads;
+	unsigned int cache_capacity;
+	void field_changed();
+	void finish(path_request* r, bool cacheable, unsigned int search_generation);
+	friend class path_search;
+public:
+	unsigned int cache_hits;
+	path_service(unsigned int threads = 0);
+	~path_service();
+	void AddRef();
+	void Release();
+	void run() override;
+	bool set_cost_field(CScriptArray* costs, int x, int y, int z, unsigned int width, unsigned int height, unsigned int depth);
+	bool set_cost_field(CScriptGrid* costs, int x, int y, int z);
+	bool update_cost_field(CScriptArray* costs, int x, int y, int z, unsigned int width, unsigned int height, unsigned int depth);
+	bool update_cost_field(CScriptGrid* costs, int x, int y, int z);
+	bool set_cost(int x, int y, int z, unsigned char cost);
+	int get_cost(int x, int y, int z);
+	unsigned int add_profile(int desperation_factor, bool allow_diagonals, int search_range);
+	unsigned int request(int start_x, int start_y, int start_z, int goal_x, int goal_y, int goal_z, unsigned int profile, asIScriptFunction* callback);
+	bool cancel(unsigned int id);
+	bool is_pending(unsigned int id);
+	bool is_ready(unsigned int id);
+	CScriptArray* get_path(unsigned int id, float* cost);
+	unsigned int dispatch(unsigned int max);
+	void clear_cache();
+	unsigned int get_cache_capacity();
+	void set_cache_capacity(unsigned int capacity);
+	unsigned int get_pending_count();
+	unsigned int get_thread_count() {
+		return threads;
+	}
+};
+
+// Directions from every tile of a bounded region toward one goal, so that any number of agents heading for the same place can each look up their next step rather than running a search of their own. Tile costs are read from a pathfinder, cost field and callback alike, when the field is built or refreshed.
+class flow_field {
+	int RefCount;
+	pathfinder* source;
+	int min_x, min_y, min_z;
+	unsigned int width, height, depth;
+	std::vector<float> costs; // Cost of stepping onto each tile, FLT_MAX if impassable.
+	std::vector<float> integration; // Cost of reaching the goal from each tile, FLT_MAX if it can't be reached.
+	std::vector<int> next; // Index of the tile to step to from each tile, -1 at the goal and wherever the goal can't be reached.
+	// Scratch space for solve, tiles are marked with the id of the sweep that last reached them.
+	std::vector<float> wave;
+	std::vector<int> wave_next;
+	std::vector<unsigned int> stamp;
+	unsigned int sweep_id;
+	size_t index(int x, int y, int z) {
+		unsigned int fx = x - min_x, fy = y - min_y, fz = z - min_z;
+		if (fx >= width || fy >= height || fz >= depth) return SIZE_MAX;
+		return (size_t(fz) * height + fy) * width + fx;
+	}
+	void load_costs();
+	void solve(size_t previous_goal);
+public:
+	int goal_x, goal_y, goal_z;
+	bool ready;
+	flow_field();
+	~flow_field();
+	void AddRef();
+	void Release();
+	bool build(pathfinder* source, int goal_x, int goal_y, int goal_z, int min_x, int min_y, int min_z, int max_x, int max_y, int max_z);
+	bool move_goal(int x, int y, int z);
+	bool refresh();
+	float get_distance(int x, int y, int z);
+	Vector3 get_next(int x, int y, int z);
+	CScriptArray* get_path(int x, int y, int z);
+};
+
 void RegisterScriptPathfinder(asIScriptEngine* engine);
@@ -0,0 +1,593 @@
+/* replication.cpp - delta compressed entity state replication code
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2024 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include "replication.h"
+#include <obfuscate.h>
+
+// Every packet starts with a message type.
+#define REPLICATION_SNAPSHOT 1
+#define REPLICATION_ACK 2
+// A snapshot is its tick followed by entity records, each an entity id, a 2 bit record type and its data, and ends with an id of 0.
+#define REPLICATION_RECORD_UPDATE 0 // A bitmask of the fields that follow.
+#define REPLICATION_RECORD_FULL 1 // The entity's schema and every field.
+#define REPLICATION_RECORD_REMOVE 2
+
+asQWORD replication_quantize(float value, const replication_field& field) {
+	asQWORD steps = (asQWORD(1) << field.bits) - 1;
+	double t = field.max > field.min ? (double(value) - field.min) / (double(field.max) - field.min) : 0;
+	if (!(t > 0)) t = 0;
+	else if (t > 1) t = 1;
+	return asQWORD(t * steps + 0.5);
+}
+
+replicator::replicator(network* net, unsigned char channel) : net(net), channel(channel) {
+	next_entity = 1;
+	tick = 1;
+	budget = 1200;
+	writer = new packet_writer();
+	reader = new packet_reader();
+	source = received_tick = received_mask = 0;
+	RefCount = 1;
+}
+replicator::~replicator() {
+	writer->release();
+	reader->release();
+	if (net) net->release();
+}
+void replicator::addRef() {
+	asAtomicInc(RefCount);
+}
+void replicator::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+
+// Both sides must add the same schemas and fields in the same order.
+unsigned int replicator::add_schema() {
+	schemas.emplace_back();
+	return schemas.size() - 1;
+}
+// Returns the new field's index, or -1 if the schema is unknown or full. Fields can't be added to a schema that entities already use.
+int replicator::add_field(unsigned int schema, replication_field_type type, float min, float max, unsigned int bits) {
+	if (schema >= schemas.size() || schemas[schema].size() >= REPLICATION_MAX_FIELDS || type < REPLICATE_BOOL || type > REPLICATE_STRING) return -1;
+	for (std::pair<const unsigned int, replication_entity>& e : entities) {
+		if (e.second.schema == schema) return -1;
+	}
+	replication_field f = {type, min, max, bits < 1 ? 1 : bits > 32 ? 32 : bits};
+	schemas[schema].push_back(f);
+	return schemas[schema].size() - 1;
+}
+
+// Returns the new entity's id, or 0 if the schema is unknown. Global entities go to every peer, others only to peers given an interest in them with set_interest.
+unsigned int replicator::add_entity(unsigned int schema, float priority, bool global) {
+	if (schema >= schemas.size()) return 0;
+	unsigned int id = next_entity++;
+	replication_entity& e = entities[id];
+	e.schema = schema;
+	e.priority = priority;
+	e.global = global;
+	e.last_changed = tick;
+	e.changed_fields = 0;
+	const std::vector<replication_field>& fields = schemas[schema];
+	e.values.resize(fields.size());
+	for (size_t i = 0; i < fields.size(); i++) {
+		replication_value& v = e.values[i];
+		v.i = fields[i].type == REPLICATE_QUANTIZED ? replication_quantize(0, fields[i]) : 0;
+		v.f = 0;
+		v.changed = tick;
+	}
+	if (!global) return id;
+	for (std::pair<const asQWORD, replication_peer>& p : peers) {
+		replication_view view = {&e, 0, tick, 1, 0, false, false};
+		p.second.views[id] = view;
+	}
+	return id;
+}
+// Drops a peer's view of an entity, telling the peer that it's gone if it may have been told about it.
+void replicator::forget(replication_peer& p, std::unordered_map<unsigned int, replication_view>::iterator view) {
+	if (!view->second.sent) {
+		p.views.erase(view);
+		return;
+	}
+	view->second.removed = true;
+	view->second.since = tick;
+	view->second.accumulated = 0;
+}
+bool replicator::remove_entity(unsigned int entity) {
+	std::unordered_map<unsigned int, replication_entity>::iterator e = entities.find(entity);
+	if (e == entities.end()) return false;
+	for (std::pair<const asQWORD, replication_peer>& p : peers) {
+		std::unordered_map<unsigned int, replication_view>::iterator view = p.second.views.find(entity);
+		if (view == p.second.views.end()) continue;
+		view->second.entity = NULL;
+		forget(p.second, view);
+	}
+	entities.erase(e);
+	return true;
+}
+int replicator::get_entity_schema(unsigned int entity) {
+	replication_entity* e = find(entity);
+	return e ? e->schema : -1;
+}
+bool replicator::set_priority(unsigned int entity, float priority) {
+	std::unordered_map<unsigned int, replication_entity>::iterator e = entities.find(entity);
+	if (e == entities.end()) return false;
+	e->second.priority = priority;
+	return true;
+}
+
+// Reads look at the entities this replicator sends and then at the ones it has received, while setters only ever change the former.
+replication_entity* replicator::find(unsigned int entity) {
+	std::unordered_map<unsigned int, replication_entity>::iterator it = entities.find(entity);
+	if (it != entities.end()) return &it->second;
+	it = received.find(entity);
+	return it != received.end() ? &it->second : NULL;
+}
+replication_value* replicator::lookup(unsigned int entity, unsigned int field, replication_entity*& e, bool sending) {
+	if (sending) {
+		std::unordered_map<unsigned int, replication_entity>::iterator it = entities.find(entity);
+		e = it != entities.end() ? &it->second : NULL;
+	} else
+		e = find(entity);
+	if (!e || field >= e->values.size()) return NULL;
+	return &e->values[field];
+}
+void replicator::touch(replication_entity& e, replication_value& v) {
+	v.changed = tick;
+	e.last_changed = tick;
+}
+// Setters only mark a field as changed when its value really changes, they fail if the field has a different type.
+bool replicator::set_bool(unsigned int entity, unsigned int field, bool value) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e);
+	if (!v || schemas[e->schema][field].type != REPLICATE_BOOL) return false;
+	if (v->i != value) {
+		v->i = value;
+		touch(*e, *v);
+	}
+	return true;
+}
+bool replicator::set_int(unsigned int entity, unsigned int field, asINT64 value) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e);
+	if (!v || schemas[e->schema][field].type != REPLICATE_INT) return false;
+	if (v->i != value) {
+		v->i = value;
+		touch(*e, *v);
+	}
+	return true;
+}
+bool replicator::set_uint(unsigned int entity, unsigned int field, asQWORD value) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e);
+	if (!v || schemas[e->schema][field].type != REPLICATE_UINT) return false;
+	if (asQWORD(v->i) != value) {
+		v->i = value;
+		touch(*e, *v);
+	}
+	return true;
+}
+// A quantized field only changes when its value moves to a different step.
+bool replicator::set_float(unsigned int entity, unsigned int field, float value) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e);
+	if (!v) return false;
+	const replication_field& f = schemas[e->schema][field];
+	if (f.type == REPLICATE_FLOAT) {
+		if (float(v->f) != value || std::signbit(float(v->f)) != std::signbit(value)) touch(*e, *v);
+		v->f = value;
+	} else if (f.type == REPLICATE_QUANTIZED) {
+		asINT64 step = replication_quantize(value, f);
+		if (v->i != step) touch(*e, *v);
+		v->i = step;
+		v->f = value;
+	} else
+		return false;
+	return true;
+}
+bool replicator::set_string(unsigned int entity, unsigned int field, const std::string& value) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e);
+	if (!v || schemas[e->schema][field].type != REPLICATE_STRING) return false;
+	if (v->s != value) {
+		v->s = value;
+		touch(*e, *v);
+	}
+	return true;
+}
+// Sends a field again as though it had changed.
+bool replicator::mark_dirty(unsigned int entity, unsigned int field) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e);
+	if (!v) return false;
+	touch(*e, *v);
+	return true;
+}
+bool replicator::get_bool(unsigned int entity, unsigned int field) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e, false);
+	return v && v->i != 0;
+}
+asINT64 replicator::get_int(unsigned int entity, unsigned int field) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e, false);
+	return v ? v->i : 0;
+}
+asQWORD replicator::get_uint(unsigned int entity, unsigned int field) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e, false);
+	return v ? asQWORD(v->i) : 0;
+}
+float replicator::get_float(unsigned int entity, unsigned int field) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e, false);
+	return v ? float(v->f) : 0;
+}
+std::string replicator::get_string(unsigned int entity, unsigned int field) {
+	replication_entity* e;
+	replication_value* v = lookup(entity, field, e, false);
+	return v ? v->s : "";
+}
+
+// Peers must be added once they should start receiving entities, and removed when they disconnect.
+bool replicator::add_peer(asQWORD peer_id) {
+	std::pair<std::unordered_map<asQWORD, replication_peer>::iterator, bool> p = peers.try_emplace(peer_id);
+	if (!p.second) return false;
+	replication_peer& peer = p.first->second;
+	peer.budget = 0;
+	for (replication_sent_packet& s : peer.history)
+		s.tick = 0;
+	for (std::pair<const unsigned int, replication_entity>& e : entities) {
+		if (!e.second.global) continue;
+		replication_view view = {&e.second, 0, tick, 1, 0, false, false};
+		peer.views[e.first] = view;
+	}
+	return true;
+}
+bool replicator::remove_peer(asQWORD peer_id) {
+	return peers.erase(peer_id) > 0;
+}
+// Scales an entity's priority for one peer, for instance by distance. An interest of 0 stops replicating the entity to that peer, which is told to remove it, while a positive interest in an entity the peer doesn't have sends it in full.
+bool replicator::set_interest(asQWORD peer_id, unsigned int entity, float interest) {
+	std::unordered_map<asQWORD, replication_peer>::iterator p = peers.find(peer_id);
+	std::unordered_map<unsigned int, replication_entity>::iterator e = entities.find(entity);
+	if (p == peers.end() || e == entities.end()) return false;
+	std::unordered_map<unsigned int, replication_view>::iterator view = p->second.views.find(entity);
+	if (interest <= 0) {
+		if (view != p->second.views.end() && !view->second.removed) forget(p->second, view);
+		return true;
+	}
+	if (view == p->second.views.end()) {
+		replication_view v = {&e->second, 0, tick, interest, 0, false, false};
+		p->second.views[entity] = v;
+		return true;
+	}
+	if (view->second.removed) {
+		view->second.removed = false;
+		view->second.acked = 0;
+		view->second.since = tick;
+	}
+	view->second.interest = interest;
+	return true;
+}
+bool replicator::set_peer_budget(asQWORD peer_id, unsigned int bytes) {
+	std::unordered_map<asQWORD, replication_peer>::iterator p = peers.find(peer_id);
+	if (p == peers.end()) return false;
+	p->second.budget = bytes && bytes < REPLICATION_MIN_BUDGET ? REPLICATION_MIN_BUDGET : bytes;
+	return true;
+}
+
+void replicator::write_field(const replication_field& field, const replication_value& v) {
+	switch (field.type) {
+		case REPLICATE_BOOL:
+			writer->write_bool(v.i != 0);
+			break;
+		case REPLICATE_INT:
+			writer->write_svarint(v.i);
+			break;
+		case REPLICATE_UINT:
+			writer->write_varint(v.i);
+			break;
+		case REPLICATE_FLOAT:
+			writer->write<float>(v.f);
+			break;
+		case REPLICATE_QUANTIZED:
+			writer->write_bits(v.i, field.bits);
+			break;
+		case REPLICATE_STRING:
+			writer->write_string(v.s);
+			break;
+	}
+}
+void replicator::read_field(const replication_field& field, replication_value& v) {
+	switch (field.type) {
+		case REPLICATE_BOOL:
+			v.i = reader->read_bool();
+			break;
+		case REPLICATE_INT:
+			v.i = reader->read_svarint();
+			break;
+		case REPLICATE_UINT:
+			v.i = reader->read_varint();
+			break;
+		case REPLICATE_FLOAT:
+			v.f = reader->read<float>();
+			break;
+		case REPLICATE_QUANTIZED:
+			v.i = reader->read_bits(field.bits);
+			v.f = field.min + (double(field.max) - field.min) * v.i / ((asQWORD(1) << field.bits) - 1);
+			break;
+		case REPLICATE_STRING:
+			v.s = reader->read_string();
+			break;
+	}
+}
+// Writes an entity's removal, its full state if the peer has never confirmed having it, or otherwise the fields changed since the state the peer last confirmed.
+void replicator::write_record(unsigned int id, replication_view& view) {
+	writer->write_varint(id);
+	if (view.removed) {
+		writer->write_bits(REPLICATION_RECORD_REMOVE, 2);
+		return;
+	}
+	replication_entity& e = *view.entity;
+	const std::vector<replication_field>& fields = schemas[e.schema];
+	if (!view.acked) {
+		writer->write_bits(REPLICATION_RECORD_FULL, 2);
+		writer->write_varint(e.schema);
+		for (size_t i = 0; i < fields.size(); i++)
+			write_field(fields[i], e.values[i]);
+		return;
+	}
+	asQWORD mask = 0;
+	for (size_t i = 0; i < fields.size(); i++) {
+		if (e.values[i].changed > view.acked) mask |= asQWORD(1) << i;
+	}
+	writer->write_bits(REPLICATION_RECORD_UPDATE, 2);
+	writer->write_bits(mask, fields.size());
+	for (size_t i = 0; i < fields.size(); i++) {
+		if (mask & (asQWORD(1) << i)) write_field(fields[i], e.values[i]);
+	}
+}
+// Every entity the peer is behind on gains its priority scaled by the peer's interest, then records are written in order of accumulated priority for as long as they fit in the peer's budget. Written entities start accumulating again from 0, so low priority entities are sent less often but never starved. Until the peer acknowledges a packet its changes are sent again in later ones.
+bool replicator::send_updates(asQWORD peer_id, replication_peer& p) {
+	candidates.clear();
+	for (std::pair<const unsigned int, replication_view>& v : p.views) {
+		replication_view& view = v.second;
+		if (view.removed) view.accumulated += 1;
+		else if (view.acked < view.entity->last_changed) view.accumulated += view.entity->priority * view.interest;
+		else continue;
+		candidates.push_back(std::make_pair(v.first, &view));
+	}
+	if (candidates.empty()) return false;
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<unsigned int, replication_view*>& a, const std::pair<unsigned int, replication_view*>& b) {
+		return a.second->accumulated > b.second->accumulated;
+	});
+	unsigned int limit = p.budget ? p.budget : budget;
+	replication_sent_packet& sent = p.history[tick % REPLICATION_HISTORY];
+	sent.tick = tick;
+	sent.records.clear();
+	writer->reset();
+	writer->write<uint8_t>(REPLICATION_SNAPSHOT);
+	writer->write_varint(tick);
+	for (std::pair<unsigned int, replication_view*>& c : candidates) {
+		if (writer->get_size() + 2 > limit) break;
+		size_t start = writer->get_size();
+		write_record(c.first, *c.second);
+		// The terminating id takes 1 more byte. A record too big for the budget on its own is still sent so that it can't hold up its entity forever.
+		if (writer->get_size() + 1 > limit && !sent.records.empty()) {
+			writer->truncate(start);
+			continue;
+		}
+		c.second->accumulated = 0;
+		c.second->sent = true;
+		replication_record r = {c.first, c.second->removed};
+		sent.records.push_back(r);
+	}
+	writer->write_varint(0);
+	return net->send(peer_id, writer, channel, false);
+}
+// Sends every peer its packet for this tick and moves on to the next one, returning how many packets were sent.
+unsigned int replicator::update() {
+	unsigned int count = 0;
+	for (std::pair<const asQWORD, replication_peer>& p : peers) {
+		if (send_updates(p.first, p.second)) count++;
+	}
+	tick++;
+	return count;
+}
+
+// The peer now has every entity in the packet of acked_tick as it was at that tick, and has removed the entities it removed.
+void replicator::acknowledge(replication_peer& p, asQWORD acked_tick) {
+	replication_sent_packet& sent = p.history[acked_tick % REPLICATION_HISTORY];
+	if (sent.tick != acked_tick) return;
+	for (replication_record& r : sent.records) {
+		std::unordered_map<unsigned int, replication_view>::iterator view = p.views.find(r.entity);
+		if (view == p.views.end() || acked_tick < view->second.since) continue;
+		if (r.removal) {
+			if (view->second.removed) p.views.erase(view);
+		} else if (!view->second.removed && acked_tick > view->second.acked)
+			view->second.acked = acked_tick;
+	}
+	sent.tick = 0;
+	sent.records.clear();
+}
+void replicator::receive_ack(asQWORD peer_id) {
+	std::unordered_map<asQWORD, replication_peer>::iterator p = peers.find(peer_id);
+	if (p == peers.end()) return;
+	asQWORD latest = reader->read_varint();
+	asQWORD mask = reader->read<uint64_t>();
+	if (reader->get_error() || !latest) return;
+	acknowledge(p->second, latest);
+	for (unsigned int n = 0; n < 64 && n + 1 < latest; n++) {
+		if (mask & (asQWORD(1) << n)) acknowledge(p->second, latest - 1 - n);
+	}
+}
+// Applies a snapshot and acknowledges it along with the 64 ticks before it, so that a lost acknowledgement is made up for by the next one. Enet drops unreliable packets that arrive after a newer one on the same channel, so snapshots are applied in order. Only the first peer to send one is replicated from, snapshots from any other are ignored until reset_received.
+void replicator::receive_snapshot(asQWORD peer_id) {
+	if (source && peer_id != source) return;
+	asQWORD t = reader->read_varint();
+	if (reader->get_error() || t <= received_tick) return;
+	source = peer_id;
+	asQWORD shift = t - received_tick;
+	if (!received_tick || shift > 64) received_mask = 0;
+	else if (shift == 64) received_mask = asQWORD(1) << 63;
+	else received_mask = (received_mask << shift) | (asQWORD(1) << (shift - 1));
+	received_tick = t;
+	while (true) {
+		unsigned int id = reader->read_varint();
+		if (!id || reader->get_error()) break;
+		unsigned int type = reader->read_bits(2);
+		if (type == REPLICATION_RECORD_REMOVE) {
+			if (received.erase(id)) removed.push_back(id);
+			continue;
+		}
+		if (type == REPLICATION_RECORD_FULL) {
+			unsigned int schema = reader->read_varint();
+			if (schema >= schemas.size()) return; // Schemas differ from the sender's, nothing more can be parsed.
+			std::pair<std::unordered_map<unsigned int, replication_entity>::iterator, bool> e = received.try_emplace(id);
+			replication_entity& entity = e.first->second;
+			const std::vector<replication_field>& fields = schemas[schema];
+			if (e.second) {
+				entity.priority = 0;
+				entity.global = false;
+				entity.last_changed = 0;
+				entity.changed_fields = 0;
+				created.push_back(id);
+			} else if (!entity.changed_fields)
+				updated.push_back(id);
+			entity.schema = schema;
+			entity.values.resize(fields.size());
+			for (size_t i = 0; i < fields.size(); i++)
+				read_field(fields[i], entity.values[i]);
+			entity.changed_fields = fields.size() < 64 ? (asQWORD(1) << fields.size()) - 1 : ~asQWORD(0);
+			continue;
+		}
+		std::unordered_map<unsigned int, replication_entity>::iterator e = received.find(id);
+		if (e == received.end() || type != REPLICATION_RECORD_UPDATE) return; // Can't know the layout of an entity we don't have.
+		const std::vector<replication_field>& fields = schemas[e->second.schema];
+		asQWORD mask = reader->read_bits(fields.size());
+		if (mask && !e->second.changed_fields) updated.push_back(id);
+		e->second.changed_fields |= mask;
+		for (size_t i = 0; i < fields.size(); i++) {
+			if (mask & (asQWORD(1) << i)) read_field(fields[i], e->second.values[i]);
+		}
+	}
+	if (reader->get_error()) return;
+	writer->reset();
+	writer->write<uint8_t>(REPLICATION_ACK);
+	writer->write_varint(received_tick);
+	writer->write<uint64_t>(received_mask);
+	net->send(peer_id, writer, channel, false);
+}
+// Handles an event if it's a replication packet on this replicator's channel, returning false for any other event so that the script can handle it. The disconnection of the peer being replicated from also resets the received state, so that a restarted server is replicated from afresh once it's connected to again.
+bool replicator::receive(network_event* e) {
+	if (e && e->type == ENET_EVENT_TYPE_DISCONNECT && source && e->peer_id == source) {
+		reset_received();
+		return false;
+	}
+	if (!e || e->type != ENET_EVENT_TYPE_RECEIVE || e->channel != channel || e->message.empty()) return false;
+	e->addRef();
+	reader->set_event(e);
+	unsigned char type = reader->read<uint8_t>();
+	if (type == REPLICATION_SNAPSHOT) receive_snapshot(e->peer_id);
+	else if (type == REPLICATION_ACK) receive_ack(e->peer_id);
+	reader->set_event(NULL);
+	return true;
+}
+// Forgets every received entity, reporting them as removed, and accepts snapshots from any peer again starting from any tick.
+void replicator::reset_received() {
+	for (std::pair<const unsigned int, replication_entity>& e : received)
+		removed.push_back(e.first);
+	received.clear();
+	source = received_tick = received_mask = 0;
+}
+// Fills the arrays with the entities created, updated and removed by received snapshots since the last call, returning the total.
+unsigned int replicator::get_changes(CScriptArray* created, CScriptArray* updated, CScriptArray* removed) {
+	std::vector<unsigned int>* lists[3] = {&this->created, &this->updated, &this->removed};
+	CScriptArray* arrays[3] = {created, updated, removed};
+	unsigned int total = 0;
+	for (int i = 0; i < 3; i++) {
+		arrays[i]->Resize(lists[i]->size());
+		for (size_t j = 0; j < lists[i]->size(); j++)
+			*(unsigned int*)arrays[i]->At(j) = (*lists[i])[j];
+		total += lists[i]->size();
+	}
+	for (int i = 0; i < 2; i++) {
+		for (unsigned int id : *lists[i]) {
+			std::unordered_map<unsigned int, replication_entity>::iterator e = received.find(id);
+			if (e != received.end()) e->second.changed_fields = 0;
+		}
+	}
+	for (int i = 0; i < 3; i++)
+		lists[i]->clear();
+	return total;
+}
+// A bitmask of the entity's fields updated since the last call to get_changes.
+asQWORD replicator::get_changed_fields(unsigned int entity) {
+	std::unordered_map<unsigned int, replication_entity>::iterator e = received.find(entity);
+	return e != received.end() ? e->second.changed_fields : 0;
+}
+
+replicator* ScriptReplicator_Factory(network* net, unsigned char channel) {
+	if (!net) {
+		asIScriptContext* ctx = asGetActiveContext();
+		if (ctx) ctx->SetException("replicator needs a network");
+		return NULL;
+	}
+	return new replicator(net, channel);
+}
+void RegisterScriptReplication(asIScriptEngine* engine) {
+	engine->RegisterEnum(_O("replication_field_type"));
+	engine->RegisterEnumValue(_O("replication_field_type"), _O("REPLICATE_BOOL"), REPLICATE_BOOL);
+	engine->RegisterEnumValue(_O("replication_field_type"), _O("REPLICATE_INT"), REPLICATE_INT);
+	engine->RegisterEnumValue(_O("replication_field_type"), _O("REPLICATE_UINT"), REPLICATE_UINT);
+	engine->RegisterEnumValue(_O("replication_field_type"), _O("REPLICATE_FLOAT"), REPLICATE_FLOAT);
+	engine->RegisterEnumValue(_O("replication_field_type"), _O("REPLICATE_QUANTIZED"), REPLICATE_QUANTIZED);
+	engine->RegisterEnumValue(_O("replication_field_type"), _O("REPLICATE_STRING"), REPLICATE_STRING);
+	engine->RegisterObjectType(_O("replicator"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("replicator"), asBEHAVE_FACTORY, _O("replicator @r(network@, uint8)"), asFUNCTION(ScriptReplicator_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("replicator"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(replicator, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("replicator"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(replicator, release), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("uint add_schema()"), asMETHOD(replicator, add_schema), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("int add_field(uint, replication_field_type, float = 0, float = 0, uint = 16)"), asMETHOD(replicator, add_field), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("uint add_entity(uint, float = 1, bool = true)"), asMETHOD(replicator, add_entity), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool remove_entity(uint)"), asMETHOD(replicator, remove_entity), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool entity_exists(uint) const"), asMETHOD(replicator, entity_exists), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("int get_entity_schema(uint) const"), asMETHOD(replicator, get_entity_schema), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool set_priority(uint, float)"), asMETHOD(replicator, set_priority), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool set_bool(uint, uint, bool)"), asMETHOD(replicator, set_bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool set_int(uint, uint, int64)"), asMETHOD(replicator, set_int), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool set_uint(uint, uint, uint64)"), asMETHOD(replicator, set_uint), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool set_float(uint, uint, float)"), asMETHOD(replicator, set_float), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool set_string(uint, uint, const string& in)"), asMETHOD(replicator, set_string), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool mark_dirty(uint, uint)"), asMETHOD(replicator, mark_dirty), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool get_bool(uint, uint) const"), asMETHOD(replicator, get_bool), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("int64 get_int(uint, uint) const"), asMETHOD(replicator, get_int), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("uint64 get_uint(uint, uint) const"), asMETHOD(replicator, get_uint), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("float get_float(uint, uint) const"), asMETHOD(replicator, get_float), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("string get_string(uint, uint) const"), asMETHOD(replicator, get_string), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool add_peer(uint64)"), asMETHOD(replicator, add_peer), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool remove_peer(uint64)"), asMETHOD(replicator, remove_peer), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool set_interest(uint64, uint, float)"), asMETHOD(replicator, set_interest), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool set_peer_budget(uint64, uint)"), asMETHOD(replicator, set_peer_budget), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("uint get_budget() const property"), asMETHOD(replicator, get_budget), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("void set_budget(uint) property"), asMETHOD(replicator, set_budget), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("uint64 get_tick() const property"), asMETHOD(replicator, get_tick), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("uint update()"), asMETHOD(replicator, update), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("bool receive(network_event&)"), asMETHOD(replicator, receive), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("uint64 get_source_peer() const property"), asMETHOD(replicator, get_source_peer), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("void reset_received()"), asMETHOD(replicator, reset_received), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("uint get_changes(uint[]&, uint[]&, uint[]&)"), asMETHOD(replicator, get_changes), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("replicator"), _O("uint64 get_changed_fields(uint) const"), asMETHOD(replicator, get_changed_fields), asCALL_THISCALL);
+}
@@ -0,0 +1,151 @@
+/* replication.h - delta compressed entity state replication header
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2024 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <angelscript.h>
+#include <scriptarray.h>
+#include "network.h"
+
+typedef enum { REPLICATE_BOOL, REPLICATE_INT, REPLICATE_UINT, REPLICATE_FLOAT, REPLICATE_QUANTIZED, REPLICATE_STRING } replication_field_type;
+typedef struct {
+	replication_field_type type;
+	float min, max; // Range of a REPLICATE_QUANTIZED field.
+	unsigned int bits;
+} replication_field;
+// Entities have at most 64 fields so that a bitmask of changed fields fits in a uint64.
+#define REPLICATION_MAX_FIELDS 64
+typedef struct {
+	asINT64 i; // Bools, integers and the step of a quantized float.
+	double f;
+	std::string s;
+	asQWORD changed; // Tick of the last change, only kept by the sending side.
+} replication_value;
+typedef struct {
+	unsigned int schema;
+	float priority;
+	bool global; // Replicated to every peer rather than only to peers given an interest in it.
+	asQWORD last_changed; // Latest changed tick of any field.
+	asQWORD changed_fields; // Receiving side, fields updated since the script last called get_changes.
+	std::vector<replication_value> values;
+} replication_entity;
+// What one peer has of one entity. acked is the latest tick whose state of the entity the peer has confirmed, 0 if it has never confirmed having the entity at all, so every field changed after it is still to be sent.
+typedef struct {
+	replication_entity* entity; // NULL once the entity has been removed.
+	asQWORD acked;
+	asQWORD since; // Tick this view was started, acknowledgements of earlier packets no longer apply to it.
+	float interest; // Scales the entity's priority for this peer, 0 to stop replicating it there.
+	float accumulated; // Priority built up while waiting for room in a packet.
+	bool sent; // Mentioned in a packet at least once, so the peer may have it.
+	bool removed; // The peer is to be told that the entity is gone.
+} replication_view;
+typedef struct {
+	unsigned int entity;
+	bool removal;
+} replication_record;
+// Which entity records went out in the packet of a tick, kept until acknowledged or overwritten 64 ticks later.
+#define REPLICATION_HISTORY 64
+typedef struct {
+	asQWORD tick;
+	std::vector<replication_record> records;
+} replication_sent_packet;
+// Smallest budget a peer can be given, room for a snapshot header and at least some records.
+#define REPLICATION_MIN_BUDGET 16
+typedef struct {
+	std::unordered_map<unsigned int, replication_view> views;
+	replication_sent_packet history[REPLICATION_HISTORY];
+	unsigned int budget; // Bytes per update, 0 to use the replicator's default.
+} replication_peer;
+
+// Replicates entity state from a server to its peers over unreliable packets on one channel. Scripts describe entities with schemas and set field values, and each update sends every peer a packet holding, for the entities with the highest accumulated priority that fit in its bandwidth budget, only the fields changed since the state the peer last acknowledged. The receiving side feeds events to receive, which applies them, acknowledges them and collects what changed.
+class replicator {
+	network* net;
+	unsigned char channel;
+	std::vector<std::vector<replication_field>> schemas;
+	std::unordered_map<unsigned int, replication_entity> entities;
+	unsigned int next_entity;
+	std::unordered_map<asQWORD, replication_peer> peers;
+	asQWORD tick; // Tick of the next update, field changes are stamped with it.
+	unsigned int budget;
+	packet_writer* writer;
+	packet_reader* reader;
+	std::vector<std::pair<unsigned int, replication_view*>> candidates; // Reused by update.
+	// Receiving side. Received entities are kept apart from the ones this replicator sends, so a peer can't alter or remove those.
+	std::unordered_map<unsigned int, replication_entity> received;
+	asQWORD source; // Peer snapshots are accepted from, 0 until the first one arrives.
+	asQWORD received_tick; // Latest tick received, older packets are ignored.
+	asQWORD received_mask; // Bit n set if received_tick - 1 - n was also received.
+	std::vector<unsigned int> created, updated, removed;
+	replication_value* lookup(unsigned int entity, unsigned int field, replication_entity*& e, bool sending = true);
+	replication_entity* find(unsigned int entity);
+	void touch(replication_entity& e, replication_value& v);
+	void write_field(const replication_field& field, const replication_value& v);
+	void read_field(const replication_field& field, replication_value& v);
+	void write_record(unsigned int id, replication_view& view);
+	bool send_updates(asQWORD peer_id, replication_peer& p);
+	void receive_snapshot(asQWORD peer_id);
+	void receive_ack(asQWORD peer_id);
+	void acknowledge(replication_peer& p, asQWORD acked_tick);
+	void forget(replication_peer& p, std::unordered_map<unsigned int, replication_view>::iterator view);
+public:
+	int RefCount;
+	replicator(network* net, unsigned char channel);
+	~replicator();
+	void addRef();
+	void release();
+	unsigned int add_schema();
+	int add_field(unsigned int schema, replication_field_type type, float min = 0, float max = 0, unsigned int bits = 16);
+	unsigned int add_entity(unsigned int schema, float priority = 1, bool global = true);
+	bool remove_entity(unsigned int entity);
+	bool entity_exists(unsigned int entity) {
+		return find(entity) != NULL;
+	}
+	int get_entity_schema(unsigned int entity);
+	bool set_priority(unsigned int entity, float priority);
+	bool set_bool(unsigned int entity, unsigned int field, bool value);
+	bool set_int(unsigned int entity, unsigned int field, asINT64 value);
+	bool set_uint(unsigned int entity, unsigned int field, asQWORD value);
+	bool set_float(unsigned int entity, unsigned int field, float value);
+	bool set_string(unsigned int entity, unsigned int field, const std::string& value);
+	bool mark_dirty(unsigned int entity, unsigned int field);
+	bool get_bool(unsigned int entity, unsigned int field);
+	asINT64 get_int(unsigned int entity, unsigned int field);
+	asQWORD get_uint(unsigned int entity, unsigned int field);
+	float get_float(unsigned int entity, unsigned int field);
+	std::string get_string(unsigned int entity, unsigned int field);
+	bool add_peer(asQWORD peer_id);
+	bool remove_peer(asQWORD peer_id);
+	bool set_interest(asQWORD peer_id, unsigned int entity, float interest);
+	bool set_peer_budget(asQWORD peer_id, unsigned int bytes);
+	unsigned int get_budget() {
+		return budget;
+	}
+	void set_budget(unsigned int bytes) {
+		budget = bytes > REPLICATION_MIN_BUDGET ? bytes : REPLICATION_MIN_BUDGET;
+	}
+	asQWORD get_tick() {
+		return tick;
+	}
+	unsigned int update();
+	bool receive(network_event* e);
+	asQWORD get_source_peer() {
+		return source;
+	}
+	void reset_received();
+	unsigned int get_changes(CScriptArray* created, CScriptArray* updated, CScriptArray* removed);
+	asQWORD get_changed_fields(unsigned int entity);
+};
+
+void RegisterScriptReplication(asIScriptEngine* engine);
@@ -15,6 +15,7 @@
 //#define SOUND_DEBUG
 #include <string>
 #include <algorithm>
+#include <list>
 #include <unordered_set>
 #include <vector>
 #ifdef _WIN32
@@ -23,6 +24,12 @@
 	#include <windows.h>
 #endif
 #include <math.h>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#define NVGT_DSP_SSE
+	#include <immintrin.h>
+#elif defined(__ARM_NEON)
+	#include <arm_neon.h>
+#endif
 #include <unordered_map>
 #include <thread.h>
 #include <bass.h>
@@ -51,6 +58,8 @@
 #include <fast_float.h>
 #include <Poco/StringTokenizer.h>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <algorithm>
 
 #ifndef _WIN32
@@ -71,7 +80,22 @@ static IPLHRTFSettings phonon_hrtfSettings{};
 static IPLHRTF phonon_hrtf = NULL;
 static IPLHRTF phonon_hrtf_reflections = NULL;
 static thread_mutex_t preload_mutex;
+// The decoded audio cache may be used before sound is initialized, so it's mutex is set up at startup.
+static struct preload_mutex_initializer {
+	preload_mutex_initializer() {
+		thread_mutex_init(&preload_mutex);
+	}
+} preload_mutex_init;
 static pack* g_sound_default_pack = nullptr;
+// Spatialization statistics and limits, see positioning_dsp.
+static float sound_hrtf_distance = 0; // Sounds without an environment that are further than this from the listener are positioned without HRTF, 0 for no limit.
+static unsigned int sound_hrtf_voices = 0; // Most batched sounds a mixer spatializes with HRTF per buffer, the nearest ones win and the rest are panned, 0 for no limit.
+static std::atomic<int> sound_spatial_voices(0); // Sounds whose last buffer was processed by steam audio.
+static std::atomic<uint64_t> sound_spatial_culled(0); // Buffers that skipped steam audio entirely because they were inaudible.
+static std::atomic<uint64_t> sound_spatial_time(0); // Microseconds spent in positioning_dsp and spatial_batch_dsp.
+// Voice virtualization, see sound::update_voice.
+static float sound_voice_threshold = -100; // Playing sounds at or below this many dB are virtualized.
+static std::atomic<int> sound_virtual_voices(0);
 
 hstream_entry* last_channel = NULL;
 hstream_entry* register_hstream(unsigned int channel) {
@@ -137,7 +161,6 @@ BOOL init_sound(unsigned int dev) {
 		freeverb.lChannel=BASS_BFX_CHANALL;
 		BASS_FXSetParameters(reverb, &freeverb);
 		*/
-		thread_mutex_init(&preload_mutex);
 	}
 	return sound_initialized;
 }
@@ -166,34 +189,94 @@ public:
 	}
 };
 
+// Multiplies an interleaved stereo float buffer by a pair of channel gains. The gains move linearly from the ones applied to the previous buffer (cur_left/cur_right, negative when there was none) to the new targets across the buffer so that position changes don't produce zipper noise, and are left at the targets afterwards.
+static void apply_stereo_gains(float* f, unsigned int frames, float& cur_left, float& cur_right, float target_left, float target_right) {
+	if (cur_left < 0 || cur_right < 0) {
+		cur_left = target_left;
+		cur_right = target_right;
+	}
+	float step_left = frames ? (target_left - cur_left) / frames : 0, step_right = frames ? (target_right - cur_right) / frames : 0;
+	float gl = cur_left, gr = cur_right;
+	unsigned int i = 0;
+	if (step_left == 0 && step_right == 0) {
+		#if defined(__AVX__)
+		__m256 g8 = _mm256_setr_ps(gl, gr, gl, gr, gl, gr, gl, gr);
+		for (; i + 4 <= frames; i += 4) _mm256_storeu_ps(f + i * 2, _mm256_mul_ps(_mm256_loadu_ps(f + i * 2), g8));
+		#endif
+		#if defined(NVGT_DSP_SSE)
+		__m128 g4 = _mm_setr_ps(gl, gr, gl, gr);
+		for (; i + 2 <= frames; i += 2) _mm_storeu_ps(f + i * 2, _mm_mul_ps(_mm_loadu_ps(f + i * 2), g4));
+		#elif defined(__ARM_NEON)
+		float32x4_t g4 = {gl, gr, gl, gr};
+		for (; i + 2 <= frames; i += 2) vst1q_f32(f + i * 2, vmulq_f32(vld1q_f32(f + i * 2), g4));
+		#endif
+	} else {
+		// Gains are derived from the frame index rather than accumulated so that long buffers don't drift from the ramp.
+		#if defined(__AVX__)
+		__m256 b8 = _mm256_setr_ps(gl, gr, gl + step_left, gr + step_right, gl + step_left * 2, gr + step_right * 2, gl + step_left * 3, gr + step_right * 3);
+		__m256 s8 = _mm256_setr_ps(step_left, step_right, step_left, step_right, step_left, step_right, step_left, step_right);
+		for (; i + 4 <= frames; i += 4)
+			_mm256_storeu_ps(f + i * 2, _mm256_mul_ps(_mm256_loadu_ps(f + i * 2), _mm256_add_ps(b8, _mm256_mul_ps(s8, _mm256_set1_ps(float(i))))));
+		#endif
+		#if defined(NVGT_DSP_SSE)
+		__m128 b4 = _mm_setr_ps(gl, gr, gl + step_left, gr + step_right);
+		__m128 s4 = _mm_setr_ps(step_left, step_right, step_left, step_right);
+		for (; i + 2 <= frames; i += 2)
+			_mm_storeu_ps(f + i * 2, _mm_mul_ps(_mm_loadu_ps(f + i * 2), _mm_add_ps(b4, _mm_mul_ps(s4, _mm_set1_ps(float(i))))));
+		#elif defined(__ARM_NEON)
+		float32x4_t b4 = {gl, gr, gl + step_left, gr + step_right};
+		float32x4_t s4 = {step_left, step_right, step_left, step_right};
+		for (; i + 2 <= frames; i += 2)
+			vst1q_f32(f + i * 2, vmulq_f32(vld1q_f32(f + i * 2), vaddq_f32(b4, vmulq_n_f32(s4, float(i)))));
+		#endif
+	}
+	for (; i < frames; i++) {
+		f[i * 2] *= gl + step_left * i;
+		f[i * 2 + 1] *= gr + step_right * i;
+	}
+	cur_left = target_left;
+	cur_right = target_right;
+}
+
 // no hrtf positional dsp
-void basic_positioning_dsp(void* buffer, unsigned int length, float x, float y, float z, float pan_step, float volume_step) {
+void basic_positioning_dsp(void* buffer, unsigned int length, float x, float y, float z, sound_base& s) {
 	if (!buffer || length < 2)
 		return;
-	float volume = 1.0 - (floorf(sqrtf(pow(fabs(x), 2) + pow(fabs(y), 2) + pow(fabs(z), 2)))) / (125.0 / volume_step);
-	float pan = x / (125.0 / pan_step);
+	float volume = 1.0 - (floorf(sqrtf(pow(fabs(x), 2) + pow(fabs(y), 2) + pow(fabs(z), 2)))) / (125.0 / s.volume_step);
+	float pan = x / (125.0 / s.pan_step);
 	if (pan < -1.0) pan = -1.0;
 	else if (pan > 1.0) pan = 1.0;
 	if (volume < 0.0) volume = 0.0;
 	else if (volume > 1.0) volume = 1.0;
-	float* f = (float*)buffer;
-	for (; length; length -= 8, f += 2) {
-		float amp = 0;
-		if (volume > 0)
-			amp = pow(10.0f, (volume * 100 - 100) / 20.0);
-		f[0] *= amp;
-		f[1] *= amp;
-		if (pan < 0)
-			f[1] = f[1] * pow(10.0f, ((1 + pan) * 100 - 100) / 20.0);
-		else if (pan > 0)
-			f[0] = f[0] * pow(10.0f, ((1 - pan) * 100 - 100) / 20.0);
-	}
+	// Volume and pan are constant for the whole buffer, so only the ramp between buffers needs per sample work.
+	float amp = volume > 0 ? pow(10.0f, (volume * 100 - 100) / 20.0) : 0;
+	float left = amp, right = amp;
+	if (pan < 0)
+		right *= pow(10.0f, ((1 + pan) * 100 - 100) / 20.0);
+	else if (pan > 0)
+		left *= pow(10.0f, ((1 - pan) * 100 - 100) / 20.0);
+	apply_stereo_gains((float*)buffer, length / (sizeof(float) * 2), s.gain_left, s.gain_right, left, right);
 }
 
 // Uses steam audio to position the sound and add other effects to it such as reverb and occlusion. Sorry if this is a bit messy, this function has seen some evolution to say the least as different things were tested and so as to not break compatibility with existing code, this should probably be cleaned up as time goes on.
-void phonon_dsp(void* buffer, unsigned int length, float x, float y, float z, sound_base& s) {
+bool phonon_dsp(void* buffer, unsigned int length, float x, float y, float z, sound_base& s) {
 	if (!buffer || length < 2 || !hrtf || !s.hrtf_effect)
-		return;
+		return false;
+	int samples = length / sizeof(float) / 2;
+	if (!s.env) {
+		// simple distance rolloff in the case of no set sound_environment
+		float volume = 1.0 - (floorf(sqrtf(pow(fabs(x), 2) + pow(fabs(y), 2) + pow(fabs(z), 2)))) / (125.0 / s.volume_step);
+		float amp = volume > 0 ? pow(10.0f, (volume * 100 - 100) / 20.0) : 0;
+		if (amp == 0 && s.gain_left == 0 && s.gain_right == 0) {
+			// Nothing of this buffer would be heard, so skip the binaural effect and start it fresh once the sound comes back into range.
+			memset(buffer, 0, length);
+			iplBinauralEffectReset(s.hrtf_effect);
+			sound_spatial_culled++;
+			return false;
+		}
+		apply_stereo_gains((float*)buffer, samples, s.gain_left, s.gain_right, amp, amp);
+	} else
+		s.gain_left = s.gain_right = -1; // The environment attenuates instead, start over without a ramp if it gets detached.
 	float blend = (fabs(x * s.pan_step) + fabs(y * s.pan_step) + fabs(z * s.pan_step)) / 3;
 	if (blend > 1.0)
 		blend = 1.0;
@@ -207,30 +290,17 @@ void phonon_dsp(void* buffer, unsigned int length, float x, float y, float z, so
 	float* in_mono_data[] = {in_mono};
 	float* reflections_data[] = {reflections1, reflections2, reflections3, reflections4, reflections5, reflections6, reflections7, reflections8, reflections9};
 	float* reflections_downmix_data[] = {reflections_downmix_left, reflections_downmix_right};
-	int samples = length / sizeof(float) / 2;
 	IPLAudioBuffer inbuffer {2, samples, in_data };
 	IPLAudioBuffer outbuffer {2, samples, out_data };
 	IPLAudioBuffer mono_tmp_buffer {1, samples, tmp_mono_data};
 	IPLAudioBuffer mono_inbuffer {1, samples, in_mono_data};
 	IPLAudioBuffer reflections_outbuffer{ 9, samples, reflections_data };
 	IPLAudioBuffer reflections_downmix_buffer {2, samples, reflections_downmix_data};
-	if (!s.env) {
-		// simple distance rolloff in the case of no set sound_environment
-		float volume = 1.0 - (floorf(sqrtf(pow(fabs(x), 2) + pow(fabs(y), 2) + pow(fabs(z), 2)))) / (125.0 / s.volume_step);
-		float* f = (float*)buffer;
-		for (; length; length -= 8, f += 2) {
-			float amp = 0;
-			if (volume > 0)
-				amp = pow(10.0f, (volume * 100 - 100) / 20.0);
-			f[0] *= amp;
-			f[1] *= amp;
-		}
-	}
 	IPLSimulationOutputs src_out{};
 	if (s.env) iplSourceGetOutputs(s.source, IPLSimulationFlags(IPL_SIMULATIONFLAGS_DIRECT | IPL_SIMULATIONFLAGS_REFLECTIONS), &src_out);
 	iplAudioBufferDeinterleave(phonon_context, (IPLfloat32*)buffer, &inbuffer);
-	iplAudioBufferDownmix(phonon_context, &inbuffer, &mono_inbuffer);
-	if (s.env) {
+	if (s.env) { // Only the direct and reflection effects take mono input.
+		iplAudioBufferDownmix(phonon_context, &inbuffer, &mono_inbuffer);
 		IPLDirectEffectParams dir_params = src_out.direct;
 		dir_params.flags = IPLDirectEffectFlags(IPL_DIRECTEFFECTFLAGS_APPLYDISTANCEATTENUATION | IPL_DIRECTEFFECTFLAGS_APPLYAIRABSORPTION | IPL_DIRECTEFFECTFLAGS_APPLYOCCLUSION);
 		iplDirectEffectApply(s.direct_effect, &dir_params, &mono_inbuffer, &mono_tmp_buffer);
@@ -243,8 +313,8 @@ void phonon_dsp(void* buffer, unsigned int length, float x, float y, float z, so
 		effect_args.hrtf = phonon_hrtf;
 		iplBinauralEffectApply(s.hrtf_effect, &effect_args, s.env ? &mono_tmp_buffer : &inbuffer, &outbuffer);
 	} else { // Sound is at the same position as the listener, direct copy to output buffer
-		memcpy(out_left, in_left, sizeof(float) * hrtf_framesize * 2);
-		memcpy(out_right, in_right, sizeof(float) * hrtf_framesize * 2);
+		memcpy(out_left, in_left, sizeof(float) * samples);
+		memcpy(out_right, in_right, sizeof(float) * samples);
 	}
 	if (s.env) { // reflections
 		IPLReflectionEffectParams reflect_params = src_out.reflections;
@@ -258,12 +328,78 @@ void phonon_dsp(void* buffer, unsigned int length, float x, float y, float z, so
 		iplAudioBufferMix(phonon_context, &reflections_downmix_buffer, &outbuffer);
 	}
 	iplAudioBufferInterleave(phonon_context, &outbuffer, (IPLfloat32*)buffer);
+	return true;
+}
+
+// Keeps sound_spatial_voices in sync with whether a sound is currently being spatialized by steam audio.
+static void set_spatial_voice(sound_base& s, bool active) {
+	if (s.spatial_voice.exchange(active) == active) return;
+	if (active) sound_spatial_voices++;
+	else sound_spatial_voices--;
+}
+
+// HRTF sounds without an environment are spatialized in batches. While BASS mixes a mixer, the positioning dsp of each such sound only queues its buffer here and silences it, then spatial_batch_dsp runs on the mixer itself once all of its sources were mixed, positions every buffer queued for it with one set of scratch buffers and adds them to the mix. A mixer and its sources are rendered by the same thread, so the queue is per thread and entries are tagged with the mixer that will take them.
+typedef struct {
+	sound_base* s;
+	DWORD mixer; // Channel of the mixer the sound is mixed into.
+	DWORD channel; // Channel the positioning dsp ran on, whose volume the mixer would otherwise have applied.
+	float x, y, z; // Position relative to the listener, after rotation.
+	size_t offset; // Start of the queued buffer in spatial_batch_samples.
+	unsigned int frames;
+} spatial_batch_entry;
+static thread_local std::vector<spatial_batch_entry> spatial_batch;
+static thread_local std::vector<float> spatial_batch_samples; // Only ever cleared, so that its memory is reused from one buffer to the next.
+
+void CALLBACK spatial_batch_dsp(HDSP handle, DWORD channel, void* buffer, DWORD length, void* user) {
+	if (spatial_batch.empty()) return;
+	auto start_time = std::chrono::steady_clock::now();
+	auto end = std::partition(spatial_batch.begin(), spatial_batch.end(), [channel](const spatial_batch_entry& e) { return e.mixer == channel; });
+	if (sound_hrtf_voices > 0 && (unsigned int)(end - spatial_batch.begin()) > sound_hrtf_voices)
+		std::sort(spatial_batch.begin(), end, [](const spatial_batch_entry& a, const spatial_batch_entry& b) { return a.x * a.x + a.y * a.y + a.z * a.z < b.x * b.x + b.y * b.y + b.z * b.z; });
+	float* out = (float*)buffer;
+	unsigned int out_frames = buffer ? length / (sizeof(float) * 2) : 0, hrtf_voices = 0;
+	for (auto e = spatial_batch.begin(); e != end; e++) {
+		sound_base& s = *e->s;
+		float* f = spatial_batch_samples.data() + e->offset;
+		bool spatialized = false;
+		if (!sound_hrtf_voices || hrtf_voices < sound_hrtf_voices) {
+			spatialized = phonon_dsp(f, e->frames * sizeof(float) * 2, e->x, e->y, e->z, s);
+			if (spatialized) hrtf_voices++;
+		} else {
+			if (s.hrtf_effect && s.spatial_voice)
+				iplBinauralEffectReset(s.hrtf_effect);
+			basic_positioning_dsp(f, e->frames * sizeof(float) * 2, e->x, e->y, e->z, s);
+		}
+		set_spatial_voice(s, spatialized);
+		float volume = 1, volume_right = s.batch_volume;
+		BASS_ChannelGetAttribute(e->channel, BASS_ATTRIB_VOL, &volume);
+		apply_stereo_gains(f, e->frames, s.batch_volume, volume_right, volume, volume);
+		unsigned int frames = std::min(e->frames, out_frames);
+		for (unsigned int i = 0; i < frames * 2; i++)
+			out[i] += f[i];
+	}
+	spatial_batch.erase(spatial_batch.begin(), end);
+	// Everything is rendered within the device output, so whatever it leaves behind belongs to a mixer that stopped rendering part way through.
+	if (spatial_batch.empty() || user == output) {
+		spatial_batch.clear();
+		spatial_batch_samples.clear();
+	}
+	sound_spatial_time += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+// Waits for any mixer period that may still be spatializing the sound in a batch, after its positioning dsp was removed and before its effects are reset or released. Must not be called while holding a lock that stream callbacks take.
+static void spatial_batch_barrier(sound_base& s) {
+	DWORD m = s.output_mixer ? BASS_Mixer_ChannelGetMixer(s.output_mixer->channel) : 0;
+	if (!m) return;
+	BASS_ChannelLock(m, TRUE);
+	BASS_ChannelLock(m, FALSE);
 }
 
 void CALLBACK positioning_dsp(HDSP handle, DWORD channel, void* buffer, DWORD length, void* user) {
 	if (!buffer || length < 1 || !user)
 		return;
 	sound_base* s = (sound_base*)user;
+	auto start_time = std::chrono::steady_clock::now();
 	float x = s->x - s->listener_x;
 	float y = s->y - s->listener_y;
 	float z = s->z - s->listener_z;
@@ -288,10 +424,29 @@ void CALLBACK positioning_dsp(HDSP handle, DWORD channel, void* buffer, DWORD le
 		effect_settings.hrtf = phonon_hrtf;
 		iplBinauralEffectCreate(phonon_context, &phonon_audio_settings, &effect_settings, &s->hrtf_effect);
 	}
-	if (hrtf && s->hrtf_effect && s->use_hrtf)
-		phonon_dsp(buffer, length, x, y, z, *s);
-	else
-		basic_positioning_dsp(buffer, length, x, y, z, s->pan_step, s->volume_step);
+	bool spatialized = false;
+	DWORD batch_mixer = 0;
+	if (hrtf && s->hrtf_effect && s->use_hrtf && !s->env && s->output_mixer && channel == s->output_mixer->channel)
+		batch_mixer = BASS_Mixer_ChannelGetMixer(channel);
+	if (batch_mixer && (sound_hrtf_distance <= 0 || x * x + y * y + z * z <= sound_hrtf_distance * sound_hrtf_distance)) {
+		// Leave the sound to its mixer's spatial_batch_dsp.
+		unsigned int frames = length / (sizeof(float) * 2);
+		size_t offset = spatial_batch_samples.size();
+		spatial_batch_samples.insert(spatial_batch_samples.end(), (float*)buffer, (float*)buffer + frames * 2);
+		spatial_batch.push_back({s, batch_mixer, channel, x, y, z, offset, frames});
+		memset(buffer, 0, length);
+		sound_spatial_time += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+		return;
+	} else if (hrtf && s->hrtf_effect && s->use_hrtf && (s->env || sound_hrtf_distance <= 0 || x * x + y * y + z * z <= sound_hrtf_distance * sound_hrtf_distance))
+		spatialized = phonon_dsp(buffer, length, x, y, z, *s);
+	else {
+		if (s->hrtf_effect && s->spatial_voice)
+			iplBinauralEffectReset(s->hrtf_effect); // Don't resume from stale HRTF state if the sound moves back within sound_hrtf_distance.
+		basic_positioning_dsp(buffer, length, x, y, z, *s);
+	}
+	s->batch_volume = -1;
+	set_spatial_voice(*s, spatialized);
+	sound_spatial_time += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
 }
 
 // Bass fileprocs
@@ -504,51 +659,111 @@ finish:
 	return ret;
 }
 
-std::unordered_map<std::string, sound_preload*> sound_preloads;
-sound_preload* get_sound_preload(const std::string& filename, bool allow_creating = false) {
+// The decoded audio cache. Every sound loaded with preloads allowed is decoded in full on a background thread and kept here under it's filename, so that later loads of the same file skip decoding entirely. Entries are kept in least recently used order and evicted from the back whenever the total size exceeds sound_cache_budget, except for entries that sounds are currently playing from or which have been pinned. All of the below is guarded by preload_mutex.
+static std::unordered_map<std::string, sound_preload*> sound_preloads;
+static std::list<sound_preload*> sound_preload_lru; // Most recently used first.
+static std::unordered_set<std::string> sound_cache_pins;
+static uint64_t sound_cache_budget = 256 * 1024 * 1024;
+static uint64_t sound_cache_used = 0;
+static uint64_t sound_cache_hits = 0;
+static uint64_t sound_cache_misses = 0;
+static uint64_t sound_cache_evictions = 0;
+static void sound_preload_free(sound_preload* p) {
+	sound_preload_lru.erase(p->lru_pos);
+	sound_preloads.erase(p->fn);
+	sound_cache_used -= p->size;
+	free(p->data);
+	delete p;
+}
+// Evicts unused preloads from the least recently used end until the cache fits within it's budget.
+static void sound_cache_trim(uint64_t budget) {
+	for (auto it = sound_preload_lru.end(); sound_cache_used > budget && it != sound_preload_lru.begin();) {
+		sound_preload* p = *--it;
+		if (p->ref > 0 || p->t == -1 || sound_cache_pins.find(p->fn) != sound_cache_pins.end())
+			continue;
+		it = std::next(it);
+		sound_preload_free(p);
+		sound_cache_evictions += 1;
+	}
+}
+// Returns true if filename is cached or currently being decoded.
+bool sound_preload_exists(const std::string& filename) {
+	lock_mutex scopelock(&preload_mutex);
+	return sound_preloads.find(filename) != sound_preloads.end();
+}
+// Looks up a fully decoded preload, taking a reference to it that must be given back with sound_preload_release.
+sound_preload* sound_preload_acquire(const std::string& filename) {
 	lock_mutex scopelock(&preload_mutex);
 	auto it = sound_preloads.find(filename);
-	if (it == sound_preloads.end()) return NULL;
-	if (!allow_creating && it->second->t == -1) return NULL;
-	return it->second;
+	if (it == sound_preloads.end() || it->second->t == -1) {
+		sound_cache_misses += 1;
+		return NULL;
+	}
+	sound_preload* p = it->second;
+	sound_cache_hits += 1;
+	p->ref += 1;
+	p->t = ticks();
+	sound_preload_lru.splice(sound_preload_lru.begin(), sound_preload_lru, p->lru_pos);
+	return p;
+}
+void sound_preload_release(sound_preload* p) {
+	lock_mutex scopelock(&preload_mutex);
+	if (p->ref > 0)
+		p->ref -= 1;
+	p->t = ticks();
+	if (p->ref < 1)
+		sound_cache_trim(sound_cache_budget);
 }
 typedef struct {
 	std::string filename;
 	pack* p;
 } sound_preload_transport;
+// Decodes channel in full into the cache under filename, unless it is already cached, being decoded by another thread, or too large to ever fit in the cache.
 void sound_preload_perform(HSTREAM channel, const std::string& filename) {
 	if (!channel) return;
-	sound_preload* pre = (sound_preload*)malloc(sizeof(sound_preload));
-	memset(pre, 0, sizeof(sound_preload));
-	pre->t = -1;
-	thread_mutex_lock(&preload_mutex);
-	sound_preloads[filename] = pre;
-	thread_mutex_unlock(&preload_mutex);
+	DWORD len = BASS_ChannelGetLength(channel, BASS_POS_BYTE);
+	sound_preload* pre;
+	{
+		lock_mutex scopelock(&preload_mutex);
+		if (len == (DWORD)-1 || len + 44 > sound_cache_budget || sound_preloads.find(filename) != sound_preloads.end())
+			return;
+		pre = new sound_preload();
+		pre->data = NULL;
+		pre->size = 0;
+		pre->ref = 0;
+		pre->t = -1;
+		pre->fn = filename;
+		sound_preload_lru.push_front(pre);
+		pre->lru_pos = sound_preload_lru.begin();
+		sound_preloads[filename] = pre;
+	}
 	BASS_CHANNELINFO ci;
 	BASS_ChannelGetInfo(channel, &ci);
-	DWORD len = BASS_ChannelGetLength(channel, BASS_POS_BYTE);
 	unsigned char* samples = (unsigned char*)malloc(len + 44);
-	len = BASS_ChannelGetData(channel, samples + 44, len | BASS_DATA_FLOAT);
+	if (samples)
+		len = BASS_ChannelGetData(channel, samples + 44, len | BASS_DATA_FLOAT);
+	BASS_ChannelSetPosition(channel, 0, BASS_POS_BYTE);
+	lock_mutex scopelock(&preload_mutex);
+	if (!samples || len == (DWORD)-1) {
+		free(samples);
+		sound_preload_free(pre);
+		return;
+	}
 	wav_header h = make_wav_header(len + 44, ci.freq, 32, ci.chans, 3);
 	memcpy(samples, &h, 44);
-	pre->ref = 1;
 	pre->data = samples;
 	pre->size = len + 44;
-	pre->fn = filename;
-	BASS_ChannelSetPosition(channel, 0, BASS_POS_BYTE);
-	thread_mutex_lock(&preload_mutex);
 	pre->t = ticks();
-	thread_mutex_unlock(&preload_mutex);
+	sound_cache_used += pre->size;
+	sound_cache_trim(sound_cache_budget);
 }
 int sound_preload_thread(void* args) {
 	sound_preload_transport* t = (sound_preload_transport*)args;
-	if (get_sound_preload(t->filename, true)) {
-		free(t);
-		return 0;
-	}
 	pack_stream* stream = NULL;
 	DWORD channel = 0;
-	if (!t->p || !t->p->is_active() || (stream = t->p->stream_open(t->filename, 0)) == NULL)
+	if (sound_preload_exists(t->filename))
+		; // Already cached or being decoded elsewhere.
+	else if (!t->p || !t->p->is_active() || (stream = t->p->stream_open(t->filename, 0)) == NULL)
 		channel = BASS_StreamCreateFile(FALSE, t->filename.c_str(), 0, 0, BASS_STREAM_DECODE | BASS_SAMPLE_FLOAT);
 	else {
 		BASS_FILEPROCS prox;
@@ -562,67 +777,127 @@ int sound_preload_thread(void* args) {
 		s->snd = NULL;
 		channel = BASS_StreamCreateFileUser(STREAMFILE_NOBUFFER, BASS_STREAM_DECODE | BASS_SAMPLE_FLOAT, &prox, s);
 	}
-	if (!channel) {
-		free(t);
-		return 0;
+	if (channel) {
+		sound_preload_perform(channel, t->filename);
+		BASS_StreamFree(channel);
 	}
 	if (t->p)
-		t->p->delay_close = TRUE;
-	sound_preload_perform(channel, t->filename);
-	if (t->p)
-		t->p->delay_close = FALSE;
-	free(t);
-	BASS_StreamFree(channel);
+		t->p->Release();
+	delete t;
 	return 0;
 }
-void sound_preload_release(sound_preload* p) {
-	if (p->ref > 0)
-		p->ref -= 1;
-	if (p->ref < 1 && ticks() - p->t > 120000) {
-		lock_mutex scopelock(&preload_mutex);
-		auto it = sound_preloads.find(p->fn);
-		if (it != sound_preloads.end())
-			sound_preloads.erase(it);
-		p->fn = "";
-		free(p->data);
-		free(p);
-	}
-}
-static int sound_preloads_clean_counter = 0;
-void sound_preloads_clean() {
-	if (sound_preloads_clean_counter < 250) {
-		sound_preloads_clean_counter += 1;
-		return;
-	}
-	sound_preloads_clean_counter = 0;
-	lock_mutex scopelock(&preload_mutex);
-	std::unordered_map<std::string, sound_preload*>::iterator i = sound_preloads.begin();
-	while (i != sound_preloads.end()) {
-		if (i->second->t == -1) {
-			i++;
-			continue;
-		}
-		if (i->second->ref > 0 || ticks() - i->second->t < 120000) {
-			i++;
-			continue;
+// Starts decoding a file into the cache on a background thread. The pack, if any, is released by the thread when it finishes.
+static void sound_preload_start(const std::string& filename, pack* p) {
+	sound_preload_transport* t = new sound_preload_transport();
+	t->filename = filename;
+	t->p = p;
+	if (p)
+		p->AddRef();
+	thread_create(sound_preload_thread, t, THREAD_STACK_SIZE_DEFAULT);
+}
+// Script interface to the cache.
+bool sound_cache_prefetch(const std::string& filename, pack* p) {
+	bool started = false;
+	if (sound_initialized || init_sound()) {
+		if (!sound_preload_exists(filename)) {
+			sound_preload_start(filename, p);
+			started = true;
 		}
-		free(i->second->data);
-		i->second->fn = "";
-		free(i->second);
-		i = sound_preloads.erase(i);
-		i++;
 	}
+	if (p)
+		p->Release();
+	return started;
+}
+void sound_cache_pin(const std::string& filename) {
+	lock_mutex scopelock(&preload_mutex);
+	sound_cache_pins.insert(filename);
+}
+void sound_cache_unpin(const std::string& filename) {
+	lock_mutex scopelock(&preload_mutex);
+	sound_cache_pins.erase(filename);
+	sound_cache_trim(sound_cache_budget);
+}
+bool sound_cache_contains(const std::string& filename) {
+	lock_mutex scopelock(&preload_mutex);
+	auto it = sound_preloads.find(filename);
+	return it != sound_preloads.end() && it->second->t != -1;
+}
+// Evicts everything that isn't playing or pinned regardless of the budget.
+void sound_cache_clear() {
+	lock_mutex scopelock(&preload_mutex);
+	sound_cache_trim(0);
+}
+uint64_t get_sound_cache_budget() {
+	return sound_cache_budget;
+}
+void set_sound_cache_budget(uint64_t budget) {
+	lock_mutex scopelock(&preload_mutex);
+	sound_cache_budget = budget;
+	sound_cache_trim(sound_cache_budget);
+}
+uint64_t get_sound_cache_size() {
+	lock_mutex scopelock(&preload_mutex);
+	return sound_cache_used;
+}
+uint64_t get_sound_cache_hits() {
+	lock_mutex scopelock(&preload_mutex);
+	return sound_cache_hits;
+}
+uint64_t get_sound_cache_misses() {
+	lock_mutex scopelock(&preload_mutex);
+	return sound_cache_misses;
+}
+float get_sound_hrtf_distance() {
+	return sound_hrtf_distance;
+}
+void set_sound_hrtf_distance(float distance) {
+	sound_hrtf_distance = distance > 0 ? distance : 0;
+}
+unsigned int get_sound_hrtf_voices() {
+	return sound_hrtf_voices;
+}
+void set_sound_hrtf_voices(unsigned int voices) {
+	sound_hrtf_voices = voices;
+}
+int get_sound_spatial_voices() {
+	return sound_spatial_voices;
+}
+uint64_t get_sound_spatial_culled() {
+	return sound_spatial_culled;
+}
+uint64_t get_sound_spatial_time() {
+	return sound_spatial_time;
+}
+float get_sound_voice_threshold() {
+	return sound_voice_threshold;
+}
+void set_sound_voice_threshold(float threshold) {
+	sound_voice_threshold = threshold;
+}
+int get_sound_virtual_voices() {
+	return sound_virtual_voices;
+}
+uint64_t get_sound_cache_evictions() {
+	lock_mutex scopelock(&preload_mutex);
+	return sound_cache_evictions;
 }
 
 
 int sound_environment_thread(void* args) {
 	sound_environment* e = (sound_environment*)args;
-	while (e->ref_count > 0)
+	while (e->ref_count > 0) {
+		uint64_t start = ticks();
 		e->background_update();
+		float rate = e->get_simulation_rate();
+		if (rate > 0) {
+			uint64_t interval = 1000 / rate, elapsed = ticks() - start;
+			if (elapsed < interval) e->wait_for_update(interval - elapsed);
+		}
+	}
 	e->_detach_all();
 	return 0;
 }
-sound_environment::sound_environment() : ref_count(1), sim_inputs({}), scene_needs_commit(false), listener_modified(false) {
+sound_environment::sound_environment() : ref_count(1), sim_inputs({}), scene_needs_commit(false), listener_modified(false), region_size(64), streaming_distance(0), simulation_rate(30), regions_changed(false), listener_region(0), loaded_regions(0) {
 	set_global_hrtf(true);
 	IPLSimulationSettings simulation_settings{};
 	simulation_settings.flags = IPLSimulationFlags(IPL_SIMULATIONFLAGS_DIRECT | IPL_SIMULATIONFLAGS_REFLECTIONS);
@@ -663,7 +938,12 @@ sound_environment::sound_environment() : ref_count(1), sim_inputs({}), scene_nee
 }
 sound_environment::~sound_environment() {
 	asAtomicDec(ref_count); // ref_count < 0 shuts down thread.
+	wake.set();
 	thread_join(env_thread);
+	for (auto& r : regions)
+		unload_region(r.second);
+	for (auto& r : retired_regions)
+		unload_region(r);
 	iplSceneRelease(&scene);
 	iplSimulatorRelease(&sim);
 }
@@ -675,22 +955,74 @@ void sound_environment::release() {
 		delete this;
 }
 bool sound_environment::add_material(const std::string& name, float absorption_low, float absorption_mid, float absorption_high, float scattering, float transmission_low, float transmission_mid, float transmission_high, bool replace_if_existing) {
+	Poco::FastMutex::ScopedLock lock(geometry_mutex);
 	if (!replace_if_existing && materials.find(name) != materials.end()) return false;
 	materials[name] = IPLMaterial{{absorption_low, absorption_mid, absorption_high}, scattering, {transmission_low, transmission_mid, transmission_high}};
 	return true;
 }
 bool sound_environment::add_box(const std::string& material, float minx, float maxx, float miny, float maxy, float minz, float maxz) {
-	if (materials.find(material) == materials.end()) return false;
-	IPLVector3 vertices[8] = {
-		{minx, miny, minz},
-		{maxx, miny, minz},
-		{maxx, maxy, minz},
-		{minx, maxy, minz},
-		{minx, miny, maxz},
-		{maxx, miny, maxz},
-		{maxx, maxy, maxz},
-		{minx, maxy, maxz}
-	};
+	Poco::FastMutex::ScopedLock lock(geometry_mutex);
+	auto m = materials.find(material);
+	if (m == materials.end()) return false;
+	// Boxes belong to the region containing their center, the environment thread builds their meshes once that region is loaded.
+	int x = floorf((minx + maxx) / 2 / region_size), y = floorf((miny + maxy) / 2 / region_size), z = floorf((minz + maxz) / 2 / region_size);
+	uint64_t key = region_key(x, y, z);
+	auto it = regions.find(key);
+	if (it == regions.end()) {
+		sound_environment_region r{x, y, z};
+		r.scene = NULL;
+		r.instance = NULL;
+		r.dirty = false;
+		it = regions.insert(std::make_pair(key, r)).first;
+	}
+	it->second.boxes.push_back(sound_environment_box{minx, maxx, miny, maxy, minz, maxz, m->second, NULL});
+	it->second.dirty = true;
+	regions_changed = true;
+	wake.set();
+	return true;
+}
+unsigned int sound_environment::clear_boxes(float minx, float maxx, float miny, float maxy, float minz, float maxz) {
+	Poco::FastMutex::ScopedLock lock(geometry_mutex);
+	unsigned int removed = 0;
+	for (auto it = regions.begin(); it != regions.end();) {
+		sound_environment_region& r = it->second;
+		for (unsigned int i = 0; i < r.boxes.size();) {
+			sound_environment_box& b = r.boxes[i];
+			if (b.minx < minx || b.maxx > maxx || b.miny < miny || b.maxy > maxy || b.minz < minz || b.maxz > maxz) {
+				i++;
+				continue;
+			}
+			if (b.mesh)
+				retire_region(r); // The environment thread may be simulating, so the scene is torn down over there.
+			r.boxes[i] = r.boxes.back();
+			r.boxes.pop_back();
+			removed++;
+		}
+		if (r.boxes.empty()) {
+			retire_region(r);
+			it = regions.erase(it);
+		} else
+			++it;
+	}
+	if (removed) {
+		regions_changed = true;
+		wake.set();
+	}
+	return removed;
+}
+uint64_t sound_environment::region_key(int x, int y, int z) {
+	return (uint64_t(x + 0x100000) & 0x1fffff) | ((uint64_t(y + 0x100000) & 0x1fffff) << 21) | ((uint64_t(z + 0x100000) & 0x1fffff) << 42);
+}
+// Builds a region's scene, or adds any boxes that are missing from an already loaded one, and instances it into the environment's scene.
+void sound_environment::load_region(sound_environment_region& r) {
+	if (!r.scene) {
+		IPLSceneSettings scene_settings{};
+		scene_settings.type = IPL_SCENETYPE_DEFAULT;
+		if (iplSceneCreate(phonon_context, &scene_settings, &r.scene) != IPL_STATUS_SUCCESS) {
+			r.scene = NULL;
+			return;
+		}
+	}
 	IPLTriangle triangles[12] = {
 		// floor
 		{0, 1, 2},
@@ -712,12 +1044,140 @@ bool sound_environment::add_box(const std::string& material, float minx, float m
 		{4, 6, 7},
 	};
 	IPLint32 material_indexes[12] = {0};
-	IPLStaticMeshSettings mesh_settings{8, 12, 1, vertices, triangles, material_indexes, & materials[material]};
-	IPLStaticMesh mesh = NULL;
-	iplStaticMeshCreate(scene, &mesh_settings, &mesh);
-	iplStaticMeshAdd(mesh, scene);
+	for (sound_environment_box& b : r.boxes) {
+		if (b.mesh) continue;
+		IPLVector3 vertices[8] = {
+			{b.minx, b.miny, b.minz},
+			{b.maxx, b.miny, b.minz},
+			{b.maxx, b.maxy, b.minz},
+			{b.minx, b.maxy, b.minz},
+			{b.minx, b.miny, b.maxz},
+			{b.maxx, b.miny, b.maxz},
+			{b.maxx, b.maxy, b.maxz},
+			{b.minx, b.maxy, b.maxz}
+		};
+		IPLStaticMeshSettings mesh_settings{8, 12, 1, vertices, triangles, material_indexes, &b.material};
+		if (iplStaticMeshCreate(r.scene, &mesh_settings, &b.mesh) != IPL_STATUS_SUCCESS) {
+			b.mesh = NULL;
+			continue;
+		}
+		iplStaticMeshAdd(b.mesh, r.scene);
+	}
+	iplSceneCommit(r.scene);
+	r.dirty = false;
+	if (!r.instance) {
+		IPLInstancedMeshSettings instance_settings{r.scene, IPLMatrix4x4{{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}}}};
+		if (iplInstancedMeshCreate(scene, &instance_settings, &r.instance) != IPL_STATUS_SUCCESS) {
+			r.instance = NULL;
+			return;
+		}
+		iplInstancedMeshAdd(r.instance, scene);
+		loaded_regions++;
+	}
 	scene_needs_commit = true;
-	return true;
+}
+// Detaches a loaded region's scene and meshes so that the environment thread can release them, leaving the region to be rebuilt if it still has boxes.
+void sound_environment::retire_region(sound_environment_region& r) {
+	if (!r.scene) return;
+	sound_environment_region retired{r.x, r.y, r.z};
+	retired.scene = r.scene;
+	retired.instance = r.instance;
+	retired.dirty = false;
+	for (sound_environment_box& b : r.boxes) {
+		if (!b.mesh) continue;
+		retired.boxes.push_back(b);
+		b.mesh = NULL;
+	}
+	retired_regions.push_back(retired);
+	r.scene = NULL;
+	r.instance = NULL;
+	r.dirty = !r.boxes.empty();
+}
+void sound_environment::unload_region(sound_environment_region& r) {
+	if (r.instance) {
+		iplInstancedMeshRemove(r.instance, scene);
+		iplInstancedMeshRelease(&r.instance);
+		r.instance = NULL;
+		loaded_regions--;
+	}
+	for (sound_environment_box& b : r.boxes) {
+		if (!b.mesh) continue;
+		iplStaticMeshRemove(b.mesh, r.scene);
+		iplStaticMeshRelease(&b.mesh);
+		b.mesh = NULL;
+	}
+	if (r.scene) iplSceneRelease(&r.scene);
+	r.scene = NULL;
+	r.dirty = !r.boxes.empty();
+}
+// Runs on the environment thread, loading the regions within streaming_distance of the listener and unloading the rest. Only regions that actually change are touched, and nothing at all happens until either the listener crosses into another region or geometry is added or removed.
+void sound_environment::stream_regions() {
+	Poco::FastMutex::ScopedLock lock(geometry_mutex);
+	for (sound_environment_region& r : retired_regions) {
+		unload_region(r);
+		scene_needs_commit = true;
+	}
+	retired_regions.clear();
+	int lx = floorf(listener_x / region_size), ly = floorf(listener_y / region_size), lz = floorf(listener_z / region_size);
+	uint64_t key = region_key(lx, ly, lz);
+	if (!regions_changed && (streaming_distance <= 0 || key == listener_region)) return;
+	listener_region = key;
+	regions_changed = false;
+	int reach = streaming_distance > 0 ? int(ceilf(streaming_distance / region_size)) : 0;
+	for (auto& it : regions) {
+		sound_environment_region& r = it.second;
+		bool in_range = streaming_distance <= 0 || (abs(r.x - lx) <= reach && abs(r.y - ly) <= reach && abs(r.z - lz) <= reach);
+		if (in_range && (!r.scene || r.dirty))
+			load_region(r);
+		else if (!in_range && r.scene) {
+			unload_region(r);
+			scene_needs_commit = true;
+		}
+	}
+}
+void sound_environment::set_region_size(float size) {
+	if (size <= 0) return;
+	Poco::FastMutex::ScopedLock lock(geometry_mutex);
+	if (size == region_size) return;
+	// Rebucket every box into the new grid, the environment thread then loads the new regions from scratch.
+	std::vector<sound_environment_box> boxes;
+	for (auto& it : regions) {
+		retire_region(it.second);
+		boxes.insert(boxes.end(), it.second.boxes.begin(), it.second.boxes.end());
+	}
+	regions.clear();
+	region_size = size;
+	for (sound_environment_box& b : boxes) {
+		int x = floorf((b.minx + b.maxx) / 2 / region_size), y = floorf((b.miny + b.maxy) / 2 / region_size), z = floorf((b.minz + b.maxz) / 2 / region_size);
+		auto it = regions.find(region_key(x, y, z));
+		if (it == regions.end()) {
+			sound_environment_region r{x, y, z};
+			r.scene = NULL;
+			r.instance = NULL;
+			it = regions.insert(std::make_pair(region_key(x, y, z), r)).first;
+		}
+		it->second.boxes.push_back(b);
+		it->second.dirty = true;
+	}
+	regions_changed = true;
+	wake.set();
+}
+void sound_environment::set_streaming_distance(float distance) {
+	Poco::FastMutex::ScopedLock lock(geometry_mutex);
+	streaming_distance = distance > 0 ? distance : 0;
+	regions_changed = true;
+	wake.set();
+}
+void sound_environment::set_simulation_rate(float rate) {
+	simulation_rate = rate > 0 ? rate : 0;
+	wake.set();
+}
+unsigned int sound_environment::get_region_count() {
+	Poco::FastMutex::ScopedLock lock(geometry_mutex);
+	return regions.size();
+}
+void sound_environment::wait_for_update(unsigned int ms) {
+	wake.tryWait(ms);
 }
 bool sound_environment::attach(sound_base* s) {
 	if (!s || s->env) return false;
@@ -772,6 +1232,7 @@ bool sound_environment::detach(sound_base* s) {
 	if (!s || s->env != this) return false;
 	s->env = NULL;
 	detaching.push_back(s);
+	wake.set();
 	s->env_detaching.wait();
 	if (ref_count > 0) this->release();
 	return true;
@@ -797,7 +1258,9 @@ void sound_environment::background_update() {
 		if (ref_count < 1) return;
 	}
 	detaching.clear();
+	stream_regions();
 	if (scene_needs_commit) {
+		Poco::FastMutex::ScopedLock lock(geometry_mutex);
 		iplSceneCommit(scene);
 		iplSimulatorCommit(sim);
 		scene_needs_commit = false;
@@ -810,7 +1273,6 @@ void sound_environment::background_update() {
 		iplSimulatorSetSharedInputs(sim, IPLSimulationFlags(IPL_SIMULATIONFLAGS_DIRECT | IPL_SIMULATIONFLAGS_REFLECTIONS), &sim_inputs);
 		iplSimulatorCommit(sim);
 		listener_modified = false;
-		iplSimulatorRunReflections(sim);
 	}
 	iplSimulatorRunReflections(sim);
 }
@@ -820,6 +1282,7 @@ void sound_environment::set_listener(float x, float y, float z, float rotation)
 	listener_z = z;
 	listener_rotation = rotation;
 	listener_modified = true;
+	if (streaming_distance > 0) wake.set(); // Regions may need streaming.
 }
 
 
@@ -859,6 +1322,11 @@ sound::sound() {
 	memstream_size = 0;
 	memstream_pos = 0;
 	memstream_legacy_encrypt = false;
+	priority = 0;
+	virtual_voice = false;
+	virtual_pos = 0;
+	virtual_time = 0;
+	audibility = 0;
 }
 sound::~sound() {
 	if (!sound_initialized)
@@ -889,11 +1357,9 @@ BOOL sound::load(const string& filename, pack* containing_pack, BOOL allow_prelo
 	if (strnicmp(filename.c_str(), "http://", 7) == 0 || strnicmp(filename.c_str(), "https:///", 8) == 0 || strnicmp(filename.c_str(), "ftp://", 6) == 0)
 		return load_url(filename);
 	channel = 0;
-	sound_preload* pre = (allow_preloads ? get_sound_preload(filename) : NULL);
+	sound_preload* pre = (allow_preloads ? sound_preload_acquire(filename) : NULL);
 	if (pre != NULL) {
 		preload_ref = pre;
-		pre->ref += 1;
-		pre->t = ticks();
 		if (pre->data && pre->size)
 			channel = BASS_StreamCreateFile(TRUE, pre->data, 0, pre->size, BASS_SAMPLE_FLOAT | BASS_STREAM_DECODE);
 	}
@@ -921,13 +1387,8 @@ BOOL sound::load(const string& filename, pack* containing_pack, BOOL allow_prelo
 			s->snd = this;
 			channel = BASS_StreamCreateFileUser(STREAMFILE_NOBUFFER, BASS_STREAM_DECODE | BASS_SAMPLE_FLOAT, &prox, s);
 		}
-		if (channel && allow_preloads && !pre) {
-			sound_preload_transport* t = (sound_preload_transport*)malloc(sizeof(sound_preload_transport));
-			memset(t, 0, sizeof(sound_preload_transport));
-			t->filename += filename;
-			t->p = containing_pack;
-			thread_create(sound_preload_thread, t, THREAD_STACK_SIZE_DEFAULT);
-		}
+		if (channel && allow_preloads && !pre)
+			sound_preload_start(filename, containing_pack);
 	}
 	if (containing_pack) containing_pack->Release();
 	return postload(filename);
@@ -940,11 +1401,9 @@ BOOL sound::load_script(asIScriptFunction* close, asIScriptFunction* len, asIScr
 		return FALSE;
 	if (channel)
 		this->close();
-	sound_preload* pre = (preload_filename != "" ? get_sound_preload(preload_filename) : NULL);
+	sound_preload* pre = (preload_filename != "" ? sound_preload_acquire(preload_filename) : NULL);
 	if (pre != NULL) {
 		preload_ref = pre;
-		pre->ref += 1;
-		pre->t = ticks();
 		if (pre->data && pre->size)
 			channel = BASS_StreamCreateFile(TRUE, pre->data, 0, pre->size, BASS_SAMPLE_FLOAT | BASS_STREAM_DECODE);
 		if (channel) {
@@ -983,11 +1442,9 @@ BOOL sound::load_memstream(string& data, unsigned int size, const std::string& p
 		return FALSE;
 	if (channel)
 		this->close();
-	sound_preload* pre = (preload_filename != "" ? get_sound_preload(preload_filename) : NULL);
+	sound_preload* pre = (preload_filename != "" ? sound_preload_acquire(preload_filename) : NULL);
 	if (pre != NULL) {
 		preload_ref = pre;
-		pre->ref += 1;
-		pre->t = ticks();
 		if (pre->data && pre->size)
 			channel = BASS_StreamCreateFile(TRUE, pre->data, 0, pre->size, BASS_SAMPLE_FLOAT | BASS_STREAM_DECODE);
 	}
@@ -1083,6 +1540,7 @@ BOOL sound::postload(const string& filename) {
 	}
 	if (!parent_mixer)
 		parent_mixer = output;
+	parent_mixer->voices.insert(this);
 	if (!output_mixer) {
 		output_mixer = new mixer(parent_mixer, !env);
 		if (listener_x != x || listener_y != y || listener_z != z || env)
@@ -1100,15 +1558,19 @@ BOOL sound::postload(const string& filename) {
 BOOL sound::close() {
 	if (channel) {
 		stop();
-		thread_mutex_lock(&close_mutex);
 		if (hrtf_effect) {
 			if (output_mixer && pos_effect)
 				BASS_ChannelRemoveDSP(output_mixer->channel, pos_effect);
 			pos_effect = 0;
+			spatial_batch_barrier(*this); // Before close_mutex, which the mixer may be waiting on in a stream callback.
 			iplBinauralEffectReset(hrtf_effect);
 			iplBinauralEffectRelease(&hrtf_effect);
 		}
 		hrtf_effect = NULL;
+		set_spatial_voice(*this, false);
+		thread_mutex_lock(&close_mutex);
+		if (parent_mixer)
+			parent_mixer->voices.erase(this);
 		if (env) env->detach(this);
 		if (output_mixer) {
 			if (parent_mixer)
@@ -1136,7 +1598,6 @@ BOOL sound::close() {
 			sound_preload_release(preload_ref);
 			preload_ref = NULL;
 		}
-		sound_preloads_clean();
 		if (close_callback) close_callback->Release();
 		if (len_callback) len_callback->Release();
 		if (read_callback) read_callback->Release();
@@ -1161,15 +1622,31 @@ int sound::set_fx(std::string& fx, int idx) {
 BOOL sound::set_mixer(mixer* m) {
 	if (!m)
 		m = output;
+	mixer* previous = parent_mixer;
+	BOOL ret;
 	if (output_mixer) {
 		if (parent_mixer)
 			parent_mixer->remove_mixer(output_mixer, TRUE);
 		if (m && m->add_mixer(output_mixer))
 			parent_mixer = m;
-		return parent_mixer == m;
+		ret = parent_mixer == m;
+	} else {
+		parent_mixer = m;
+		ret = m != NULL;
+	}
+	if (channel && parent_mixer != previous) {
+		bool held = false;
+		if (previous) {
+			previous->voices.erase(this);
+			held = previous->real_voices.erase(this) > 0;
+		}
+		if (parent_mixer) {
+			parent_mixer->voices.insert(this);
+			if (held)
+				parent_mixer->real_voices.insert(this);
+		}
 	}
-	parent_mixer = m;
-	return m != NULL;
+	return ret;
 }
 
 BOOL sound_base::set_position(float listener_x, float listener_y, float listener_z, float sound_x, float sound_y, float sound_z, float rotation, float pan_step, float volume_step) {
@@ -1185,9 +1662,12 @@ BOOL sound_base::set_position(float listener_x, float listener_y, float listener
 	if (x == listener_x && y == listener_y && z == listener_z && !env) {
 		if (pos_effect) {
 			BASS_ChannelRemoveDSP(output_mixer ? output_mixer->channel : channel, pos_effect);
+			spatial_batch_barrier(*this);
 			if (hrtf_effect)
 				iplBinauralEffectReset(hrtf_effect);
 			pos_effect = 0;
+			gain_left = gain_right = -1;
+			set_spatial_voice(*this, false);
 		}
 	} else if (!pos_effect)
 		pos_effect = BASS_ChannelSetDSP(output_mixer ? output_mixer->channel : channel, positioning_dsp, this, 0);
@@ -1202,18 +1682,121 @@ BOOL sound_base::set_position(float listener_x, float listener_y, float listener
 		iplSourceSetInputs(source, IPLSimulationFlags(IPL_SIMULATIONFLAGS_DIRECT | IPL_SIMULATIONFLAGS_REFLECTIONS), &inputs);
 		iplSimulatorCommit(env->sim);
 	}
+	update_voice();
 	return TRUE;
 }
 
+// Voice virtualization. A sound that can't be heard, or that lost its voice to a more important one on a mixer with max_voices set, is paused in BASS so that it is neither decoded nor run through any DSP, while its position is extrapolated from the time it was virtualized. It is made real again at that position once it is audible and has a voice.
+float sound::get_audibility() {
+	float volume = get_volume();
+	if (volume <= 0)
+		return -HUGE_VALF;
+	float db = 20 * log10f(volume);
+	if (env || (x == listener_x && y == listener_y && z == listener_z))
+		return db; // Environments attenuate in steam audio and we have no cheap way of knowing by how much.
+	float dx = x - listener_x, dy = y - listener_y, dz = z - listener_z;
+	float positional = 1.0 - floorf(sqrtf(dx * dx + dy * dy + dz * dz)) / (125.0 / volume_step);
+	if (positional <= 0)
+		return -HUGE_VALF;
+	if (positional < 1)
+		db += positional * 100 - 100;
+	return db;
+}
+QWORD sound::get_virtual_position(bool& ended) {
+	ended = false;
+	double elapsed = (ticks() - virtual_time) / 1000.0 * get_pitch();
+	QWORD pos = virtual_pos + BASS_ChannelSeconds2Bytes(channel, elapsed);
+	QWORD len = BASS_ChannelGetLength(channel, BASS_POS_BYTE);
+	if (len > 0 && len != (QWORD) - 1 && pos >= len) {
+		if (BASS_ChannelFlags(channel, 0, 0) & BASS_SAMPLE_LOOP)
+			pos %= len;
+		else
+			ended = true;
+	}
+	return pos;
+}
+// Virtual positions are extrapolated at the current pitch, so one is brought up to date before the pitch changes.
+void sound::rebase_virtual_position() {
+	if (!virtual_voice)
+		return;
+	bool ended;
+	virtual_pos = get_virtual_position(ended);
+	virtual_time = ticks();
+}
+bool sound::make_virtual() {
+	if (virtual_voice || !is_playing())
+		return false;
+	// Streams of unknown length such as URLs keep receiving data, so can't be paused without consequence.
+	QWORD len = BASS_ChannelGetLength(channel, BASS_POS_BYTE);
+	if (len == 0 || len == (QWORD) - 1)
+		return false;
+	virtual_pos = BASS_Mixer_ChannelGetPosition(channel, BASS_POS_BYTE);
+	virtual_time = ticks();
+	BASS_Mixer_ChannelFlags(channel, BASS_MIXER_CHAN_PAUSE, BASS_MIXER_CHAN_PAUSE);
+	if (hrtf_effect)
+		iplBinauralEffectReset(hrtf_effect);
+	virtual_voice = true;
+	sound_virtual_voices++;
+	hold_voice(false);
+	return true;
+}
+bool sound::make_real() {
+	if (!virtual_voice)
+		return false;
+	bool ended;
+	QWORD pos = get_virtual_position(ended);
+	virtual_voice = false;
+	sound_virtual_voices--;
+	if (ended) {
+		stop();
+		return false;
+	}
+	gain_left = gain_right = -1; // Whatever the last buffer was positioned with is long gone.
+	BASS_Mixer_ChannelSetPosition(channel, pos, BASS_POS_BYTE);
+	BASS_Mixer_ChannelFlags(channel, 0, BASS_MIXER_CHAN_PAUSE);
+	hold_voice(true);
+	return true;
+}
+// Keeps the parent mixer's set of real voices up to date, so that voice_available needn't look at every sound on the mixer.
+void sound::hold_voice(bool held) {
+	if (!parent_mixer)
+		return;
+	if (held)
+		parent_mixer->real_voices.insert(this);
+	else
+		parent_mixer->real_voices.erase(this);
+}
+// A sound whose volume is sliding counts as audible, so that one faded in from silence isn't left virtual until its position is next set.
+void sound::update_voice() {
+	if (!channel || (!virtual_voice && !is_playing()))
+		return;
+	audibility = get_audibility();
+	bool audible = audibility > sound_voice_threshold || is_volume_sliding();
+	if (virtual_voice && audible && (!parent_mixer || parent_mixer->voice_available(this)))
+		make_real();
+	else if (!virtual_voice && !audible)
+		make_virtual();
+}
+
 BOOL sound::play() {
 	if (!channel)
 		return FALSE;
 	if (loaded_filename != "" && is_playing())
 		return FALSE;
+	if (virtual_voice) // Restarting a sound that is still playing virtually, carry on from where it logically is.
+		make_real();
 	if (BASS_ChannelIsActive(channel) != BASS_ACTIVE_PLAYING)
 		BASS_Mixer_ChannelSetPosition(channel, 0, BASS_POS_BYTE);
 	BASS_ChannelFlags(channel, 0, BASS_SAMPLE_LOOP);
-	return !(BASS_Mixer_ChannelFlags(channel, 0, BASS_MIXER_CHAN_PAUSE)&BASS_MIXER_CHAN_PAUSE);
+	BOOL ret = !(BASS_Mixer_ChannelFlags(channel, 0, BASS_MIXER_CHAN_PAUSE)&BASS_MIXER_CHAN_PAUSE);
+	if (ret) {
+		audibility = get_audibility();
+		if ((audibility <= sound_voice_threshold && !is_volume_sliding()) || (parent_mixer && !parent_mixer->voice_available(this)))
+			make_virtual();
+		else
+			hold_voice(true);
+	}
+	return ret;
 }
 
 BOOL sound::play_wait() {
@@ -1240,7 +1823,19 @@ BOOL sound::pause() {
 		return FALSE;
 	if (!is_playing())
 		return FALSE;
+	if (virtual_voice) { // Already paused in BASS, only the position needs catching up.
+		bool ended;
+		QWORD pos = get_virtual_position(ended);
+		virtual_voice = false;
+		sound_virtual_voices--;
+		if (ended) {
+			stop();
+			return FALSE;
+		}
+		return BASS_Mixer_ChannelSetPosition(channel, pos, BASS_POS_BYTE);
+	}
 	BOOL ret = (BASS_Mixer_ChannelFlags(channel, BASS_MIXER_CHAN_PAUSE, BASS_MIXER_CHAN_PAUSE)&BASS_MIXER_CHAN_PAUSE) > 0;
+	hold_voice(false);
 	if (ret && hrtf && hrtf_effect)
 		iplBinauralEffectReset(hrtf_effect);
 	return ret;
@@ -1251,6 +1846,10 @@ BOOL sound::seek(float offset) {
 		return FALSE;
 	QWORD bytes = BASS_ChannelSeconds2Bytes(channel, offset / 1000);
 	BOOL ret = BASS_Mixer_ChannelSetPosition(channel, bytes, BASS_POS_BYTE);
+	if (ret && virtual_voice) {
+		virtual_pos = bytes;
+		virtual_time = ticks();
+	}
 	if (ret && hrtf && hrtf_effect)
 		iplBinauralEffectReset(hrtf_effect);
 	return ret;
@@ -1259,7 +1858,12 @@ BOOL sound::seek(float offset) {
 BOOL sound::stop() {
 	if (!channel)
 		return FALSE;
+	if (virtual_voice) {
+		virtual_voice = false;
+		sound_virtual_voices--;
+	}
 	BOOL ret = (BASS_Mixer_ChannelFlags(channel, BASS_MIXER_CHAN_PAUSE, BASS_MIXER_CHAN_PAUSE)&BASS_MIXER_CHAN_PAUSE) > 0;
+	hold_voice(false);
 	BASS_Mixer_ChannelSetPosition(channel, 0, BASS_POS_BYTE);
 	if (ret && hrtf && hrtf_effect)
 		iplBinauralEffectReset(hrtf_effect);
@@ -1271,10 +1875,18 @@ BOOL sound::is_active() {
 }
 
 BOOL sound::is_paused() {
-	return channel > 0 && parent_mixer && (BASS_Mixer_ChannelFlags(channel, BASS_MIXER_CHAN_PAUSE, 0)&BASS_MIXER_CHAN_PAUSE) > 0;
+	return channel > 0 && !virtual_voice && parent_mixer && (BASS_Mixer_ChannelFlags(channel, BASS_MIXER_CHAN_PAUSE, 0)&BASS_MIXER_CHAN_PAUSE) > 0;
 }
 
 BOOL sound::is_playing() {
+	if (virtual_voice) {
+		bool ended;
+		get_virtual_position(ended);
+		if (!ended)
+			return TRUE;
+		stop();
+		return FALSE;
+	}
 	return channel > 0 && parent_mixer && output_mixer && BASS_ChannelIsActive(channel) == BASS_ACTIVE_PLAYING && BASS_Mixer_ChannelGetMixer(channel) == output_mixer->channel && BASS_Mixer_ChannelGetMixer(output_mixer->channel) == parent_mixer->channel && !(BASS_Mixer_ChannelFlags(channel, 0, 0)&BASS_MIXER_CHAN_PAUSE);
 }
 
@@ -1317,7 +1929,12 @@ float sound::get_length_ms() {
 float sound::get_position() {
 	if (!channel)
 		return -1;
-	QWORD pos = BASS_ChannelGetPosition(channel, BASS_POS_BYTE);
+	QWORD pos;
+	if (virtual_voice) {
+		bool ended;
+		pos = get_virtual_position(ended);
+	} else
+		pos = BASS_ChannelGetPosition(channel, BASS_POS_BYTE);
 	if (pos > 0)
 		return BASS_ChannelBytes2Seconds(channel, pos);
 	else
@@ -1371,7 +1988,9 @@ BOOL sound::set_pan(float pan) {
 		return FALSE;
 	if (pan < -1.0 || pan > 1.0)
 		return FALSE;
-	return BASS_ChannelSetAttribute(channel, BASS_ATTRIB_PAN, pan);
+	BOOL r = BASS_ChannelSetAttribute(channel, BASS_ATTRIB_PAN, pan);
+	update_voice();
+	return r;
 }
 BOOL sound::set_pan_alt(float pan) {
 	return set_pan(pan / 100);
@@ -1382,7 +2001,9 @@ BOOL sound::slide_pan(float pan, unsigned int time) {
 		return FALSE;
 	if (pan < -1.0 || pan > 1.0)
 		return FALSE;
-	return BASS_ChannelSlideAttribute(channel, BASS_ATTRIB_PAN, pan, time);
+	BOOL r = BASS_ChannelSlideAttribute(channel, BASS_ATTRIB_PAN, pan, time);
+	update_voice();
+	return r;
 }
 BOOL sound::slide_pan_alt(float pan, unsigned int time) {
 	return slide_pan(pan / 100, time);
@@ -1392,9 +2013,11 @@ BOOL sound::set_pitch(float pitch) {
 	if (!channel)
 		return FALSE;
 	if (pitch < 0.05 || pitch > 5.0) return false;
+	rebase_virtual_position();
 	BASS_ChannelLock(channel, TRUE);
 	BOOL r = BASS_ChannelSetAttribute(channel, BASS_ATTRIB_FREQ, channel_info.freq * pitch);
 	BASS_ChannelLock(channel, FALSE);
+	update_voice();
 	return r;
 }
 BOOL sound::set_pitch_alt(float pitch) {
@@ -1405,7 +2028,10 @@ BOOL sound::slide_pitch(float pitch, unsigned int time) {
 	if (!channel)
 		return FALSE;
 	if (pitch < 0.05 || pitch > 5.0) return false;
-	return BASS_ChannelSlideAttribute(channel, BASS_ATTRIB_FREQ, channel_info.freq * pitch, time);
+	rebase_virtual_position();
+	BOOL r = BASS_ChannelSlideAttribute(channel, BASS_ATTRIB_FREQ, channel_info.freq * pitch, time);
+	update_voice();
+	return r;
 }
 BOOL sound::slide_pitch_alt(float pitch, unsigned int time) {
 	return slide_pitch(pitch / 100, time);
@@ -1416,10 +2042,13 @@ BOOL sound::set_volume(float volume) {
 		return FALSE;
 	if (volume < 0) volume = 0.0;
 	if (volume > 1) volume = 1.0;
+	BOOL r;
 	if (output_mixer)
-		return output_mixer->set_volume(volume);
+		r = output_mixer->set_volume(volume);
 	else
-		return BASS_ChannelSetAttribute(channel, BASS_ATTRIB_VOL, volume);
+		r = BASS_ChannelSetAttribute(channel, BASS_ATTRIB_VOL, volume);
+	update_voice();
+	return r;
 }
 BOOL sound::set_volume_alt(float volume) {
 	return set_volume((volume + 100) / 100);
@@ -1430,10 +2059,13 @@ BOOL sound::slide_volume(float volume, unsigned int time) {
 		return FALSE;
 	if (volume < 0.0 || volume > 1.0)
 		return FALSE;
+	BOOL r;
 	if (output_mixer)
-		return output_mixer->slide_volume(volume, time);
+		r = output_mixer->slide_volume(volume, time);
 	else
-		return BASS_ChannelSlideAttribute(channel, BASS_ATTRIB_VOL, volume, time);
+		r = BASS_ChannelSlideAttribute(channel, BASS_ATTRIB_VOL, volume, time);
+	update_voice();
+	return r;
 }
 BOOL sound::slide_volume_alt(float volume, unsigned int time) {
 	return slide_volume((volume + 100) / 100, time);
@@ -1470,9 +2102,12 @@ mixer::mixer(mixer* parent, BOOL for_single_sound, BOOL for_decode, BOOL floatin
 		else
 			parent_mixer = NULL;
 	}
+	if (!for_single_sound && floatingpoint)
+		BASS_ChannelSetDSP(channel, spatial_batch_dsp, this, 0x7fffffff); // Ahead of any effects set on the mixer.
 	output_mixer = NULL;
 	hrtf_effect = NULL;
 	pos_effect = 0;
+	max_voices = 0;
 }
 
 mixer::~mixer() {
@@ -1481,6 +2116,9 @@ mixer::~mixer() {
 			i->set_mixer(output);
 		for (auto i : sounds)
 			i->set_mixer(output);
+		std::vector<sound*> moving(voices.begin(), voices.end()); // set_mixer erases from voices.
+		for (auto i : moving)
+			i->set_mixer(output);
 	}
 	mixers.clear();
 	sounds.clear();
@@ -1557,6 +2195,63 @@ BOOL mixer::remove_sound(sound& s, BOOL internal) {
 	return TRUE;
 }
 
+// Forgets real voices that have ended by themselves since they were started.
+void mixer::prune_voices() {
+	for (auto it = real_voices.begin(); it != real_voices.end();) {
+		if ((*it)->is_playing())
+			++it;
+		else
+			it = real_voices.erase(it);
+	}
+}
+// Returns whether s may play for real on this mixer, virtualizing the least important real voice to make room if s outranks it. Only the mixer's real voices are looked at, and only once they appear to fill max_voices.
+bool mixer::voice_available(sound* s) {
+	if (!max_voices)
+		return true;
+	if (real_voices.size() - real_voices.count(s) < max_voices)
+		return true;
+	prune_voices();
+	unsigned int count = 0;
+	sound* weakest = NULL;
+	for (auto v : real_voices) {
+		if (v == s)
+			continue;
+		count++;
+		if (!weakest || v->priority < weakest->priority || (v->priority == weakest->priority && v->audibility < weakest->audibility))
+			weakest = v;
+	}
+	if (count < max_voices)
+		return true;
+	if (!weakest || weakest->priority > s->priority || (weakest->priority == s->priority && weakest->audibility >= s->audibility))
+		return false;
+	return weakest->make_virtual();
+}
+// Re-evaluates every playing sound on this mixer, for instance so that voices freed by sounds stopping are handed to virtual ones that haven't had their position updated.
+void mixer::update_voices() {
+	std::vector<sound*> playing;
+	for (auto v : voices) {
+		if (v->virtual_voice || v->is_playing()) {
+			v->audibility = v->get_audibility();
+			playing.push_back(v);
+		}
+	}
+	std::sort(playing.begin(), playing.end(), [](sound * a, sound * b) {
+		return a->priority != b->priority ? a->priority > b->priority : a->audibility > b->audibility;
+	});
+	unsigned int real = 0;
+	for (auto v : playing) {
+		if ((v->audibility > sound_voice_threshold || v->is_volume_sliding()) && (!max_voices || real < max_voices)) {
+			if (!v->virtual_voice || v->make_real())
+				real++;
+		} else
+			v->make_virtual();
+	}
+}
+unsigned int mixer::get_voice_count() {
+	prune_voices();
+	return real_voices.size();
+}
+
 int mixer::set_fx(std::string& fx, int idx) {
 	if(fx.size()<1) {
 		if(idx>=0&&idx<effects.size()) {
@@ -2027,6 +2722,8 @@ void RegisterScriptSound(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod("sound", "bool get_active() const property", asMETHOD(sound, is_active), asCALL_THISCALL);
 	engine->RegisterObjectMethod("sound", "bool get_playing() const property", asMETHOD(sound, is_playing), asCALL_THISCALL);
 	engine->RegisterObjectMethod("sound", "bool get_paused() const property", asMETHOD(sound, is_paused), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound", "bool get_virtual() const property", asMETHOD(sound, is_virtual), asCALL_THISCALL);
+	engine->RegisterObjectProperty("sound", "int priority", asOFFSET(sound, priority));
 	engine->RegisterObjectMethod("sound", "bool get_sliding() const property", asMETHOD(sound, is_sliding), asCALL_THISCALL);
 	engine->RegisterObjectMethod("sound", "bool get_pan_sliding() const property", asMETHOD(sound, is_pan_sliding), asCALL_THISCALL);
 	engine->RegisterObjectMethod("sound", "bool get_pitch_sliding() const property", asMETHOD(sound, is_pitch_sliding), asCALL_THISCALL);
@@ -2046,6 +2743,10 @@ void RegisterScriptSound(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod("mixer", "bool set_position(float, float, float, float, float, float, float, float, float)", asMETHOD(mixer, set_position), asCALL_THISCALL);
 	engine->RegisterObjectMethod("mixer", "bool set_mixer(mixer@ = null)", asMETHOD(mixer, set_mixer), asCALL_THISCALL);
 	engine->RegisterObjectMethod("mixer", "bool get_sliding() const property", asMETHOD(mixer, is_sliding), asCALL_THISCALL);
+	engine->RegisterObjectMethod("mixer", "uint get_max_voices() const property", asMETHOD(mixer, get_max_voices), asCALL_THISCALL);
+	engine->RegisterObjectMethod("mixer", "void set_max_voices(uint) property", asMETHOD(mixer, set_max_voices), asCALL_THISCALL);
+	engine->RegisterObjectMethod("mixer", "uint get_voice_count() const property", asMETHOD(mixer, get_voice_count), asCALL_THISCALL);
+	engine->RegisterObjectMethod("mixer", "void update_voices()", asMETHOD(mixer, update_voices), asCALL_THISCALL);
 	engine->RegisterObjectMethod("mixer", "bool get_pan_sliding() const property", asMETHOD(mixer, is_pan_sliding), asCALL_THISCALL);
 	engine->RegisterObjectMethod("mixer", "bool get_pitch_sliding() const property", asMETHOD(mixer, is_pitch_sliding), asCALL_THISCALL);
 	engine->RegisterObjectMethod("mixer", "bool get_volume_sliding() const property", asMETHOD(mixer, is_volume_sliding), asCALL_THISCALL);
@@ -2069,6 +2770,15 @@ void RegisterScriptSound(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod("sound_environment", "sound@ new_sound()", asMETHOD(sound_environment, new_sound), asCALL_THISCALL);
 	engine->RegisterObjectMethod("sound_environment", "void update()", asMETHOD(sound_environment, update), asCALL_THISCALL);
 	engine->RegisterObjectMethod("sound_environment", "void set_listener(float, float, float, float)", asMETHOD(sound_environment, set_listener), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound_environment", "uint clear_boxes(float, float, float, float, float, float)", asMETHOD(sound_environment, clear_boxes), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound_environment", "float get_region_size() const property", asMETHOD(sound_environment, get_region_size), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound_environment", "void set_region_size(float) property", asMETHOD(sound_environment, set_region_size), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound_environment", "float get_streaming_distance() const property", asMETHOD(sound_environment, get_streaming_distance), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound_environment", "void set_streaming_distance(float) property", asMETHOD(sound_environment, set_streaming_distance), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound_environment", "float get_simulation_rate() const property", asMETHOD(sound_environment, get_simulation_rate), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound_environment", "void set_simulation_rate(float) property", asMETHOD(sound_environment, set_simulation_rate), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound_environment", "uint get_region_count() const property", asMETHOD(sound_environment, get_region_count), asCALL_THISCALL);
+	engine->RegisterObjectMethod("sound_environment", "uint get_loaded_regions() const property", asMETHOD(sound_environment, get_loaded_regions), asCALL_THISCALL);
 
 	engine->RegisterGlobalFunction("bool get_SOUND_AVAILABLE() property", asFUNCTION(sound_available), asCALL_CDECL);
 	engine->RegisterGlobalFunction("float get_sound_master_volume() property", asFUNCTION(get_master_volume_r), asCALL_CDECL);
@@ -2084,4 +2794,25 @@ void RegisterScriptSound(asIScriptEngine* engine) {
 	engine->RegisterGlobalFunction("bool get_sound_global_hrtf() property", asFUNCTION(get_global_hrtf), asCALL_CDECL);
 	engine->RegisterGlobalFunction("void set_sound_global_hrtf(bool) property", asFUNCTION(set_global_hrtf), asCALL_CDECL);
 	engine->RegisterGlobalProperty("mixer@ sound_default_mixer", &g_default_mixer);
+	engine->RegisterGlobalFunction("uint64 get_sound_cache_budget() property", asFUNCTION(get_sound_cache_budget), asCALL_CDECL);
+	engine->RegisterGlobalFunction("void set_sound_cache_budget(uint64) property", asFUNCTION(set_sound_cache_budget), asCALL_CDECL);
+	engine->RegisterGlobalFunction("uint64 get_sound_cache_size() property", asFUNCTION(get_sound_cache_size), asCALL_CDECL);
+	engine->RegisterGlobalFunction("uint64 get_sound_cache_hits() property", asFUNCTION(get_sound_cache_hits), asCALL_CDECL);
+	engine->RegisterGlobalFunction("uint64 get_sound_cache_misses() property", asFUNCTION(get_sound_cache_misses), asCALL_CDECL);
+	engine->RegisterGlobalFunction("uint64 get_sound_cache_evictions() property", asFUNCTION(get_sound_cache_evictions), asCALL_CDECL);
+	engine->RegisterGlobalFunction("float get_sound_hrtf_distance() property", asFUNCTION(get_sound_hrtf_distance), asCALL_CDECL);
+	engine->RegisterGlobalFunction("void set_sound_hrtf_distance(float) property", asFUNCTION(set_sound_hrtf_distance), asCALL_CDECL);
+	engine->RegisterGlobalFunction("uint get_sound_hrtf_voices() property", asFUNCTION(get_sound_hrtf_voices), asCALL_CDECL);
+	engine->RegisterGlobalFunction("void set_sound_hrtf_voices(uint) property", asFUNCTION(set_sound_hrtf_voices), asCALL_CDECL);
+	engine->RegisterGlobalFunction("float get_sound_voice_threshold() property", asFUNCTION(get_sound_voice_threshold), asCALL_CDECL);
+	engine->RegisterGlobalFunction("void set_sound_voice_threshold(float) property", asFUNCTION(set_sound_voice_threshold), asCALL_CDECL);
+	engine->RegisterGlobalFunction("int get_sound_virtual_voices() property", asFUNCTION(get_sound_virtual_voices), asCALL_CDECL);
+	engine->RegisterGlobalFunction("int get_sound_spatial_voices() property", asFUNCTION(get_sound_spatial_voices), asCALL_CDECL);
+	engine->RegisterGlobalFunction("uint64 get_sound_spatial_culled() property", asFUNCTION(get_sound_spatial_culled), asCALL_CDECL);
+	engine->RegisterGlobalFunction("uint64 get_sound_spatial_time() property", asFUNCTION(get_sound_spatial_time), asCALL_CDECL);
+	engine->RegisterGlobalFunction("bool sound_cache_prefetch(const string&in, pack@ = sound_default_pack)", asFUNCTION(sound_cache_prefetch), asCALL_CDECL);
+	engine->RegisterGlobalFunction("bool sound_cache_contains(const string&in)", asFUNCTION(sound_cache_contains), asCALL_CDECL);
+	engine->RegisterGlobalFunction("void sound_cache_pin(const string&in)", asFUNCTION(sound_cache_pin), asCALL_CDECL);
+	engine->RegisterGlobalFunction("void sound_cache_unpin(const string&in)", asFUNCTION(sound_cache_unpin), asCALL_CDECL);
+	engine->RegisterGlobalFunction("void sound_cache_clear()", asFUNCTION(sound_cache_clear), asCALL_CDECL);
 }
@@ -14,6 +14,7 @@
 #define sound_h
 #pragma once
 #include <atomic>
+#include <list>
 #include <unordered_set>
 #include <vector>
 #include <angelscript.h>
@@ -33,12 +34,14 @@ BOOL shutdown_sound();
 class sound;
 class mixer;
 
-typedef struct {
+// A fully decoded sound in the decoded audio cache, shared by every sound loaded from the same filename.
+typedef struct sound_preload {
 	unsigned char* data;
 	unsigned int size;
-	int ref;
-	unsigned long long t; // Time since preload was last used, stored using ticks().
+	int ref; // Number of sounds using this preload, it can't be evicted while above 0.
+	unsigned long long t; // Time since preload was last used, stored using ticks(), or -1 while it is still being decoded.
 	std::string fn;
+	std::list<sound_preload*>::iterator lru_pos; // Position in the cache's least recently used list.
 } sound_preload;
 
 typedef struct {
@@ -64,14 +67,45 @@ typedef struct {
 	bool inside;
 } sound_reverb;
 
+// A box of static geometry added to a sound_environment, only turned into a steam audio mesh while the region containing it is loaded.
+typedef struct {
+	float minx, maxx, miny, maxy, minz, maxz;
+	IPLMaterial material;
+	IPLStaticMesh mesh; // NULL until built into the region's scene.
+} sound_environment_box;
+
+// Geometry is partitioned into a grid of cubic regions. Each loaded region owns a scene of its own which is instanced into the environment's scene, so that loading, unloading or changing one region never rebuilds the others.
+typedef struct {
+	int x, y, z; // Grid coordinates.
+	std::vector<sound_environment_box> boxes;
+	IPLScene scene; // NULL while the region is unloaded.
+	IPLInstancedMesh instance;
+	bool dirty; // Boxes were added since the region's scene was last committed.
+} sound_environment_region;
+
 class sound_base;
 class sound_environment {
 	IPLScene scene;
 	std::vector<sound_base*> attached;
 	std::vector<sound_base*> detaching;
 	std::unordered_map<std::string, IPLMaterial> materials;
+	std::unordered_map<uint64_t, sound_environment_region> regions;
+	std::vector<sound_environment_region> retired_regions; // Scenes detached by the script thread, released by the environment thread.
+	Poco::FastMutex geometry_mutex; // Guards materials, regions and the streaming settings, which the script thread changes while the environment thread streams them in and out.
+	float region_size;
+	float streaming_distance; // Regions further than this from the listener are unloaded, 0 keeps every region loaded.
+	float simulation_rate; // Reflection simulations per second, 0 for as many as possible.
+	bool regions_changed; // Geometry or streaming settings changed, so the set of loaded regions must be reevaluated.
+	uint64_t listener_region; // Key of the region the listener was in when regions were last streamed.
+	unsigned int loaded_regions;
+	Poco::Event wake; // Set to cut the environment thread's wait between simulations short.
 	bool scene_needs_commit = false;
 	bool _detach(sound_base* s);
+	uint64_t region_key(int x, int y, int z);
+	void load_region(sound_environment_region& r);
+	void unload_region(sound_environment_region& r);
+	void retire_region(sound_environment_region& r);
+	void stream_regions();
 public:
 	int ref_count;
 	IPLSimulator sim;
@@ -95,6 +129,27 @@ public:
 	void update();
 	void background_update(); // Runs on an internal thread, where as update is called by the user.
 	void set_listener(float x, float y, float z, float rotation);
+	unsigned int clear_boxes(float minx, float maxx, float miny, float maxy, float minz, float maxz);
+	float get_region_size() {
+		return region_size;
+	}
+	void set_region_size(float size);
+	float get_streaming_distance() {
+		return streaming_distance;
+	}
+	void set_streaming_distance(float distance);
+	float get_simulation_rate() {
+		return simulation_rate;
+	}
+	void set_simulation_rate(float rate);
+	unsigned int get_loaded_regions() {
+		return loaded_regions;
+	}
+	unsigned int get_region_count();
+	void wait_for_update(unsigned int ms);
+	void wake_up() {
+		wake.set();
+	}
 };
 
 class mixer;
@@ -126,15 +181,19 @@ public:
 	float rotation;
 	float pan_step;
 	float volume_step;
+	float gain_left, gain_right; // Channel gains the positioning dsp applied to the last buffer, negative until one has been processed.
+	float batch_volume; // Volume the spatial batch mixed the last buffer at, negative until one has been mixed.
+	std::atomic<bool> spatial_voice; // Whether the positioning dsp processed the last buffer with steam audio, changed by both the audio and script threads.
 	unsigned int channel;
 	hstream_entry* store_channel;
-	sound_base() : env(NULL), source(NULL), direct_effect(NULL), reflection_effect(NULL), reflection_decode_effect(NULL) {}
+	sound_base() : env(NULL), gain_left(-1), gain_right(-1), batch_volume(-1), spatial_voice(false), source(NULL), direct_effect(NULL), reflection_effect(NULL), reflection_decode_effect(NULL) {}
 	virtual void AddRef();
 	virtual void Release();
 	void set_hrtf(BOOL enable) {
 		use_hrtf = enable;
 	}
 	BOOL set_position(float listener_x, float listener_y, float listener_z, float sound_x, float sound_y, float sound_z, float rotation, float pan_step, float volume_step);
+	virtual void update_voice() {}
 };
 
 class sound : public sound_base {
@@ -156,6 +215,11 @@ public:
 	unsigned int memstream_size;
 	DWORD memstream_pos;
 	bool memstream_legacy_encrypt;
+	int priority; // When a mixer runs out of voices, sounds with a higher priority keep playing over those with a lower one.
+	bool virtual_voice; // Logically playing but paused in BASS, either because it can't be heard or because its mixer ran out of voices.
+	QWORD virtual_pos; // Byte position of the channel at virtual_time.
+	uint64_t virtual_time; // ticks() when the sound was virtualized or last seeked while virtual.
+	float audibility; // Approximate volume in dB the sound would play at, as of the last update_voice.
 	sound();
 	~sound();
 	void Release();
@@ -169,6 +233,16 @@ public:
 	BOOL push_memory(unsigned char* buffer, unsigned int length, BOOL stream_end = FALSE, int pcm_rate = 0, int pcm_chans = 0);
 	BOOL push_string(const std::string& buffer, BOOL stream_end = FALSE, int pcm_rate = 0, int pcm_chans = 0);
 	BOOL postload(const std::string& filename = std::string(""));
+	float get_audibility();
+	QWORD get_virtual_position(bool& ended);
+	void rebase_virtual_position();
+	bool make_virtual();
+	bool make_real();
+	void update_voice();
+	void hold_voice(bool held);
+	bool is_virtual() {
+		return virtual_voice;
+	}
 	BOOL close();
 	int set_fx(std::string& fx, int idx = -1);
 	void set_length(float len) {
@@ -218,6 +292,11 @@ class mixer : public sound_base {
 	std::vector<mixer_effect> effects;
 	mixer* parent_mixer;
 	int get_effect_index(const std::string& id);
+	unsigned int max_voices; // 0 for no limit.
+	friend class sound;
+	std::unordered_set<sound*> voices; // Loaded sounds whose parent_mixer is this one, the set max_voices applies to.
+	std::unordered_set<sound*> real_voices; // The voices started for real and not since paused, stopped or virtualized. Ones that ended by themselves linger until voice_available prunes them.
+	void prune_voices();
 public:
 	mixer(mixer* parent = NULL, BOOL for_single_sound = FALSE, BOOL for_decode = FALSE, BOOL floatingpoint = TRUE);
 	~mixer();
@@ -228,6 +307,16 @@ public:
 	BOOL remove_mixer(mixer* m, BOOL internal = FALSE);
 	BOOL add_sound(sound& s, BOOL internal = FALSE);
 	BOOL remove_sound(sound& s, BOOL internal = FALSE);
+	bool voice_available(sound* s);
+	void update_voices();
+	unsigned int get_max_voices() {
+		return max_voices;
+	}
+	void set_max_voices(unsigned int count) {
+		max_voices = count;
+		update_voices();
+	}
+	unsigned int get_voice_count();
 	bool set_impulse_response(const std::string& response, float dry, float wet);
 	int set_fx(std::string& fx, int idx = -1);
 	BOOL set_mixer(mixer* m);